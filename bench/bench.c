@@ -0,0 +1,790 @@
+/* Micro-benchmarks for every public function in matrix.h and vector.h,
+ * and for plan_execute of plan.h.
+ *
+ * Each function runs over a sweep of working set sizes chosen from the
+ * machine's cache sizes. A run is warmed up, then timed in several
+ * batches whose iteration count is calibrated to last --min-time
+ * seconds; the median batch is reported.
+ *
+ * Usage: bench [options]
+ *   --sizes LIST      comma separated subset of tiny,l1,l2,llc,dram
+ *   --filter STR      only run functions whose name contains STR
+ *   --min-time SEC    minimum duration of a timed batch (default 0.05)
+ *   --max-flops N     skip runs above N flops per call (default 2e10)
+ *   --cpu N           pin to this CPU (default 0, -1 to disable)
+ *   --json FILE       also write the results to FILE as JSON
+ *   --backend-diff    time every function with the native code and
+ *                     with the CBLAS backend at threshold 0, and print
+ *                     both with the speedup of the latter (needs a
+ *                     build with BLAS, see include/backend.h)
+ */
+
+#define _GNU_SOURCE
+
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "backend.h"
+#include "matrix.h"
+#include "plan.h"
+#include "vector.h"
+
+#define NREPS 5
+
+/* Shape families. The working set size of a run is spread over
+ * three n x n matrices (MAT), three n-vectors (VEC), or one n x n
+ * matrix and its vectors (MV). */
+enum family {
+    MAT,
+    VEC,
+    MV
+};
+
+/* Functions whose cost does not depend on the operands' size
+ * run only for the first selected size. */
+#define ONCE 1
+
+/* Runs with the matrices a, b and out in the LAMAT_TILED layout */
+#define TILED 2
+
+struct fixture {
+    long n;
+    LINALG_SCALAR *buf;
+    int *perm;          /* random permutation of 0 to n - 1 */
+    matrix *a;
+    matrix *b;
+    matrix *out;
+    vector *x;
+    vector *y;
+    vector *z;
+};
+
+struct bench {
+    const char *name;
+    enum family fam;
+    int flags;
+    /* Nominal flops and bytes moved by one call, for operand size n */
+    double flops_n3, flops_n2, flops_n;
+    double bytes_n2, bytes_n;
+    void (*run)(struct fixture *f);
+};
+
+struct size_class {
+    const char *name;
+    long bytes;
+};
+
+
+static volatile LINALG_SCALAR sink;
+
+
+/* matrix.h */
+
+static void b_mat_new(struct fixture *f) {
+    matrix *m;
+    mat_new(&m, f->buf, f->n, f->n);
+    mat_del(m);
+}
+
+static void b_mat_alloc(struct fixture *f) {
+    matrix *m;
+    mat_alloc(&m);
+    mat_del(m);
+}
+
+static void b_mat_identity(struct fixture *f) {
+    matrix *m;
+    mat_identity(&m, f->n);
+    mat_del(m);
+}
+
+static void b_mat_zero(struct fixture *f) {
+    matrix *m;
+    mat_zero(&m, f->n, f->n);
+    mat_del(m);
+}
+
+static void b_mat_dup(struct fixture *f) {
+    matrix *m;
+    mat_dup(&m, f->a);
+    mat_del(m);
+}
+
+static void b_mat_cpy(struct fixture *f) { mat_cpy(f->out, f->a); }
+
+static void b_mat_dim(struct fixture *f) {
+    int r, c;
+    mat_dim(f->a, &r, &c);
+    sink = r + c;
+}
+
+static void b_mat_get_data(struct fixture *f) { mat_get_data(f->a, f->buf); }
+static void b_mat_set_data(struct fixture *f) { mat_set_data(f->out, f->buf); }
+
+static void b_mat_read(struct fixture *f) {
+    LINALG_SCALAR r;
+    mat_read(f->a, 0, 0, &r);
+    sink = r;
+}
+
+static void b_mat_get(struct fixture *f) { sink = mat_get(f->a, 0, 0); }
+static void b_mat_write(struct fixture *f) { mat_write(f->out, 0, 0, 1); }
+static void b_mat_set(struct fixture *f) { mat_set(f->out, 0, 0, 1); }
+
+static void b_mat_add(struct fixture *f) { mat_add(f->a, f->b, f->out); }
+static void b_mat_add_(struct fixture *f) { mat_add_(f->out, f->b); }
+static void b_mat_sub(struct fixture *f) { mat_sub(f->a, f->b, f->out); }
+static void b_mat_sub_(struct fixture *f) { mat_sub_(f->out, f->b); }
+static void b_mat_mul(struct fixture *f) { mat_mul(f->a, f->b, f->out); }
+
+static void b_mat_gather_rows(struct fixture *f) {
+    mat_gather_rows(f->a, f->perm, f->n, f->out);
+}
+
+static void b_mat_scatter_rows(struct fixture *f) {
+    mat_scatter_rows(f->out, f->perm, f->n, f->a);
+}
+
+static void b_mat_permute_rows(struct fixture *f) {
+    mat_permute_rows(f->out, f->perm);
+}
+
+static void b_mat_permute_cols(struct fixture *f) {
+    mat_permute_cols(f->out, f->perm);
+}
+
+/* Plans are made on the first call for a size, during the warm up */
+static void b_plan_execute(struct fixture *f) {
+    static plan *p;
+    static long n;
+
+    if (p == NULL || n != f->n) {
+        if (p != NULL) {
+            plan_del(p);
+        }
+        n = f->n;
+        mat_mul_plan(&p, n, n, n, 0);
+    }
+    plan_execute(p, f->a, f->b, f->out);
+}
+static void b_mat_mul_(struct fixture *f) { mat_mul_(f->out, f->b); }
+static void b_mat_mul_strassen(struct fixture *f) {
+    mat_mul_algo(f->a, f->b, f->out, LAMAT_MUL_STRASSEN);
+}
+static void b_mat_pow(struct fixture *f) { mat_pow(f->a, 16, f->out); }
+static void b_mat_expm(struct fixture *f) { mat_expm(f->a, f->out); }
+
+static void b_mat_ger(struct fixture *f) { mat_ger(f->out, 1e-6, f->x, f->y); }
+static void b_mat_syrk(struct fixture *f) { mat_syrk(f->out, 1e-6, f->b); }
+
+static void b_mat_radd(struct fixture *f) { mat_radd(f->a, f->y, f->out); }
+static void b_mat_radd_(struct fixture *f) { mat_radd_(f->out, f->y); }
+static void b_mat_rsub(struct fixture *f) { mat_rsub(f->a, f->y, f->out); }
+static void b_mat_rsub_(struct fixture *f) { mat_rsub_(f->out, f->y); }
+static void b_mat_rmul(struct fixture *f) { mat_rmul(f->a, f->y, f->out); }
+static void b_mat_rmul_(struct fixture *f) { mat_rmul_(f->out, f->y); }
+static void b_mat_rdiv(struct fixture *f) { mat_rdiv(f->a, f->y, f->out); }
+static void b_mat_rdiv_(struct fixture *f) { mat_rdiv_(f->out, f->y); }
+static void b_mat_cadd(struct fixture *f) { mat_cadd(f->a, f->y, f->out); }
+static void b_mat_cadd_(struct fixture *f) { mat_cadd_(f->out, f->y); }
+static void b_mat_csub(struct fixture *f) { mat_csub(f->a, f->y, f->out); }
+static void b_mat_csub_(struct fixture *f) { mat_csub_(f->out, f->y); }
+static void b_mat_cmul(struct fixture *f) { mat_cmul(f->a, f->y, f->out); }
+static void b_mat_cmul_(struct fixture *f) { mat_cmul_(f->out, f->y); }
+static void b_mat_cdiv(struct fixture *f) { mat_cdiv(f->a, f->y, f->out); }
+static void b_mat_cdiv_(struct fixture *f) { mat_cdiv_(f->out, f->y); }
+
+static void b_mat_smul(struct fixture *f) { mat_smul(f->a, 1, f->out); }
+static void b_mat_smul_(struct fixture *f) { mat_smul_(f->out, 1); }
+static void b_mat_sdiv(struct fixture *f) { mat_sdiv(f->a, 1, f->out); }
+static void b_mat_sdiv_(struct fixture *f) { mat_sdiv_(f->out, 1); }
+
+static void b_mat_map(struct fixture *f) { mat_map(f->a, vm_exp, NULL, f->out); }
+static void b_mat_map_(struct fixture *f) { mat_map_(f->out, vm_sigmoid, NULL); }
+
+static void b_mat_transpose(struct fixture *f) { mat_transpose(f->a, f->out); }
+static void b_mat_transpose_(struct fixture *f) { mat_transpose_(f->out); }
+
+
+/* vector.h */
+
+static void b_vec_new(struct fixture *f) {
+    vector *v;
+    vec_new(&v, f->buf, f->n);
+    vec_del(v);
+}
+
+static void b_vec_alloc(struct fixture *f) {
+    vector *v;
+    vec_alloc(&v);
+    vec_del(v);
+}
+
+static void b_vec_basis(struct fixture *f) {
+    vector *v;
+    vec_basis(&v, f->n, 0);
+    vec_del(v);
+}
+
+static void b_vec_zero(struct fixture *f) {
+    vector *v;
+    vec_zero(&v, f->n);
+    vec_del(v);
+}
+
+static void b_vec_dup(struct fixture *f) {
+    vector *v;
+    vec_dup(&v, f->x);
+    vec_del(v);
+}
+
+static void b_vec_cpy(struct fixture *f) { vec_cpy(f->z, f->x); }
+
+static void b_vec_dim(struct fixture *f) {
+    int d;
+    vec_dim(f->x, &d);
+    sink = d;
+}
+
+static void b_vec_get_data(struct fixture *f) { vec_get_data(f->x, f->buf); }
+static void b_vec_set_data(struct fixture *f) { vec_set_data(f->z, f->buf); }
+
+static void b_vec_norm(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_norm(f->x, &r);
+    sink = r;
+}
+
+static void b_vec_norm2(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_norm2(f->x, &r);
+    sink = r;
+}
+
+static void b_vec_dist(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_dist(f->x, f->y, &r);
+    sink = r;
+}
+
+static void b_vec_dist2(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_dist2(f->x, f->y, &r);
+    sink = r;
+}
+
+static void b_vec_read(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_read(f->x, 0, &r);
+    sink = r;
+}
+
+static void b_vec_get(struct fixture *f) { sink = vec_get(f->x, 0); }
+static void b_vec_write(struct fixture *f) { vec_write(f->z, 0, 1); }
+static void b_vec_set(struct fixture *f) { vec_set(f->z, 0, 1); }
+
+static void b_vec_add(struct fixture *f) { vec_add(f->x, f->y, f->z); }
+static void b_vec_add_(struct fixture *f) { vec_add_(f->z, f->y); }
+static void b_vec_sub(struct fixture *f) { vec_sub(f->x, f->y, f->z); }
+static void b_vec_sub_(struct fixture *f) { vec_sub_(f->z, f->y); }
+
+static void b_vec_dot(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_dot(f->x, f->y, &r);
+    sink = r;
+}
+
+static void b_vec_dot_pairwise(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_dot_sum(f->x, f->y, LASUM_PAIRWISE, &r);
+    sink = r;
+}
+
+static void b_vec_dot_kahan(struct fixture *f) {
+    LINALG_SCALAR r;
+    vec_dot_sum(f->x, f->y, LASUM_KAHAN, &r);
+    sink = r;
+}
+
+static void b_vec_smul(struct fixture *f) { vec_smul(f->x, 1, f->z); }
+static void b_vec_smul_(struct fixture *f) { vec_smul_(f->z, 1); }
+static void b_vec_sdiv(struct fixture *f) { vec_sdiv(f->x, 1, f->z); }
+static void b_vec_sdiv_(struct fixture *f) { vec_sdiv_(f->z, 1); }
+static void b_vec_emul(struct fixture *f) { vec_emul(f->x, f->y, f->z); }
+static void b_vec_emul_(struct fixture *f) { vec_emul_(f->z, f->y); }
+
+static void b_vec_map(struct fixture *f) { vec_map(f->x, vm_exp, NULL, f->z); }
+static void b_vec_map_(struct fixture *f) { vec_map_(f->z, vm_sigmoid, NULL); }
+
+static void b_vec_gather(struct fixture *f) {
+    vec_gather(f->x, f->perm, f->n, f->z);
+}
+
+static void b_vec_scatter(struct fixture *f) {
+    vec_scatter(f->z, f->perm, f->n, f->x);
+}
+
+static void b_vec_mmul_l(struct fixture *f) { vec_mmul_l(f->x, f->b, f->z); }
+static void b_vec_mmul_l_(struct fixture *f) { vec_mmul_l_(f->z, f->b); }
+static void b_vec_mmul_r(struct fixture *f) { vec_mmul_r(f->b, f->x, f->z); }
+static void b_vec_mmul_r_(struct fixture *f) { vec_mmul_r_(f->b, f->z); }
+
+
+#define S sizeof(LINALG_SCALAR)
+
+static const struct bench benches[] = {
+    /* name                 fam  flags  n^3 n^2 n   bytes n^2 n */
+    {"mat_new",             MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_new},
+    {"mat_alloc",           MAT, ONCE,  0, 0, 0,    0, 0,     b_mat_alloc},
+    {"mat_identity",        MAT, 0,     0, 0, 0,    S, 0,     b_mat_identity},
+    {"mat_zero",            MAT, 0,     0, 0, 0,    S, 0,     b_mat_zero},
+    {"mat_dup",             MAT, 0,     0, 0, 0,    0, 0,     b_mat_dup},
+    {"mat_cpy",             MAT, 0,     0, 0, 0,    0, 0,     b_mat_cpy},
+    {"mat_dim",             MAT, ONCE,  0, 0, 0,    0, 0,     b_mat_dim},
+    {"mat_get_data",        MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_get_data},
+    {"mat_set_data",        MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_set_data},
+    {"mat_read",            MAT, ONCE,  0, 0, 0,    0, 0,     b_mat_read},
+    {"mat_get",             MAT, ONCE,  0, 0, 0,    0, 0,     b_mat_get},
+    {"mat_write",           MAT, ONCE,  0, 0, 0,    0, 0,     b_mat_write},
+    {"mat_set",             MAT, ONCE,  0, 0, 0,    0, 0,     b_mat_set},
+    {"mat_add",             MAT, 0,     0, 1, 0,    3*S, 0,   b_mat_add},
+    {"mat_add_",            MAT, 0,     0, 1, 0,    3*S, 0,   b_mat_add_},
+    {"mat_sub",             MAT, 0,     0, 1, 0,    3*S, 0,   b_mat_sub},
+    {"mat_sub_",            MAT, 0,     0, 1, 0,    3*S, 0,   b_mat_sub_},
+    {"mat_mul",             MAT, 0,     2, 0, 0,    3*S, 0,   b_mat_mul},
+    {"mat_mul_",            MAT, 0,     2, 0, 0,    3*S, 0,   b_mat_mul_},
+    {"mat_mul_strassen",    MAT, 0,     2, 0, 0,    3*S, 0,   b_mat_mul_strassen},
+    {"plan_execute",        MAT, 0,     2, 0, 0,    3*S, 0,   b_plan_execute},
+    {"mat_pow",             MAT, 0,     8, 0, 0,    2*S, 0,   b_mat_pow},
+    {"mat_expm",            MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_expm},
+    {"mat_ger",             MV,  0,     0, 2, 0,    2*S, 2*S, b_mat_ger},
+    {"mat_syrk",            MAT, 0,     1, 0, 0,    2*S, 0,   b_mat_syrk},
+    {"mat_radd",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_radd},
+    {"mat_radd_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_radd_},
+    {"mat_rsub",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_rsub},
+    {"mat_rsub_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_rsub_},
+    {"mat_rmul",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_rmul},
+    {"mat_rmul_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_rmul_},
+    {"mat_rdiv",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_rdiv},
+    {"mat_rdiv_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_rdiv_},
+    {"mat_cadd",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_cadd},
+    {"mat_cadd_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_cadd_},
+    {"mat_csub",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_csub},
+    {"mat_csub_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_csub_},
+    {"mat_cmul",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_cmul},
+    {"mat_cmul_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_cmul_},
+    {"mat_cdiv",            MAT, 0,     0, 1, 0,    2*S, S,   b_mat_cdiv},
+    {"mat_cdiv_",           MAT, 0,     0, 1, 0,    2*S, S,   b_mat_cdiv_},
+    {"mat_smul",            MAT, 0,     0, 1, 0,    2*S, 0,   b_mat_smul},
+    {"mat_smul_",           MAT, 0,     0, 1, 0,    2*S, 0,   b_mat_smul_},
+    {"mat_sdiv",            MAT, 0,     0, 1, 0,    2*S, 0,   b_mat_sdiv},
+    {"mat_sdiv_",           MAT, 0,     0, 1, 0,    2*S, 0,   b_mat_sdiv_},
+    {"mat_map",             MAT, 0,     0, 1, 0,    2*S, 0,   b_mat_map},
+    {"mat_map_",            MAT, 0,     0, 1, 0,    2*S, 0,   b_mat_map_},
+    {"mat_transpose",       MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_transpose},
+    {"mat_transpose_",      MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_transpose_},
+    {"mat_gather_rows",     MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_gather_rows},
+    {"mat_scatter_rows",    MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_scatter_rows},
+    {"mat_permute_rows",    MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_permute_rows},
+    {"mat_permute_cols",    MAT, 0,     0, 0, 0,    2*S, 0,   b_mat_permute_cols},
+    {"mat_mul_tiled",       MAT, TILED, 2, 0, 0,    3*S, 0,   b_mat_mul},
+    {"mat_cmul_tiled",      MAT, TILED, 0, 1, 0,    2*S, S,   b_mat_cmul},
+    {"mat_transpose_tiled", MAT, TILED, 0, 0, 0,    2*S, 0,   b_mat_transpose},
+
+    {"vec_new",             VEC, 0,     0, 0, 0,    0, 2*S,   b_vec_new},
+    {"vec_alloc",           VEC, ONCE,  0, 0, 0,    0, 0,     b_vec_alloc},
+    {"vec_basis",           VEC, 0,     0, 0, 0,    0, S,     b_vec_basis},
+    {"vec_zero",            VEC, 0,     0, 0, 0,    0, S,     b_vec_zero},
+    {"vec_dup",             VEC, 0,     0, 0, 0,    0, 0,     b_vec_dup},
+    {"vec_cpy",             VEC, 0,     0, 0, 0,    0, 0,     b_vec_cpy},
+    {"vec_dim",             VEC, ONCE,  0, 0, 0,    0, 0,     b_vec_dim},
+    {"vec_get_data",        VEC, 0,     0, 0, 0,    0, 2*S,   b_vec_get_data},
+    {"vec_set_data",        VEC, 0,     0, 0, 0,    0, 2*S,   b_vec_set_data},
+    {"vec_norm",            VEC, 0,     0, 0, 2,    0, S,     b_vec_norm},
+    {"vec_norm2",           VEC, 0,     0, 0, 2,    0, S,     b_vec_norm2},
+    {"vec_dist",            VEC, 0,     0, 0, 3,    0, 2*S,   b_vec_dist},
+    {"vec_dist2",           VEC, 0,     0, 0, 3,    0, 2*S,   b_vec_dist2},
+    {"vec_read",            VEC, ONCE,  0, 0, 0,    0, 0,     b_vec_read},
+    {"vec_get",             VEC, ONCE,  0, 0, 0,    0, 0,     b_vec_get},
+    {"vec_write",           VEC, ONCE,  0, 0, 0,    0, 0,     b_vec_write},
+    {"vec_set",             VEC, ONCE,  0, 0, 0,    0, 0,     b_vec_set},
+    {"vec_add",             VEC, 0,     0, 0, 1,    0, 3*S,   b_vec_add},
+    {"vec_add_",            VEC, 0,     0, 0, 1,    0, 3*S,   b_vec_add_},
+    {"vec_sub",             VEC, 0,     0, 0, 1,    0, 3*S,   b_vec_sub},
+    {"vec_sub_",            VEC, 0,     0, 0, 1,    0, 3*S,   b_vec_sub_},
+    {"vec_dot",             VEC, 0,     0, 0, 2,    0, 2*S,   b_vec_dot},
+    {"vec_dot_pairwise",    VEC, 0,     0, 0, 2,    0, 2*S,   b_vec_dot_pairwise},
+    {"vec_dot_kahan",       VEC, 0,     0, 0, 2,    0, 2*S,   b_vec_dot_kahan},
+    {"vec_smul",            VEC, 0,     0, 0, 1,    0, 2*S,   b_vec_smul},
+    {"vec_smul_",           VEC, 0,     0, 0, 1,    0, 2*S,   b_vec_smul_},
+    {"vec_sdiv",            VEC, 0,     0, 0, 1,    0, 2*S,   b_vec_sdiv},
+    {"vec_sdiv_",           VEC, 0,     0, 0, 1,    0, 2*S,   b_vec_sdiv_},
+    {"vec_emul",            VEC, 0,     0, 0, 1,    0, 3*S,   b_vec_emul},
+    {"vec_emul_",           VEC, 0,     0, 0, 1,    0, 3*S,   b_vec_emul_},
+    {"vec_map",             VEC, 0,     0, 0, 1,    0, 2*S,   b_vec_map},
+    {"vec_map_",            VEC, 0,     0, 0, 1,    0, 2*S,   b_vec_map_},
+    {"vec_gather",          VEC, 0,     0, 0, 0,    0, 2*S,   b_vec_gather},
+    {"vec_scatter",         VEC, 0,     0, 0, 0,    0, 2*S,   b_vec_scatter},
+    {"vec_mmul_l",          MV,  0,     0, 2, 0,    S, 2*S,   b_vec_mmul_l},
+    {"vec_mmul_l_",         MV,  0,     0, 2, 0,    S, 2*S,   b_vec_mmul_l_},
+    {"vec_mmul_r",          MV,  0,     0, 2, 0,    S, 2*S,   b_vec_mmul_r},
+    {"vec_mmul_r_",         MV,  0,     0, 2, 0,    S, 2*S,   b_vec_mmul_r_},
+    {"vec_mmul_l_tiled",    MV,  TILED, 0, 2, 0,    S, 2*S,   b_vec_mmul_l},
+    {"vec_mmul_r_tiled",    MV,  TILED, 0, 2, 0,    S, 2*S,   b_vec_mmul_r},
+};
+
+#define NBENCH (sizeof(benches) / sizeof(*benches))
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static long cache_size(int name, long fallback) {
+    long r = sysconf(name);
+    return r > 0 ? r : fallback;
+}
+
+
+static void fill(LINALG_SCALAR *p, long len, LINALG_SCALAR lo, LINALG_SCALAR hi) {
+    long i;
+    for (i = 0; i < len; i++) {
+        p[i] = lo + (hi - lo) * (rand() / (LINALG_SCALAR)RAND_MAX);
+    }
+}
+
+
+/* Builds operands of dimension n for the given family. Inputs hold
+ * values that keep repeated in place updates away from overflow and
+ * subnormals: a and x in [0.5, 1.5), b with every entry 1/n and y all
+ * ones. VEC runs get 1 x 1 matrices. */
+static void fixture_init(struct fixture *f, enum family fam, long n) {
+    long m = fam == VEC ? 1 : n;
+    long len = m * m > n ? m * m : n;
+    LINALG_SCALAR *tmp;
+    long i, j;
+    int t;
+
+    f->n = n;
+    f->buf = malloc(len * sizeof(*f->buf));
+    tmp = malloc(len * sizeof(*tmp));
+
+    fill(tmp, m * m, 0.5, 1.5);
+    mat_new(&f->a, tmp, m, m);
+    mat_new(&f->out, tmp, m, m);
+    for (i = 0; i < m * m; i++) {
+        tmp[i] = 1.0 / m;
+    }
+    mat_new(&f->b, tmp, m, m);
+
+    fill(tmp, n, 0.5, 1.5);
+    vec_new(&f->x, tmp, n);
+    vec_new(&f->z, tmp, n);
+    for (i = 0; i < n; i++) {
+        tmp[i] = 1;
+    }
+    vec_new(&f->y, tmp, n);
+
+    memcpy(f->buf, tmp, n * sizeof(*tmp));
+    free(tmp);
+
+    f->perm = malloc(n * sizeof(*f->perm));
+    for (i = 0; i < n; i++) {
+        f->perm[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        t = f->perm[i];
+        f->perm[i] = f->perm[j];
+        f->perm[j] = t;
+    }
+}
+
+
+static void fixture_layout(struct fixture *f, int layout) {
+    mat_set_layout(f->a, layout);
+    mat_set_layout(f->b, layout);
+    mat_set_layout(f->out, layout);
+}
+
+
+static void fixture_del(struct fixture *f) {
+    free(f->buf);
+    free(f->perm);
+    mat_del(f->a);
+    mat_del(f->b);
+    mat_del(f->out);
+    vec_del(f->x);
+    vec_del(f->y);
+    vec_del(f->z);
+}
+
+
+static long family_dim(enum family fam, long bytes) {
+    long n;
+    switch (fam) {
+        case MAT:
+            n = sqrt(bytes / (3.0 * sizeof(LINALG_SCALAR)));
+            break;
+        case VEC:
+            n = bytes / (3 * sizeof(LINALG_SCALAR));
+            break;
+        default:
+            n = sqrt(bytes / (double)sizeof(LINALG_SCALAR));
+            break;
+    }
+    return n < 1 ? 1 : n;
+}
+
+
+static double time_batch(const struct bench *b, struct fixture *f, long iters) {
+    double t0;
+    long i;
+
+    t0 = now();
+    for (i = 0; i < iters; i++) {
+        b->run(f);
+    }
+    return now() - t0;
+}
+
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+
+/* Returns the median time of one call in seconds. */
+static double measure(const struct bench *b, struct fixture *f,
+        double min_time, long *iters_out) {
+    double t, samples[NREPS];
+    long iters;
+    int r;
+
+    /* Warm up caches, page tables and branch predictors, and
+     * find how many calls take at least min_time. */
+    iters = 1;
+    while ((t = time_batch(b, f, iters)) < min_time) {
+        iters = t > 0 ? iters * 1.2 * min_time / t + 1 : iters * 10;
+    }
+
+    for (r = 0; r < NREPS; r++) {
+        samples[r] = time_batch(b, f, iters) / iters;
+    }
+    qsort(samples, NREPS, sizeof(*samples), cmp_double);
+    *iters_out = iters;
+    return samples[NREPS / 2];
+}
+
+
+static void pin(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+
+    if (cpu < 0) {
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "warning: could not pin to CPU %d\n", cpu);
+    }
+#endif
+}
+
+
+static int selected(const char *list, const char *name) {
+    size_t len = strlen(name);
+    const char *p = list;
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == list || p[-1] == ',') && (p[len] == ',' || p[len] == '\0')) {
+            return 1;
+        }
+        p += len;
+    }
+    return 0;
+}
+
+
+int main(int argc, char **argv) {
+    struct size_class sizes[5];
+    const char *size_list = "tiny,l1,l2,llc,dram";
+    const char *filter = "";
+    const char *json_path = NULL;
+    double min_time = 0.05;
+    double max_flops = 2e10;
+    int cpu = 0;
+    int diff = 0;
+    FILE *json = NULL;
+    int first_json = 1;
+    int first_size = 1;
+    size_t s, i;
+    int fam;
+
+    for (i = 1; i < (size_t)argc; i++) {
+        if (strcmp(argv[i], "--sizes") == 0 && i + 1 < (size_t)argc) {
+            size_list = argv[++i];
+        } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < (size_t)argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < (size_t)argc) {
+            min_time = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--max-flops") == 0 && i + 1 < (size_t)argc) {
+            max_flops = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < (size_t)argc) {
+            cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--json") == 0 && i + 1 < (size_t)argc) {
+            json_path = argv[++i];
+        } else if (strcmp(argv[i], "--backend-diff") == 0) {
+            diff = 1;
+        } else {
+            fprintf(stderr, "usage: %s [--sizes LIST] [--filter STR] "
+                    "[--min-time SEC] [--max-flops N] [--cpu N] "
+                    "[--json FILE] [--backend-diff]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (diff && linalg_backend(LABACK_CBLAS, 0) != 0) {
+        fprintf(stderr, "%s: --backend-diff needs a build with BLAS\n",
+                argv[0]);
+        return 1;
+    }
+
+    /* Working sets sit at half of each cache level so they stay
+     * resident, and the DRAM one well past the last level. */
+    sizes[0].name = "tiny";
+    sizes[0].bytes = 256;
+    sizes[1].name = "l1";
+    sizes[1].bytes = cache_size(_SC_LEVEL1_DCACHE_SIZE, 32 << 10) / 2;
+    sizes[2].name = "l2";
+    sizes[2].bytes = cache_size(_SC_LEVEL2_CACHE_SIZE, 1 << 20) / 2;
+    sizes[3].name = "llc";
+    sizes[3].bytes = cache_size(_SC_LEVEL3_CACHE_SIZE, 16 << 20) / 2;
+    sizes[4].name = "dram";
+    sizes[4].bytes = sizes[3].bytes * 8;
+    if (sizes[4].bytes > (512L << 20)) {
+        sizes[4].bytes = 512L << 20;
+    }
+
+    if (json_path != NULL) {
+        json = fopen(json_path, "w");
+        if (json == NULL) {
+            perror(json_path);
+            return 1;
+        }
+        fprintf(json, "{\n  \"scalar_bytes\": %d,\n  \"cpu\": %d,\n"
+                "  \"min_time\": %g,\n  \"results\": [",
+                (int)sizeof(LINALG_SCALAR), cpu, min_time);
+    }
+
+    pin(cpu);
+    srand(1);
+
+    if (diff) {
+        printf("%-18s %-5s %8s %12s %12s %8s\n",
+                "function", "size", "n", "native ns", "blas ns", "speedup");
+    } else {
+        printf("%-18s %-5s %8s %12s %10s %10s\n",
+                "function", "size", "n", "ns/op", "GFLOP/s", "GB/s");
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        if (!selected(size_list, sizes[s].name)) {
+            continue;
+        }
+
+        for (fam = MAT; fam <= MV; fam++) {
+            struct fixture f;
+            long n = family_dim(fam, sizes[s].bytes);
+            int built = 0;
+
+            for (i = 0; i < NBENCH; i++) {
+                const struct bench *b = &benches[i];
+                double dn = n, flops, bytes, t, tb = 0;
+                long iters, iters_b;
+
+                if (b->fam != (enum family)fam
+                        || strstr(b->name, filter) == NULL
+                        || ((b->flags & ONCE) && !first_size)) {
+                    continue;
+                }
+
+                flops = b->flops_n3 * dn*dn*dn + b->flops_n2 * dn*dn
+                    + b->flops_n * dn;
+                bytes = b->bytes_n2 * dn*dn + b->bytes_n * dn;
+                if (flops > max_flops) {
+                    printf("%-18s %-5s %8ld %12s\n",
+                            b->name, sizes[s].name, n, "skipped");
+                    continue;
+                }
+
+                if (!built) {
+                    fixture_init(&f, fam, n);
+                    built = 1;
+                }
+                if (b->flags & TILED) {
+                    fixture_layout(&f, LAMAT_TILED);
+                }
+                if (diff) {
+                    linalg_backend(LABACK_NATIVE, 0);
+                }
+                t = measure(b, &f, min_time, &iters);
+                if (diff) {
+                    linalg_backend(LABACK_CBLAS, 0);
+                    tb = measure(b, &f, min_time, &iters_b);
+                }
+                if (b->flags & TILED) {
+                    fixture_layout(&f, LAMAT_ROW_MAJOR);
+                }
+
+                if (diff) {
+                    printf("%-18s %-5s %8ld %12.1f %12.1f %8.2f\n",
+                            b->name, sizes[s].name, n, t * 1e9, tb * 1e9,
+                            t / tb);
+                } else {
+                    printf("%-18s %-5s %8ld %12.1f %10.3f %10.3f\n",
+                            b->name, sizes[s].name, n, t * 1e9,
+                            flops / t * 1e-9, bytes / t * 1e-9);
+                }
+                fflush(stdout);
+
+                if (json != NULL && diff) {
+                    fprintf(json, "%s\n    {\"name\": \"%s\", \"size\": \"%s\", "
+                            "\"n\": %ld, \"native_ns_per_op\": %.3f, "
+                            "\"blas_ns_per_op\": %.3f}",
+                            first_json ? "" : ",", b->name, sizes[s].name,
+                            n, t * 1e9, tb * 1e9);
+                    first_json = 0;
+                } else if (json != NULL) {
+                    fprintf(json, "%s\n    {\"name\": \"%s\", \"size\": \"%s\", "
+                            "\"n\": %ld, \"iters\": %ld, \"ns_per_op\": %.3f, "
+                            "\"gflops\": %.6f, \"gbps\": %.6f}",
+                            first_json ? "" : ",", b->name, sizes[s].name,
+                            n, iters, t * 1e9,
+                            flops / t * 1e-9, bytes / t * 1e-9);
+                    first_json = 0;
+                }
+            }
+
+            if (built) {
+                fixture_del(&f);
+            }
+        }
+        first_size = 0;
+    }
+
+    if (json != NULL) {
+        fprintf(json, "\n  ]\n}\n");
+        fclose(json);
+    }
+    return 0;
+}
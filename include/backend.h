@@ -0,0 +1,58 @@
+#ifndef BACKEND_H
+#define BACKEND_H 1
+
+/* Delegation to a CBLAS library.
+ *
+ * Built with make BLAS=<library>, e.g. make BLAS=openblas, the library
+ * links against that CBLAS and may hand the following to it:
+ *
+ *  - mat_mul and mat_mul_, for row-major operands, LAMAT_MUL_CLASSIC
+ *    and LASUM_NAIVE (?gemm);
+ *  - vec_mmul_r, vec_mmul_l and their _ variants, for row-major
+ *    matrices (?gemv);
+ *  - vec_dot, vec_norm2 and vec_norm in LASUM_NAIVE (?dot);
+ *  - mat_add_, mat_sub_, vec_add_, vec_sub_ and the operations built
+ *    on them (?axpy), mat_smul_, vec_smul_ and theirs (?scal), for
+ *    operands in the same layout.
+ *
+ * A call goes to the BLAS only if its work, in multiply-adds or
+ * element operations (m * k * n for a product, rows * cols for
+ * a matrix-vector product, the number of elements otherwise), reaches
+ * the threshold; smaller ones stay with the native code, which has
+ * no call overhead. Results may differ from the native ones in the
+ * last bits, as the BLAS orders its sums its own way.
+ *
+ * bench --backend-diff compares the two on the machine at hand. With
+ * single-threaded OpenBLAS on x86-64, mat_mul gained two to three
+ * times and vec_dot five from a few thousand operations on, while
+ * the native matrix-vector products stayed faster up to sizes that
+ * spill out of the last level cache. */
+
+/* Native code only. The default without BLAS. */
+#define LABACK_NATIVE 0
+
+/* The CBLAS library linked in, from the threshold on. The default
+ * when built with BLAS, with LABACK_THRESHOLD. */
+#define LABACK_CBLAS 1
+
+/* Default threshold of LABACK_CBLAS */
+#define LABACK_THRESHOLD 4096
+
+
+/* Operation was not successful due to an unknown backend or
+ * a negative threshold. */
+#define LABACK_INVALID 1
+
+/* Operation was not successful because the library was built
+ * without BLAS. */
+#define LABACK_UNSUPPORTED 2
+
+
+/* Sets the backend of every thread, and for LABACK_CBLAS, the
+ * smallest work handed to it.
+ * Possible errors:
+ *  - LABACK_INVALID
+ *  - LABACK_UNSUPPORTED */
+int linalg_backend(int backend, long threshold);
+
+#endif
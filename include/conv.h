@@ -0,0 +1,87 @@
+#ifndef CONV_H
+#define CONV_H 1
+
+#include "linalg.h"
+#include "matrix.h"
+#include "vector.h"
+
+/* Convolution of signals and images with small kernels.
+ *
+ * Like most signal and neural network libraries, these compute the
+ * cross-correlation: element (i, j) of the result is the sum over (a, b)
+ * of k(a, b) * x(i + a - p, j + b - q), with p and q the padding set by
+ * the mode. Flip the kernel in both directions for the convolution
+ * proper.
+ *
+ * conv_1d and conv_2d slide a single kernel directly over the data,
+ * with unrolled code for 3 x 3 and 5 x 5 kernels. conv_multi applies a
+ * bank of filters to an image with several channels as one matrix
+ * product, building the patch matrix of im2col a block of output pixels
+ * at a time rather than whole.
+ *
+ * Matrices in the LAMAT_TILED layout are read through a row-major copy,
+ * and results are always row-major. */
+
+
+/* Padding modes */
+
+/* No padding: only positions where the kernel fits entirely.
+ * The result is n - k + 1 long in each dimension. */
+#define LACONV_VALID 0
+
+/* Zero padding so that the result has the size of the input, the kernel
+ * centered on every element; for even kernels, one more element of
+ * padding goes after the data than before. */
+#define LACONV_SAME 1
+
+/* Zero padding so that every position where the kernel and the data
+ * overlap is computed. The result is n + k - 1 long in each dimension. */
+#define LACONV_FULL 2
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions, or a kernel larger than the data
+ * in LACONV_VALID mode. */
+#define LACONV_INCOMPATIBLE_DIM 1
+
+/* Operation was not successful due to an unknown mode. */
+#define LACONV_INVALID 2
+
+
+/* Writes the correlation of x with the kernel k into out.
+ * Possible errors:
+ *  - LACONV_INCOMPATIBLE_DIM
+ *  - LACONV_INVALID */
+int conv_1d(const vector *x, const vector *k, int mode, vector *out);
+
+/* Replaces x with its correlation with the kernel k.
+ * Possible errors:
+ *  - LACONV_INCOMPATIBLE_DIM
+ *  - LACONV_INVALID */
+int conv_1d_(vector *x, const vector *k, int mode);
+
+/* Writes the correlation of the image x with the kernel k into out.
+ * Possible errors:
+ *  - LACONV_INCOMPATIBLE_DIM
+ *  - LACONV_INVALID */
+int conv_2d(const matrix *x, const matrix *k, int mode, matrix *out);
+
+/* Replaces the image x with its correlation with the kernel k.
+ * Possible errors:
+ *  - LACONV_INCOMPATIBLE_DIM
+ *  - LACONV_INVALID */
+int conv_2d_(matrix *x, const matrix *k, int mode);
+
+/* Correlates an image of c channels with f filters of c channels each.
+ * Row ch of x holds channel ch of the image, h x w elements by rows.
+ * Row i of filters holds filter i, its c channels of kh x kw elements
+ * one after the other, each by rows. Row i of out receives the result
+ * of filter i, summed over the channels, by rows; its dimensions follow
+ * from h, w, kh, kw and the mode as for conv_2d.
+ * Possible errors:
+ *  - LACONV_INCOMPATIBLE_DIM
+ *  - LACONV_INVALID */
+int conv_multi(const matrix *x, int h, int w, const matrix *filters,
+        int kh, int kw, int mode, matrix *out);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef COVAR_H
+#define COVAR_H 1
+
+#include "linalg.h"
+#include "matrix.h"
+#include "vector.h"
+
+/* Running mean, covariance and Gram matrix of a stream of samples.
+ *
+ * Samples are buffered into blocks. Each full block is centered on its
+ * own mean and added with a single mat_syrk, then merged into the
+ * running totals with a mat_ger (Chan et al.'s pairwise update). The
+ * cost per sample is a fraction of the O(n^2) pass an outer product
+ * would take, and centering keeps the covariance accurate when the
+ * mean is large next to the spread.
+ *
+ * Reading a result first adds the samples still buffered. */
+
+typedef struct covar covar;
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions */
+#define LACOV_INCOMPATIBLE_DIM 1
+
+/* Operation was not successful because too few samples were added:
+ * the mean needs one, the covariance two. */
+#define LACOV_EMPTY 2
+
+/* Operation was not successful because memory
+ * could not be allocated. */
+#define LACOV_ALLOC 3
+
+
+/* Creates an accumulator for samples of dim elements, buffered by
+ * blocks of the given number of samples; 0 picks a default. */
+int cov_new(covar **c, int dim, int block);
+
+/* Frees resources allocated for c */
+int cov_del(covar *c);
+
+/* Forgets every sample added to c.
+ * Possible errors:
+ *  - LACOV_ALLOC */
+int cov_reset(covar *c);
+
+/* Adds the sample x.
+ * Possible errors:
+ *  - LACOV_INCOMPATIBLE_DIM */
+int cov_add(covar *c, const vector *x);
+
+/* Adds every row of m as a sample.
+ * Possible errors:
+ *  - LACOV_INCOMPATIBLE_DIM */
+int cov_add_mat(covar *c, const matrix *m);
+
+/* Writes to *n the number of samples added. */
+int cov_count(const covar *c, long long *n);
+
+/* Writes the mean of the samples into out.
+ * Possible errors:
+ *  - LACOV_EMPTY */
+int cov_mean(covar *c, vector *out);
+
+/* Writes the sample covariance matrix, normalized by n - 1, into out.
+ * Possible errors:
+ *  - LACOV_EMPTY */
+int cov_covar(covar *c, matrix *out);
+
+/* Writes the sum of x * x^T over the samples x into out. */
+int cov_gram(covar *c, matrix *out);
+
+#endif
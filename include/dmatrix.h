@@ -0,0 +1,139 @@
+#ifndef DMATRIX_H
+#define DMATRIX_H 1
+
+#include <stddef.h>
+
+#include "linalg.h"
+#include "matrix.h"
+
+/* Matrices distributed over several processes.
+ *
+ * The processes of a linalg_comm form a grid of p x q, as square as
+ * their number allows, process r sitting at row r / q and column r % q.
+ * A dmatrix is cut into nb x nb blocks dealt block-cyclically over the
+ * grid: block (i, j) belongs to the process at (i mod p, j mod q). Each
+ * process stores its blocks as one local row-major matrix, in the order
+ * of the global blocks, so that every row and column of the grid gets
+ * an even share of any part of the matrix.
+ *
+ * Every process of the communicator calls the dmat_ functions below
+ * together, with the same arguments but for the local data, and in the
+ * same order; they return once the process's own part is done.
+ *
+ * Messages go through a linalg_transport. linalg_comm_connect provides
+ * one over Unix domain sockets, for processes on one machine; others,
+ * over MPI for instance, plug in through linalg_comm_new. */
+
+typedef struct linalg_comm linalg_comm;
+typedef struct dmatrix dmatrix;
+
+/* Point to point messages between the processes 0 to size - 1. Messages
+ * from one process to another arrive in the order they were sent, and
+ * calls block until the buffer can be reused: send until the message is
+ * handed over, recv until it has arrived whole. A communicator makes at
+ * most one call at a time, but from any of its caller's threads.
+ * send and recv return 0 on success; close is called by
+ * linalg_comm_del. */
+struct linalg_transport {
+    int rank;
+    int size;
+    void *ctx;
+    int (*send)(void *ctx, int to, const void *buf, size_t len);
+    int (*recv)(void *ctx, int from, void *buf, size_t len);
+    void (*close)(void *ctx);
+};
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions */
+#define LADMAT_INCOMPATIBLE_DIM 1
+
+/* Operation was not successful due to an argument outside its range,
+ * or operands distributed over different communicators or blocks. */
+#define LADMAT_INVALID 2
+
+/* Operation was not successful because a message could not be sent or
+ * received; errno holds the cause when it comes from a system call.
+ * The processes are then out of step, and the communicator and the
+ * dmatrices involved can only be deleted. */
+#define LADMAT_COMM 3
+
+
+/* Creates a communicator over the given transport, which it owns
+ * from then on.
+ * Possible errors:
+ *  - LADMAT_INVALID */
+int linalg_comm_new(linalg_comm **c, const struct linalg_transport *t);
+
+/* Creates a communicator between size processes of this machine, this
+ * one being rank, over Unix domain sockets. Process r listens on the
+ * path made of path, a dot and r, until every process of higher rank
+ * has connected, and connects to every process of lower rank, waiting
+ * up to a minute for it to listen.
+ * Possible errors:
+ *  - LADMAT_INVALID
+ *  - LADMAT_COMM */
+int linalg_comm_connect(linalg_comm **c, const char *path, int rank,
+        int size);
+
+/* Closes the transport of c and frees it. */
+int linalg_comm_del(linalg_comm *c);
+
+/* Writes to *rank the rank of this process in c and to *size the number
+ * of processes. If any of the int pointers are NULL, it is left
+ * untouched. */
+int linalg_comm_rank(const linalg_comm *c, int *rank, int *size);
+
+
+/* Creates a null rows x cols dmatrix of nb x nb blocks over c, which
+ * must outlive it.
+ * Possible errors:
+ *  - LADMAT_INVALID */
+int dmat_new(dmatrix **d, linalg_comm *c, int rows, int cols, int nb);
+
+/* Frees resources allocated for d */
+int dmat_del(dmatrix *d);
+
+/* Writes to *rows and *cols the global dimensions of d, and to *nb the
+ * order of its blocks. If any of the int pointers are NULL, it is left
+ * untouched. */
+int dmat_dim(const dmatrix *d, int *rows, int *cols, int *nb);
+
+/* The local part of d, owned by d and valid until d is freed. Its
+ * element (i, j) is the global element (ig, jg) with
+ *     ig = (i / nb * p + row) * nb + i % nb,
+ *     jg = (j / nb * q + col) * nb + j % nb,
+ * for this process at (row, col) of the p x q grid. It may be read and
+ * written freely, but keeps its dimensions and layout. */
+matrix *dmat_local(const dmatrix *d);
+
+/* Distributes m, held by the process of the given rank, over d: the
+ * other processes only receive, and ignore m, which may be NULL.
+ * Possible errors:
+ *  - LADMAT_INCOMPATIBLE_DIM
+ *  - LADMAT_INVALID
+ *  - LADMAT_COMM */
+int dmat_scatter(dmatrix *d, const matrix *m, int root);
+
+/* Collects d into m on the process of the given rank, the others only
+ * sending and ignoring m, which may be NULL. m is row-major.
+ * Possible errors:
+ *  - LADMAT_INVALID
+ *  - LADMAT_COMM */
+int dmat_gather(const dmatrix *d, matrix *m, int root);
+
+/* Writes the result of a * b into out, all three distributed over the
+ * same communicator with the same blocks, by SUMMA: for every block
+ * column of a, its owners send their part of it along their rows of
+ * the grid and the owners of the matching block row of b along their
+ * columns, and every process adds the product of the two parts it
+ * received to its part of out. The parts of the next step travel on a
+ * second thread while the current ones are multiplied. out must be
+ * distinct from a and b.
+ * Possible errors:
+ *  - LADMAT_INCOMPATIBLE_DIM
+ *  - LADMAT_INVALID
+ *  - LADMAT_COMM */
+int dmat_mul(const dmatrix *a, const dmatrix *b, dmatrix *out);
+
+#endif
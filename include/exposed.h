@@ -0,0 +1,66 @@
+#ifndef EXPOSED_H
+#define EXPOSED_H 1
+
+#include "linalg.h"
+#include "matrix.h"
+#include "vector.h"
+
+#include <stddef.h>
+
+/* Inline element access.
+ *
+ * Including this header opts into the layout of struct matrix and
+ * struct vector, which is otherwise private: code that includes it has
+ * to be rebuilt with every new version of the library. In exchange the
+ * getters below compile to a plain load, so loops over them can be
+ * unrolled and vectorized like loops over arrays.
+ *
+ * There are no inline setters: a duplicate shares its storage with the
+ * original until either is written, and only the library knows when
+ * the storage is shared. To write many elements, take the storage once
+ * with mat_data_ptr, mat_row_ptr or vec_data_ptr, which give the matrix
+ * or vector storage of its own, and write through the pointer.
+ *
+ * For whole rows, mat_row_cptr and vec_data_cptr are cheaper still and
+ * do not need this header. */
+
+struct matrix {
+    LINALG_SCALAR *data;
+    int rows;
+    int cols;
+    int layout;     /* LAMAT_ROW_MAJOR or LAMAT_TILED */
+};
+
+struct vector {
+    LINALG_SCALAR *data;
+    int dim;
+};
+
+
+/* Pointer to element (row, col) of m, in either layout, for reading.
+ * No boundary checks are made. */
+static inline const LINALG_SCALAR *mat_elem_ptr(const matrix *m, int row,
+        int col) {
+    int tiles;
+
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        return m->data + (size_t)row * m->cols + col;
+    }
+    tiles = (m->cols + LAMAT_TILE - 1) / LAMAT_TILE;
+    return m->data
+        + ((size_t)(row / LAMAT_TILE) * tiles + col / LAMAT_TILE)
+            * LAMAT_TILE * LAMAT_TILE
+        + (row % LAMAT_TILE) * LAMAT_TILE + col % LAMAT_TILE;
+}
+
+/* Inline version of mat_get */
+static inline LINALG_SCALAR mat_iget(const matrix *m, int row, int col) {
+    return *mat_elem_ptr(m, row, col);
+}
+
+/* Inline version of vec_get */
+static inline LINALG_SCALAR vec_iget(const vector *v, int i) {
+    return v->data[i];
+}
+
+#endif
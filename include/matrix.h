@@ -6,6 +6,7 @@ typedef struct matrix matrix;
 
 #include "linalg.h"
 #include "vector.h"
+#include "vmath.h"
 
 /* Operation was not successful due to one or more of
  * the operands' dimensions */
@@ -15,6 +16,54 @@ typedef struct matrix matrix;
  * being outside the bounds of a matrix. */
 #define LAMAT_OOB 2
 
+/* Operation was not successful due to an argument
+ * outside its supported range. */
+#define LAMAT_INVALID 3
+
+/* Operation was not successful because memory
+ * could not be allocated. Every operation writing a matrix in place
+ * may return it when storage shared with a duplicate (see mat_dup)
+ * cannot be copied; the matrix is then left as it was. */
+#define LAMAT_ALLOC 4
+
+
+/* Algorithms for mat_mul_algo and mat_mul_policy */
+
+/* Classical O(n^3) product. Every element is a plain sum of products,
+ * accumulated in increasing order of the inner index. */
+#define LAMAT_MUL_CLASSIC 0
+
+/* Strassen-Winograd recursion, O(n^2.81), for square operands of order
+ * above strassen_cutoff (see tune.h); other products are classical.
+ * Faster for large orders, but less accurate: errors are only bounded
+ * relative to the largest elements of the operands, not element by
+ * element, and grow with every level of recursion. Elements of the
+ * result much smaller than the others can lose most of their digits.
+ * Allocates a workspace of about 2n^2/3 elements, plus 3 padded copies
+ * of the operands when n is not a multiple of a power of two.
+ * Only used when both operands are LAMAT_ROW_MAJOR. */
+#define LAMAT_MUL_STRASSEN 1
+
+
+/* Storage layouts for mat_set_layout.
+ * Operations accept operands in any mix of layouts. Results take the
+ * layout of the first matrix operand; mat_cpy copies it as well. */
+
+/* Elements stored by rows. The layout of every new matrix. */
+#define LAMAT_ROW_MAJOR 0
+
+/* Elements stored by LAMAT_TILE x LAMAT_TILE tiles, each contiguous and
+ * row-major. Rows and columns are then both walked a tile at a time, so
+ * column access (mat_cmul, vec_mmul_l, the right operand of mat_mul)
+ * touches as few cache lines and pages as row access. Edge tiles are
+ * padded, which costs up to LAMAT_TILE - 1 extra rows and columns
+ * of storage. Products by vectors sum a tile at a time, so their
+ * results may differ in the last bits from those of row-major storage. */
+#define LAMAT_TILED 1
+
+/* Order of the tiles of LAMAT_TILED */
+#define LAMAT_TILE 64
+
 
 /* Creates a new matrix whose elements are in data,
  * ordered by rows.
@@ -31,26 +80,68 @@ int mat_identity(matrix **m, int order);
 /* Creates a null matrix with the given dimensions. */
 int mat_zero(matrix **m, int rows, int cols);
 
-/* Creates a new matrix with same values as src. */
+/* Creates a new matrix with same values as src. It shares src's
+ * storage, so this takes constant time, until either of them is
+ * written: the first write then copies the values. Reference counts are
+ * atomic, so threads may duplicate and read a matrix concurrently. */
 int mat_dup(matrix **dst, const matrix *src);
 
-/* Copies src's values and dimensions into dst. */
+/* Copies src's values and dimensions into dst, sharing src's storage
+ * like mat_dup. */
 int mat_cpy(matrix *dst, const matrix *src);
 
 /* Frees resources allocated for m */
 int mat_del(matrix *m);
 
 
+/* Converts the storage of m to the given layout, one of
+ * the LAMAT_ constants above.
+ * Possible errors:
+ *  - LAMAT_INVALID
+ *  - LAMAT_ALLOC */
+int mat_set_layout(matrix *m, int layout);
+
+/* Returns the storage layout of m. */
+int mat_get_layout(const matrix *m);
+
 /* Writes to *rows and *cols the dimensions of m.
  * If any of the int pointers are NULL, it is left untouched. */
 int mat_dim(const matrix *m, int *rows, int *cols);
 
-/* Copies m's elements into data. */
+/* Copies m's elements into data, ordered by rows. */
 int mat_get_data(const matrix *m, LINALG_SCALAR *data);
 
-/* Copies data's elements into m. */
+/* Copies data's elements, ordered by rows, into m. */
 int mat_set_data(matrix *m, const LINALG_SCALAR *data);
 
+/* Storage of m, in its layout: for LAMAT_ROW_MAJOR, element (i, j) is
+ * at i * mat_stride(m) + j. The pointer is valid until m is freed,
+ * changes layout or is written as the output of an operation, which
+ * may move its storage. Storage shared with a duplicate, or attached
+ * read-only (see shm.h), is first copied, so that writes through the
+ * pointer only reach m; NULL is returned if that copy cannot be
+ * allocated. As that replaces m's storage, no other thread may use m
+ * during the call. */
+LINALG_SCALAR *mat_data_ptr(matrix *m);
+
+/* Storage of m for reading only, as it is: never copied, so readers in
+ * any number of threads may call it at once. Valid like mat_data_ptr's,
+ * and until m is written, by the caller or through a duplicate. */
+const LINALG_SCALAR *mat_data_cptr(const matrix *m);
+
+/* Distance in elements between the starts of consecutive rows of
+ * a LAMAT_ROW_MAJOR matrix. Do not assume it equals the number
+ * of columns. */
+int mat_stride(const matrix *m);
+
+/* Pointer to the first element of the given row, whose elements are
+ * contiguous, or NULL if m is not LAMAT_ROW_MAJOR. Obtained through
+ * mat_data_ptr, and valid for as long. No boundary checks are made. */
+LINALG_SCALAR *mat_row_ptr(matrix *m, int row);
+
+/* Same as mat_row_ptr, for reading only, through mat_data_cptr */
+const LINALG_SCALAR *mat_row_cptr(const matrix *m, int row);
+
 
 /* Writes the element with corresponding position into out.
  * Possible errors:
@@ -60,17 +151,22 @@ int mat_read(const matrix *m, int row, int col, LINALG_SCALAR *out);
 /* Alternative version of mat_read for easier handling.
  * Returns the element with corresponding position in the matrix.
  * No error or boundary checks are made. Useful for quick acces to values.
+ * exposed.h has an inline version, mat_iget.
  */
 LINALG_SCALAR mat_get(const matrix *m, int row, int col);
 
 /* Writes r into the matrix's corresponding position.
  * Possible errors:
- *  - LAMAT_OOB */
+ *  - LAMAT_OOB
+ *  - LAMAT_ALLOC */
 int mat_write(matrix *m, int row, int col, LINALG_SCALAR r);
 
 /* Unsafe version of mat_write.
  * Writes r into the matrix's corresponding position.
- * No error checks are made. */
+ * No error checks are made: nothing is written if m's storage is shared
+ * and cannot be copied. Every call checks whether it is shared, an
+ * atomic load, so whole matrices are better filled with mat_set_data
+ * or through mat_data_ptr. */
 void mat_set(matrix *m, int row, int col, LINALG_SCALAR r);
 
 
@@ -94,16 +190,108 @@ int mat_sub(const matrix *a, const matrix *b, matrix *out);
  *  - LAMAT_INCOMPATIBLE_DIM */
 int mat_sub_(matrix *a, const matrix *b);
 
-/* Writes the result of a * b into out.
+/* Writes the result of a * b into out, using the algorithm
+ * set with mat_mul_policy.
  * Possible errors:
  *  - LAMAT_INCOMPATIBLE_DIM */
 int mat_mul(const matrix *a, const matrix *b, matrix *out);
 
-/* Writes the result of a * b into a.
+/* Writes the result of a * b into a, using the algorithm
+ * set with mat_mul_policy.
  * Possible errors:
  *  - LAMAT_INCOMPATIBLE_DIM */
 int mat_mul_(matrix *a, const matrix *b);
 
+/* Writes the result of a * b into out, using the given algorithm,
+ * one of the LAMAT_MUL_ constants.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM
+ *  - LAMAT_INVALID */
+int mat_mul_algo(const matrix *a, const matrix *b, matrix *out, int algo);
+
+/* Sets the algorithm used by mat_mul and mat_mul_ in every thread.
+ * The default is LAMAT_MUL_CLASSIC.
+ * Possible errors:
+ *  - LAMAT_INVALID */
+int mat_mul_policy(int algo);
+
+/* Writes a to the power k >= 0 into out, by repeated squaring: about
+ * log2(k) products instead of k - 1, with the algorithm set with
+ * mat_mul_policy. The intermediate powers live in a workspace of 3
+ * matrices the size of a, allocated per thread and kept for later calls
+ * as long as it takes at most 32 MiB; see linalg_workspace_release.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM
+ *  - LAMAT_INVALID
+ *  - LAMAT_ALLOC */
+int mat_pow(const matrix *a, int k, matrix *out);
+
+/* Replaces a with a to the power k >= 0, as mat_pow.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM
+ *  - LAMAT_INVALID
+ *  - LAMAT_ALLOC */
+int mat_pow_(matrix *a, int k);
+
+/* Writes the exponential of a into out, by scaling and squaring: a is
+ * divided by a power of two 2^s until a Pade approximant of degree at
+ * most 7, 9 for double, is accurate to the last bit, and the
+ * approximant's value is squared s times. Shares the workspace of
+ * mat_pow, growing it to 8 matrices the size of a.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM
+ *  - LAMAT_INVALID, for elements that are not finite
+ *  - LAMAT_ALLOC */
+int mat_expm(const matrix *a, matrix *out);
+
+/* Replaces a with its exponential, as mat_expm.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM
+ *  - LAMAT_INVALID
+ *  - LAMAT_ALLOC */
+int mat_expm_(matrix *a);
+
+/* Frees the workspace of mat_pow, mat_expm, mat_permute_rows and
+ * mat_permute_cols kept by the calling thread, for a thread that is
+ * done with them but keeps running. Workspaces over 32 MiB are not
+ * kept in the first place. */
+int linalg_workspace_release(void);
+
+/* Adds alpha * x * y^T to a, with x holding as many elements as a has
+ * rows and y as many as it has columns. No temporary is allocated.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_ger(matrix *a, LINALG_SCALAR alpha, const vector *x,
+        const vector *y);
+
+/* Adds alpha * a^T * a to c, a k x n and c n x n: every row of a is
+ * added as a rank-1 update, but all k at once, at the speed of a
+ * matrix product. c must be symmetric; only its upper triangle is
+ * computed, then copied over the lower one.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_syrk(matrix *c, LINALG_SCALAR alpha, const matrix *a);
+
+/* Element-wise addition of v to every row of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_radd(const matrix *m, const vector *v, matrix *out);
+
+/* Element-wise in place addition of v to every row of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_radd_(matrix *m, const vector *v);
+
+/* Element-wise subtraction of v from every row of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_rsub(const matrix *m, const vector *v, matrix *out);
+
+/* Element-wise in place subtraction of v from every row of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_rsub_(matrix *m, const vector *v);
+
 /* Element-wise multiplication of v with every row of m.
  * Possible errors:
  *  - LAMAT_INCOMPATIBLE_DIM */
@@ -114,6 +302,36 @@ int mat_rmul(const matrix *m, const vector *v, matrix *out);
  *  - LAMAT_INCOMPATIBLE_DIM */
 int mat_rmul_(matrix *m, const vector *v);
 
+/* Element-wise division of every row of m by v.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_rdiv(const matrix *m, const vector *v, matrix *out);
+
+/* Element-wise in place division of every row of m by v.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_rdiv_(matrix *m, const vector *v);
+
+/* Element-wise addition of v to every column of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_cadd(const matrix *m, const vector *v, matrix *out);
+
+/* Element-wise in place addition of v to every column of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_cadd_(matrix *m, const vector *v);
+
+/* Element-wise subtraction of v from every column of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_csub(const matrix *m, const vector *v, matrix *out);
+
+/* Element-wise in place subtraction of v from every column of m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_csub_(matrix *m, const vector *v);
+
 /* Element-wise multiplication of v with every column of m.
  * Possible errors:
  *  - LAMAT_INCOMPATIBLE_DIM */
@@ -124,6 +342,16 @@ int mat_cmul(const matrix *m, const vector *v, matrix *out);
  *  - LAMAT_INCOMPATIBLE_DIM */
 int mat_cmul_(matrix *m, const vector *v);
 
+/* Element-wise division of every column of m by v.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_cdiv(const matrix *m, const vector *v, matrix *out);
+
+/* Element-wise in place division of every column of m by v.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM */
+int mat_cdiv_(matrix *m, const vector *v);
+
 /* Writes the result of s * m into out. */
 int mat_smul(const matrix *m, LINALG_SCALAR s, matrix *out);
 
@@ -136,8 +364,60 @@ int mat_sdiv(const matrix *m, LINALG_SCALAR s, matrix *out);
 /* Writes the result of (1/s) * m into m. */
 int mat_sdiv_(matrix *m, LINALG_SCALAR s);
 
+/* Writes f(x, ctx) for every element x of m into out.
+ * Built-in functions from vmath.h run through vectorized kernels. */
+int mat_map(const matrix *m, vm_func f, void *ctx, matrix *out);
+
+/* Replaces every element x of m with f(x, ctx).
+ * Built-in functions from vmath.h run through vectorized kernels. */
+int mat_map_(matrix *m, vm_func f, void *ctx);
+
+
+/* Writes the transpose of m into out. */
+int mat_transpose(const matrix *m, matrix *out);
 
 /* Transposes m. */
 int mat_transpose_(matrix *m);
 
+
+/* Row selection and permutations. Indices are checked before anything
+ * is written. Rows are copied whole, a tile's width at a time for
+ * LAMAT_TILED, and large selections are split between threads, one per
+ * online CPU at most. */
+
+/* Writes the rows idx[0] to idx[n - 1] of m into out, which gets n rows
+ * and m's layout.
+ * Possible errors:
+ *  - LAMAT_INVALID, for n <= 0
+ *  - LAMAT_OOB */
+int mat_gather_rows(const matrix *m, const int *idx, int n, matrix *out);
+
+/* Writes row i of src, of n rows, into row idx[i] of m for every
+ * 0 <= i < n. If an index repeats, the last of its rows ends up there:
+ * threads are given rows of m to write rather than indices. src must
+ * be distinct from m.
+ * Possible errors:
+ *  - LAMAT_INCOMPATIBLE_DIM
+ *  - LAMAT_INVALID
+ *  - LAMAT_OOB */
+int mat_scatter_rows(matrix *m, const int *idx, int n, const matrix *src);
+
+/* Rearranges the rows of m so that row i holds what was row perm[i],
+ * following the cycles of perm in place: only rows out of place move,
+ * each once, through a single row of scratch.
+ * Possible errors:
+ *  - LAMAT_INVALID, if perm is not a permutation of the rows
+ *  - LAMAT_OOB
+ *  - LAMAT_ALLOC */
+int mat_permute_rows(matrix *m, const int *perm);
+
+/* Rearranges the columns of m so that column j holds what was column
+ * perm[j]. Rows are rearranged one at a time through a row of scratch,
+ * which reads m in storage order.
+ * Possible errors:
+ *  - LAMAT_INVALID, if perm is not a permutation of the columns
+ *  - LAMAT_OOB
+ *  - LAMAT_ALLOC */
+int mat_permute_cols(matrix *m, const int *perm);
+
 #endif
@@ -0,0 +1,73 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H 1
+
+#include "matrix.h"
+#include "vector.h"
+
+/* Placement of matrix and vector storage on the memory nodes of
+ * NUMA machines.
+ *
+ * By default storage comes from malloc, and the kernel places each page
+ * on the node of the thread that first writes it. The policies below
+ * place the pages explicitly, with mbind(2). They only apply to storage
+ * of at least LANUMA_MIN_BYTES; smaller buffers fit in a few pages and
+ * keep using malloc.
+ *
+ * Workers of a linalg_queue are spread evenly over the nodes and pinned
+ * to the CPUs of their node when there is more than one. */
+
+/* Storage placed by the kernel's default policy */
+#define LANUMA_DEFAULT 0
+
+/* Pages spread round-robin over every node, for data read by all
+ * threads alike. */
+#define LANUMA_INTERLEAVE 1
+
+/* Every page on the given node. */
+#define LANUMA_BIND 2
+
+/* Storage split into one contiguous block per node, in node order, so
+ * that the rows of a matrix are divided evenly between the nodes. This
+ * is where parallel first-touch initialization by row blocks would put
+ * them, without depending on which thread writes first. */
+#define LANUMA_BLOCKED 3
+
+/* Smallest storage the policies apply to */
+#define LANUMA_MIN_BYTES (256 * 1024)
+
+
+/* Operation was not successful due to an unknown policy
+ * or a node that does not exist. */
+#define LANUMA_INVALID 1
+
+/* Operation was not successful because the kernel
+ * refused the placement. */
+#define LANUMA_UNSUPPORTED 2
+
+/* Operation was not successful because the storage is in
+ * shared memory (see shm.h), which other processes map. */
+#define LANUMA_ATTACHED 3
+
+
+/* Returns the number of memory nodes, 1 on machines without NUMA. */
+int linalg_numa_nodes(void);
+
+/* Sets the policy for storage allocated from now on by every thread.
+ * node is only used by LANUMA_BIND.
+ * Possible errors:
+ *  - LANUMA_INVALID */
+int linalg_numa_policy(int policy, int node);
+
+/* Moves the storage of m to new memory placed with the given policy,
+ * whatever its size. Storage in shared memory (see mat_share and
+ * mat_attach in shm.h) is not moved, as other processes map it.
+ * Possible errors:
+ *  - LANUMA_INVALID
+ *  - LANUMA_UNSUPPORTED
+ *  - LANUMA_ATTACHED */
+int mat_place(matrix *m, int policy, int node);
+
+/* Same as mat_place, for vectors. */
+int vec_place(vector *v, int policy, int node);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef PLAN_H
+#define PLAN_H 1
+
+#include "matrix.h"
+
+/* Execution plans for products repeated on operands of one shape.
+ *
+ * mat_mul decides on every call which kernel to run, how to block it and
+ * where to put its result, and allocates the workspace of Strassen and
+ * of the summation modes anew each time. A plan makes these decisions
+ * once, for given dimensions and the policies in force when it is made,
+ * and keeps the workspace they need, so that executing it allocates
+ * nothing as long as the output already has the right dimensions,
+ * layout and storage of its own.
+ *
+ * Plans take row-major operands only. A plan may be executed by one
+ * thread at a time. */
+
+typedef struct plan plan;
+
+
+/* Multiplies by Strassen-Winograd recursion when the operands are
+ * square, like LAMAT_MUL_STRASSEN. */
+#define LAPLAN_STRASSEN 1
+
+/* Splits the rows of the product into bands, one per online CPU at most
+ * and fewer for small products, run by the calling thread and the
+ * library's pool of workers. While the pool runs another split
+ * operation, the calling thread runs every band. Only the blocked
+ * kernels are split, in any summation mode; the generated ones of
+ * SPEC_SHAPES, Strassen and a CBLAS backend run on the calling
+ * thread. */
+#define LAPLAN_THREADS 2
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions */
+#define LAPLAN_INCOMPATIBLE_DIM 1
+
+/* Operation was not successful due to an argument outside its range,
+ * an operand that is not row-major, or an output that is also an
+ * operand. */
+#define LAPLAN_INVALID 2
+
+/* Operation was not successful because memory
+ * could not be allocated. */
+#define LAPLAN_ALLOC 3
+
+
+/* Creates a plan for the product of a rows x inner matrix by an
+ * inner x cols one, with flags a combination of the LAPLAN_ flags
+ * above. The summation mode and backend are those in force at the time,
+ * see summation.h and backend.h, and so are the tuning parameters.
+ * Possible errors:
+ *  - LAPLAN_INVALID
+ *  - LAPLAN_ALLOC */
+int mat_mul_plan(plan **p, int rows, int inner, int cols, int flags);
+
+/* Frees resources allocated for p */
+int plan_del(plan *p);
+
+/* Writes the result of a * b into out as planned by p. a and b must have
+ * the dimensions p was made for and be row-major. out becomes a
+ * row-major matrix of the result's dimensions, its storage reused if
+ * it already has them and is not shared with another matrix.
+ * Possible errors:
+ *  - LAPLAN_INCOMPATIBLE_DIM
+ *  - LAPLAN_INVALID
+ *  - LAPLAN_ALLOC */
+int plan_execute(plan *p, const matrix *a, const matrix *b, matrix *out);
+
+#endif
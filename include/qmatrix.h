@@ -0,0 +1,87 @@
+#ifndef QMATRIX_H
+#define QMATRIX_H 1
+
+#include "linalg.h"
+#include "matrix.h"
+#include "vector.h"
+
+/* Read-only matrices stored in reduced precision.
+ *
+ * A qmatrix is made from a matrix once and then multiplied by regular
+ * vectors and matrices. Its elements are converted back to
+ * LINALG_SCALAR on the fly; products and sums are computed in
+ * LINALG_SCALAR as well, so only the stored matrix loses precision.
+ *
+ * On x86-64 the kernels come in versions for AVX2 with F16C and FMA and
+ * for AVX-512, and the best one the CPU supports is picked at run time.
+ * Results may differ between versions in the last bits, as they sum the
+ * products in different orders. The environment variable LINALG_QMAT_ISA
+ * set to generic, avx2, avx512 or avx512-bf16 caps the version picked,
+ * to compare them or to get the same results on different CPUs.
+ *
+ * Matrices in the LAMAT_TILED layout are read through a row-major copy,
+ * and results are always row-major. */
+
+typedef struct qmatrix qmatrix;
+
+
+/* Storage formats */
+
+/* bfloat16: 8 bits of exponent and 8 of significand, so the range of
+ * float with about 3 significant decimal digits. Where AVX512-BF16 does
+ * the rounding, subnormal elements become zero. */
+#define LAQMAT_BF16 1
+
+/* IEEE 754 half precision: 5 bits of exponent and 11 of significand.
+ * Magnitudes above 65504 become infinite and below about 6e-8 zero. */
+#define LAQMAT_FP16 2
+
+/* Symmetric 8 bit integers with one scale per row: every element is
+ * stored as the nearest multiple of max|row| / 127. */
+#define LAQMAT_INT8 3
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions */
+#define LAQMAT_INCOMPATIBLE_DIM 1
+
+/* Operation was not successful due to an unknown storage format. */
+#define LAQMAT_INVALID 2
+
+/* Operation was not successful because memory
+ * could not be allocated. */
+#define LAQMAT_ALLOC 3
+
+
+/* Creates a qmatrix holding the elements of m in the given format,
+ * rounded to nearest.
+ * Possible errors:
+ *  - LAQMAT_INVALID
+ *  - LAQMAT_ALLOC */
+int qmat_new(qmatrix **q, const matrix *m, int format);
+
+/* Frees resources allocated for q */
+int qmat_del(qmatrix *q);
+
+/* Writes to *rows and *cols the dimensions of q, and to *format
+ * its storage format. NULL pointers are left untouched. */
+int qmat_dim(const qmatrix *q, int *rows, int *cols, int *format);
+
+/* Writes the elements of q, converted back, into out.
+ * Possible errors:
+ *  - LAQMAT_ALLOC */
+int qmat_to_mat(const qmatrix *q, matrix *out);
+
+/* Writes the result of q * v into out.
+ * Possible errors:
+ *  - LAQMAT_INCOMPATIBLE_DIM
+ *  - LAQMAT_ALLOC */
+int qmat_mmul_r(const qmatrix *q, const vector *v, vector *out);
+
+/* Writes the result of q * b into out.
+ * Possible errors:
+ *  - LAQMAT_INCOMPATIBLE_DIM
+ *  - LAQMAT_ALLOC */
+int qmat_mul(const qmatrix *q, const matrix *b, matrix *out);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef QUEUE_H
+#define QUEUE_H 1
+
+#include "matrix.h"
+#include "vector.h"
+
+/* Asynchronous execution of library calls on a pool of worker threads.
+ *
+ * Every task names the objects it reads and the objects it writes. A task
+ * starts only after every earlier task of the same queue that writes one
+ * of its objects, or reads one it writes, has finished. Tasks that share
+ * nothing run in parallel, so independent chains overlap, while each
+ * chain still sees its operations applied in submission order.
+ *
+ * The objects of a task must not be used by the caller, other than
+ * through more tasks of the same queue, until the task has finished. */
+
+typedef struct linalg_queue linalg_queue;
+typedef struct linalg_task linalg_task;
+
+/* Body of a task. Its return value becomes the task's result. */
+typedef int (*linalg_task_func)(void *ctx);
+
+/* Completion callback, called with the task's result. */
+typedef void (*linalg_task_done)(int result, void *ctx);
+
+
+/* Operation was not successful because memory or a thread
+ * could not be allocated. */
+#define LAQUEUE_ALLOC 1
+
+
+/* Creates a queue served by the given number of worker threads,
+ * or by one per online CPU if threads is 0 or less.
+ * Possible errors:
+ *  - LAQUEUE_ALLOC */
+int linalg_queue_new(linalg_queue **q, int threads);
+
+/* Waits for every task of q to finish, then stops its workers and
+ * frees it. Task handles stay valid until deleted. */
+int linalg_queue_del(linalg_queue *q);
+
+/* Waits for every task submitted to q so far to finish. */
+int linalg_queue_finish(linalg_queue *q);
+
+
+/* Submits f(ctx), which reads the nreads objects in reads and writes the
+ * nwrites objects in writes. Objects are compared by address only.
+ * If task is not NULL, a handle to the new task is written into it,
+ * which must be released with linalg_task_del.
+ * Possible errors:
+ *  - LAQUEUE_ALLOC */
+int linalg_submit(linalg_queue *q, linalg_task_func f, void *ctx,
+        const void *const *reads, int nreads,
+        void *const *writes, int nwrites, linalg_task **task);
+
+/* Asynchronous counterparts of the functions of the same name, with
+ * the dependencies filled in. The result of each task is the return
+ * value of the function.
+ * Possible errors:
+ *  - LAQUEUE_ALLOC */
+int linalg_async_mat_add(linalg_queue *q, const matrix *a, const matrix *b,
+        matrix *out, linalg_task **task);
+int linalg_async_mat_add_(linalg_queue *q, matrix *a, const matrix *b,
+        linalg_task **task);
+int linalg_async_mat_sub(linalg_queue *q, const matrix *a, const matrix *b,
+        matrix *out, linalg_task **task);
+int linalg_async_mat_sub_(linalg_queue *q, matrix *a, const matrix *b,
+        linalg_task **task);
+int linalg_async_mat_mul(linalg_queue *q, const matrix *a, const matrix *b,
+        matrix *out, linalg_task **task);
+int linalg_async_mat_mul_(linalg_queue *q, matrix *a, const matrix *b,
+        linalg_task **task);
+int linalg_async_vec_mmul_r(linalg_queue *q, const matrix *m,
+        const vector *v, vector *out, linalg_task **task);
+int linalg_async_vec_mmul_r_(linalg_queue *q, const matrix *m, vector *v,
+        linalg_task **task);
+
+
+/* Blocks until t has finished and writes its result into *result,
+ * unless result is NULL.
+ * Must not be called from a task of the same queue. */
+int linalg_task_wait(linalg_task *t, int *result);
+
+/* Returns 1 if t has finished and 0 otherwise, without blocking. */
+int linalg_task_poll(linalg_task *t);
+
+/* Sets the function called with t's result once it has finished.
+ * It runs on the worker thread that ran t, or right away on the calling
+ * thread if t has already finished. A task has at most one callback;
+ * setting another one replaces it. */
+int linalg_task_then(linalg_task *t, linalg_task_done cb, void *ctx);
+
+/* Releases the handle t. The task itself still runs to completion. */
+int linalg_task_del(linalg_task *t);
+
+#endif
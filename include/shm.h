@@ -0,0 +1,82 @@
+#ifndef SHM_H
+#define SHM_H 1
+
+#include "matrix.h"
+#include "vector.h"
+
+/* Matrices and vectors in POSIX shared memory, for processes on the
+ * same host to use one copy of large read-mostly data.
+ *
+ * mat_share moves the storage of a matrix into a new shared memory
+ * object with the given name, which other processes of the same user
+ * then map with mat_attach. Names follow shm_open(3): a slash followed
+ * by up to NAME_MAX characters other than slashes. The object records
+ * the dimensions and layout, so a name is all an attaching process
+ * needs.
+ *
+ * Attached matrices are read-only and take part in every operation as
+ * operands, reading the shared pages directly. They may also be the
+ * output of an operation, in place operations (mat_add_ and the like)
+ * included, which then moves them to private storage, as does
+ * mat_data_ptr; mat_data_cptr reads the shared pages. The process that
+ * shared a matrix keeps it writable, and its writes are seen by every
+ * process attached to it. As the output of an operation that cannot
+ * write in place, because its size or layout changes or it is an operand
+ * as well, it moves back to private storage like an attached matrix.
+ * Duplicates of shared matrices, unlike those of private ones, are real
+ * copies.
+ *
+ * Every process using the object holds a reference, dropped when its
+ * matrix or vector is deleted or moved to private storage. The name is
+ * removed with the last reference, or at once with linalg_shm_unlink;
+ * mappings then live on until their holders drop them. References of
+ * processes that exit without deleting their matrices are never
+ * dropped, so their objects are left for linalg_shm_unlink. */
+
+
+/* Operation was not successful because no shared object has the name,
+ * or the last reference to it is being dropped. */
+#define LASHM_NOT_FOUND 1
+
+/* Operation was not successful because the name is in use. */
+#define LASHM_EXISTS 2
+
+/* Operation was not successful because the object under the name holds
+ * a vector rather than a matrix, or the other way around, or was not
+ * created by this library. */
+#define LASHM_MISMATCH 3
+
+/* Operation was not successful because of a failed system call,
+ * for instance for an invalid name or lack of permissions; errno
+ * holds the cause. */
+#define LASHM_SYSTEM 4
+
+
+/* Moves the storage of m into a new shared memory object named name.
+ * Possible errors:
+ *  - LASHM_EXISTS
+ *  - LASHM_SYSTEM */
+int mat_share(matrix *m, const char *name);
+
+/* Creates a read-only matrix backed by the shared object named name.
+ * Possible errors:
+ *  - LASHM_NOT_FOUND
+ *  - LASHM_MISMATCH
+ *  - LASHM_SYSTEM */
+int mat_attach(matrix **m, const char *name);
+
+/* Same as mat_share, for vectors. */
+int vec_share(vector *v, const char *name);
+
+/* Same as mat_attach, for vectors. */
+int vec_attach(vector **v, const char *name);
+
+/* Removes the name of a shared object created by this library, whatever
+ * its references. Matrices and vectors using it are not affected.
+ * Possible errors:
+ *  - LASHM_NOT_FOUND
+ *  - LASHM_MISMATCH
+ *  - LASHM_SYSTEM */
+int linalg_shm_unlink(const char *name);
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef SMATRIX_H
+#define SMATRIX_H 1
+
+#include "linalg.h"
+#include "matrix.h"
+#include "vector.h"
+
+/* Square matrices with a known structure, stored compactly.
+ *
+ * Only the elements the structure allows are stored, and products and
+ * solves only visit those: multiplying an n x n diagonal or banded
+ * smatrix with an n x k matrix costs O(nk) instead of O(n^2 k).
+ * Operations mixing an smatrix with dense matrices and vectors pick the
+ * kernel of the smatrix's kind.
+ *
+ * Matrices in the LAMAT_TILED layout are read through a row-major copy,
+ * and results are always row-major. */
+
+typedef struct smatrix smatrix;
+
+
+/* Kinds of structure */
+
+/* Only the main diagonal */
+#define LASMAT_DIAGONAL 1
+
+/* The main diagonal, a given number of diagonals below it and a given
+ * number above it; a tridiagonal matrix has one of each. */
+#define LASMAT_BANDED 2
+
+/* The main diagonal and everything above it */
+#define LASMAT_UPPER 3
+
+/* The main diagonal and everything below it */
+#define LASMAT_LOWER 4
+
+/* Equal to its transpose. The upper triangle is stored. */
+#define LASMAT_SYMMETRIC 5
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions */
+#define LASMAT_INCOMPATIBLE_DIM 1
+
+/* Operation was not successful due to an unknown kind
+ * or a negative number of diagonals. */
+#define LASMAT_INVALID 2
+
+/* Operation was not successful because the matrix is singular or,
+ * for LASMAT_SYMMETRIC, not positive definite. */
+#define LASMAT_SINGULAR 3
+
+
+/* Creates an smatrix of the given kind, other than LASMAT_BANDED, from
+ * the square matrix m. Elements outside the structure are ignored; for
+ * LASMAT_SYMMETRIC, so is the lower triangle.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM
+ *  - LASMAT_INVALID */
+int smat_new(smatrix **s, const matrix *m, int kind);
+
+/* Creates a LASMAT_BANDED smatrix from the square matrix m, with lower
+ * diagonals below the main one and upper above it. Elements outside
+ * the band are ignored.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM
+ *  - LASMAT_INVALID */
+int smat_band(smatrix **s, const matrix *m, int lower, int upper);
+
+/* Creates a LASMAT_DIAGONAL smatrix whose diagonal holds
+ * the elements of d. */
+int smat_diag(smatrix **s, const vector *d);
+
+/* Creates a LASMAT_DIAGONAL identity matrix of the given order. */
+int smat_identity(smatrix **s, int order);
+
+/* Frees resources allocated for s */
+int smat_del(smatrix *s);
+
+/* Writes to *order the order of s and to *kind its kind.
+ * NULL pointers are left untouched. */
+int smat_dim(const smatrix *s, int *order, int *kind);
+
+/* Writes to *lower and *upper the number of diagonals below and above
+ * the main one that s may hold. NULL pointers are left untouched. */
+int smat_bands(const smatrix *s, int *lower, int *upper);
+
+/* Writes s into out as a dense matrix. */
+int smat_to_mat(const smatrix *s, matrix *out);
+
+
+/* Writes the result of s * v into out.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM */
+int smat_mmul_r(const smatrix *s, const vector *v, vector *out);
+
+/* Writes the result of v * s into out.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM */
+int smat_mmul_l(const vector *v, const smatrix *s, vector *out);
+
+/* Writes the result of s * b into out.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM */
+int smat_mul_l(const smatrix *s, const matrix *b, matrix *out);
+
+/* Writes the result of a * s into out.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM */
+int smat_mul_r(const matrix *a, const smatrix *s, matrix *out);
+
+
+/* Writes into out the solution x of s * x = b.
+ * Triangular systems are solved by substitution, banded ones by
+ * Gaussian elimination with partial pivoting within the band, and
+ * symmetric ones by Cholesky factorization.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM
+ *  - LASMAT_SINGULAR */
+int smat_solve(const smatrix *s, const vector *b, vector *out);
+
+/* Writes into out the solution x of s * x = b, for every column
+ * of b at once.
+ * Possible errors:
+ *  - LASMAT_INCOMPATIBLE_DIM
+ *  - LASMAT_SINGULAR */
+int smat_solve_mat(const smatrix *s, const matrix *b, matrix *out);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H 1
+
+#include <stdio.h>
+
+/* Instrumentation of the matrix and vector functions.
+ *
+ * Counters are only collected when the library is built with
+ * -DLINALG_STATS (e.g. make rebuild CFLAGS=-DLINALG_STATS). Otherwise
+ * every hook compiles to nothing and the functions below only report
+ * LASTATS_DISABLED.
+ *
+ * Each thread keeps its own counters, so collecting them takes no locks.
+ * For every public function of matrix.h and vector.h, except the
+ * unchecked accessors mat_get, mat_set, vec_get and vec_set, they record:
+ *  - number of calls;
+ *  - total time, including calls to other library functions, and self
+ *    time, excluding them;
+ *  - bytes allocated and bytes copied by the function itself;
+ *  - floating point operations performed by the function itself.
+ *
+ * Building with -DLINALG_STATS_PERF as well also records CPU cycles and
+ * retired instructions through perf_event_open on Linux. Reading the
+ * hardware counters costs a system call per function call, so expect
+ * a noticeable slowdown of small operations. */
+
+/* Operation was not successful because the library
+ * was built without LINALG_STATS. */
+#define LASTATS_DISABLED 1
+
+
+/* Writes the counters of every thread that has called into the library,
+ * followed by their totals, into out as JSON.
+ * Counters of other threads still running are read without
+ * synchronization and may be slightly out of date.
+ * Possible errors:
+ *  - LASTATS_DISABLED */
+int linalg_stats_dump(FILE *out);
+
+/* Zeroes the counters of the calling thread.
+ * Possible errors:
+ *  - LASTATS_DISABLED */
+int linalg_stats_reset(void);
+
+#endif
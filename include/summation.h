@@ -0,0 +1,39 @@
+#ifndef SUMMATION_H
+#define SUMMATION_H 1
+
+/* Accuracy of long sums.
+ *
+ * By default a reduction such as vec_dot adds its terms one after the
+ * other into a single LINALG_SCALAR, so its error grows with the number
+ * of terms n. The other modes keep it small at a modest cost:
+ *
+ *  - vec_dot, vec_norm2, vec_dist2 (and so vec_norm and vec_dist) sum
+ *    their terms in the mode set with linalg_sum_policy, or in the one
+ *    given to their _sum variants;
+ *  - mat_mul and mat_mul_ sum the products of every element of the
+ *    result in the mode set with linalg_sum_policy, for row-major
+ *    operands and LAMAT_MUL_CLASSIC only. */
+
+/* One term after the other, as above: error proportional to n. */
+#define LASUM_NAIVE 0
+
+/* Blocks of terms summed separately, then halves summed recursively:
+ * error proportional to log n, at about the speed of LASUM_NAIVE. */
+#define LASUM_PAIRWISE 1
+
+/* Kahan's compensated summation: error independent of n, at two to
+ * four times the cost of LASUM_PAIRWISE on data in cache. */
+#define LASUM_KAHAN 2
+
+
+/* Operation was not successful due to an unknown mode. */
+#define LASUM_INVALID 1
+
+
+/* Sets the mode used by the reductions above in every thread.
+ * The default is LASUM_NAIVE.
+ * Possible errors:
+ *  - LASUM_INVALID */
+int linalg_sum_policy(int mode);
+
+#endif
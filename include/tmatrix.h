@@ -0,0 +1,73 @@
+#ifndef TMATRIX_H
+#define TMATRIX_H 1
+
+#include "linalg.h"
+#include "matrix.h"
+#include "vector.h"
+
+/* Toeplitz and circulant matrices, stored by their first column and row.
+ *
+ * Element (i, j) of a Toeplitz matrix only depends on i - j, so a
+ * rows x cols one is defined by rows + cols - 1 elements. A circulant
+ * matrix is a square Toeplitz matrix whose rows are rotations of the
+ * first, defined by its first column alone.
+ *
+ * Products with vectors embed the matrix in a circulant one of a power
+ * of two order, at least rows + cols - 1, and apply that in O(n log n)
+ * through a real FFT; circulant matrices of a power of two order are
+ * applied as they are. The transform of the embedding and the twiddle
+ * factors are computed once, when the tmatrix is created; products only
+ * transform the vector and back. Small matrices are multiplied directly.
+ * Results may differ from those of the dense product in the last bits,
+ * relative to the largest elements of the operands rather than element
+ * by element. */
+
+typedef struct tmatrix tmatrix;
+
+
+/* Kinds of structure */
+
+/* Square, every row the previous one rotated right by one element */
+#define LATMAT_CIRCULANT 1
+
+/* Constant along every diagonal */
+#define LATMAT_TOEPLITZ 2
+
+
+/* Operation was not successful due to one or more of
+ * the operands' dimensions */
+#define LATMAT_INCOMPATIBLE_DIM 1
+
+
+/* Creates a circulant tmatrix whose first column holds the elements
+ * of col: element (i, j) is col[(i - j) mod n]. */
+int tmat_circulant(tmatrix **t, const vector *col);
+
+/* Creates a Toeplitz tmatrix with the first column col and the first
+ * row row: element (i, j) is col[i - j] for i >= j and row[j - i]
+ * otherwise. The matrix has as many rows as col has elements and as
+ * many columns as row; row[0] is ignored in favour of col[0]. */
+int tmat_toeplitz(tmatrix **t, const vector *col, const vector *row);
+
+/* Frees resources allocated for t */
+int tmat_del(tmatrix *t);
+
+/* Writes to *rows and *cols the dimensions of t and to *kind its kind.
+ * If any of the int pointers are NULL, it is left untouched. */
+int tmat_dim(const tmatrix *t, int *rows, int *cols, int *kind);
+
+/* Writes the dense, row-major equivalent of t into out. */
+int tmat_to_mat(const tmatrix *t, matrix *out);
+
+
+/* Writes the result of t * v into out, v a column vector.
+ * Possible errors:
+ *  - LATMAT_INCOMPATIBLE_DIM */
+int tmat_mmul_r(const tmatrix *t, const vector *v, vector *out);
+
+/* Writes the result of v * t into out, v a row vector.
+ * Possible errors:
+ *  - LATMAT_INCOMPATIBLE_DIM */
+int tmat_mmul_l(const vector *v, const tmatrix *t, vector *out);
+
+#endif
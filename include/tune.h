@@ -0,0 +1,84 @@
+#ifndef TUNE_H
+#define TUNE_H 1
+
+#include "linalg.h"
+
+/* Parameters of the kernels behind mat_mul, mat_mul_algo, vec_mmul_r
+ * and mat_transpose. The best values depend on the machine's caches and
+ * vector units, so they can be measured with linalg_tune and kept in a
+ * cache file.
+ *
+ * The first call to any of those functions loads the cache file (see
+ * linalg_tuning_load). If there is none and the environment variable
+ * LINALG_AUTOTUNE is set, the library tunes itself on the spot and saves
+ * the result; otherwise it uses built-in defaults. The linalg-tune
+ * program (make tune) does the same ahead of time. */
+struct linalg_tuning {
+    /* mat_mul block sizes: rows of a, columns of a (rows of b)
+     * and columns of b handled per block. */
+    int gemm_mc;
+    int gemm_kc;
+    int gemm_nc;
+
+    /* vec_mmul_r: matrix rows processed per pass, and independent
+     * partial sums kept per row. More than one partial sum lets the
+     * dot products vectorize but changes their summation order. */
+    int gemv_rows;
+    int gemv_lanes;
+
+    /* mat_transpose: side of the square tiles copied at a time */
+    int transpose_block;
+
+    /* LAMAT_MUL_STRASSEN: largest order multiplied with the
+     * classical kernel instead of recursing further */
+    int strassen_cutoff;
+};
+
+/* Operation was not successful because the cache file could
+ * not be read or written, or was written for another CPU. */
+#define LATUNE_IO 1
+
+/* Operation was not successful due to one of the parameters
+ * being outside its supported range. */
+#define LATUNE_INVALID 2
+
+/* Operation was not successful because memory
+ * could not be allocated. */
+#define LATUNE_ALLOC 3
+
+
+/* Writes the parameters currently in use into *out. */
+int linalg_tuning_get(struct linalg_tuning *out);
+
+/* Replaces the parameters in use. Operations already running on other
+ * threads finish with the parameters they started with, which stay
+ * allocated until the process exits.
+ * Possible errors:
+ *  - LATUNE_INVALID
+ *  - LATUNE_ALLOC */
+int linalg_tuning_set(const struct linalg_tuning *t);
+
+/* Benchmarks the candidate parameters on this machine, takes the fastest
+ * ones into use and writes them into *out if out is not NULL.
+ * Takes a few seconds.
+ * Possible errors:
+ *  - LATUNE_ALLOC */
+int linalg_tune(struct linalg_tuning *out);
+
+/* Loads and takes into use parameters saved by linalg_tuning_save.
+ * If path is NULL, uses the default cache file: $LINALG_TUNE_FILE if set,
+ * else $XDG_CACHE_HOME/linalg-tune, else $HOME/.cache/linalg-tune.
+ * Files saved on a different CPU model are rejected.
+ * Possible errors:
+ *  - LATUNE_IO
+ *  - LATUNE_INVALID
+ *  - LATUNE_ALLOC */
+int linalg_tuning_load(const char *path);
+
+/* Saves the parameters in use to path, or to the default
+ * cache file if path is NULL.
+ * Possible errors:
+ *  - LATUNE_IO */
+int linalg_tuning_save(const char *path);
+
+#endif
@@ -6,6 +6,8 @@ typedef struct vector vector;
 
 #include "linalg.h"
 #include "matrix.h"
+#include "summation.h"
+#include "vmath.h"
 
 /* Operation was not successful due to one or more of
  * the operands' dimensions */
@@ -15,6 +17,16 @@ typedef struct vector vector;
  * being outside the bounds of a vector. */
 #define LAVEC_OOB 2
 
+/* Operation was not successful due to an unknown summation mode,
+ * or another argument outside its supported range. */
+#define LAVEC_INVALID 3
+
+/* Operation was not successful because memory
+ * could not be allocated. Every operation writing a vector in place
+ * may return it when storage shared with a duplicate (see vec_dup)
+ * cannot be copied; the vector is then left as it was. */
+#define LAVEC_ALLOC 4
+
 
 /* Creates a new vector.
  * Vectors differ from matrices in that vectors try to adapt
@@ -32,10 +44,11 @@ int vec_basis(vector **v, int dim, int pos);
 /* Creates a null vector. */
 int vec_zero(vector **v, int dim);
 
-/* Creates a new vector with the same values as src. */
+/* Creates a new vector with the same values as src, sharing its storage
+ * until either of them is written, as mat_dup does. */
 int vec_dup(vector **dst, const vector *src);
 
-/* Copies src's values into dst. */
+/* Copies src's values into dst, sharing src's storage like vec_dup. */
 int vec_cpy(vector *dst, const vector *src);
 
 /* Frees resources allocated for v. */
@@ -51,6 +64,15 @@ int vec_get_data(const vector *v, LINALG_SCALAR *data);
 /* Copies data's elements into v. */
 int vec_set_data(vector *v, const LINALG_SCALAR *data);
 
+/* Storage of v, its elements contiguous. The pointer is valid until v
+ * is freed or written as the output of an operation, which may move
+ * its storage. Storage shared with a duplicate is first copied, and no
+ * other thread may use v during the call, as for mat_data_ptr. */
+LINALG_SCALAR *vec_data_ptr(vector *v);
+
+/* Storage of v for reading only, as for mat_data_cptr */
+const LINALG_SCALAR *vec_data_cptr(const vector *v);
+
 /* Writes v's norm into *out. */
 int vec_norm(const vector *v, LINALG_SCALAR *out);
 
@@ -67,6 +89,19 @@ int vec_dist(const vector *a, const vector *b, LINALG_SCALAR *out);
  *  - LAVEC_INCOMPATIBLE_DIM */
 int vec_dist2(const vector *a, const vector *b, LINALG_SCALAR *out);
 
+/* Same as vec_norm2, summing in the given mode, one of the LASUM_
+ * constants of summation.h.
+ * Possible errors:
+ *  - LAVEC_INVALID */
+int vec_norm2_sum(const vector *v, int mode, LINALG_SCALAR *out);
+
+/* Same as vec_dist2, summing in the given mode.
+ * Possible errors:
+ *  - LAVEC_INCOMPATIBLE_DIM
+ *  - LAVEC_INVALID */
+int vec_dist2_sum(const vector *a, const vector *b, int mode,
+        LINALG_SCALAR *out);
+
 
 /* Writes the element with corresponding position into out.
  * Possible errors:
@@ -75,17 +110,22 @@ int vec_read(const vector *v, int i, LINALG_SCALAR *out);
 
 /* Alternative version of vec_read for easier handling.
  * Returns the element with corresponding position in the vector.
- * No error or boundary checks are made. Useful for quick acces to values. */
+ * No error or boundary checks are made. Useful for quick acces to values.
+ * exposed.h has an inline version, vec_iget. */
 LINALG_SCALAR vec_get(const vector *v, int i);
 
 /* Writes r into the vector's corresponding position.
  * Possible errors:
- *  - LAVEC_OOB */
+ *  - LAVEC_OOB
+ *  - LAVEC_ALLOC */
 int vec_write(vector *v, int i, LINALG_SCALAR r);
 
 /* Unsafe version of mat_write.
  * Writes r into the matrix's corresponding position.
- * No error checks are made. */
+ * No error checks are made: nothing is written if v's storage is shared
+ * and cannot be copied. Every call checks whether it is shared, an
+ * atomic load, so whole vectors are better filled with vec_set_data
+ * or through vec_data_ptr. */
 void vec_set(vector *v, int i, LINALG_SCALAR r);
 
 /* Writes the result of a + b into out.
@@ -113,6 +153,12 @@ int vec_sub_(vector *a, const vector *b);
  *  - LAVEC_INCOMPATIBLE_DIM */
 int vec_dot(const vector *a, const vector *b, LINALG_SCALAR *r);
 
+/* Same as vec_dot, summing in the given mode.
+ * Possible errors:
+ *  - LAVEC_INCOMPATIBLE_DIM
+ *  - LAVEC_INVALID */
+int vec_dot_sum(const vector *a, const vector *b, int mode, LINALG_SCALAR *r);
+
 /* Scales v by r and writes to out. */
 int vec_smul(const vector *v, LINALG_SCALAR r, vector *out);
 
@@ -135,6 +181,14 @@ int vec_emul(const vector *a, const vector *b, vector *out);
  *  - LAVEC_INCOMPATIBLE_DIM */
 int vec_emul_(vector *a, const vector *b);
 
+/* Writes f(x, ctx) for every element x of v into out.
+ * Built-in functions from vmath.h run through vectorized kernels. */
+int vec_map(const vector *v, vm_func f, void *ctx, vector *out);
+
+/* Replaces every element x of v with f(x, ctx).
+ * Built-in functions from vmath.h run through vectorized kernels. */
+int vec_map_(vector *v, vm_func f, void *ctx);
+
 /* Writes the result of v * m into out.
  * Possible errors:
  *  - LAVEC_INCOMPATIBLE_DIM */
@@ -155,4 +209,26 @@ int vec_mmul_r(const matrix *m, const vector *v, vector *out);
  *  - LAVEC_INCOMPATIBLE_DIM */
 int vec_mmul_r_(const matrix *m, vector *v);
 
+
+/* Index selection. Indices are checked before anything is written.
+ * Large selections are split between threads, one per online CPU
+ * at most. */
+
+/* Writes the elements idx[0] to idx[n - 1] of v into out, of
+ * dimension n.
+ * Possible errors:
+ *  - LAVEC_INVALID, for n <= 0
+ *  - LAVEC_OOB */
+int vec_gather(const vector *v, const int *idx, int n, vector *out);
+
+/* Writes element i of src, of dimension n, into element idx[i] of v
+ * for every 0 <= i < n. If an index repeats, the last of its elements
+ * ends up there: threads are given elements of v to write rather than
+ * indices. src must be distinct from v.
+ * Possible errors:
+ *  - LAVEC_INCOMPATIBLE_DIM
+ *  - LAVEC_INVALID
+ *  - LAVEC_OOB */
+int vec_scatter(vector *v, const int *idx, int n, const vector *src);
+
 #endif
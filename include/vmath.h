@@ -0,0 +1,46 @@
+#ifndef VMATH_H
+#define VMATH_H 1
+
+#include "linalg.h"
+
+/* Element-wise function accepted by mat_map and vec_map.
+ * ctx is passed unchanged from the caller on every invocation. */
+typedef LINALG_SCALAR (*vm_func)(LINALG_SCALAR x, void *ctx);
+
+
+/* Built-in functions.
+ * They can be called directly on a single value, but are meant to be
+ * given to vm_apply, mat_map or vec_map, which recognize them and run a
+ * vectorized kernel over the whole array instead of calling them once per
+ * element. Both paths compute exactly the same values.
+ * The ctx argument is ignored.
+ *
+ * Error bounds are measured against the correctly rounded float result
+ * over all finite inputs of the function's domain. */
+
+/* e^x. Max error 1 ulp.
+ * Results below FLT_MIN are flushed to zero; overflows to +inf. */
+LINALG_SCALAR vm_exp(LINALG_SCALAR x, void *ctx);
+
+/* Natural logarithm. Max error 1 ulp.
+ * Returns -inf for 0 and NaN for negative inputs. */
+LINALG_SCALAR vm_log(LINALG_SCALAR x, void *ctx);
+
+/* Square root. Correctly rounded (0.5 ulp).
+ * Returns NaN for negative inputs. */
+LINALG_SCALAR vm_sqrt(LINALG_SCALAR x, void *ctx);
+
+/* Hyperbolic tangent. Max error 2 ulp. */
+LINALG_SCALAR vm_tanh(LINALG_SCALAR x, void *ctx);
+
+/* Logistic function 1 / (1 + e^-x). Max error 2 ulp.
+ * Results below FLT_MIN are flushed to zero. */
+LINALG_SCALAR vm_sigmoid(LINALG_SCALAR x, void *ctx);
+
+
+/* Writes f(src[i], ctx) into dst[i] for every 0 <= i < n.
+ * dst and src may be the same array, but must not otherwise overlap. */
+void vm_apply(vm_func f, void *ctx,
+        LINALG_SCALAR *dst, const LINALG_SCALAR *src, int n);
+
+#endif
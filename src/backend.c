@@ -0,0 +1,129 @@
+#include "backend.h"
+#include "internal.h"
+
+/* Defines LINALG_BLAS when built with BLAS, see the Makefile */
+#include ".gen/blas.h"
+
+#include <limits.h>
+#include <stdatomic.h>
+
+#ifdef LINALG_BLAS
+#include <cblas.h>
+
+/* The CBLAS routine f for the precision of LINALG_SCALAR */
+#define BLAS(f) _Generic((LINALG_SCALAR)0, \
+        float: cblas_s##f, double: cblas_d##f)
+
+static atomic_int cur_backend = LABACK_CBLAS;
+#else
+static atomic_int cur_backend = LABACK_NATIVE;
+#endif
+
+static atomic_long cur_threshold = LABACK_THRESHOLD;
+
+
+int linalg_backend(int backend, long threshold) {
+    if ((backend != LABACK_NATIVE && backend != LABACK_CBLAS)
+            || threshold < 0) {
+        return LABACK_INVALID;
+    }
+#ifndef LINALG_BLAS
+    if (backend == LABACK_CBLAS) {
+        return LABACK_UNSUPPORTED;
+    }
+#endif
+    atomic_store(&cur_threshold, threshold);
+    atomic_store(&cur_backend, backend);
+    return 0;
+}
+
+
+/* Whether a call of the given work goes to the BLAS. Without BLAS the
+ * backend stays LABACK_NATIVE, so the callers below never get past
+ * this. */
+static int use(long long work) {
+    return atomic_load_explicit(&cur_backend, memory_order_relaxed)
+            == LABACK_CBLAS
+        && work >= atomic_load_explicit(&cur_threshold, memory_order_relaxed);
+}
+
+
+int blas_used(long long work) {
+    return use(work);
+}
+
+
+int blas_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n) {
+    if (!use((long long)m * k * n)) {
+        return 0;
+    }
+#ifdef LINALG_BLAS
+    BLAS(gemm)(CblasRowMajor, CblasNoTrans, CblasNoTrans, m, n, k,
+            1, a, k, b, n, 0, c, n);
+#endif
+    return 1;
+}
+
+
+int blas_gemv(const LINALG_SCALAR *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols) {
+    if (!use((long long)rows * cols)) {
+        return 0;
+    }
+#ifdef LINALG_BLAS
+    BLAS(gemv)(CblasRowMajor, CblasNoTrans, rows, cols, 1, m, cols,
+            v, 1, 0, out, 1);
+#endif
+    return 1;
+}
+
+
+int blas_gevm(const LINALG_SCALAR *v, const LINALG_SCALAR *m,
+        LINALG_SCALAR *out, int rows, int cols) {
+    if (!use((long long)rows * cols)) {
+        return 0;
+    }
+#ifdef LINALG_BLAS
+    BLAS(gemv)(CblasRowMajor, CblasTrans, rows, cols, 1, m, cols,
+            v, 1, 0, out, 1);
+#endif
+    return 1;
+}
+
+
+int blas_dot(const LINALG_SCALAR *x, const LINALG_SCALAR *y, int n,
+        LINALG_SCALAR *out) {
+    if (!use(n)) {
+        return 0;
+    }
+#ifdef LINALG_BLAS
+    *out = BLAS(dot)(n, x, 1, y, 1);
+#else
+    *out = 0;
+#endif
+    return 1;
+}
+
+
+int blas_axpy(LINALG_SCALAR alpha, const LINALG_SCALAR *x,
+        LINALG_SCALAR *y, size_t n) {
+    if (n > INT_MAX || !use(n)) {
+        return 0;
+    }
+#ifdef LINALG_BLAS
+    BLAS(axpy)(n, alpha, x, 1, y, 1);
+#endif
+    return 1;
+}
+
+
+int blas_scal(LINALG_SCALAR alpha, LINALG_SCALAR *x, size_t n) {
+    if (n > INT_MAX || !use(n)) {
+        return 0;
+    }
+#ifdef LINALG_BLAS
+    BLAS(scal)(n, alpha, x, 1);
+#endif
+    return 1;
+}
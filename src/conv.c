@@ -0,0 +1,295 @@
+#include "conv.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Elements of the im2col block of conv_multi, about 128 KiB */
+#define CONV_BLOCK (32 * 1024)
+
+
+/* y[j] += s * x[j] for every 0 <= j < n */
+static void axpy(LINALG_SCALAR *restrict y, const LINALG_SCALAR *restrict x,
+        LINALG_SCALAR s, int n) {
+    int j;
+    for (j = 0; j < n; j++) {
+        y[j] += s * x[j];
+    }
+}
+
+
+/* Writes into *n and *pad the length of the result and the padding
+ * before the data, for data of length len and a kernel of length k.
+ * Returns nonzero for an unknown mode. */
+static int out_dim(int len, int k, int mode, int *n, int *pad) {
+    switch (mode) {
+        case LACONV_VALID:
+            *pad = 0;
+            *n = len - k + 1;
+            return 0;
+        case LACONV_SAME:
+            *pad = (k - 1) / 2;
+            *n = len;
+            return 0;
+        case LACONV_FULL:
+            *pad = k - 1;
+            *n = len + k - 1;
+            return 0;
+    }
+    return 1;
+}
+
+
+/* out = valid correlation of x, rows ldx elements apart, with the
+ * kh x kw kernel k, for an oh x ow out. Every element sums its kh * kw
+ * products in one go, so with constant kh and kw the loop over j is
+ * vectorized with all of them unrolled. Always inlined, like
+ * gemv_block. */
+static inline __attribute__((always_inline)) void direct_fixed(
+        const LINALG_SCALAR *restrict x, int ldx,
+        const LINALG_SCALAR *restrict k, LINALG_SCALAR *restrict out,
+        int oh, int ow, const int kh, const int kw) {
+    const LINALG_SCALAR *row;
+    LINALG_SCALAR s;
+    int i, j, a, b;
+
+    for (i = 0; i < oh; i++) {
+        row = x + (size_t)i * ldx;
+        for (j = 0; j < ow; j++) {
+            s = 0;
+            for (a = 0; a < kh; a++) {
+                for (b = 0; b < kw; b++) {
+                    s += k[a * kw + b] * row[(size_t)a * ldx + j + b];
+                }
+            }
+            out[(size_t)i * ow + j] = s;
+        }
+    }
+}
+
+
+/* Same as direct_fixed for any kernel: one pass over every row of out
+ * per element of the kernel, which keeps the same order of summation. */
+static void direct_any(const LINALG_SCALAR *x, int ldx,
+        const LINALG_SCALAR *k, LINALG_SCALAR *out,
+        int oh, int ow, int kh, int kw) {
+    LINALG_SCALAR *row;
+    int i, a, b;
+
+    for (i = 0; i < oh; i++) {
+        row = out + (size_t)i * ow;
+        memset(row, 0, ow * sizeof(*row));
+        for (a = 0; a < kh; a++) {
+            for (b = 0; b < kw; b++) {
+                axpy(row, x + (size_t)(i + a) * ldx + b, k[a * kw + b], ow);
+            }
+        }
+    }
+}
+
+
+/* Correlation of the h x w image x with the kh x kw kernel k, into an
+ * out of oh x ow. The image is first copied into a zero-padded buffer
+ * when the mode pads it. */
+static void correlate(const LINALG_SCALAR *x, int h, int w,
+        const LINALG_SCALAR *k, int kh, int kw, int ph, int pw,
+        LINALG_SCALAR *out, int oh, int ow) {
+    LINALG_SCALAR *padded = NULL;
+    int ldx, i;
+
+    ldx = w;
+    if (ph != 0 || pw != 0 || oh + kh - 1 > h || ow + kw - 1 > w) {
+        ldx = ow + kw - 1;
+        padded = calloc((size_t)(oh + kh - 1) * ldx, sizeof(*padded));
+        for (i = 0; i < h; i++) {
+            memcpy(padded + (size_t)(i + ph) * ldx + pw, x + (size_t)i * w,
+                    w * sizeof(*x));
+        }
+        x = padded;
+    }
+
+    if (kh == 3 && kw == 3) {
+        direct_fixed(x, ldx, k, out, oh, ow, 3, 3);
+    } else if (kh == 5 && kw == 5) {
+        direct_fixed(x, ldx, k, out, oh, ow, 5, 5);
+    } else if (kh == 1 && kw == 3) {
+        direct_fixed(x, ldx, k, out, oh, ow, 1, 3);
+    } else if (kh == 1 && kw == 5) {
+        direct_fixed(x, ldx, k, out, oh, ow, 1, 5);
+    } else {
+        direct_any(x, ldx, k, out, oh, ow, kh, kw);
+    }
+
+    free(padded);
+}
+
+
+/* m itself if row-major, else a row-major copy left in *tmp */
+static const matrix *row_major(const matrix *m, matrix **tmp) {
+    *tmp = NULL;
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        return m;
+    }
+    mat_dup(tmp, m);
+    mat_set_layout(*tmp, LAMAT_ROW_MAJOR);
+    return *tmp;
+}
+
+
+int conv_1d(const vector *x, const vector *k, int mode, vector *out) {
+    LINALG_SCALAR *data;
+    int n, pad;
+
+    if (out_dim(x->dim, k->dim, mode, &n, &pad) != 0) {
+        return LACONV_INVALID;
+    }
+    if (k->dim < 1 || n < 1) {
+        return LACONV_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(n * sizeof(*data));
+    correlate(x->data, 1, x->dim, k->data, 1, k->dim, 0, pad, data, 1, n);
+
+    data_free(out->data);
+    out->data = data;
+    out->dim = n;
+    return 0;
+}
+
+
+int conv_1d_(vector *x, const vector *k, int mode) {
+    return conv_1d(x, k, mode, x);
+}
+
+
+int conv_2d(const matrix *x, const matrix *k, int mode, matrix *out) {
+    LINALG_SCALAR *data;
+    matrix *tx, *tk;
+    int oh, ow, ph, pw;
+
+    if (out_dim(x->rows, k->rows, mode, &oh, &ph) != 0) {
+        return LACONV_INVALID;
+    }
+    out_dim(x->cols, k->cols, mode, &ow, &pw);
+    if (k->rows < 1 || k->cols < 1 || oh < 1 || ow < 1) {
+        return LACONV_INCOMPATIBLE_DIM;
+    }
+
+    x = row_major(x, &tx);
+    k = row_major(k, &tk);
+    data = data_alloc((size_t)oh * ow * sizeof(*data));
+    correlate(x->data, x->rows, x->cols, k->data, k->rows, k->cols,
+            ph, pw, data, oh, ow);
+    if (tx != NULL) {
+        mat_del(tx);
+    }
+    if (tk != NULL) {
+        mat_del(tk);
+    }
+
+    data_free(out->data);
+    out->data = data;
+    out->rows = oh;
+    out->cols = ow;
+    out->layout = LAMAT_ROW_MAJOR;
+    return 0;
+}
+
+
+int conv_2d_(matrix *x, const matrix *k, int mode) {
+    return conv_2d(x, k, mode, x);
+}
+
+
+/* Writes into b, rows ldb elements apart, the columns p0 to p0 + n - 1
+ * of the patch matrix of x: row (ch * kh + a) * kw + c holds, for every
+ * output pixel (i, j), the element (i + a - ph, j + c - pw) of channel
+ * ch, or zero outside the image. Output rows are ow pixels long. */
+static void im2col(const LINALG_SCALAR *x, int chans, int h, int w,
+        int kh, int kw, int ph, int pw, int ow, int p0, int n,
+        LINALG_SCALAR *b, int ldb) {
+    const LINALG_SCALAR *src;
+    LINALG_SCALAR *row;
+    int ch, a, c, t, i, j, y, x0, run, lo, hi;
+
+    for (ch = 0; ch < chans; ch++) {
+        for (a = 0; a < kh; a++) {
+            for (c = 0; c < kw; c++) {
+                row = b + (size_t)((ch * kh + a) * kw + c) * ldb;
+                /* A run of output pixels within one output row reads
+                 * a run of one row of the image */
+                for (t = 0; t < n; t += run) {
+                    i = (p0 + t) / ow;
+                    j = (p0 + t) % ow;
+                    run = ow - j < n - t ? ow - j : n - t;
+                    y = i + a - ph;
+                    if (y < 0 || y >= h) {
+                        memset(row + t, 0, run * sizeof(*row));
+                        continue;
+                    }
+                    src = x + ((size_t)ch * h + y) * w;
+                    x0 = j + c - pw;
+                    lo = x0 < 0 ? (-x0 < run ? -x0 : run) : 0;
+                    hi = w - x0 < run ? w - x0 : run;
+                    hi = hi < lo ? lo : hi;
+                    memset(row + t, 0, lo * sizeof(*row));
+                    memcpy(row + t + lo, src + x0 + lo,
+                            (hi - lo) * sizeof(*row));
+                    memset(row + t + hi, 0, (run - hi) * sizeof(*row));
+                }
+            }
+        }
+    }
+}
+
+
+int conv_multi(const matrix *x, int h, int w, const matrix *filters,
+        int kh, int kw, int mode, matrix *out) {
+    LINALG_SCALAR *data, *b;
+    matrix *tx, *tf;
+    int oh, ow, ph, pw, ck, pixels, block, p0, n;
+    const struct linalg_tuning *t;
+
+    if (out_dim(h, kh, mode, &oh, &ph) != 0) {
+        return LACONV_INVALID;
+    }
+    out_dim(w, kw, mode, &ow, &pw);
+    ck = x->rows * kh * kw;
+    if (kh < 1 || kw < 1 || oh < 1 || ow < 1 || x->cols != h * w
+            || filters->cols != ck) {
+        return LACONV_INCOMPATIBLE_DIM;
+    }
+
+    /* out = filters * patches, the patches a block of pixels at a time */
+    pixels = oh * ow;
+    block = CONV_BLOCK / ck;
+    block = block < 16 ? 16 : block;
+    block = block > pixels ? pixels : block;
+
+    x = row_major(x, &tx);
+    filters = row_major(filters, &tf);
+    t = tune_params();
+    data = data_alloc((size_t)filters->rows * pixels * sizeof(*data));
+    b = malloc((size_t)ck * block * sizeof(*b));
+    for (p0 = 0; p0 < pixels; p0 += block) {
+        n = p0 + block < pixels ? block : pixels - p0;
+        im2col(x->data, x->rows, h, w, kh, kw, ph, pw, ow, p0, n, b, block);
+        kern_gemm_ld(filters->data, ck, b, block, data + p0, pixels,
+                filters->rows, ck, n, t);
+    }
+    free(b);
+    out->rows = filters->rows;
+    if (tx != NULL) {
+        mat_del(tx);
+    }
+    if (tf != NULL) {
+        mat_del(tf);
+    }
+
+    data_free(out->data);
+    out->data = data;
+    out->cols = pixels;
+    out->layout = LAMAT_ROW_MAJOR;
+    return 0;
+}
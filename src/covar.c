@@ -0,0 +1,201 @@
+#include "covar.h"
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Samples per block when cov_new is given 0 */
+#define COV_BLOCK 128
+
+
+struct covar {
+    LINALG_SCALAR *block;       /* pending samples, by rows */
+    LINALG_SCALAR *bmean;       /* mean of the pending samples */
+    LINALG_SCALAR *mean;        /* mean of the samples flushed */
+    matrix *m2;                 /* sum of their outer products about it */
+    long long n;                /* samples flushed */
+    int pending;
+    int cap;
+    int dim;
+};
+
+
+/* Adds the pending samples to the running totals. */
+static void flush(covar *c) {
+    int i, j, b, dim;
+    long long total;
+    LINALG_SCALAR *row;
+    matrix rows;
+    vector delta;
+
+    b = c->pending;
+    dim = c->dim;
+    if (b == 0) {
+        return;
+    }
+
+    memset(c->bmean, 0, dim * sizeof(*c->bmean));
+    for (i = 0, row = c->block; i < b; i++, row += dim) {
+        for (j = 0; j < dim; j++) {
+            c->bmean[j] += row[j];
+        }
+    }
+    for (j = 0; j < dim; j++) {
+        c->bmean[j] /= b;
+    }
+    for (i = 0, row = c->block; i < b; i++, row += dim) {
+        for (j = 0; j < dim; j++) {
+            row[j] -= c->bmean[j];
+        }
+    }
+
+    /* The merge term first: mat_syrk leaves m2 exactly symmetric */
+    total = c->n + b;
+    for (j = 0; j < dim; j++) {
+        c->bmean[j] -= c->mean[j];
+    }
+    delta.data = c->bmean;
+    delta.dim = dim;
+    mat_ger(c->m2, (LINALG_SCALAR)((double)c->n * b / total),
+            &delta, &delta);
+
+    rows.data = c->block;
+    rows.rows = b;
+    rows.cols = dim;
+    rows.layout = LAMAT_ROW_MAJOR;
+    mat_syrk(c->m2, 1, &rows);
+
+    for (j = 0; j < dim; j++) {
+        c->mean[j] += c->bmean[j] * ((LINALG_SCALAR)b / total);
+    }
+    c->n = total;
+    c->pending = 0;
+}
+
+
+int cov_new(covar **out, int dim, int block) {
+    covar *c;
+
+    c = malloc(sizeof(*c));
+    c->dim = dim;
+    c->cap = block > 0 ? block : COV_BLOCK;
+    c->block = data_alloc((size_t)c->cap * dim * sizeof(*c->block));
+    c->bmean = data_alloc(dim * sizeof(*c->bmean));
+    c->mean = data_alloc(dim * sizeof(*c->mean));
+    mat_zero(&c->m2, dim, dim);
+    cov_reset(c);
+
+    *out = c;
+    return 0;
+}
+
+
+int cov_del(covar *c) {
+    data_free(c->block);
+    data_free(c->bmean);
+    data_free(c->mean);
+    mat_del(c->m2);
+    free(c);
+    return 0;
+}
+
+
+int cov_reset(covar *c) {
+    LINALG_SCALAR *data;
+
+    /* Outputs of cov_covar and cov_gram share m2's storage until
+     * written */
+    data = data_own(c->m2->data, 1);
+    if (data == NULL && c->dim > 0) {
+        return LACOV_ALLOC;
+    }
+    c->m2->data = data;
+    memset(c->mean, 0, c->dim * sizeof(*c->mean));
+    memset(c->m2->data, 0, (size_t)c->dim * c->dim * sizeof(*c->m2->data));
+    c->n = 0;
+    c->pending = 0;
+    return 0;
+}
+
+
+int cov_add(covar *c, const vector *x) {
+    if (x->dim != c->dim) {
+        return LACOV_INCOMPATIBLE_DIM;
+    }
+
+    memcpy(c->block + (size_t)c->pending * c->dim, x->data,
+            c->dim * sizeof(*x->data));
+    if (++c->pending == c->cap) {
+        flush(c);
+    }
+    return 0;
+}
+
+
+int cov_add_mat(covar *c, const matrix *m) {
+    int i, j0, w, ld;
+    LINALG_SCALAR *row;
+
+    if (m->cols != c->dim) {
+        return LACOV_INCOMPATIBLE_DIM;
+    }
+
+    for (i = 0; i < m->rows; i++) {
+        row = c->block + (size_t)c->pending * c->dim;
+        for (j0 = 0; j0 < m->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < m->cols ? LAMAT_TILE : m->cols - j0;
+            memcpy(row + j0, mat_at(m, i, j0, &ld), w * sizeof(*row));
+        }
+        if (++c->pending == c->cap) {
+            flush(c);
+        }
+    }
+    return 0;
+}
+
+
+int cov_count(const covar *c, long long *n) {
+    *n = c->n + c->pending;
+    return 0;
+}
+
+
+int cov_mean(covar *c, vector *out) {
+    flush(c);
+    if (c->n < 1) {
+        return LACOV_EMPTY;
+    }
+
+    out->data = data_realloc(out->data, c->dim * sizeof(*out->data));
+    out->dim = c->dim;
+    memcpy(out->data, c->mean, c->dim * sizeof(*out->data));
+    return 0;
+}
+
+
+int cov_covar(covar *c, matrix *out) {
+    flush(c);
+    if (c->n < 2) {
+        return LACOV_EMPTY;
+    }
+
+    mat_cpy(out, c->m2);
+    mat_sdiv_(out, (LINALG_SCALAR)(c->n - 1));
+    return 0;
+}
+
+
+int cov_gram(covar *c, matrix *out) {
+    matrix mean;
+
+    flush(c);
+    mat_cpy(out, c->m2);
+    /* n * mean * mean^T, as a rank-1 mat_syrk to stay symmetric */
+    mean.data = c->mean;
+    mean.rows = 1;
+    mean.cols = c->dim;
+    mean.layout = LAMAT_ROW_MAJOR;
+    mat_syrk(out, (LINALG_SCALAR)c->n, &mean);
+    return 0;
+}
@@ -0,0 +1,593 @@
+#include "dmatrix.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+
+struct linalg_comm {
+    struct linalg_transport t;
+    int prows;      /* p x q grid */
+    int pcols;
+    int prow;       /* position of this process in it */
+    int pcol;
+};
+
+struct dmatrix {
+    linalg_comm *comm;
+    matrix *local;
+    int rows;
+    int cols;
+    int nb;
+};
+
+/* The parts of a and b for step k of dmat_mul, and the result of
+ * their exchange */
+struct panel {
+    const dmatrix *a;
+    const dmatrix *b;
+    int k;
+    LINALG_SCALAR *pa;
+    LINALG_SCALAR *pb;
+    int err;
+};
+
+
+/* Seconds linalg_comm_connect waits for a process to listen */
+#define CONNECT_TIMEOUT 60
+
+
+/* Sockets of linalg_comm_connect, one per other process */
+struct sock_ctx {
+    int size;
+    int *fds;
+};
+
+
+static int sock_send(void *ctx, int to, const void *buf, size_t len) {
+    struct sock_ctx *s = ctx;
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(s->fds[to], p, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+static int sock_recv(void *ctx, int from, void *buf, size_t len) {
+    struct sock_ctx *s = ctx;
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = recv(s->fds[from], p, len, 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n == 0) {
+                errno = ECONNRESET;
+            }
+            return 1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+
+static void sock_close(void *ctx) {
+    struct sock_ctx *s = ctx;
+    int i;
+
+    for (i = 0; i < s->size; i++) {
+        if (s->fds[i] >= 0) {
+            close(s->fds[i]);
+        }
+    }
+    free(s->fds);
+    free(s);
+}
+
+
+/* Connects to the socket at addr, retrying while nobody listens yet.
+ * Returns the socket, or -1. */
+static int connect_retry(const struct sockaddr_un *addr) {
+    struct timespec pause = {0, 10 * 1000 * 1000};
+    time_t start = time(NULL);
+    int fd;
+
+    for (;;) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) {
+            return -1;
+        }
+        if (connect(fd, (const struct sockaddr *)addr, sizeof(*addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        if ((errno != ENOENT && errno != ECONNREFUSED)
+                || time(NULL) - start > CONNECT_TIMEOUT) {
+            return -1;
+        }
+        nanosleep(&pause, NULL);
+    }
+}
+
+
+int linalg_comm_new(linalg_comm **out, const struct linalg_transport *t) {
+    linalg_comm *c;
+    int p;
+
+    if (t->size < 1 || t->rank < 0 || t->rank >= t->size) {
+        return LADMAT_INVALID;
+    }
+
+    /* The grid is p x q with the largest p <= sqrt(size) that divides it */
+    for (p = 1; (p + 1) * (p + 1) <= t->size; p++);
+    while (t->size % p != 0) {
+        p--;
+    }
+    c = malloc(sizeof(*c));
+    c->t = *t;
+    c->prows = p;
+    c->pcols = t->size / p;
+    c->prow = t->rank / c->pcols;
+    c->pcol = t->rank % c->pcols;
+    *out = c;
+    return 0;
+}
+
+
+int linalg_comm_connect(linalg_comm **out, const char *path, int rank,
+        int size) {
+    struct linalg_transport t;
+    struct sockaddr_un addr;
+    struct sock_ctx *s;
+    int lfd = -1, fd, i, peer, err;
+
+    if (rank < 0 || rank >= size
+            || strlen(path) + 12 > sizeof(addr.sun_path)) {
+        return LADMAT_INVALID;
+    }
+
+    s = malloc(sizeof(*s));
+    s->size = size;
+    s->fds = malloc(size * sizeof(*s->fds));
+    for (i = 0; i < size; i++) {
+        s->fds[i] = -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    /* Listens first, so that higher ranks can connect before
+     * being accepted */
+    if (rank < size - 1) {
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%d", path, rank);
+        unlink(addr.sun_path);
+        lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (lfd < 0 || bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+                || listen(lfd, size) != 0) {
+            goto fail;
+        }
+    }
+    for (i = 0; i < rank; i++) {
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%d", path, i);
+        s->fds[i] = connect_retry(&addr);
+        if (s->fds[i] < 0 || sock_send(s, i, &rank, sizeof(rank)) != 0) {
+            goto fail;
+        }
+    }
+    for (i = rank + 1; i < size; i++) {
+        fd = accept(lfd, NULL, NULL);
+        if (fd < 0) {
+            goto fail;
+        }
+        if (recv(fd, &peer, sizeof(peer), MSG_WAITALL) != sizeof(peer)
+                || peer <= rank || peer >= size || s->fds[peer] >= 0) {
+            close(fd);
+            errno = EPROTO;
+            goto fail;
+        }
+        s->fds[peer] = fd;
+    }
+    if (lfd >= 0) {
+        close(lfd);
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%d", path, rank);
+        unlink(addr.sun_path);
+    }
+
+    t.rank = rank;
+    t.size = size;
+    t.ctx = s;
+    t.send = sock_send;
+    t.recv = sock_recv;
+    t.close = sock_close;
+    return linalg_comm_new(out, &t);
+
+fail:
+    err = errno;
+    if (lfd >= 0) {
+        close(lfd);
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s.%d", path, rank);
+        unlink(addr.sun_path);
+    }
+    sock_close(s);
+    errno = err;
+    return LADMAT_COMM;
+}
+
+
+int linalg_comm_del(linalg_comm *c) {
+    if (c->t.close != NULL) {
+        c->t.close(c->t.ctx);
+    }
+    free(c);
+    return 0;
+}
+
+
+int linalg_comm_rank(const linalg_comm *c, int *rank, int *size) {
+    if (rank != NULL) {
+        *rank = c->t.rank;
+    }
+    if (size != NULL) {
+        *size = c->t.size;
+    }
+    return 0;
+}
+
+
+/* Messages of len elements, none at all when empty */
+static int send_to(const linalg_comm *c, int to, const LINALG_SCALAR *buf,
+        size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    return c->t.send(c->t.ctx, to, buf, len * sizeof(*buf)) != 0;
+}
+
+
+static int recv_from(const linalg_comm *c, int from, LINALG_SCALAR *buf,
+        size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    return c->t.recv(c->t.ctx, from, buf, len * sizeof(*buf)) != 0;
+}
+
+
+/* Number of the n rows or columns in blocks of nb, dealt over procs
+ * processes, that process p holds */
+static int local_len(int n, int nb, int p, int procs) {
+    int blocks, len;
+
+    blocks = (n + nb - 1) / nb;
+    len = (blocks / procs + (p < blocks % procs)) * nb;
+    /* The last block may be short */
+    if (blocks > 0 && (blocks - 1) % procs == p) {
+        len -= blocks * nb - n;
+    }
+    return len;
+}
+
+
+/* Global index of the local row or column l of process p */
+static int to_global(int l, int nb, int p, int procs) {
+    return (l / nb * procs + p) * nb + l % nb;
+}
+
+
+int dmat_new(dmatrix **out, linalg_comm *c, int rows, int cols, int nb) {
+    dmatrix *d;
+
+    if (rows < 0 || cols < 0 || nb < 1) {
+        return LADMAT_INVALID;
+    }
+
+    d = malloc(sizeof(*d));
+    d->comm = c;
+    d->rows = rows;
+    d->cols = cols;
+    d->nb = nb;
+    mat_zero(&d->local, local_len(rows, nb, c->prow, c->prows),
+            local_len(cols, nb, c->pcol, c->pcols));
+    *out = d;
+    return 0;
+}
+
+
+int dmat_del(dmatrix *d) {
+    mat_del(d->local);
+    free(d);
+    return 0;
+}
+
+
+int dmat_dim(const dmatrix *d, int *rows, int *cols, int *nb) {
+    if (rows != NULL) {
+        *rows = d->rows;
+    }
+    if (cols != NULL) {
+        *cols = d->cols;
+    }
+    if (nb != NULL) {
+        *nb = d->nb;
+    }
+    return 0;
+}
+
+
+matrix *dmat_local(const dmatrix *d) {
+    return d->local;
+}
+
+
+/* Copies between the row-major rows x cols matrix g, rows ldg elements
+ * apart, and the local part l of the process at (pr, pc), in the
+ * direction given by to_local. Columns are copied a block at a time. */
+static void copy_part(const dmatrix *d, LINALG_SCALAR *g, int ldg,
+        LINALG_SCALAR *l, int pr, int pc, int to_local) {
+    const linalg_comm *c = d->comm;
+    LINALG_SCALAR *pg, *pl;
+    int lr, lc, i, j, w;
+
+    lr = local_len(d->rows, d->nb, pr, c->prows);
+    lc = local_len(d->cols, d->nb, pc, c->pcols);
+    for (i = 0; i < lr; i++) {
+        for (j = 0; j < lc; j += d->nb) {
+            w = j + d->nb < lc ? d->nb : lc - j;
+            pg = g + (size_t)to_global(i, d->nb, pr, c->prows) * ldg
+                + to_global(j, d->nb, pc, c->pcols);
+            pl = l + (size_t)i * lc + j;
+            if (to_local) {
+                memcpy(pl, pg, w * sizeof(*pl));
+            } else {
+                memcpy(pg, pl, w * sizeof(*pl));
+            }
+        }
+    }
+}
+
+
+/* Elements of the local part of the process at (pr, pc) */
+static size_t part_len(const dmatrix *d, int pr, int pc) {
+    const linalg_comm *c = d->comm;
+
+    return (size_t)local_len(d->rows, d->nb, pr, c->prows)
+        * local_len(d->cols, d->nb, pc, c->pcols);
+}
+
+
+int dmat_scatter(dmatrix *d, const matrix *m, int root) {
+    const linalg_comm *c = d->comm;
+    LINALG_SCALAR *buf;
+    matrix *tmp = NULL;
+    int r, pr, pc, err = 0;
+
+    if (root < 0 || root >= c->t.size) {
+        return LADMAT_INVALID;
+    }
+    /* The local part may share its storage with a duplicate */
+    d->local->data = data_own(d->local->data, 1);
+    if (c->t.rank != root) {
+        return recv_from(c, root, d->local->data,
+                part_len(d, c->prow, c->pcol)) ? LADMAT_COMM : 0;
+    }
+    if (m->rows != d->rows || m->cols != d->cols) {
+        return LADMAT_INCOMPATIBLE_DIM;
+    }
+
+    if (m->layout != LAMAT_ROW_MAJOR) {
+        mat_dup(&tmp, m);
+        mat_set_layout(tmp, LAMAT_ROW_MAJOR);
+        m = tmp;
+    }
+    /* Process 0 holds the largest part */
+    buf = malloc(part_len(d, 0, 0) * sizeof(*buf));
+    for (r = 0; r < c->t.size && err == 0; r++) {
+        pr = r / c->pcols;
+        pc = r % c->pcols;
+        if (r == root) {
+            copy_part(d, m->data, m->cols, d->local->data, pr, pc, 1);
+            continue;
+        }
+        copy_part(d, m->data, m->cols, buf, pr, pc, 1);
+        err = send_to(c, r, buf, part_len(d, pr, pc));
+    }
+    free(buf);
+    if (tmp != NULL) {
+        mat_del(tmp);
+    }
+    return err ? LADMAT_COMM : 0;
+}
+
+
+int dmat_gather(const dmatrix *d, matrix *m, int root) {
+    const linalg_comm *c = d->comm;
+    LINALG_SCALAR *buf;
+    int r, pr, pc, err = 0;
+
+    if (root < 0 || root >= c->t.size) {
+        return LADMAT_INVALID;
+    }
+    if (c->t.rank != root) {
+        return send_to(c, root, d->local->data,
+                part_len(d, c->prow, c->pcol)) ? LADMAT_COMM : 0;
+    }
+
+    m->data = data_realloc(m->data,
+            (size_t)d->rows * d->cols * sizeof(*m->data));
+    m->rows = d->rows;
+    m->cols = d->cols;
+    m->layout = LAMAT_ROW_MAJOR;
+    /* Process 0 holds the largest part */
+    buf = malloc(part_len(d, 0, 0) * sizeof(*buf));
+    for (r = 0; r < c->t.size && err == 0; r++) {
+        pr = r / c->pcols;
+        pc = r % c->pcols;
+        if (r == root) {
+            copy_part(d, m->data, m->cols, d->local->data, pr, pc, 0);
+            continue;
+        }
+        err = recv_from(c, r, buf, part_len(d, pr, pc));
+        copy_part(d, m->data, m->cols, buf, pr, pc, 0);
+    }
+    free(buf);
+    return err ? LADMAT_COMM : 0;
+}
+
+
+/* Step p->k of dmat_mul: the owners of block column k of a copy their
+ * part of it into p->pa and send it along their row of the grid, then
+ * the owners of block row k of b do the same with p->pb along their
+ * column; the other processes receive them. Every process goes through
+ * the steps in the same order and, within a step, sends or receives
+ * only along its row, then only along its column, so no two processes
+ * can wait on each other. */
+static int exchange(struct panel *p) {
+    const linalg_comm *c = p->a->comm;
+    const matrix *la = p->a->local, *lb = p->b->local;
+    int nb, kb, owner, off, i, err = 0;
+
+    nb = p->a->nb;
+    kb = p->k * nb + nb < p->a->cols ? nb : p->a->cols - p->k * nb;
+
+    owner = p->k % c->pcols;
+    if (c->pcol == owner) {
+        off = p->k / c->pcols * nb;
+        for (i = 0; i < la->rows; i++) {
+            memcpy(p->pa + (size_t)i * kb, la->data + (size_t)i * la->cols
+                    + off, kb * sizeof(*p->pa));
+        }
+        for (i = 0; i < c->pcols && err == 0; i++) {
+            if (i != owner) {
+                err = send_to(c, c->prow * c->pcols + i, p->pa,
+                        (size_t)la->rows * kb);
+            }
+        }
+    } else {
+        err = recv_from(c, c->prow * c->pcols + owner, p->pa,
+                (size_t)la->rows * kb);
+    }
+    if (err != 0) {
+        return err;
+    }
+
+    owner = p->k % c->prows;
+    if (c->prow == owner) {
+        off = p->k / c->prows * nb;
+        memcpy(p->pb, lb->data + (size_t)off * lb->cols,
+                (size_t)kb * lb->cols * sizeof(*p->pb));
+        for (i = 0; i < c->prows && err == 0; i++) {
+            if (i != owner) {
+                err = send_to(c, i * c->pcols + c->pcol, p->pb,
+                        (size_t)kb * lb->cols);
+            }
+        }
+    } else {
+        err = recv_from(c, owner * c->pcols + c->pcol, p->pb,
+                (size_t)kb * lb->cols);
+    }
+    return err;
+}
+
+
+static void *exchange_thread(void *arg) {
+    struct panel *p = arg;
+
+    p->err = exchange(p);
+    return NULL;
+}
+
+
+int dmat_mul(const dmatrix *a, const dmatrix *b, dmatrix *out) {
+    const struct linalg_tuning *t;
+    struct panel p[2];
+    LINALG_SCALAR *bufs;
+    matrix *lc;
+    pthread_t thread;
+    int nb, steps, k, kb, next, started, err = 0;
+
+    if (a->comm != b->comm || a->comm != out->comm || a->nb != b->nb
+            || a->nb != out->nb || out == a || out == b) {
+        return LADMAT_INVALID;
+    }
+    if (a->cols != b->rows) {
+        return LADMAT_INCOMPATIBLE_DIM;
+    }
+
+    nb = a->nb;
+    lc = out->local;
+    if (out->rows != a->rows || out->cols != b->cols) {
+        mat_del(out->local);
+        mat_zero(&out->local, a->local->rows, b->local->cols);
+        lc = out->local;
+        out->rows = a->rows;
+        out->cols = b->cols;
+    } else {
+        lc->data = data_own(lc->data, 1);
+        memset(lc->data, 0, (size_t)lc->rows * lc->cols * sizeof(*lc->data));
+    }
+
+    /* Two sets of parts: one multiplied, the other on its way */
+    bufs = malloc(2 * ((size_t)lc->rows + lc->cols) * nb * sizeof(*bufs));
+    for (k = 0; k < 2; k++) {
+        p[k].a = a;
+        p[k].b = b;
+        p[k].pa = bufs + k * ((size_t)lc->rows + lc->cols) * nb;
+        p[k].pb = p[k].pa + (size_t)lc->rows * nb;
+        p[k].err = 0;
+    }
+
+    t = tune_params();
+    steps = (a->cols + nb - 1) / nb;
+    if (steps > 0) {
+        p[0].k = 0;
+        err = exchange(&p[0]);
+    }
+    for (k = 0; k < steps && err == 0; k++) {
+        next = (k + 1) % 2;
+        started = 0;
+        if (k + 1 < steps) {
+            p[next].k = k + 1;
+            p[next].err = 0;
+            started = pthread_create(&thread, NULL, exchange_thread,
+                    &p[next]) == 0;
+        }
+
+        kb = k * nb + nb < a->cols ? nb : a->cols - k * nb;
+        if (lc->rows > 0 && lc->cols > 0) {
+            kern_gemm_acc_ld(p[k % 2].pa, kb, p[k % 2].pb, lc->cols,
+                    lc->data, lc->cols, lc->rows, kb, lc->cols, t);
+        }
+
+        if (started) {
+            pthread_join(thread, NULL);
+        } else if (k + 1 < steps) {
+            p[next].err = exchange(&p[next]);
+        }
+        err = p[next].err;
+    }
+
+    free(bufs);
+    return err ? LADMAT_COMM : 0;
+}
@@ -0,0 +1,282 @@
+#ifndef INTERNAL_H
+#define INTERNAL_H 1
+
+/* Declarations shared by the library's source files.
+ * Not part of the public interface. The layout of the opaque types
+ * is in exposed.h. */
+
+#include "exposed.h"
+#include "linalg.h"
+#include "matrix.h"
+#include "tune.h"
+
+#include <pthread.h>
+
+
+/* Kernel parameters in use. The first call loads them, see tune.h. */
+const struct linalg_tuning *tune_params(void);
+
+
+/* Storage of matrices and vectors, placed according to the policy set
+ * with linalg_numa_policy. Only these may allocate, resize or free the
+ * data of a matrix or vector.
+ *
+ * Buffers are reference counted, so that duplicates share them until
+ * one is written: data_free drops a reference, and data_realloc gives
+ * a buffer of its own to the caller if others hold references. */
+void *data_alloc(size_t len);
+void *data_realloc(void *p, size_t len);
+void data_free(void *p);
+
+/* Returns storage with the len bytes of src to replace dst, whose
+ * holder lets go of it: src itself, with one more reference, or if
+ * either is a buffer of data_wrap, a copy into dst resized with
+ * data_realloc. */
+void *data_copy(void *dst, void *src, size_t len);
+
+/* Returns p if its holder may write it, else a private copy of it,
+ * dropping the reference to p: when p is shared with other holders,
+ * or when writable is set and p is a read-only buffer of data_wrap.
+ * Every write in place must go through this first. */
+void *data_own(void *p, int writable);
+
+/* Every buffer of data_alloc is preceded by a header this large, which
+ * keeps the data aligned to a cache line. */
+#define DATA_HDR_BYTES 64
+
+/* Makes a buffer for data_realloc and data_free out of the len bytes at
+ * p, whose memory the caller manages, with DATA_HDR_BYTES writable and
+ * private bytes before p for the header. data_free then calls
+ * release(p). data_realloc keeps p for the same length if it is
+ * writable, and otherwise moves the data to new storage and releases p.
+ * Such buffers are never shared, see data_copy. Returns p. */
+void *data_wrap(void *p, size_t len, int readonly, void (*release)(void *));
+
+/* Pins thread to the CPUs of the given node.
+ * Returns nonzero on failure. */
+int numa_pin(pthread_t thread, int node);
+
+
+/* Splitting of loops between threads, see parallel.c */
+
+/* Body of part index of a loop, over lo <= i < hi */
+typedef void (*par_func)(void *ctx, int index, long lo, long hi);
+
+/* Smallest amount of data worth a thread of its own, in bytes moved */
+#define PAR_GRAIN_BYTES (1L << 21)
+
+/* Number of parts to split n iterations into, each at least grain
+ * of them, and at most one per online CPU. */
+int par_parts(long n, long grain);
+
+/* Runs f over 0 <= i < n split into parts contiguous ranges, and
+ * returns once all are done. The parts are shared between the calling
+ * thread and a pool of workers started on first use, one per online
+ * CPU and pinned over the NUMA nodes. The pool runs one loop at a
+ * time: while it is taken, by another thread or by the loop the call
+ * is made from, the caller runs every part itself, in order. */
+void par_for(long n, int parts, par_func f, void *ctx);
+
+
+/* Storage of matrices in either layout, see matrix.c.
+ * A tiled matrix stores its LAMAT_TILE x LAMAT_TILE tiles one after the
+ * other by rows of tiles, each tile row-major. Edge tiles are padded to
+ * full size; the padding holds undefined values that are never read
+ * back. In both layouts the elements of a row that share a tile are
+ * contiguous. */
+
+/* Number of elements stored for a rows x cols matrix in layout */
+size_t mat_len(int rows, int cols, int layout);
+
+/* Pointer to element (i, j) of m. *ld is set to the distance between
+ * rows within the tile holding it: the elements (i + r, j + c) of that
+ * tile are at r * *ld + c from the pointer. */
+LINALG_SCALAR *mat_at(const matrix *m, int i, int j, int *ld);
+
+/* out = m * v, with out holding m->rows elements. out must not
+ * overlap v. */
+void mat_gemv(const matrix *m, const LINALG_SCALAR *v, LINALG_SCALAR *out);
+
+/* out = v * m, with out holding m->cols elements. out must not
+ * overlap v. */
+void mat_gevm(const LINALG_SCALAR *v, const matrix *m, LINALG_SCALAR *out);
+
+
+/* Kernels on raw row-major arrays, see kernels.c */
+
+/* c = a * b, with a m x k and b k x n. c must not overlap a or b. */
+void kern_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n, const struct linalg_tuning *t);
+
+/* Same as kern_gemm, with rows of a, b and c lda, ldb and ldc
+ * elements apart. */
+void kern_gemm_ld(const LINALG_SCALAR *a, int lda, const LINALG_SCALAR *b,
+        int ldb, LINALG_SCALAR *c, int ldc, int m, int k, int n,
+        const struct linalg_tuning *t);
+
+/* Same as kern_gemm_ld, but adds a * b to c. */
+void kern_gemm_acc_ld(const LINALG_SCALAR *a, int lda,
+        const LINALG_SCALAR *b, int ldb, LINALG_SCALAR *c, int ldc,
+        int m, int k, int n, const struct linalg_tuning *t);
+
+/* c = a * b, with a, b and c n x n, by Strassen-Winograd recursion
+ * down to t->strassen_cutoff. c must not overlap a or b.
+ * Returns nonzero if its workspace could not be allocated. */
+int kern_strassen(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int n, const struct linalg_tuning *t);
+
+/* Same as kern_strassen, with a workspace of kern_strassen_len(n, t)
+ * elements given by the caller. */
+size_t kern_strassen_len(int n, const struct linalg_tuning *t);
+void kern_strassen_ws(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int n, LINALG_SCALAR *ws,
+        const struct linalg_tuning *t);
+
+/* out = m * v, with m rows x cols. out must not overlap m or v. */
+void kern_gemv(const LINALG_SCALAR *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols,
+        const struct linalg_tuning *t);
+
+/* Same as kern_gemv, with rows of m ld elements apart. */
+void kern_gemv_ld(const LINALG_SCALAR *m, int ld, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols,
+        const struct linalg_tuning *t);
+
+/* dst = transpose of src, with src rows x cols. */
+void kern_transpose(const LINALG_SCALAR *src, LINALG_SCALAR *dst,
+        int rows, int cols, const struct linalg_tuning *t);
+
+/* Reductions in the LASUM_PAIRWISE or LASUM_KAHAN mode, see
+ * summation.c */
+
+/* Mode set with linalg_sum_policy */
+int sum_policy(void);
+
+/* Sum of x[i] * y[i], x[i]^2 and (x[i] - y[i])^2 over 0 <= i < n */
+LINALG_SCALAR sum_dot(const LINALG_SCALAR *x, const LINALG_SCALAR *y,
+        int n, int mode);
+LINALG_SCALAR sum_sq(const LINALG_SCALAR *x, int n, int mode);
+LINALG_SCALAR sum_dist2(const LINALG_SCALAR *x, const LINALG_SCALAR *y,
+        int n, int mode);
+
+/* Same as kern_gemm, summing in the given mode.
+ * Returns nonzero if its workspace could not be allocated. */
+int sum_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n, int mode,
+        const struct linalg_tuning *t);
+
+/* Same as sum_gemm, with a workspace of sum_gemm_len(k, mode, t)
+ * elements given by the caller. */
+size_t sum_gemm_len(int k, int mode, const struct linalg_tuning *t);
+void sum_gemm_ws(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n, int mode,
+        LINALG_SCALAR *tmp, const struct linalg_tuning *t);
+
+/* Kernels generated for the shapes in SPEC_SHAPES, see spec.c.
+ * Each returns 1 if it handled the given shape and 0 otherwise,
+ * with the same aliasing rules as the kern_ functions above. */
+int spec_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n);
+int spec_gemv(const LINALG_SCALAR *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols);
+int spec_dot(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        int dim, LINALG_SCALAR *out);
+
+/* The kernel spec_gemm runs for the m x k by k x n product, or NULL if
+ * the shape has none. */
+typedef void (*spec_gemm_fn)(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c);
+spec_gemm_fn spec_gemm_find(int m, int k, int n);
+
+/* Calls into the CBLAS library of the backend set with linalg_backend,
+ * see backend.c. Each returns 1 if it handled the call and 0 if the
+ * native code should, with the same aliasing rules as the kern_
+ * functions above; blas_axpy and blas_scal work in place. */
+int blas_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n);
+/* out = m * v and out = v * m, with m rows x cols */
+int blas_gemv(const LINALG_SCALAR *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols);
+int blas_gevm(const LINALG_SCALAR *v, const LINALG_SCALAR *m,
+        LINALG_SCALAR *out, int rows, int cols);
+int blas_dot(const LINALG_SCALAR *x, const LINALG_SCALAR *y, int n,
+        LINALG_SCALAR *out);
+/* y += alpha * x and x *= alpha */
+int blas_axpy(LINALG_SCALAR alpha, const LINALG_SCALAR *x,
+        LINALG_SCALAR *y, size_t n);
+int blas_scal(LINALG_SCALAR alpha, LINALG_SCALAR *x, size_t n);
+
+/* Whether a call of the given work would go to the BLAS at present */
+int blas_used(long long work);
+
+
+/* Public functions tracked by the instrumentation layer */
+#define LINALG_OPS(X) \
+    X(mat_new) X(mat_alloc) X(mat_identity) X(mat_zero) X(mat_dup) \
+    X(mat_cpy) X(mat_del) X(mat_dim) X(mat_get_data) X(mat_set_data) \
+    X(mat_read) X(mat_write) X(mat_add) X(mat_add_) X(mat_sub) \
+    X(mat_sub_) X(mat_mul) X(mat_mul_) X(mat_mul_algo) \
+    X(mat_mul_policy) X(mat_pow) X(mat_pow_) X(mat_expm) X(mat_expm_) \
+    X(mat_ger) X(mat_syrk) X(mat_radd) X(mat_radd_) \
+    X(mat_rsub) X(mat_rsub_) X(mat_rmul) X(mat_rmul_) X(mat_rdiv) \
+    X(mat_rdiv_) X(mat_cadd) X(mat_cadd_) X(mat_csub) X(mat_csub_) \
+    X(mat_cmul) X(mat_cmul_) X(mat_cdiv) X(mat_cdiv_) X(mat_smul) \
+    X(mat_smul_) X(mat_sdiv) X(mat_sdiv_) X(mat_map) X(mat_map_) \
+    X(mat_transpose) X(mat_transpose_) X(mat_set_layout) \
+    X(mat_gather_rows) X(mat_scatter_rows) X(mat_permute_rows) \
+    X(mat_permute_cols) \
+    X(vec_new) X(vec_alloc) X(vec_basis) X(vec_zero) X(vec_dup) \
+    X(vec_cpy) X(vec_del) X(vec_dim) X(vec_get_data) X(vec_set_data) \
+    X(vec_norm) X(vec_norm2) X(vec_dist) X(vec_dist2) X(vec_norm2_sum) \
+    X(vec_dist2_sum) X(vec_read) X(vec_write) X(vec_add) X(vec_add_) \
+    X(vec_sub) X(vec_sub_) X(vec_dot) X(vec_dot_sum) X(vec_smul) \
+    X(vec_smul_) X(vec_sdiv) X(vec_sdiv_) X(vec_emul) X(vec_emul_) \
+    X(vec_map) X(vec_map_) X(vec_mmul_l) X(vec_mmul_l_) X(vec_mmul_r) \
+    X(vec_mmul_r_) X(vec_gather) X(vec_scatter)
+
+enum linalg_op {
+#define X(name) OP_##name,
+    LINALG_OPS(X)
+#undef X
+    OP_COUNT
+};
+
+
+/* Instrumentation hooks, see stats.h.
+ * STATS_OP must come right after a function's declarations; the frame it
+ * declares is closed automatically whenever the function returns.
+ * The other hooks charge their amount to the innermost open frame. */
+#ifdef LINALG_STATS
+
+struct stats_frame {
+    enum linalg_op op;
+    struct thread_stats *owner;
+    struct stats_frame *parent;
+    long long start_ns;
+    long long child_ns;
+    long long start_perf[2];
+};
+
+void stats_enter(struct stats_frame *f, enum linalg_op op);
+void stats_leave(struct stats_frame *f);
+void stats_alloc(long long bytes);
+void stats_copy(long long bytes);
+void stats_flops(long long n);
+
+#define STATS_OP(name) \
+    struct stats_frame stats_frame_ __attribute__((cleanup(stats_leave))); \
+    stats_enter(&stats_frame_, OP_##name)
+#define STATS_ALLOC(bytes) stats_alloc(bytes)
+#define STATS_COPY(bytes) stats_copy(bytes)
+#define STATS_FLOPS(n) stats_flops(n)
+
+#else
+
+#define STATS_OP(name) ((void)0)
+#define STATS_ALLOC(bytes) ((void)0)
+#define STATS_COPY(bytes) ((void)0)
+#define STATS_FLOPS(n) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+#include "internal.h"
+
+#include <string.h>
+
+/* Raw kernels on row-major arrays, parametrized by struct linalg_tuning.
+ * Dimension checks and allocation are left to the callers. */
+
+
+/* y[j] += s * x[j] for every 0 <= j < n */
+static void axpy(LINALG_SCALAR *restrict y, const LINALG_SCALAR *restrict x,
+        LINALG_SCALAR s, int n) {
+    int j;
+    for (j = 0; j < n; j++) {
+        y[j] += s * x[j];
+    }
+}
+
+
+void kern_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n, const struct linalg_tuning *t) {
+    kern_gemm_ld(a, k, b, n, c, n, m, k, n, t);
+}
+
+
+void kern_gemm_ld(const LINALG_SCALAR *a, int lda, const LINALG_SCALAR *b,
+        int ldb, LINALG_SCALAR *c, int ldc, int m, int k, int n,
+        const struct linalg_tuning *t) {
+    int i;
+
+    for (i = 0; i < m; i++) {
+        memset(c + (size_t)i * ldc, 0, n * sizeof(*c));
+    }
+    kern_gemm_acc_ld(a, lda, b, ldb, c, ldc, m, k, n, t);
+}
+
+
+void kern_gemm_acc_ld(const LINALG_SCALAR *a, int lda,
+        const LINALG_SCALAR *b, int ldb, LINALG_SCALAR *c, int ldc,
+        int m, int k, int n, const struct linalg_tuning *t) {
+    int i0, p0, j0, i, p;
+    int imax, pmax, jlen;
+    const LINALG_SCALAR *arow;
+    LINALG_SCALAR *crow;
+
+    /* Every c[i][j] still accumulates its products in
+     * increasing p order, as the unblocked loop would. */
+    for (i0 = 0; i0 < m; i0 += t->gemm_mc) {
+        imax = i0 + t->gemm_mc < m ? i0 + t->gemm_mc : m;
+        for (p0 = 0; p0 < k; p0 += t->gemm_kc) {
+            pmax = p0 + t->gemm_kc < k ? p0 + t->gemm_kc : k;
+            for (j0 = 0; j0 < n; j0 += t->gemm_nc) {
+                jlen = j0 + t->gemm_nc < n ? t->gemm_nc : n - j0;
+                for (i = i0; i < imax; i++) {
+                    arow = a + (size_t)i * lda;
+                    crow = c + (size_t)i * ldc + j0;
+                    for (p = p0; p < pmax; p++) {
+                        axpy(crow, b + (size_t)p * ldb + j0, arow[p], jlen);
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+/* Largest gemv_rows and gemv_lanes supported */
+#define GEMV_MAX_ROWS 4
+#define GEMV_MAX_LANES 16
+
+/* out[i] = m[i] . v for the rows in [i0, i1).
+ * Always inlined with constant rows and lanes, so that
+ * every variant gets its own fully unrolled loop nest. */
+static inline __attribute__((always_inline)) void gemv_block(
+        const LINALG_SCALAR *restrict m, const LINALG_SCALAR *restrict v,
+        LINALG_SCALAR *restrict out, int i0, int i1, int cols, int ld,
+        const int rows, const int lanes) {
+    LINALG_SCALAR acc[GEMV_MAX_ROWS][GEMV_MAX_LANES];
+    LINALG_SCALAR s;
+    int i, j, r, l;
+
+    for (i = i0; i + rows <= i1; i += rows) {
+        for (r = 0; r < rows; r++) {
+            for (l = 0; l < lanes; l++) {
+                acc[r][l] = 0;
+            }
+        }
+        for (j = 0; j + lanes <= cols; j += lanes) {
+            for (r = 0; r < rows; r++) {
+                for (l = 0; l < lanes; l++) {
+                    acc[r][l] += m[(size_t)(i + r) * ld + j + l] * v[j + l];
+                }
+            }
+        }
+        for (r = 0; r < rows; r++) {
+            s = 0;
+            for (l = 0; l < lanes; l++) {
+                s += acc[r][l];
+            }
+            for (l = j; l < cols; l++) {
+                s += m[(size_t)(i + r) * ld + l] * v[l];
+            }
+            out[i + r] = s;
+        }
+    }
+
+    /* Leftover rows */
+    for (; i < i1; i++) {
+        s = 0;
+        for (j = 0; j < cols; j++) {
+            s += m[(size_t)i * ld + j] * v[j];
+        }
+        out[i] = s;
+    }
+}
+
+
+#define GEMV_CASE(r, l) \
+    case r * 100 + l: \
+        gemv_block(m, v, out, 0, rows, cols, ld, r, l); \
+        break;
+
+void kern_gemv(const LINALG_SCALAR *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols,
+        const struct linalg_tuning *t) {
+    kern_gemv_ld(m, cols, v, out, rows, cols, t);
+}
+
+
+void kern_gemv_ld(const LINALG_SCALAR *m, int ld, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, int rows, int cols,
+        const struct linalg_tuning *t) {
+    switch (t->gemv_rows * 100 + t->gemv_lanes) {
+        GEMV_CASE(1, 1) GEMV_CASE(1, 4) GEMV_CASE(1, 8) GEMV_CASE(1, 16)
+        GEMV_CASE(2, 1) GEMV_CASE(2, 4) GEMV_CASE(2, 8) GEMV_CASE(2, 16)
+        GEMV_CASE(4, 1) GEMV_CASE(4, 4) GEMV_CASE(4, 8) GEMV_CASE(4, 16)
+        default:
+            gemv_block(m, v, out, 0, rows, cols, ld, 1, 1);
+            break;
+    }
+}
+
+#undef GEMV_CASE
+
+
+void kern_transpose(const LINALG_SCALAR *src, LINALG_SCALAR *dst,
+        int rows, int cols, const struct linalg_tuning *t) {
+    int i0, j0, i, j, imax, jmax;
+    int bs = t->transpose_block;
+
+    for (i0 = 0; i0 < rows; i0 += bs) {
+        imax = i0 + bs < rows ? i0 + bs : rows;
+        for (j0 = 0; j0 < cols; j0 += bs) {
+            jmax = j0 + bs < cols ? j0 + bs : cols;
+            for (i = i0; i < imax; i++) {
+                for (j = j0; j < jmax; j++) {
+                    dst[(size_t)j * rows + i] = src[(size_t)i * cols + j];
+                }
+            }
+        }
+    }
+}
@@ -1,25 +1,342 @@
 #include "matrix.h"
+#include "internal.h"
 
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
 
-struct matrix {
-    LINALG_SCALAR *data;
-    int rows;
-    int cols;
+/* Algorithm used by mat_mul and mat_mul_ */
+static atomic_int mul_policy = LAMAT_MUL_CLASSIC;
+
+/* Element-wise operations of the broadcasting kernels */
+enum bc_op {
+    BC_ADD,
+    BC_SUB,
+    BC_MUL,
+    BC_DIV
 };
 
+/* Number of tiles covering n rows or columns of a tiled matrix */
+#define TILES(n) (((n) + LAMAT_TILE - 1) / LAMAT_TILE)
+
+
+size_t mat_len(int rows, int cols, int layout) {
+    if (layout == LAMAT_TILED) {
+        return (size_t)TILES(rows) * TILES(cols) * LAMAT_TILE * LAMAT_TILE;
+    }
+    return (size_t)rows * cols;
+}
+
+
+LINALG_SCALAR *mat_at(const matrix *m, int i, int j, int *ld) {
+    size_t tile;
+
+    if (m->layout == LAMAT_TILED) {
+        tile = (size_t)(i / LAMAT_TILE) * TILES(m->cols) + j / LAMAT_TILE;
+        *ld = LAMAT_TILE;
+        return m->data + tile * LAMAT_TILE * LAMAT_TILE
+            + (i % LAMAT_TILE) * LAMAT_TILE + j % LAMAT_TILE;
+    }
+    *ld = m->cols;
+    return m->data + (size_t)i * m->cols + j;
+}
+
+
+/* A matrix header for data, to walk it with mat_at */
+static matrix view(LINALG_SCALAR *data, int rows, int cols, int layout) {
+    matrix m;
+
+    m.data = data;
+    m.rows = rows;
+    m.cols = cols;
+    m.layout = layout;
+    return m;
+}
+
+
+/* Gives m storage of its own, unshared and writable, before a write
+ * in place. If that takes a copy which cannot be allocated, m keeps
+ * its storage and LAMAT_ALLOC is returned. */
+static int own(matrix *m) {
+    LINALG_SCALAR *data;
+
+    /* Only empty matrices have no storage */
+    if (m->data == NULL) {
+        return 0;
+    }
+    data = data_own(m->data, 1);
+    if (data == NULL) {
+        return LAMAT_ALLOC;
+    }
+    m->data = data;
+    return 0;
+}
+
+
+/* Copies the elements of src into dst, which has the same dimensions
+ * and possibly another layout, one row of a tile at a time. */
+static void relayout(const matrix *dst, const matrix *src) {
+    int i0, j0, i, h, w, ldd, lds;
+    LINALG_SCALAR *d, *s;
+
+    for (i0 = 0; i0 < src->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < src->rows ? LAMAT_TILE : src->rows - i0;
+        for (j0 = 0; j0 < src->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < src->cols ? LAMAT_TILE : src->cols - j0;
+            d = mat_at(dst, i0, j0, &ldd);
+            s = mat_at(src, i0, j0, &lds);
+            for (i = 0; i < h; i++) {
+                memcpy(d + (size_t)i * ldd, s + (size_t)i * lds,
+                        w * sizeof(*d));
+            }
+        }
+    }
+}
+
+
+/* Writes s[j] op v[j] into d[j] for every 0 <= j < n.
+ * d may be the same array as s. */
+static void bc_vec(enum bc_op op, LINALG_SCALAR *d,
+        const LINALG_SCALAR *s, const LINALG_SCALAR *v, int n) {
+    int j;
+
+    switch (op) {
+        case BC_ADD:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] + v[j];
+            }
+            break;
+        case BC_SUB:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] - v[j];
+            }
+            break;
+        case BC_MUL:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] * v[j];
+            }
+            break;
+        case BC_DIV:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] / v[j];
+            }
+            break;
+    }
+}
+
+
+/* Writes s[j] op x into d[j] for every 0 <= j < n.
+ * d may be the same array as s. */
+static void bc_scal(enum bc_op op, LINALG_SCALAR *d,
+        const LINALG_SCALAR *s, LINALG_SCALAR x, int n) {
+    int j;
+
+    switch (op) {
+        case BC_ADD:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] + x;
+            }
+            break;
+        case BC_SUB:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] - x;
+            }
+            break;
+        case BC_MUL:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] * x;
+            }
+            break;
+        case BC_DIV:
+            for (j = 0; j < n; j++) {
+                d[j] = s[j] / x;
+            }
+            break;
+    }
+}
+
+
+/* a = a op b element-wise, for a and b in different layouts */
+static void ew_mixed(enum bc_op op, matrix *a, const matrix *b) {
+    int i0, j0, i, h, w, lda, ldb;
+    LINALG_SCALAR *pa, *pb;
+
+    for (i0 = 0; i0 < a->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < a->rows ? LAMAT_TILE : a->rows - i0;
+        for (j0 = 0; j0 < a->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < a->cols ? LAMAT_TILE : a->cols - j0;
+            pa = mat_at(a, i0, j0, &lda);
+            pb = mat_at(b, i0, j0, &ldb);
+            for (i = 0; i < h; i++) {
+                bc_vec(op, pa + (size_t)i * lda, pa + (size_t)i * lda,
+                        pb + (size_t)i * ldb, w);
+            }
+        }
+    }
+}
+
+
+/* c = a * b a tile at a time, for operands in any layout. Like
+ * kern_gemm, every element sums its products in increasing order
+ * of the inner index. */
+static void mul_tiles(const matrix *a, const matrix *b, const matrix *c,
+        const struct linalg_tuning *t) {
+    int i0, j0, p0, i, h, w, d, lda, ldb, ldc;
+    LINALG_SCALAR *pa, *pb, *pc;
+
+    for (i0 = 0; i0 < c->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < c->rows ? LAMAT_TILE : c->rows - i0;
+        for (j0 = 0; j0 < c->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < c->cols ? LAMAT_TILE : c->cols - j0;
+            pc = mat_at(c, i0, j0, &ldc);
+            for (i = 0; i < h; i++) {
+                memset(pc + (size_t)i * ldc, 0, w * sizeof(*pc));
+            }
+            for (p0 = 0; p0 < a->cols; p0 += LAMAT_TILE) {
+                d = p0 + LAMAT_TILE < a->cols ? LAMAT_TILE : a->cols - p0;
+                pa = mat_at(a, i0, p0, &lda);
+                pb = mat_at(b, p0, j0, &ldb);
+                kern_gemm_acc_ld(pa, lda, pb, ldb, pc, ldc, h, d, w, t);
+            }
+        }
+    }
+}
+
+
+/* dst = transpose of src, both tiled: every tile is transposed whole,
+ * padding included, into its mirror. */
+static void transpose_tiles(const matrix *src, const matrix *dst,
+        const struct linalg_tuning *t) {
+    int i0, j0, ld;
+
+    for (i0 = 0; i0 < src->rows; i0 += LAMAT_TILE) {
+        for (j0 = 0; j0 < src->cols; j0 += LAMAT_TILE) {
+            kern_transpose(mat_at(src, i0, j0, &ld),
+                    mat_at(dst, j0, i0, &ld), LAMAT_TILE, LAMAT_TILE, t);
+        }
+    }
+}
+
+
+/* Rows and lanes of the partial sums of gemv_tiles */
+#define GEMV_TILE_ROWS 4
+#define GEMV_TILE_LANES 8
+
+/* out = m * v for tiled m. Rows keep GEMV_TILE_LANES partial sums
+ * across their tiles and reduce them once at the end, so short tile
+ * rows do not each pay for a reduction; GEMV_TILE_ROWS rows at a time
+ * share the loads of v. A tiled matrix is read as a single stream,
+ * which the hardware prefetchers follow less eagerly than the several
+ * rows kern_gemv reads at once, so the same rows of the next tile are
+ * prefetched by hand. */
+static void gemv_tiles(const matrix *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out) {
+    LINALG_SCALAR acc[LAMAT_TILE][GEMV_TILE_LANES];
+    LINALG_SCALAR s[GEMV_TILE_ROWS][GEMV_TILE_LANES];
+    const LINALG_SCALAR *p, *x;
+    int i0, j0, i, j, r, l, h, w, ld;
+
+    for (i0 = 0; i0 < m->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < m->rows ? LAMAT_TILE : m->rows - i0;
+        memset(acc, 0, sizeof(acc));
+        for (j0 = 0; j0 < m->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < m->cols ? LAMAT_TILE : m->cols - j0;
+            p = mat_at(m, i0, j0, &ld);
+            x = v + j0;
+            for (i = 0; i + GEMV_TILE_ROWS <= h && w == LAMAT_TILE;
+                    i += GEMV_TILE_ROWS) {
+                memcpy(s, acc[i], sizeof(s));
+                for (j = 0; j < GEMV_TILE_ROWS * LAMAT_TILE;
+                        j += 64 / sizeof(*p)) {
+                    __builtin_prefetch(p + LAMAT_TILE * LAMAT_TILE
+                            + i * LAMAT_TILE + j);
+                }
+                for (j = 0; j < LAMAT_TILE; j += GEMV_TILE_LANES) {
+                    for (r = 0; r < GEMV_TILE_ROWS; r++) {
+                        for (l = 0; l < GEMV_TILE_LANES; l++) {
+                            s[r][l] += p[(i + r) * LAMAT_TILE + j + l]
+                                * x[j + l];
+                        }
+                    }
+                }
+                memcpy(acc[i], s, sizeof(s));
+            }
+            /* Leftover rows and partial tiles */
+            for (; i < h; i++) {
+                for (j = 0; j < w; j++) {
+                    acc[i][j % GEMV_TILE_LANES] +=
+                        p[i * LAMAT_TILE + j] * x[j];
+                }
+            }
+        }
+        for (i = 0; i < h; i++) {
+            out[i0 + i] = 0;
+            for (l = 0; l < GEMV_TILE_LANES; l++) {
+                out[i0 + i] += acc[i][l];
+            }
+        }
+    }
+}
+
+
+void mat_gemv(const matrix *m, const LINALG_SCALAR *v, LINALG_SCALAR *out) {
+    const struct linalg_tuning *t = tune_params();
+
+    if (m->layout == LAMAT_TILED) {
+        gemv_tiles(m, v, out);
+    } else if (!blas_gemv(m->data, v, out, m->rows, m->cols)
+            && !spec_gemv(m->data, v, out, m->rows, m->cols)) {
+        kern_gemv(m->data, v, out, m->rows, m->cols, t);
+    }
+}
+
+
+void mat_gevm(const LINALG_SCALAR *v, const matrix *m, LINALG_SCALAR *out) {
+    int i0, j0, i, j, h, w, ld;
+    const LINALG_SCALAR *p;
+    LINALG_SCALAR s;
+
+    if (m->layout == LAMAT_ROW_MAJOR
+            && blas_gevm(v, m->data, out, m->rows, m->cols)) {
+        return;
+    }
+    /* Row by row, so both layouts are read in storage order; every
+     * element still sums its products by increasing row */
+    memset(out, 0, m->cols * sizeof(*out));
+    for (i0 = 0; i0 < m->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < m->rows ? LAMAT_TILE : m->rows - i0;
+        for (j0 = 0; j0 < m->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < m->cols ? LAMAT_TILE : m->cols - j0;
+            p = mat_at(m, i0, j0, &ld);
+            for (i = 0; i < h; i++, p += ld) {
+                s = v[i0 + i];
+                for (j = 0; j < w; j++) {
+                    out[j0 + j] += s * p[j];
+                }
+            }
+        }
+    }
+}
+
 
 int mat_new(matrix **out, const LINALG_SCALAR *data, int rows, int cols) {
-    int bytelen = rows * cols * sizeof(*data);
+    int bytelen;
+    matrix *m;
 
-    matrix *m = malloc(sizeof(*m));
-    m->data = malloc(bytelen);
+    STATS_OP(mat_new);
+    bytelen = rows * cols * sizeof(*data);
+    m = malloc(sizeof(*m));
+    m->data = data_alloc(bytelen);
+    STATS_ALLOC(bytelen);
     if (data != NULL) {
         memcpy(m->data, data, bytelen);
+        STATS_COPY(bytelen);
     }
     m->rows = rows;
     m->cols = cols;
+    m->layout = LAMAT_ROW_MAJOR;
 
     *out = m;
     return 0;
@@ -27,19 +344,24 @@ int mat_new(matrix **out, const LINALG_SCALAR *data, int rows, int cols) {
 
 
 int mat_alloc(matrix **out) {
-    matrix *m = malloc(sizeof(*m));
+    matrix *m;
+
+    STATS_OP(mat_alloc);
+    m = malloc(sizeof(*m));
     m->data = NULL;
     m->rows = 0;
     m->cols = 0;
+    m->layout = LAMAT_ROW_MAJOR;
     *out = m;
     return 0;
 }
 
 
-int mat_id(matrix **out, int order) {
+int mat_identity(matrix **out, int order) {
     int err, i;
     matrix *m;
 
+    STATS_OP(mat_identity);
     err = mat_zero(&m, order, order);
     if (err != 0) {
         return err;
@@ -65,6 +387,7 @@ int mat_zero(matrix **out, int rows, int cols) {
     int err;
     matrix *m;
 
+    STATS_OP(mat_zero);
     err = mat_new(&m, NULL, rows, cols);
     if (err != 0) {
         return err;
@@ -81,8 +404,14 @@ int mat_dup(matrix **dst, const matrix *src) {
     int err;
     matrix *m;
 
-    err = mat_new(&m, src->data, src->rows, src->cols);
+    STATS_OP(mat_dup);
+    err = mat_alloc(&m);
+    if (err != 0) {
+        return err;
+    }
+    err = mat_cpy(m, src);
     if (err != 0) {
+        mat_del(m);
         return err;
     }
 
@@ -92,25 +421,70 @@ int mat_dup(matrix **dst, const matrix *src) {
 
 
 int mat_cpy(matrix *dst, const matrix *src) {
-    int bytelen;
-
-    bytelen = src->rows * src->cols * sizeof(*src->data);
-    dst->data = realloc(dst->data, bytelen);
-    memcpy(dst->data, src->data, bytelen);
+    size_t bytelen;
+
+    STATS_OP(mat_cpy);
+    bytelen = mat_len(src->rows, src->cols, src->layout)
+        * sizeof(*src->data);
+    /* Usually shares src's storage, copied on the first write */
+    dst->data = data_copy(dst->data, src->data, bytelen);
+    if (dst->data != src->data) {
+        STATS_ALLOC(bytelen);
+        STATS_COPY(bytelen);
+    }
     dst->rows = src->rows;
     dst->cols = src->cols;
+    dst->layout = src->layout;
     return 0;
 }
 
 
 int mat_del(matrix *m) {
-    free(m->data);
+    STATS_OP(mat_del);
+    data_free(m->data);
     free(m);
     return 0;
 }
 
 
+int mat_set_layout(matrix *m, int layout) {
+    LINALG_SCALAR *data;
+    size_t bytelen;
+    matrix dst;
+
+    STATS_OP(mat_set_layout);
+    if (layout != LAMAT_ROW_MAJOR && layout != LAMAT_TILED) {
+        return LAMAT_INVALID;
+    }
+    if (layout == m->layout) {
+        return 0;
+    }
+
+    bytelen = mat_len(m->rows, m->cols, layout) * sizeof(*data);
+    data = data_alloc(bytelen);
+    if (data == NULL && bytelen > 0) {
+        return LAMAT_ALLOC;
+    }
+    STATS_ALLOC(bytelen);
+    STATS_COPY((size_t)m->rows * m->cols * sizeof(*data));
+
+    dst = view(data, m->rows, m->cols, layout);
+    relayout(&dst, m);
+
+    data_free(m->data);
+    m->data = data;
+    m->layout = layout;
+    return 0;
+}
+
+
+int mat_get_layout(const matrix *m) {
+    return m->layout;
+}
+
+
 int mat_dim(const matrix *m, int *rows, int *cols) {
+    STATS_OP(mat_dim);
     if (rows != NULL) {
         *rows = m->rows;
     }
@@ -122,18 +496,78 @@ int mat_dim(const matrix *m, int *rows, int *cols) {
 
 
 int mat_get_data(const matrix *m, LINALG_SCALAR *out) {
-    memcpy(out, m->data, m->rows * m->cols * sizeof(*out));
+    matrix dst;
+
+    STATS_OP(mat_get_data);
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        memcpy(out, m->data, m->rows * m->cols * sizeof(*out));
+    } else {
+        dst = view(out, m->rows, m->cols, LAMAT_ROW_MAJOR);
+        relayout(&dst, m);
+    }
+    STATS_COPY(m->rows * m->cols * sizeof(*out));
     return 0;
 }
 
 
 int mat_set_data(matrix *m, const LINALG_SCALAR *data) {
-    memcpy(m->data, data, m->rows * m->cols * sizeof(*data));
+    matrix src;
+
+    STATS_OP(mat_set_data);
+    if (own(m) != 0) {
+        return LAMAT_ALLOC;
+    }
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        memcpy(m->data, data, m->rows * m->cols * sizeof(*data));
+    } else {
+        /* relayout only reads through src */
+        src = view((LINALG_SCALAR *)data, m->rows, m->cols,
+                LAMAT_ROW_MAJOR);
+        relayout(m, &src);
+    }
+    STATS_COPY(m->rows * m->cols * sizeof(*data));
     return 0;
 }
 
 
+LINALG_SCALAR *mat_data_ptr(matrix *m) {
+    if (own(m) != 0) {
+        return NULL;
+    }
+    return m->data;
+}
+
+
+const LINALG_SCALAR *mat_data_cptr(const matrix *m) {
+    return m->data;
+}
+
+
+int mat_stride(const matrix *m) {
+    return m->cols;
+}
+
+
+LINALG_SCALAR *mat_row_ptr(matrix *m, int row) {
+    LINALG_SCALAR *data;
+
+    if (m->layout != LAMAT_ROW_MAJOR || (data = mat_data_ptr(m)) == NULL) {
+        return NULL;
+    }
+    return data + (size_t)row * m->cols;
+}
+
+
+const LINALG_SCALAR *mat_row_cptr(const matrix *m, int row) {
+    if (m->layout != LAMAT_ROW_MAJOR) {
+        return NULL;
+    }
+    return m->data + (size_t)row * m->cols;
+}
+
+
 int mat_read(const matrix *m, int row, int col, LINALG_SCALAR *out) {
+    STATS_OP(mat_read);
     if (row < 0 || row >= m->rows
             || col < 0 || col >= m->cols) {
         return LAMAT_OOB;
@@ -144,22 +578,40 @@ int mat_read(const matrix *m, int row, int col, LINALG_SCALAR *out) {
 
 
 LINALG_SCALAR mat_get(const matrix *m, int row, int col) {
-    return m->data[row*m->cols + col];
+    int ld;
+
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        return m->data[row*m->cols + col];
+    }
+    return *mat_at(m, row, col, &ld);
 }
 
 
 int mat_write(matrix *m, int row, int col, LINALG_SCALAR r) {
+    STATS_OP(mat_write);
     if (row < 0 || row >= m->rows
             || col < 0 || col >= m->cols) {
         return LAMAT_OOB;
     }
+    if (own(m) != 0) {
+        return LAMAT_ALLOC;
+    }
     mat_set(m, row, col, r);
     return 0;
 }
 
 
 void mat_set(matrix *m, int row, int col, LINALG_SCALAR r) {
-    m->data[row*m->cols + col] = r;
+    int ld;
+
+    if (own(m) != 0) {
+        return;
+    }
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        m->data[row*m->cols + col] = r;
+    } else {
+        *mat_at(m, row, col, &ld) = r;
+    }
 }
 
 
@@ -167,6 +619,7 @@ int mat_add(const matrix *a, const matrix *b, matrix *out) {
     int err;
     matrix *tmp;
 
+    STATS_OP(mat_add);
     err = mat_dup(&tmp, a);
     if (err != 0) {
         return err;
@@ -183,15 +636,24 @@ int mat_add(const matrix *a, const matrix *b, matrix *out) {
 
 
 int mat_add_(matrix *a, const matrix *b) {
-    int i, len;
+    size_t i, len;
 
+    STATS_OP(mat_add_);
     if (a->rows != b->rows || a->cols != b->cols) {
         return LAMAT_INCOMPATIBLE_DIM;
     }
-    len = a->rows * a->cols;
-    for (i = 0; i < len; i++) {
-        a->data[i] += b->data[i];
+    if (own(a) != 0) {
+        return LAMAT_ALLOC;
     }
+    len = mat_len(a->rows, a->cols, a->layout);
+    if (a->layout != b->layout) {
+        ew_mixed(BC_ADD, a, b);
+    } else if (!blas_axpy(1, b->data, a->data, len)) {
+        for (i = 0; i < len; i++) {
+            a->data[i] += b->data[i];
+        }
+    }
+    STATS_FLOPS((long long)a->rows * a->cols);
     return 0;
 }
 
@@ -200,6 +662,7 @@ int mat_sub(const matrix *a, const matrix *b, matrix *out) {
     int err;
     matrix *tmp;
 
+    STATS_OP(mat_sub);
     err = mat_dup(&tmp, a);
     if (err != 0) {
         return err;
@@ -216,183 +679,846 @@ int mat_sub(const matrix *a, const matrix *b, matrix *out) {
 
 
 int mat_sub_(matrix *a, const matrix *b) {
-    int i, len;
+    size_t i, len;
 
+    STATS_OP(mat_sub_);
     if (a->rows != b->rows || a->cols != b->cols) {
         return LAMAT_INCOMPATIBLE_DIM;
     }
-    len = a->rows * a->cols;
-    for (i = 0; i < len; i++) {
-        a->data[i] -= b->data[i];
+    if (own(a) != 0) {
+        return LAMAT_ALLOC;
+    }
+    len = mat_len(a->rows, a->cols, a->layout);
+    if (a->layout != b->layout) {
+        ew_mixed(BC_SUB, a, b);
+    } else if (!blas_axpy(-1, b->data, a->data, len)) {
+        for (i = 0; i < len; i++) {
+            a->data[i] -= b->data[i];
+        }
     }
+    STATS_FLOPS((long long)a->rows * a->cols);
     return 0;
 }
 
 
+/* Elements of the workspace mul_rows takes for products of order n */
+static size_t mul_rows_len(int n, int algo, int mode,
+        const struct linalg_tuning *t) {
+    if (algo == LAMAT_MUL_STRASSEN) {
+        return kern_strassen_len(n, t);
+    }
+    return mode != LASUM_NAIVE ? sum_gemm_len(n, mode, t) : 0;
+}
+
+
+/* c = a * b, all row-major and c apart from a and b, with the given
+ * algorithm and summation mode. ws holds mul_rows_len elements for
+ * square products, or is NULL for the kernels to allocate their own. */
+static void mul_rows(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int rows, int inner, int cols, int algo,
+        int mode, const struct linalg_tuning *t, LINALG_SCALAR *ws) {
+    int done, square = rows == inner && inner == cols;
+
+    if (ws != NULL && square && algo == LAMAT_MUL_STRASSEN) {
+        kern_strassen_ws(a, b, c, rows, ws, t);
+        return;
+    }
+    if (ws != NULL && algo == LAMAT_MUL_CLASSIC && mode != LASUM_NAIVE) {
+        sum_gemm_ws(a, b, c, rows, inner, cols, mode, ws, t);
+        return;
+    }
+    /* kern_strassen only fails if it cannot allocate its workspace,
+     * in which case the classical kernel is used instead */
+    done = algo == LAMAT_MUL_STRASSEN && square
+        && kern_strassen(a, b, c, rows, t) == 0;
+    /* Likewise for the workspace of sum_gemm */
+    done = done || (algo == LAMAT_MUL_CLASSIC && mode == LASUM_NAIVE
+        && blas_gemm(a, b, c, rows, inner, cols));
+    done = done || (algo == LAMAT_MUL_CLASSIC && mode != LASUM_NAIVE
+        && sum_gemm(a, b, c, rows, inner, cols, mode, t) == 0);
+    if (!done && !spec_gemm(a, b, c, rows, inner, cols)) {
+        kern_gemm(a, b, c, rows, inner, cols, t);
+    }
+}
+
+
 int mat_mul(const matrix *a, const matrix *b, matrix *out) {
-    int i, j, k;
-    LINALG_SCALAR s;
+    STATS_OP(mat_mul);
+    return mat_mul_algo(a, b, out, atomic_load(&mul_policy));
+}
+
+
+int mat_mul_algo(const matrix *a, const matrix *b, matrix *out, int algo) {
+    int rows, inner, cols, layout;
+    size_t bytelen;
+    LINALG_SCALAR *data;
+    matrix c;
 
+    STATS_OP(mat_mul_algo);
+    if (algo != LAMAT_MUL_CLASSIC && algo != LAMAT_MUL_STRASSEN) {
+        return LAMAT_INVALID;
+    }
     if (a->cols != b->rows) {
         return LAMAT_INCOMPATIBLE_DIM;
     }
-    
-    out->rows = a->rows;
-    out->cols = b->cols;
-    out->data = realloc(out->data, out->rows * out->cols * sizeof(*out->data));
 
-    for (i = 0; i < out->rows; i++) {
-        for (j = 0; j < out->cols; j++) {
-            s = 0;
-            for (k = 0; k < a->cols; k++) {
-                s += mat_get(a, i, k) * mat_get(b, k, j);
-            }
-            mat_set(out, i, j, s);
-        }
+    rows = a->rows;
+    inner = a->cols;
+    cols = b->cols;
+    layout = a->layout;
+    bytelen = mat_len(rows, cols, layout) * sizeof(*data);
+    if (out == a || out == b) {
+        /* The kernel cannot write over its own operands */
+        data = data_alloc(bytelen);
+    } else {
+        data = data_realloc(out->data, bytelen);
+        out->data = data;
     }
+    STATS_ALLOC(bytelen);
+    STATS_FLOPS(2LL * rows * cols * inner);
+
+    if (layout != LAMAT_ROW_MAJOR || b->layout != LAMAT_ROW_MAJOR) {
+        c = view(data, rows, cols, layout);
+        mul_tiles(a, b, &c, tune_params());
+    } else {
+        mul_rows(a->data, b->data, data, rows, inner, cols, algo,
+                sum_policy(), tune_params(), NULL);
+    }
+
+    if (data != out->data) {
+        data_free(out->data);
+        out->data = data;
+    }
+    out->rows = rows;
+    out->cols = cols;
+    out->layout = layout;
     return 0;
 }
 
 
 int mat_mul_(matrix *a, const matrix *b) {
-    int err;
-    matrix *aux;
+    STATS_OP(mat_mul_);
+    return mat_mul_algo(a, b, a, atomic_load(&mul_policy));
+}
 
-    err = mat_new(&aux, NULL, a->rows, a->cols);
-    if (err != 0) {
-        return err;
-    }
 
-    err = mat_mul(a, b, aux);
-    if (err != 0) {
-        mat_del(aux);
-        return err;
+int mat_mul_policy(int algo) {
+    STATS_OP(mat_mul_policy);
+    if (algo != LAMAT_MUL_CLASSIC && algo != LAMAT_MUL_STRASSEN) {
+        return LAMAT_INVALID;
     }
-
-    err = mat_cpy(a, aux);
-    mat_del(aux);
-    return err;
+    atomic_store(&mul_policy, algo);
+    return 0;
 }
 
 
-int mat_rmul(const matrix *m, const vector *v, matrix *out) {
-    int err;
-    matrix *tmp;
+/* Scratch storage of mat_pow, mat_expm and the permutations, kept from
+ * one call to the next in every thread up to WS_KEEP_BYTES, and freed
+ * by linalg_workspace_release or when the thread exits */
+struct workspace {
+    LINALG_SCALAR *data;
+    size_t len;
+};
 
-    err = mat_dup(&tmp, m);
-    if (err != 0) {
-        return err;
-    }
-    err = mat_rmul_(tmp, v);
-    if (err != 0) {
-        mat_del(tmp);
-        return err;
-    }
-    err = mat_cpy(out, tmp);
-    mat_del(tmp);
-    return err;
-}
+#define WS_KEEP_BYTES (1L << 25)
 
+static pthread_key_t ws_key;
+static pthread_once_t ws_once = PTHREAD_ONCE_INIT;
 
-int mat_rmul_(matrix *m, const vector *v) {
-    int i, j, vdim;
-    LINALG_SCALAR r;
 
-    vec_dim(v, &vdim);
-    if (vdim != m->cols) {
-        return LAMAT_INCOMPATIBLE_DIM;
-    }
+static void ws_free(void *p) {
+    struct workspace *w = p;
 
-    for (i = 0; i < m->rows; i++) {
-        for (j = 0; j < m->cols; j++) {
-            r = mat_get(m, i, j) * vec_get(v, j);
-            mat_set(m, i, j, r);
-        }
-    }
+    data_free(w->data);
+    free(w);
+}
 
-    return 0;
+
+static void ws_init(void) {
+    pthread_key_create(&ws_key, ws_free);
 }
 
 
-int mat_cmul(const matrix *m, const vector *v, matrix *out) {
-    int err;
-    matrix *tmp;
+/* The workspace of the calling thread, grown to at least len elements,
+ * or NULL if it cannot be */
+static LINALG_SCALAR *workspace(size_t len) {
+    struct workspace *w;
 
-    err = mat_dup(&tmp, m);
-    if (err != 0) {
-        return err;
+    pthread_once(&ws_once, ws_init);
+    w = pthread_getspecific(ws_key);
+    if (w == NULL) {
+        w = calloc(1, sizeof(*w));
+        if (w == NULL || pthread_setspecific(ws_key, w) != 0) {
+            free(w);
+            return NULL;
+        }
     }
-    err = mat_cmul_(tmp, v);
-    if (err != 0) {
-        mat_del(tmp);
-        return err;
+    len = len > 0 ? len : 1;
+    if (w->len < len) {
+        data_free(w->data);
+        w->data = data_alloc(len * sizeof(*w->data));
+        w->len = w->data != NULL ? len : 0;
+        STATS_ALLOC(len * sizeof(*w->data));
     }
-    err = mat_cpy(out, tmp);
-    mat_del(tmp);
-    return err;
+    return w->data;
 }
 
 
-int mat_cmul_(matrix *m, const vector *v) {
-    int i, j, vdim;
-    LINALG_SCALAR r;
+/* Frees the workspace of the calling thread if it has grown past what
+ * is kept between calls */
+static void ws_trim(void) {
+    struct workspace *w = pthread_getspecific(ws_key);
 
-    vec_dim(v, &vdim);
-    if (vdim != m->rows) {
-        return LAMAT_INCOMPATIBLE_DIM;
+    if (w != NULL && w->len * sizeof(*w->data) > WS_KEEP_BYTES) {
+        data_free(w->data);
+        w->data = NULL;
+        w->len = 0;
     }
+}
 
-    for (i = 0; i < m->cols; i++) {
-        for (j = 0; j < m->rows; j++) {
-            r = mat_get(m, j, i) * vec_get(v, j);
-            mat_set(m, j, i, r);
-        }
-    }
 
+int linalg_workspace_release(void) {
+    struct workspace *w;
+
+    pthread_once(&ws_once, ws_init);
+    w = pthread_getspecific(ws_key);
+    if (w != NULL) {
+        data_free(w->data);
+        w->data = NULL;
+        w->len = 0;
+    }
     return 0;
 }
 
 
-int mat_smul(const matrix *m, LINALG_SCALAR s, matrix *out) {
-    int err;
-    matrix *tmp;
-    err = mat_dup(&tmp, m);
-    if (err != 0) {
-        return err;
-    }
+/* Writes r, n x n and row-major, into out in the given layout */
+static void store_square(matrix *out, const LINALG_SCALAR *r, int n,
+        int layout) {
+    matrix src, dst;
 
-    err = mat_smul_(tmp, s);
-    if (err != 0) {
-        mat_del(tmp);
-        return err;
-    }
-    err = mat_cpy(out, tmp);
-    mat_del(tmp);
-    return err;
+    out->data = data_realloc(out->data,
+            mat_len(n, n, layout) * sizeof(*out->data));
+    out->rows = n;
+    out->cols = n;
+    out->layout = layout;
+    src = view((LINALG_SCALAR *)r, n, n, LAMAT_ROW_MAJOR);
+    dst = view(out->data, n, n, layout);
+    relayout(&dst, &src);
 }
 
 
-int mat_smul_(matrix *m, LINALG_SCALAR s) {
-    int i, len;
+/* Products of mat_pow and mat_expm: the algorithm, summation mode and
+ * parameters, taken once per call, and the workspace of mul_rows */
+struct mul_sq {
+    int algo;
+    int mode;
+    const struct linalg_tuning *t;
+    LINALG_SCALAR *ws;
+};
 
-    len = m->rows * m->cols;
-    for (i = 0; i < len; i++) {
-        m->data[i] *= s;
-    }
-    return 0;
+
+/* Takes the settings of the products of order n into *x, and returns
+ * the elements of workspace they need */
+static size_t mul_sq_init(struct mul_sq *x, int n) {
+    x->algo = atomic_load(&mul_policy);
+    x->mode = sum_policy();
+    x->t = tune_params();
+    x->ws = NULL;
+    return mul_rows_len(n, x->algo, x->mode, x->t);
 }
 
 
-int mat_sdiv(const matrix *m, LINALG_SCALAR s, matrix *out) {
-    int err;
-    matrix *tmp;
+/* c = a * b, all n x n and row-major, as set up in x */
+static void mul_sq(const struct mul_sq *x, const LINALG_SCALAR *a,
+        const LINALG_SCALAR *b, LINALG_SCALAR *c, int n) {
+    mul_rows(a, b, c, n, n, n, x->algo, x->mode, x->t, x->ws);
+}
 
+
+/* Writes b to the power k > 0 into r, with t as scratch, all n x n and
+ * row-major. b is squared for every bit of k but the highest and
+ * multiplied into the result for every set bit. The three buffers take
+ * turns as operands and results, so the pointers are swapped rather
+ * than the data copied, and *r ends up pointing to the result. */
+static void pow_rows(LINALG_SCALAR **b, LINALG_SCALAR **r,
+        LINALG_SCALAR **t, int n, int k, const struct mul_sq *x) {
+    LINALG_SCALAR *p;
+    int first = 1;
+
+    for (;;) {
+        if (k & 1) {
+            if (first) {
+                memcpy(*r, *b, (size_t)n * n * sizeof(**r));
+            } else {
+                mul_sq(x, *r, *b, *t, n);
+                p = *r;
+                *r = *t;
+                *t = p;
+            }
+            first = 0;
+        }
+        k >>= 1;
+        if (k == 0) {
+            return;
+        }
+        mul_sq(x, *b, *b, *t, n);
+        p = *b;
+        *b = *t;
+        *t = p;
+    }
+}
+
+
+int mat_pow(const matrix *a, int k, matrix *out) {
+    LINALG_SCALAR *w, *b, *r, *t;
+    struct mul_sq x;
+    matrix src, dst;
+    int n, i, layout, muls;
+    size_t nn, wslen;
+
+    STATS_OP(mat_pow);
+    if (k < 0) {
+        return LAMAT_INVALID;
+    }
+    if (a->rows != a->cols) {
+        return LAMAT_INCOMPATIBLE_DIM;
+    }
+
+    n = a->rows;
+    nn = (size_t)n * n;
+    layout = a->layout;
+    /* b, r and t, then the workspace of the products */
+    wslen = mul_sq_init(&x, n);
+    w = workspace(3 * nn + wslen);
+    if (w == NULL) {
+        return LAMAT_ALLOC;
+    }
+    b = w;
+    r = w + nn;
+    t = r + nn;
+    x.ws = t + nn;
+    if (k == 0) {
+        memset(r, 0, nn * sizeof(*r));
+        for (i = 0; i < n; i++) {
+            r[(size_t)i * n + i] = 1;
+        }
+    } else {
+        src = *a;
+        dst = view(b, n, n, LAMAT_ROW_MAJOR);
+        relayout(&dst, &src);
+        pow_rows(&b, &r, &t, n, k, &x);
+        for (muls = 0; k > 1; k >>= 1) {
+            muls += 1 + (k & 1);
+        }
+        STATS_FLOPS(2LL * n * n * n * muls);
+    }
+
+    store_square(out, r, n, layout);
+    ws_trim();
+    return 0;
+}
+
+
+int mat_pow_(matrix *a, int k) {
+    STATS_OP(mat_pow_);
+    return mat_pow(a, k, a);
+}
+
+
+/* Degrees of the Pade approximants of mat_expm, and the largest 1-norms
+ * for which each one is accurate to the unit roundoff of float and
+ * double respectively, from Higham, "The scaling and squaring method for
+ * the matrix exponential revisited", 2005. Larger norms are scaled down
+ * by a power of two to the last one. */
+static const int pade_degree[] = {3, 5, 7, 9};
+static const double pade_theta_float[] = {
+    4.258730016922831e-1, 1.880152677804762, 3.925724783138660
+};
+static const double pade_theta_double[] = {
+    1.495585217958292e-2, 2.539398330063230e-1, 9.504178996162932e-1,
+    2.097847961257068
+};
+
+
+/* Largest sum of the absolute values of a column of a, n x n and
+ * row-major, NaN if any is, or -1 if memory runs out */
+static double norm1(const LINALG_SCALAR *a, int n) {
+    double *col, r;
+    int i, j;
+
+    col = calloc(n, sizeof(*col));
+    if (col == NULL) {
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            col[j] += fabs(a[(size_t)i * n + j]);
+        }
+    }
+    r = 0;
+    for (j = 0; j < n; j++) {
+        r = col[j] > r || isnan(col[j]) ? col[j] : r;
+    }
+    free(col);
+    return r;
+}
+
+
+/* Replaces x, n x k and row-major, with the solution of a * x = x, a
+ * being n x n and row-major, by Gaussian elimination with partial
+ * pivoting, which overwrites a. Returns nonzero if a is singular. */
+static int solve_rows(LINALG_SCALAR *a, LINALG_SCALAR *x, int n, int k) {
+    LINALG_SCALAR *ri, *rc, l, s;
+    int c, i, j, p;
+
+    for (c = 0; c < n; c++) {
+        p = c;
+        for (i = c + 1; i < n; i++) {
+            if (fabs(a[(size_t)i * n + c]) > fabs(a[(size_t)p * n + c])) {
+                p = i;
+            }
+        }
+        if (a[(size_t)p * n + c] == 0) {
+            return 1;
+        }
+        if (p != c) {
+            for (j = c; j < n; j++) {
+                s = a[(size_t)c * n + j];
+                a[(size_t)c * n + j] = a[(size_t)p * n + j];
+                a[(size_t)p * n + j] = s;
+            }
+            for (j = 0; j < k; j++) {
+                s = x[(size_t)c * k + j];
+                x[(size_t)c * k + j] = x[(size_t)p * k + j];
+                x[(size_t)p * k + j] = s;
+            }
+        }
+        rc = a + (size_t)c * n;
+        for (i = c + 1; i < n; i++) {
+            ri = a + (size_t)i * n;
+            l = ri[c] / rc[c];
+            for (j = c + 1; j < n; j++) {
+                ri[j] -= l * rc[j];
+            }
+            for (j = 0; j < k; j++) {
+                x[(size_t)i * k + j] -= l * x[(size_t)c * k + j];
+            }
+        }
+    }
+
+    for (i = n - 1; i >= 0; i--) {
+        ri = a + (size_t)i * n;
+        for (c = i + 1; c < n; c++) {
+            for (j = 0; j < k; j++) {
+                x[(size_t)i * k + j] -= ri[c] * x[(size_t)c * k + j];
+            }
+        }
+        l = 1 / ri[i];
+        for (j = 0; j < k; j++) {
+            x[(size_t)i * k + j] *= l;
+        }
+    }
+    return 0;
+}
+
+
+int mat_expm(const matrix *a, matrix *out) {
+    LINALG_SCALAR *w, *pw[5], *u, *v, *t, *r, d;
+    const double *theta;
+    double norm, coef[10], scale;
+    int n, i, j, m, deg, degrees, s, layout;
+    size_t nn, wslen;
+    struct mul_sq x;
+    matrix src, dst;
+
+    STATS_OP(mat_expm);
+    if (a->rows != a->cols) {
+        return LAMAT_INCOMPATIBLE_DIM;
+    }
+
+    n = a->rows;
+    nn = (size_t)n * n;
+    layout = a->layout;
+    /* a, its even powers up to the 8th, u, v and one scratch, then the
+     * workspace of the products */
+    wslen = mul_sq_init(&x, n);
+    w = workspace(8 * nn + wslen);
+    if (w == NULL) {
+        return LAMAT_ALLOC;
+    }
+    x.ws = w + 8 * nn;
+    for (i = 0; i < 5; i++) {
+        pw[i] = w + i * nn;
+    }
+    u = w + 5 * nn;
+    v = w + 6 * nn;
+    t = w + 7 * nn;
+    src = *a;
+    dst = view(pw[0], n, n, LAMAT_ROW_MAJOR);
+    relayout(&dst, &src);
+
+    norm = norm1(pw[0], n);
+    if (!isfinite(norm) || norm < 0) {
+        ws_trim();
+        return norm < 0 ? LAMAT_ALLOC : LAMAT_INVALID;
+    }
+    if (sizeof(LINALG_SCALAR) == sizeof(float)) {
+        theta = pade_theta_float;
+        degrees = sizeof(pade_theta_float) / sizeof(*pade_theta_float);
+    } else {
+        theta = pade_theta_double;
+        degrees = sizeof(pade_theta_double) / sizeof(*pade_theta_double);
+    }
+    for (deg = 0; deg < degrees - 1 && norm > theta[deg]; deg++);
+    s = 0;
+    if (norm > theta[deg]) {
+        s = (int)ceil(log2(norm / theta[deg]));
+        scale = ldexp(1, -s);
+        for (i = 0; i < (int)nn; i++) {
+            pw[0][i] *= scale;
+        }
+    }
+    m = pade_degree[deg];
+
+    /* Coefficients of the numerator p(x) of the approximant, whose
+     * denominator is p(-x): p(a) = v + u and p(-a) = v - u, with v the
+     * even terms and u the odd ones */
+    coef[0] = 1;
+    for (j = 1; j <= m; j++) {
+        coef[j] = coef[j - 1] * (m - j + 1) / ((double)j * (2 * m - j + 1));
+    }
+    mul_sq(&x, pw[0], pw[0], pw[1], n);
+    for (j = 2; j <= m / 2; j++) {
+        mul_sq(&x, pw[j / 2], pw[j - j / 2], pw[j], n);
+    }
+
+    /* u = a (sum of coef[2j + 1] a^2j), v = sum of coef[2j] a^2j, with
+     * pw[j] = a^2j for j > 0 */
+    memset(t, 0, nn * sizeof(*t));
+    memset(v, 0, nn * sizeof(*v));
+    for (j = 1; j <= m / 2; j++) {
+        for (i = 0; i < (int)nn; i++) {
+            t[i] += (LINALG_SCALAR)coef[2 * j + 1] * pw[j][i];
+            v[i] += (LINALG_SCALAR)coef[2 * j] * pw[j][i];
+        }
+    }
+    for (i = 0; i < n; i++) {
+        t[(size_t)i * n + i] += coef[1];
+        v[(size_t)i * n + i] += coef[0];
+    }
+    mul_sq(&x, pw[0], t, u, n);
+
+    /* (v - u) r = v + u */
+    for (i = 0; i < (int)nn; i++) {
+        d = u[i];
+        u[i] = v[i] + d;
+        v[i] -= d;
+    }
+    if (solve_rows(v, u, n, n) != 0) {
+        ws_trim();
+        return LAMAT_INVALID;
+    }
+
+    /* exp(a) = r^(2^s) */
+    r = u;
+    for (i = 0; i < s; i++) {
+        mul_sq(&x, r, r, t, n);
+        v = r;
+        r = t;
+        t = v;
+    }
+    STATS_FLOPS(2LL * nn * n * (m / 2 + 1 + s) + 8LL * nn * n / 3);
+
+    store_square(out, r, n, layout);
+    ws_trim();
+    return 0;
+}
+
+
+int mat_expm_(matrix *a) {
+    STATS_OP(mat_expm_);
+    return mat_expm(a, a);
+}
+
+
+int mat_ger(matrix *a, LINALG_SCALAR alpha, const vector *x,
+        const vector *y) {
+    int i0, j0, i, j, h, w, ld;
+    LINALG_SCALAR *p, s;
+
+    STATS_OP(mat_ger);
+    if (x->dim != a->rows || y->dim != a->cols) {
+        return LAMAT_INCOMPATIBLE_DIM;
+    }
+
+    if (own(a) != 0) {
+        return LAMAT_ALLOC;
+    }
+    STATS_FLOPS(2LL * a->rows * a->cols);
+    for (i0 = 0; i0 < a->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < a->rows ? LAMAT_TILE : a->rows - i0;
+        for (j0 = 0; j0 < a->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < a->cols ? LAMAT_TILE : a->cols - j0;
+            p = mat_at(a, i0, j0, &ld);
+            for (i = 0; i < h; i++, p += ld) {
+                s = alpha * x->data[i0 + i];
+                for (j = 0; j < w; j++) {
+                    p[j] += s * y->data[j0 + j];
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+
+/* Copies the upper triangle of the square matrix m over its lower
+ * triangle, a pair of mirrored tiles at a time. */
+static void mirror_upper(const matrix *m) {
+    int i0, j0, i, j, h, w, ldu, ldl;
+    LINALG_SCALAR *pu, *pl;
+
+    for (i0 = 0; i0 < m->rows; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < m->rows ? LAMAT_TILE : m->rows - i0;
+        for (j0 = i0; j0 < m->cols; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < m->cols ? LAMAT_TILE : m->cols - j0;
+            pu = mat_at(m, i0, j0, &ldu);
+            pl = mat_at(m, j0, i0, &ldl);
+            for (i = 0; i < h; i++) {
+                for (j = j0 == i0 ? i + 1 : 0; j < w; j++) {
+                    pl[(size_t)j * ldl + i] = pu[(size_t)i * ldu + j];
+                }
+            }
+        }
+    }
+}
+
+
+int mat_syrk(matrix *c, LINALG_SCALAR alpha, const matrix *a) {
+    int k, n, i0, j0, h, w, ld;
+    size_t i, bytelen;
+    LINALG_SCALAR *at, *rows, *pc;
+    const struct linalg_tuning *t;
+    matrix src;
+
+    STATS_OP(mat_syrk);
+    if (c->rows != a->cols || c->cols != a->cols) {
+        return LAMAT_INCOMPATIBLE_DIM;
+    }
+
+    if (own(c) != 0) {
+        return LAMAT_ALLOC;
+    }
+    k = a->rows;
+    n = a->cols;
+    t = tune_params();
+    /* The kernel wants a row-major a, which must not be c either */
+    rows = a->data;
+    if (a->layout != LAMAT_ROW_MAJOR || a == c) {
+        rows = data_alloc((size_t)k * n * sizeof(*rows));
+        STATS_ALLOC((size_t)k * n * sizeof(*rows));
+        src = view(rows, k, n, LAMAT_ROW_MAJOR);
+        relayout(&src, a);
+    }
+    bytelen = (size_t)n * k * sizeof(*at);
+    at = data_alloc(bytelen);
+    STATS_ALLOC(bytelen);
+    kern_transpose(rows, at, k, n, t);
+    for (i = 0; i < (size_t)n * k; i++) {
+        at[i] *= alpha;
+    }
+
+    /* Rows of c a block at a time, from the diagonal onwards. Tiled
+     * c is updated a tile at a time; the blocks on the diagonal also
+     * compute a few elements below it, which mirror_upper overwrites. */
+    STATS_FLOPS((long long)k * n * (n + 1));
+    for (i0 = 0; i0 < n; i0 += LAMAT_TILE) {
+        h = i0 + LAMAT_TILE < n ? LAMAT_TILE : n - i0;
+        if (c->layout != LAMAT_TILED) {
+            kern_gemm_acc_ld(at + (size_t)i0 * k, k, rows + i0, n,
+                    c->data + (size_t)i0 * n + i0, n, h, k, n - i0, t);
+            continue;
+        }
+        for (j0 = i0; j0 < n; j0 += LAMAT_TILE) {
+            w = j0 + LAMAT_TILE < n ? LAMAT_TILE : n - j0;
+            pc = mat_at(c, i0, j0, &ld);
+            kern_gemm_acc_ld(at + (size_t)i0 * k, k, rows + j0, n,
+                    pc, ld, h, k, w, t);
+        }
+    }
+    mirror_upper(c);
+
+    data_free(at);
+    if (rows != a->data) {
+        data_free(rows);
+    }
+    return 0;
+}
+
+
+/* Applies op between v and every row of m if by_row is set,
+ * or every column of m otherwise, writing the result into out.
+ * out may be m. Both cases walk m in storage order. */
+static int mat_bcast(const matrix *m, const vector *v,
+        enum bc_op op, int by_row, matrix *out) {
+    int i0, j0, i, h, w, ldm, ldo;
+    LINALG_SCALAR *pm, *po;
+
+    if (v->dim != (by_row ? m->cols : m->rows)) {
+        return LAMAT_INCOMPATIBLE_DIM;
+    }
+
+    if (out != m) {
+        out->rows = m->rows;
+        out->cols = m->cols;
+        out->layout = m->layout;
+        out->data = data_realloc(out->data,
+                mat_len(out->rows, out->cols, out->layout)
+                * sizeof(*out->data));
+        STATS_ALLOC(mat_len(out->rows, out->cols, out->layout)
+                * sizeof(*out->data));
+    } else if (own(out) != 0) {
+        return LAMAT_ALLOC;
+    }
+
+    STATS_FLOPS((long long)m->rows * m->cols);
+    if (m->layout == LAMAT_TILED) {
+        for (i0 = 0; i0 < m->rows; i0 += LAMAT_TILE) {
+            h = i0 + LAMAT_TILE < m->rows ? LAMAT_TILE : m->rows - i0;
+            for (j0 = 0; j0 < m->cols; j0 += LAMAT_TILE) {
+                w = j0 + LAMAT_TILE < m->cols ? LAMAT_TILE : m->cols - j0;
+                pm = mat_at(m, i0, j0, &ldm);
+                po = mat_at(out, i0, j0, &ldo);
+                for (i = 0; i < h; i++, pm += ldm, po += ldo) {
+                    if (by_row) {
+                        bc_vec(op, po, pm, v->data + j0, w);
+                    } else {
+                        bc_scal(op, po, pm, v->data[i0 + i], w);
+                    }
+                }
+            }
+        }
+        return 0;
+    }
+    for (i = 0; i < m->rows; i++) {
+        if (by_row) {
+            bc_vec(op, out->data + i*m->cols, m->data + i*m->cols,
+                    v->data, m->cols);
+        } else {
+            bc_scal(op, out->data + i*m->cols, m->data + i*m->cols,
+                    v->data[i], m->cols);
+        }
+    }
+    return 0;
+}
+
+
+int mat_radd(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_radd);
+    return mat_bcast(m, v, BC_ADD, 1, out);
+}
+
+
+int mat_radd_(matrix *m, const vector *v) {
+    STATS_OP(mat_radd_);
+    return mat_bcast(m, v, BC_ADD, 1, m);
+}
+
+
+int mat_rsub(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_rsub);
+    return mat_bcast(m, v, BC_SUB, 1, out);
+}
+
+
+int mat_rsub_(matrix *m, const vector *v) {
+    STATS_OP(mat_rsub_);
+    return mat_bcast(m, v, BC_SUB, 1, m);
+}
+
+
+int mat_rmul(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_rmul);
+    return mat_bcast(m, v, BC_MUL, 1, out);
+}
+
+
+int mat_rmul_(matrix *m, const vector *v) {
+    STATS_OP(mat_rmul_);
+    return mat_bcast(m, v, BC_MUL, 1, m);
+}
+
+
+int mat_rdiv(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_rdiv);
+    return mat_bcast(m, v, BC_DIV, 1, out);
+}
+
+
+int mat_rdiv_(matrix *m, const vector *v) {
+    STATS_OP(mat_rdiv_);
+    return mat_bcast(m, v, BC_DIV, 1, m);
+}
+
+
+int mat_cadd(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_cadd);
+    return mat_bcast(m, v, BC_ADD, 0, out);
+}
+
+
+int mat_cadd_(matrix *m, const vector *v) {
+    STATS_OP(mat_cadd_);
+    return mat_bcast(m, v, BC_ADD, 0, m);
+}
+
+
+int mat_csub(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_csub);
+    return mat_bcast(m, v, BC_SUB, 0, out);
+}
+
+
+int mat_csub_(matrix *m, const vector *v) {
+    STATS_OP(mat_csub_);
+    return mat_bcast(m, v, BC_SUB, 0, m);
+}
+
+
+int mat_cmul(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_cmul);
+    return mat_bcast(m, v, BC_MUL, 0, out);
+}
+
+
+int mat_cmul_(matrix *m, const vector *v) {
+    STATS_OP(mat_cmul_);
+    return mat_bcast(m, v, BC_MUL, 0, m);
+}
+
+
+int mat_cdiv(const matrix *m, const vector *v, matrix *out) {
+    STATS_OP(mat_cdiv);
+    return mat_bcast(m, v, BC_DIV, 0, out);
+}
+
+
+int mat_cdiv_(matrix *m, const vector *v) {
+    STATS_OP(mat_cdiv_);
+    return mat_bcast(m, v, BC_DIV, 0, m);
+}
+
+
+int mat_smul(const matrix *m, LINALG_SCALAR s, matrix *out) {
+    int err;
+    matrix *tmp;
+    STATS_OP(mat_smul);
     err = mat_dup(&tmp, m);
     if (err != 0) {
         return err;
     }
 
-    err = mat_sdiv_(tmp, s);
+    err = mat_smul_(tmp, s);
     if (err != 0) {
         mat_del(tmp);
         return err;
@@ -403,26 +1529,35 @@ int mat_sdiv(const matrix *m, LINALG_SCALAR s, matrix *out) {
 }
 
 
-int mat_sdiv_(matrix *m, LINALG_SCALAR s) {
-    int i, len;
+int mat_smul_(matrix *m, LINALG_SCALAR s) {
+    size_t i, len;
 
-    len = m->rows * m->cols;
-    for (i = 0; i < len; i++) {
-        m->data[i] /= s;
+    STATS_OP(mat_smul_);
+    if (own(m) != 0) {
+        return LAMAT_ALLOC;
+    }
+    len = mat_len(m->rows, m->cols, m->layout);
+    if (!blas_scal(s, m->data, len)) {
+        for (i = 0; i < len; i++) {
+            m->data[i] *= s;
+        }
     }
+    STATS_FLOPS((long long)m->rows * m->cols);
     return 0;
 }
 
 
-int mat_transpose(const matrix *m, matrix *out) {
+int mat_sdiv(const matrix *m, LINALG_SCALAR s, matrix *out) {
     int err;
     matrix *tmp;
 
+    STATS_OP(mat_sdiv);
     err = mat_dup(&tmp, m);
     if (err != 0) {
         return err;
     }
-    err = mat_transpose_(tmp);
+
+    err = mat_sdiv_(tmp, s);
     if (err != 0) {
         mat_del(tmp);
         return err;
@@ -433,21 +1568,389 @@ int mat_transpose(const matrix *m, matrix *out) {
 }
 
 
+int mat_sdiv_(matrix *m, LINALG_SCALAR s) {
+    size_t i, len;
+
+    STATS_OP(mat_sdiv_);
+    if (own(m) != 0) {
+        return LAMAT_ALLOC;
+    }
+    len = mat_len(m->rows, m->cols, m->layout);
+    for (i = 0; i < len; i++) {
+        m->data[i] /= s;
+    }
+    STATS_FLOPS((long long)m->rows * m->cols);
+    return 0;
+}
+
+
+int mat_map(const matrix *m, vm_func f, void *ctx, matrix *out) {
+    size_t len;
+
+    STATS_OP(mat_map);
+    len = mat_len(m->rows, m->cols, m->layout);
+    if (out != m) {
+        out->rows = m->rows;
+        out->cols = m->cols;
+        out->layout = m->layout;
+        out->data = data_realloc(out->data, len * sizeof(*out->data));
+        STATS_ALLOC(len * sizeof(*out->data));
+    } else if (own(out) != 0) {
+        return LAMAT_ALLOC;
+    }
+    vm_apply(f, ctx, out->data, m->data, len);
+    STATS_FLOPS((long long)m->rows * m->cols);
+    return 0;
+}
+
+
+int mat_map_(matrix *m, vm_func f, void *ctx) {
+    STATS_OP(mat_map_);
+    if (own(m) != 0) {
+        return LAMAT_ALLOC;
+    }
+    vm_apply(f, ctx, m->data, m->data,
+            mat_len(m->rows, m->cols, m->layout));
+    STATS_FLOPS((long long)m->rows * m->cols);
+    return 0;
+}
+
+
+int mat_transpose(const matrix *m, matrix *out) {
+    STATS_OP(mat_transpose);
+    if (out == m) {
+        return mat_transpose_(out);
+    }
+
+    out->rows = m->cols;
+    out->cols = m->rows;
+    out->layout = m->layout;
+    out->data = data_realloc(out->data,
+            mat_len(out->rows, out->cols, out->layout) * sizeof(*out->data));
+    STATS_ALLOC(mat_len(out->rows, out->cols, out->layout)
+            * sizeof(*out->data));
+
+    if (m->layout == LAMAT_TILED) {
+        transpose_tiles(m, out, tune_params());
+    } else {
+        kern_transpose(m->data, out->data, m->rows, m->cols, tune_params());
+    }
+    return 0;
+}
+
+
 int mat_transpose_(matrix *m) {
+    int rows;
+    size_t bytelen;
+    LINALG_SCALAR *data;
+    matrix dst;
+
+    STATS_OP(mat_transpose_);
+    bytelen = mat_len(m->cols, m->rows, m->layout) * sizeof(*data);
+    data = data_alloc(bytelen);
+    STATS_ALLOC(bytelen);
+
+    if (m->layout == LAMAT_TILED) {
+        dst = view(data, m->cols, m->rows, m->layout);
+        transpose_tiles(m, &dst, tune_params());
+    } else {
+        kern_transpose(m->data, data, m->rows, m->cols, tune_params());
+    }
+
+    data_free(m->data);
+    m->data = data;
+    rows = m->rows;
+    m->rows = m->cols;
+    m->cols = rows;
+    return 0;
+}
+
+
+/* Copies row si of src into row di of dst, which has as many columns
+ * and possibly another layout, a tile at a time. */
+static void copy_row(const matrix *dst, int di, const matrix *src, int si) {
+    int j0, w, ld;
+
+    if (dst->layout == LAMAT_ROW_MAJOR && src->layout == LAMAT_ROW_MAJOR) {
+        memcpy(dst->data + (size_t)di * dst->cols,
+                src->data + (size_t)si * src->cols,
+                src->cols * sizeof(*dst->data));
+        return;
+    }
+    for (j0 = 0; j0 < src->cols; j0 += LAMAT_TILE) {
+        w = j0 + LAMAT_TILE < src->cols ? LAMAT_TILE : src->cols - j0;
+        memcpy(mat_at(dst, di, j0, &ld), mat_at(src, si, j0, &ld),
+                w * sizeof(*dst->data));
+    }
+}
+
+
+/* Returns LAMAT_OOB if any of the n indices in idx is outside
+ * [0, len), else 0. */
+static int check_indices(const int *idx, int n, int len) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (idx[i] < 0 || idx[i] >= len) {
+            return LAMAT_OOB;
+        }
+    }
+    return 0;
+}
+
+
+/* Returns 0 if perm holds every index of [0, n) once, else LAMAT_OOB
+ * or LAMAT_INVALID. seen is scratch for n flags, all left set on
+ * success. */
+static int check_perm(const int *perm, int n, unsigned char *seen) {
+    int i, err;
+
+    err = check_indices(perm, n, n);
+    if (err != 0) {
+        return err;
+    }
+    for (i = 0; i < n; i++) {
+        seen[i] = 0;
+    }
+    for (i = 0; i < n; i++) {
+        if (seen[perm[i]]) {
+            return LAMAT_INVALID;
+        }
+        seen[perm[i]] = 1;
+    }
+    return 0;
+}
+
+
+/* Rows idx[i] of m, copied into or from rows i of rows. The rows are
+ * not prefetched by hand: their loads do not depend on one another, so
+ * the core already overlaps them, and the hardware prefetchers follow
+ * each row past its first lines. Measured, prefetching a few rows ahead
+ * only added instructions. */
+struct row_move {
+    const matrix *m;
+    const matrix *rows;
+    const int *idx;
+    int n;              /* indices, for scatter_part */
+};
+
+
+static void gather_part(void *ctx, int index, long lo, long hi) {
+    const struct row_move *r = ctx;
+    long i;
+
+    (void)index;
+    for (i = lo; i < hi; i++) {
+        copy_row(r->rows, i, r->m, r->idx[i]);
+    }
+}
+
+
+/* Parts of a scatter take the rows of m in [lo, hi) rather than a share
+ * of the indices, so that every row is written by one thread, in the
+ * order of the indices, and the last of repeated indices wins. Each
+ * part reads all of idx, a fraction of the rows it moves. */
+static void scatter_part(void *ctx, int index, long lo, long hi) {
+    const struct row_move *r = ctx;
+    int i;
+
+    (void)index;
+    for (i = 0; i < r->n; i++) {
+        if (r->idx[i] >= lo && r->idx[i] < hi) {
+            copy_row(r->m, r->idx[i], r->rows, i);
+        }
+    }
+}
+
+
+/* Number of parts for moving n rows of m, one if they are empty */
+static int row_parts(const matrix *m, int n) {
+    if (m->cols == 0) {
+        return 1;
+    }
+    return par_parts(n,
+            PAR_GRAIN_BYTES / ((long)m->cols * sizeof(*m->data)) + 1);
+}
+
+
+int mat_gather_rows(const matrix *m, const int *idx, int n, matrix *out) {
+    struct row_move r;
+    LINALG_SCALAR *data;
+    matrix dst;
+    size_t bytelen;
+    int err;
+
+    STATS_OP(mat_gather_rows);
+    if (n <= 0) {
+        return LAMAT_INVALID;
+    }
+    err = check_indices(idx, n, m->rows);
+    if (err != 0) {
+        return err;
+    }
+
+    bytelen = mat_len(n, m->cols, m->layout) * sizeof(*data);
+    if (out == m) {
+        data = data_alloc(bytelen);
+    } else {
+        data = data_realloc(out->data, bytelen);
+        out->data = data;
+    }
+    STATS_ALLOC(bytelen);
+    STATS_COPY((long long)n * m->cols * sizeof(*data));
+
+    /* Rows without columns leave nothing to move */
+    if (m->cols > 0) {
+        dst = view(data, n, m->cols, m->layout);
+        r.m = m;
+        r.rows = &dst;
+        r.idx = idx;
+        par_for(n, row_parts(m, n), gather_part, &r);
+    }
+
+    if (data != out->data) {
+        data_free(out->data);
+        out->data = data;
+    }
+    out->rows = n;
+    out->cols = m->cols;
+    out->layout = m->layout;
+    return 0;
+}
+
+
+int mat_scatter_rows(matrix *m, const int *idx, int n, const matrix *src) {
+    struct row_move r;
     int err;
-    int i, j;
-    matrix *aux;
 
-    err = mat_new(&aux, NULL, m->cols, m->rows);
+    STATS_OP(mat_scatter_rows);
+    if (src == m) {
+        return LAMAT_INVALID;
+    }
+    if (src->rows != n || src->cols != m->cols) {
+        return LAMAT_INCOMPATIBLE_DIM;
+    }
+    err = check_indices(idx, n, m->rows);
+    if (err != 0 || m->cols == 0) {
+        return err;
+    }
+
+    if (own(m) != 0) {
+        return LAMAT_ALLOC;
+    }
+    STATS_COPY((long long)n * m->cols * sizeof(*m->data));
+    r.m = m;
+    r.rows = src;
+    r.idx = idx;
+    r.n = n;
+    par_for(m->rows, row_parts(m, n), scatter_part, &r);
+    return 0;
+}
+
+
+int mat_permute_rows(matrix *m, const int *perm) {
+    LINALG_SCALAR *w;
+    unsigned char *seen;
+    matrix tmp;
+    int i, j, k, err;
+
+    STATS_OP(mat_permute_rows);
+    w = workspace(m->cols + (m->rows + sizeof(*w) - 1) / sizeof(*w));
+    if (w == NULL) {
+        return LAMAT_ALLOC;
+    }
+    seen = (unsigned char *)(w + m->cols);
+    err = check_perm(perm, m->rows, seen);
+    if (err == 0) {
+        err = own(m);
+    }
     if (err != 0) {
+        ws_trim();
         return err;
     }
+
+    STATS_COPY((long long)m->rows * m->cols * sizeof(*m->data));
+    /* Every cycle of perm moves its rows up by one, the row of its
+     * start going through tmp, so only rows outside of place move.
+     * seen is cleared for the rows done. */
+    tmp = view(w, 1, m->cols, LAMAT_ROW_MAJOR);
     for (i = 0; i < m->rows; i++) {
-        for (j = 0; j < m->cols; j++) {
-            mat_set(aux, j, i, mat_get(m, i, j));
+        if (!seen[i] || perm[i] == i) {
+            continue;
         }
+        copy_row(&tmp, 0, m, i);
+        for (j = i; perm[j] != i; j = k) {
+            k = perm[j];
+            copy_row(m, j, m, k);
+            seen[j] = 0;
+        }
+        copy_row(m, j, &tmp, 0);
+        seen[j] = 0;
     }
-    err = mat_cpy(m, aux);
-    mat_del(aux);
-    return err;
+    ws_trim();
+    return 0;
+}
+
+
+/* Columns of m rearranged as perm says, in rows of their own using two
+ * rows of scratch per part */
+struct col_perm {
+    matrix *m;
+    const int *perm;
+    LINALG_SCALAR *w;
+};
+
+
+static void permute_cols_part(void *ctx, int index, long lo, long hi) {
+    const struct col_perm *c = ctx;
+    LINALG_SCALAR *row, *d;
+    matrix src, dst;
+    long i;
+    int j, cols = c->m->cols;
+
+    row = c->w + (size_t)index * 2 * cols;
+    src = view(row, 1, cols, LAMAT_ROW_MAJOR);
+    dst = view(row + cols, 1, cols, LAMAT_ROW_MAJOR);
+    for (i = lo; i < hi; i++) {
+        copy_row(&src, 0, c->m, i);
+        d = c->m->layout == LAMAT_ROW_MAJOR
+            ? c->m->data + (size_t)i * cols : dst.data;
+        for (j = 0; j < cols; j++) {
+            d[j] = row[c->perm[j]];
+        }
+        if (d == dst.data) {
+            copy_row(c->m, i, &dst, 0);
+        }
+    }
+}
+
+
+int mat_permute_cols(matrix *m, const int *perm) {
+    struct col_perm c;
+    unsigned char *seen;
+    int parts, err;
+
+    STATS_OP(mat_permute_cols);
+    parts = row_parts(m, m->rows);
+    c.w = workspace((size_t)parts * 2 * m->cols
+            + (m->cols + sizeof(*c.w) - 1) / sizeof(*c.w));
+    if (c.w == NULL) {
+        return LAMAT_ALLOC;
+    }
+    seen = (unsigned char *)(c.w + (size_t)parts * 2 * m->cols);
+    err = check_perm(perm, m->cols, seen);
+    if (err == 0 && m->cols > 0) {
+        err = own(m);
+    }
+    if (err != 0 || m->cols == 0) {
+        ws_trim();
+        return err;
+    }
+
+    STATS_COPY((long long)m->rows * m->cols * sizeof(*m->data));
+    c.m = m;
+    c.perm = perm;
+    par_for(m->rows, parts, permute_cols_part, &c);
+    ws_trim();
+    return 0;
 }
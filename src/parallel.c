@@ -0,0 +1,184 @@
+#include "placement.h"
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+
+/* Most parts par_for splits a range into */
+#define PAR_MAX_PARTS 64
+
+/* Online CPUs, counted once: sysconf reads them from /sys */
+static long cpus;
+static pthread_once_t cpus_once = PTHREAD_ONCE_INIT;
+
+/* Workers of par_for: one per online CPU but the caller's, started by
+ * the first loop split into parts and kept until the process exits,
+ * pinned round-robin over the NUMA nodes like those of a linalg_queue.
+ * They run one loop at a time, handed to them by bumping gen. Its parts
+ * are spread over the nodes in order, like the pages of LANUMA_BLOCKED
+ * storage, part i going to node i * nodes / parts; workers take those
+ * of their node in turn from its entry of next, then help the others. */
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+    unsigned gen;
+    int busy;                       /* a loop holds the workers */
+    int pending;                    /* workers still in the loop */
+    int nthreads;
+
+    par_func f;
+    void *ctx;
+    long n;
+    int parts;
+    int nodes;
+    atomic_int next[PAR_MAX_PARTS]; /* next part of each node */
+} pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER
+};
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+
+static void count_cpus(void) {
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+}
+
+
+int par_parts(long n, long grain) {
+    long parts;
+
+    pthread_once(&cpus_once, count_cpus);
+    parts = grain > 0 ? n / grain : n;
+    parts = parts < cpus ? parts : cpus;
+    parts = parts < PAR_MAX_PARTS ? parts : PAR_MAX_PARTS;
+    return parts > 1 ? (int)parts : 1;
+}
+
+
+/* First part of the current loop that goes to node */
+static int first_part(int node) {
+    return (int)(((long)node * pool.parts + pool.nodes - 1) / pool.nodes);
+}
+
+
+/* Runs the parts of the current loop not yet taken, those of node
+ * first */
+static void run_parts(int node) {
+    long n = pool.n;
+    int i, k, cur, end, parts = pool.parts;
+
+    for (k = 0; k < pool.nodes; k++) {
+        cur = (node + k) % pool.nodes;
+        end = first_part(cur + 1);
+        while ((i = atomic_fetch_add_explicit(&pool.next[cur], 1,
+                        memory_order_relaxed)) < end) {
+            pool.f(pool.ctx, i, n * i / parts, n * (i + 1) / parts);
+        }
+    }
+}
+
+
+static void *worker(void *arg) {
+    int node = (int)(intptr_t)arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.gen == seen) {
+            pthread_cond_wait(&pool.start_cond, &pool.lock);
+        }
+        seen = pool.gen;
+
+        pthread_mutex_unlock(&pool.lock);
+        run_parts(node);
+        pthread_mutex_lock(&pool.lock);
+
+        if (--pool.pending == 0) {
+            pthread_cond_signal(&pool.done_cond);
+        }
+    }
+    return NULL;
+}
+
+
+static void start_pool(void) {
+    pthread_t thread;
+    long threads;
+    int i, nodes;
+
+    pthread_once(&cpus_once, count_cpus);
+    threads = cpus < PAR_MAX_PARTS ? cpus - 1 : PAR_MAX_PARTS - 1;
+    nodes = linalg_numa_nodes();
+    /* Loops have at most PAR_MAX_PARTS parts, no more nodes get any */
+    pool.nodes = nodes < PAR_MAX_PARTS ? nodes : PAR_MAX_PARTS;
+    /* Loops run on the workers that could be started, if any */
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&thread, NULL, worker,
+                    (void *)(intptr_t)(i % pool.nodes)) != 0) {
+            break;
+        }
+        pthread_detach(thread);
+        /* Best effort, a worker that cannot be pinned still runs */
+        if (nodes > 1) {
+            numa_pin(thread, i % nodes);
+        }
+    }
+    pool.nthreads = i;
+}
+
+
+/* Runs every part of a loop on the calling thread */
+static void run_inline(long n, int parts, par_func f, void *ctx) {
+    int i;
+
+    for (i = 0; i < parts; i++) {
+        f(ctx, i, n * i / parts, n * (i + 1) / parts);
+    }
+}
+
+
+void par_for(long n, int parts, par_func f, void *ctx) {
+    int k;
+
+    parts = parts < PAR_MAX_PARTS ? parts : PAR_MAX_PARTS;
+    if (parts <= 1) {
+        run_inline(n, parts, f, ctx);
+        return;
+    }
+
+    pthread_once(&pool_once, start_pool);
+    pthread_mutex_lock(&pool.lock);
+    if (pool.busy || pool.nthreads == 0) {
+        /* The workers are taken, for instance by the loop this one
+         * runs in */
+        pthread_mutex_unlock(&pool.lock);
+        run_inline(n, parts, f, ctx);
+        return;
+    }
+    pool.busy = 1;
+    pool.f = f;
+    pool.ctx = ctx;
+    pool.n = n;
+    pool.parts = parts;
+    for (k = 0; k < pool.nodes; k++) {
+        atomic_store_explicit(&pool.next[k], first_part(k),
+                memory_order_relaxed);
+    }
+    pool.pending = pool.nthreads;
+    pool.gen++;
+    pthread_cond_broadcast(&pool.start_cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    /* The caller is not pinned, and starts with the parts of node 0 */
+    run_parts(0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.pending > 0) {
+        pthread_cond_wait(&pool.done_cond, &pool.lock);
+    }
+    pool.busy = 0;
+    pthread_mutex_unlock(&pool.lock);
+}
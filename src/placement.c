@@ -0,0 +1,382 @@
+#define _GNU_SOURCE
+#include "placement.h"
+#include "internal.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Memory policies of mbind(2), from linux/mempolicy.h */
+#define MPOL_DEFAULT 0
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#define MPOL_MF_MOVE (1 << 1)
+
+/* Largest number of nodes handled */
+#define MAX_NODES 1024
+
+#define HDR_BYTES DATA_HDR_BYTES
+
+struct hdr {
+    size_t len;     /* bytes of data */
+    size_t map;     /* bytes mapped with mmap, 0 if from malloc */
+    /* For buffers of data_wrap, called by data_free, else NULL */
+    void (*release)(void *);
+    int readonly;
+    atomic_int refs;    /* holders of the buffer */
+};
+
+static atomic_int cur_policy = LANUMA_DEFAULT;
+static atomic_int cur_node = 0;
+
+
+int linalg_numa_nodes(void) {
+    static atomic_int nodes = 0;
+    char buf[256];
+    const char *p;
+    int n, r;
+    FILE *f;
+
+    r = atomic_load_explicit(&nodes, memory_order_relaxed);
+    if (r > 0) {
+        return r;
+    }
+
+    /* The online list looks like "0-1" or "0,2-3"; the highest
+     * node number is the last one in it */
+    r = 1;
+    f = fopen("/sys/devices/system/node/online", "r");
+    if (f != NULL) {
+        if (fgets(buf, sizeof(buf), f) != NULL) {
+            p = buf + strcspn(buf, "\n");
+            while (p > buf && (p[-1] >= '0' && p[-1] <= '9')) {
+                p--;
+            }
+            n = atoi(p) + 1;
+            r = n > 0 && n <= MAX_NODES ? n : 1;
+        }
+        fclose(f);
+    }
+    atomic_store_explicit(&nodes, r, memory_order_relaxed);
+    return r;
+}
+
+
+int linalg_numa_policy(int policy, int node) {
+    if (policy < LANUMA_DEFAULT || policy > LANUMA_BLOCKED
+            || (policy == LANUMA_BIND
+                && (node < 0 || node >= linalg_numa_nodes()))) {
+        return LANUMA_INVALID;
+    }
+    atomic_store(&cur_node, node);
+    atomic_store(&cur_policy, policy);
+    return 0;
+}
+
+
+static void set_node(unsigned long *mask, int node) {
+    mask[node / (8 * sizeof(*mask))] |= 1UL << (node % (8 * sizeof(*mask)));
+}
+
+
+static long mbind_nodes(void *addr, size_t len, int mode,
+        const unsigned long *mask, unsigned flags) {
+    return syscall(SYS_mbind, addr, len, mode, mask,
+            (unsigned long)MAX_NODES + 1, flags);
+}
+
+
+/* Applies policy to the page aligned range [base, base + len).
+ * Returns nonzero if the kernel refused it. */
+static int place(void *base, size_t len, int policy, int node,
+        unsigned flags) {
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t start, end;
+    int nodes = linalg_numa_nodes();
+    int i, err = 0;
+
+    memset(mask, 0, sizeof(mask));
+    switch (policy) {
+        case LANUMA_INTERLEAVE:
+            for (i = 0; i < nodes; i++) {
+                set_node(mask, i);
+            }
+            return mbind_nodes(base, len, MPOL_INTERLEAVE, mask, flags) != 0;
+        case LANUMA_BIND:
+            set_node(mask, node);
+            return mbind_nodes(base, len, MPOL_BIND, mask, flags) != 0;
+        case LANUMA_BLOCKED:
+            for (i = 0; i < nodes; i++) {
+                start = len / page * i / nodes * page;
+                end = i + 1 < nodes
+                    ? len / page * (i + 1) / nodes * page : len;
+                if (end <= start) {
+                    continue;
+                }
+                memset(mask, 0, sizeof(mask));
+                set_node(mask, i);
+                err |= mbind_nodes((char *)base + start, end - start,
+                        MPOL_BIND, mask, flags) != 0;
+            }
+            return err;
+    }
+    return mbind_nodes(base, len, MPOL_DEFAULT, NULL, flags) != 0;
+}
+
+
+static struct hdr *hdr_of(void *p) {
+    return (struct hdr *)((char *)p - HDR_BYTES);
+}
+
+
+/* Allocates len bytes placed with policy. Placement is best effort:
+ * if the kernel refuses it, *refused is set and the memory is
+ * still returned. */
+static void *alloc_placed(size_t len, int policy, int node, int *refused) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t map;
+    struct hdr *h;
+    char *base;
+
+    if (policy == LANUMA_DEFAULT) {
+        h = malloc(HDR_BYTES + len);
+        if (h == NULL) {
+            return NULL;
+        }
+        h->len = len;
+        h->map = 0;
+        h->release = NULL;
+        h->readonly = 0;
+        atomic_init(&h->refs, 1);
+        return (char *)h + HDR_BYTES;
+    }
+
+    map = (HDR_BYTES + len + page - 1) / page * page;
+    base = mmap(NULL, map, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    /* Nothing is touched yet, so the pages are placed as they fault in */
+    if (place(base, map, policy, node, 0) != 0 && refused != NULL) {
+        *refused = 1;
+    }
+    h = (struct hdr *)base;
+    h->len = len;
+    h->map = map;
+    h->release = NULL;
+    h->readonly = 0;
+    atomic_init(&h->refs, 1);
+    return base + HDR_BYTES;
+}
+
+
+void *data_wrap(void *p, size_t len, int readonly, void (*release)(void *)) {
+    struct hdr *h = hdr_of(p);
+
+    h->len = len;
+    h->map = 0;
+    h->release = release;
+    h->readonly = readonly;
+    atomic_init(&h->refs, 1);
+    return p;
+}
+
+
+void *data_alloc(size_t len) {
+    int policy = atomic_load_explicit(&cur_policy, memory_order_relaxed);
+
+    if (len < LANUMA_MIN_BYTES) {
+        policy = LANUMA_DEFAULT;
+    }
+    return alloc_placed(len, policy,
+            atomic_load_explicit(&cur_node, memory_order_relaxed), NULL);
+}
+
+
+void data_free(void *p) {
+    struct hdr *h;
+
+    if (p == NULL) {
+        return;
+    }
+    h = hdr_of(p);
+    /* The last holder frees it, after the writes of all the others */
+    if (atomic_fetch_sub_explicit(&h->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    if (h->release != NULL) {
+        h->release(p);
+    } else if (h->map != 0) {
+        munmap(h, h->map);
+    } else {
+        free(h);
+    }
+}
+
+
+void *data_realloc(void *p, size_t len) {
+    struct hdr *h;
+    void *r;
+
+    if (p == NULL) {
+        return data_alloc(len);
+    }
+    h = hdr_of(p);
+    if (atomic_load_explicit(&h->refs, memory_order_acquire) > 1) {
+        /* Shared storage is left to its other holders */
+    } else if (h->release != NULL) {
+        /* Wrapped storage can only be reused as it is */
+        if (!h->readonly && len == h->len) {
+            return p;
+        }
+    } else if (h->map == 0 && (len < LANUMA_MIN_BYTES || atomic_load_explicit(
+                    &cur_policy, memory_order_relaxed) == LANUMA_DEFAULT)) {
+        h = realloc(h, HDR_BYTES + len);
+        if (h == NULL) {
+            return NULL;
+        }
+        h->len = len;
+        return (char *)h + HDR_BYTES;
+    }
+    if (h->map != 0 && HDR_BYTES + len <= h->map
+            && atomic_load_explicit(&h->refs, memory_order_relaxed) == 1) {
+        /* Still fits and keeps its placement */
+        h->len = len;
+        return p;
+    }
+
+    r = data_alloc(len);
+    if (r == NULL) {
+        return NULL;
+    }
+    memcpy(r, p, h->len < len ? h->len : len);
+    data_free(p);
+    return r;
+}
+
+
+void *data_copy(void *dst, void *src, size_t len) {
+    void *r;
+
+    if (src == dst) {
+        return dst;
+    }
+    /* Only empty matrices and vectors have no storage */
+    if (src != NULL && hdr_of(src)->release == NULL
+            && (dst == NULL || hdr_of(dst)->release == NULL)) {
+        atomic_fetch_add_explicit(&hdr_of(src)->refs, 1,
+                memory_order_relaxed);
+        data_free(dst);
+        return src;
+    }
+    r = data_realloc(dst, len);
+    if (r != NULL && len > 0) {
+        memcpy(r, src, len);
+    }
+    return r;
+}
+
+
+void *data_own(void *p, int writable) {
+    struct hdr *h;
+    void *r;
+
+    if (p == NULL) {
+        return NULL;
+    }
+    h = hdr_of(p);
+    if (atomic_load_explicit(&h->refs, memory_order_acquire) == 1
+            && !(writable && h->readonly)) {
+        return p;
+    }
+    r = data_alloc(h->len);
+    if (r == NULL) {
+        return NULL;
+    }
+    memcpy(r, p, h->len);
+    data_free(p);
+    return r;
+}
+
+
+/* Replaces *data, of len bytes, with a copy placed with policy */
+static int move(LINALG_SCALAR **data, size_t len, int policy, int node) {
+    LINALG_SCALAR *r;
+    int refused = 0;
+
+    if (policy < LANUMA_DEFAULT || policy > LANUMA_BLOCKED
+            || (policy == LANUMA_BIND
+                && (node < 0 || node >= linalg_numa_nodes()))) {
+        return LANUMA_INVALID;
+    }
+    /* Attached storage is where the other processes see it */
+    if (*data != NULL && hdr_of(*data)->release != NULL) {
+        return LANUMA_ATTACHED;
+    }
+    r = alloc_placed(len, policy, node, &refused);
+    if (r == NULL) {
+        return LANUMA_UNSUPPORTED;
+    }
+    memcpy(r, *data, len);
+    data_free(*data);
+    *data = r;
+    return refused ? LANUMA_UNSUPPORTED : 0;
+}
+
+
+int mat_place(matrix *m, int policy, int node) {
+    return move(&m->data,
+            mat_len(m->rows, m->cols, m->layout) * sizeof(*m->data),
+            policy, node);
+}
+
+
+int vec_place(vector *v, int policy, int node) {
+    return move(&v->data, (size_t)v->dim * sizeof(*v->data), policy, node);
+}
+
+
+int numa_pin(pthread_t thread, int node) {
+    cpu_set_t set;
+    char path[64], buf[4096];
+    char *p, *end;
+    long lo, hi, c;
+    FILE *f;
+
+    snprintf(path, sizeof(path),
+            "/sys/devices/system/node/node%d/cpulist", node);
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return 1;
+    }
+    p = fgets(buf, sizeof(buf), f);
+    fclose(f);
+    if (p == NULL) {
+        return 1;
+    }
+
+    /* Ranges like "0-3,8-11" */
+    CPU_ZERO(&set);
+    while (*p >= '0' && *p <= '9') {
+        lo = hi = strtol(p, &end, 10);
+        if (*end == '-') {
+            hi = strtol(end + 1, &end, 10);
+        }
+        for (c = lo; c <= hi && c < CPU_SETSIZE; c++) {
+            CPU_SET(c, &set);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    if (CPU_COUNT(&set) == 0) {
+        return 1;
+    }
+    return pthread_setaffinity_np(thread, sizeof(set), &set);
+}
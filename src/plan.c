@@ -0,0 +1,178 @@
+#include "plan.h"
+#include "summation.h"
+#include "internal.h"
+
+#include <stdlib.h>
+
+/* Smallest share of a product, in multiply-adds, worth a thread of
+ * its own */
+#define PLAN_MIN_WORK (1L << 20)
+
+
+/* Kernels a plan may settle on, in the order mat_mul tries them */
+enum kind {
+    KIND_STRASSEN,
+    KIND_BLAS,
+    KIND_SUM,
+    KIND_SPEC,
+    KIND_GEMM
+};
+
+struct plan {
+    int rows, inner, cols;
+    enum kind kind;
+    int mode;                       /* summation mode of KIND_SUM */
+    spec_gemm_fn spec;              /* kernel of KIND_SPEC */
+    struct linalg_tuning t;
+
+    /* Bands of rows of the product, run as the parts of a par_for,
+     * each with wslen elements of ws of its own */
+    LINALG_SCALAR *ws;
+    size_t wslen;
+    int nbands;
+
+    /* Operands of the current execution */
+    const LINALG_SCALAR *a, *b;
+    LINALG_SCALAR *c;
+};
+
+
+/* Rows lo to hi of the product, band index */
+static void run_band(void *ctx, int index, long lo, long hi) {
+    const plan *p = ctx;
+    size_t off = (size_t)lo;
+    int rows = (int)(hi - lo);
+
+    if (p->kind == KIND_SUM) {
+        sum_gemm_ws(p->a + off * p->inner, p->b, p->c + off * p->cols,
+                rows, p->inner, p->cols, p->mode,
+                p->ws != NULL ? p->ws + p->wslen * index : NULL, &p->t);
+    } else {
+        kern_gemm(p->a + off * p->inner, p->b, p->c + off * p->cols,
+                rows, p->inner, p->cols, &p->t);
+    }
+}
+
+
+/* Number of bands to split the rows of p into */
+static int nbands(const plan *p, int flags) {
+    int n;
+
+    if (!(flags & LAPLAN_THREADS)
+            || (p->kind != KIND_SUM && p->kind != KIND_GEMM)) {
+        return 1;
+    }
+    n = par_parts((long)p->rows * p->inner * p->cols, PLAN_MIN_WORK);
+    return n < p->rows ? n : p->rows;
+}
+
+
+int mat_mul_plan(plan **p, int rows, int inner, int cols, int flags) {
+    plan *r;
+    size_t wslen = 0;
+
+    if (rows <= 0 || inner <= 0 || cols <= 0
+            || (flags & ~(LAPLAN_STRASSEN | LAPLAN_THREADS)) != 0) {
+        return LAPLAN_INVALID;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return LAPLAN_ALLOC;
+    }
+    r->rows = rows;
+    r->inner = inner;
+    r->cols = cols;
+    r->t = *tune_params();
+    r->mode = sum_policy();
+
+    if ((flags & LAPLAN_STRASSEN) && rows == inner && inner == cols) {
+        r->kind = KIND_STRASSEN;
+        wslen = kern_strassen_len(rows, &r->t);
+    } else if (r->mode == LASUM_NAIVE
+            && blas_used((long long)rows * inner * cols)) {
+        r->kind = KIND_BLAS;
+    } else if (r->mode != LASUM_NAIVE) {
+        r->kind = KIND_SUM;
+        wslen = sum_gemm_len(inner, r->mode, &r->t);
+    } else if ((r->spec = spec_gemm_find(rows, inner, cols)) != NULL) {
+        r->kind = KIND_SPEC;
+    } else {
+        r->kind = KIND_GEMM;
+    }
+
+    r->nbands = nbands(r, flags);
+    r->wslen = wslen;
+    if (wslen > 0) {
+        r->ws = malloc(wslen * r->nbands * sizeof(*r->ws));
+        if (r->ws == NULL) {
+            free(r);
+            return LAPLAN_ALLOC;
+        }
+    }
+
+    *p = r;
+    return 0;
+}
+
+
+int plan_del(plan *p) {
+    free(p->ws);
+    free(p);
+    return 0;
+}
+
+
+int plan_execute(plan *p, const matrix *a, const matrix *b, matrix *out) {
+    size_t len = (size_t)p->rows * p->cols;
+    LINALG_SCALAR *data;
+
+    if (a->rows != p->rows || a->cols != p->inner || b->rows != p->inner
+            || b->cols != p->cols) {
+        return LAPLAN_INCOMPATIBLE_DIM;
+    }
+    if (a->layout != LAMAT_ROW_MAJOR || b->layout != LAMAT_ROW_MAJOR
+            || out == a || out == b) {
+        return LAPLAN_INVALID;
+    }
+
+    /* Storage shared with a or b, among others, is replaced rather
+     * than written through */
+    if (out->rows == p->rows && out->cols == p->cols
+            && out->layout == LAMAT_ROW_MAJOR) {
+        data = data_own(out->data, 1);
+    } else {
+        data = data_realloc(out->data, len * sizeof(*data));
+    }
+    if (data == NULL) {
+        return LAPLAN_ALLOC;
+    }
+    out->data = data;
+    out->rows = p->rows;
+    out->cols = p->cols;
+    out->layout = LAMAT_ROW_MAJOR;
+
+    switch (p->kind) {
+    case KIND_STRASSEN:
+        kern_strassen_ws(a->data, b->data, data, p->rows, p->ws, &p->t);
+        break;
+    case KIND_BLAS:
+        /* Unless the backend has been switched off since */
+        if (!blas_gemm(a->data, b->data, data, p->rows, p->inner, p->cols)) {
+            kern_gemm(a->data, b->data, data, p->rows, p->inner, p->cols,
+                    &p->t);
+        }
+        break;
+    case KIND_SPEC:
+        p->spec(a->data, b->data, data);
+        break;
+    case KIND_SUM:
+    case KIND_GEMM:
+        p->a = a->data;
+        p->b = b->data;
+        p->c = data;
+        par_for(p->rows, p->nbands, run_band, p);
+        break;
+    }
+    return 0;
+}
@@ -0,0 +1,672 @@
+#include "qmatrix.h"
+#include "internal.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+struct qmatrix {
+    void *data;                 /* rows * cols elements, by rows */
+    LINALG_SCALAR *scales;      /* LAQMAT_INT8: one per row */
+    int rows;
+    int cols;
+    int format;
+};
+
+
+/* Independent partial sums per dot product, as in kern_gemv */
+#define QMAT_LANES 16
+
+/* Instruction sets the kernels are specialized for, see isa() */
+#define ISA_GENERIC 0
+#define ISA_AVX2 1          /* with FMA and F16C */
+#define ISA_AVX512 2
+#define ISA_AVX512_BF16 3
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define QMAT_X86 1
+#include <immintrin.h>
+#endif
+
+
+/* Half precision, native where the compiler has _Float16 */
+#ifdef __FLT16_MAX__
+
+typedef _Float16 half;
+
+static inline LINALG_SCALAR from_fp16(half h) {
+    return h;
+}
+
+static inline half to_fp16(LINALG_SCALAR x) {
+    return (half)x;
+}
+
+#else
+
+typedef uint16_t half;
+
+static inline LINALG_SCALAR from_fp16(half h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+    uint32_t u;
+    float f;
+
+    if (exp == 0x1f) {
+        u = sign | 0x7f800000 | (man << 13);
+    } else if (exp != 0) {
+        u = sign | ((exp + 112) << 23) | (man << 13);
+    } else {
+        /* Zero or subnormal: man * 2^-24 is exact in float */
+        f = (float)man * 5.9604644775390625e-8f;
+        memcpy(&u, &f, sizeof(u));
+        u |= sign;
+    }
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline half to_fp16(LINALG_SCALAR x) {
+    float f = x;
+    uint32_t u, sign, man;
+    int exp;
+
+    memcpy(&u, &f, sizeof(u));
+    sign = (u >> 16) & 0x8000;
+    u &= 0x7fffffff;
+    if (u > 0x7f800000) {
+        return sign | 0x7e00;
+    }
+    if (u >= 0x477ff000) {
+        /* Rounds to 65520 or more */
+        return sign | 0x7c00;
+    }
+    exp = (int)(u >> 23) - 112;
+    if (exp <= 0) {
+        /* Subnormal or zero: round to nearest multiple of 2^-24 */
+        memcpy(&f, &u, sizeof(f));
+        return sign | (uint16_t)lrintf(f * 16777216.0f);
+    }
+    man = u & 0x7fffff;
+    u = ((uint32_t)exp << 10) | (man >> 13);
+    man &= 0x1fff;
+    if (man > 0x1000 || (man == 0x1000 && (u & 1))) {
+        u++;
+    }
+    return sign | u;
+}
+
+#endif
+
+
+static inline LINALG_SCALAR from_bf16(uint16_t h) {
+    uint32_t u = (uint32_t)h << 16;
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static inline uint16_t to_bf16(LINALG_SCALAR x) {
+    float f = x;
+    uint32_t u;
+
+    memcpy(&u, &f, sizeof(u));
+    if ((u & 0x7fffffff) > 0x7f800000) {
+        /* Keep NaNs quiet */
+        return (u >> 16) | 0x40;
+    }
+    u += 0x7fff + ((u >> 16) & 1);
+    return u >> 16;
+}
+
+static inline LINALG_SCALAR from_int8(int8_t x) {
+    return x;
+}
+
+
+/* Returns the best ISA_ constant the CPU supports, or the one named by
+ * $LINALG_QMAT_ISA if lower */
+static int isa(void) {
+    static const char *const names[] = {
+        "generic", "avx2", "avx512", "avx512-bf16"
+    };
+    static atomic_int cached = -1;
+    int r = atomic_load_explicit(&cached, memory_order_relaxed);
+    const char *env;
+    int i;
+
+    if (r < 0) {
+        r = ISA_GENERIC;
+#ifdef QMAT_X86
+        __builtin_cpu_init();
+        if (sizeof(LINALG_SCALAR) == sizeof(float)
+                && __builtin_cpu_supports("avx2")
+                && __builtin_cpu_supports("fma")
+                && __builtin_cpu_supports("f16c")) {
+            r = ISA_AVX2;
+            if (__builtin_cpu_supports("avx512f")) {
+                r = __builtin_cpu_supports("avx512bf16")
+                    ? ISA_AVX512_BF16 : ISA_AVX512;
+            }
+        }
+#endif
+        if ((env = getenv("LINALG_QMAT_ISA")) != NULL) {
+            for (i = 0; i < r; i++) {
+                if (strcmp(env, names[i]) == 0) {
+                    r = i;
+                }
+            }
+        }
+        atomic_store_explicit(&cached, r, memory_order_relaxed);
+    }
+    return r;
+}
+
+
+/* Defines, for a storage type and its conversion to LINALG_SCALAR:
+ *  - gemv_NAME: out[i] = scale[i] * (w[i] . v) for rows i, with scale
+ *    NULL meaning 1;
+ *  - expand_NAME: out[i] = scale * w[i] for n elements. */
+#define QMAT_KERNELS(name, type, load) \
+    static void gemv_##name(const type *w, const LINALG_SCALAR *scale, \
+            const LINALG_SCALAR *v, LINALG_SCALAR *out, int rows, \
+            int cols) { \
+        LINALG_SCALAR acc[QMAT_LANES], s; \
+        const type *row; \
+        int i, j, l; \
+        for (i = 0; i < rows; i++) { \
+            row = w + (size_t)i * cols; \
+            for (l = 0; l < QMAT_LANES; l++) { \
+                acc[l] = 0; \
+            } \
+            for (j = 0; j + QMAT_LANES <= cols; j += QMAT_LANES) { \
+                for (l = 0; l < QMAT_LANES; l++) { \
+                    acc[l] += load(row[j + l]) * v[j + l]; \
+                } \
+            } \
+            s = 0; \
+            for (l = 0; l < QMAT_LANES; l++) { \
+                s += acc[l]; \
+            } \
+            for (; j < cols; j++) { \
+                s += load(row[j]) * v[j]; \
+            } \
+            out[i] = scale != NULL ? s * scale[i] : s; \
+        } \
+    } \
+    static void expand_##name(const type *w, LINALG_SCALAR scale, \
+            LINALG_SCALAR *out, size_t n) { \
+        size_t i; \
+        for (i = 0; i < n; i++) { \
+            out[i] = load(w[i]) * scale; \
+        } \
+    }
+
+QMAT_KERNELS(bf16, uint16_t, from_bf16)
+QMAT_KERNELS(fp16, half, from_fp16)
+QMAT_KERNELS(int8, int8_t, from_int8)
+
+#undef QMAT_KERNELS
+
+
+#ifdef QMAT_X86
+
+/* Load 16 or 8 elements from p converted to float */
+#define LOAD512_bf16(p) _mm512_castsi512_ps(_mm512_slli_epi32( \
+    _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(p))), 16))
+#define LOAD512_fp16(p) \
+    _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(p)))
+#define LOAD512_int8(p) _mm512_cvtepi32_ps( \
+    _mm512_cvtepi8_epi32(_mm_loadu_si128((const __m128i *)(p))))
+#define LOAD256_bf16(p) _mm256_castsi256_ps(_mm256_slli_epi32( \
+    _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(p))), 16))
+#define LOAD256_fp16(p) \
+    _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(p)))
+#define LOAD256_int8(p) _mm256_cvtepi32_ps( \
+    _mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i *)(p))))
+
+#define TARGET_AVX2 __attribute__((target("avx2,fma,f16c")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx2,fma,f16c")))
+
+TARGET_AVX2 static inline float hsum256(__m256 x) {
+    __m128 r = _mm_add_ps(_mm256_castps256_ps128(x),
+            _mm256_extractf128_ps(x, 1));
+    r = _mm_add_ps(r, _mm_movehl_ps(r, r));
+    r = _mm_add_ss(r, _mm_movehdup_ps(r));
+    return _mm_cvtss_f32(r);
+}
+
+/* Same as QMAT_KERNELS, for AVX2 (gemv256_NAME, expand256_NAME) and
+ * AVX-512 (gemv512_NAME, expand512_NAME). Two accumulators per row
+ * hide the latency of the multiply-adds. */
+#define QMAT_X86_KERNELS(name, type, load) \
+    TARGET_AVX512 static void gemv512_##name(const type *w, \
+            const LINALG_SCALAR *scale, const LINALG_SCALAR *v, \
+            LINALG_SCALAR *out, int rows, int cols) { \
+        __m512 a0, a1; \
+        const type *row; \
+        LINALG_SCALAR s; \
+        int i, j; \
+        for (i = 0; i < rows; i++) { \
+            row = w + (size_t)i * cols; \
+            a0 = _mm512_setzero_ps(); \
+            a1 = _mm512_setzero_ps(); \
+            for (j = 0; j + 32 <= cols; j += 32) { \
+                a0 = _mm512_fmadd_ps(LOAD512_##name(row + j), \
+                        _mm512_loadu_ps(v + j), a0); \
+                a1 = _mm512_fmadd_ps(LOAD512_##name(row + j + 16), \
+                        _mm512_loadu_ps(v + j + 16), a1); \
+            } \
+            if (j + 16 <= cols) { \
+                a0 = _mm512_fmadd_ps(LOAD512_##name(row + j), \
+                        _mm512_loadu_ps(v + j), a0); \
+                j += 16; \
+            } \
+            s = _mm512_reduce_add_ps(_mm512_add_ps(a0, a1)); \
+            for (; j < cols; j++) { \
+                s += load(row[j]) * v[j]; \
+            } \
+            out[i] = scale != NULL ? s * scale[i] : s; \
+        } \
+    } \
+    TARGET_AVX512 static void expand512_##name(const type *w, \
+            LINALG_SCALAR scale, LINALG_SCALAR *out, size_t n) { \
+        __m512 f = _mm512_set1_ps(scale); \
+        size_t i; \
+        for (i = 0; i + 16 <= n; i += 16) { \
+            _mm512_storeu_ps(out + i, _mm512_mul_ps(LOAD512_##name(w + i), f)); \
+        } \
+        for (; i < n; i++) { \
+            out[i] = load(w[i]) * scale; \
+        } \
+    } \
+    TARGET_AVX2 static void gemv256_##name(const type *w, \
+            const LINALG_SCALAR *scale, const LINALG_SCALAR *v, \
+            LINALG_SCALAR *out, int rows, int cols) { \
+        __m256 a0, a1; \
+        const type *row; \
+        LINALG_SCALAR s; \
+        int i, j; \
+        for (i = 0; i < rows; i++) { \
+            row = w + (size_t)i * cols; \
+            a0 = _mm256_setzero_ps(); \
+            a1 = _mm256_setzero_ps(); \
+            for (j = 0; j + 16 <= cols; j += 16) { \
+                a0 = _mm256_fmadd_ps(LOAD256_##name(row + j), \
+                        _mm256_loadu_ps(v + j), a0); \
+                a1 = _mm256_fmadd_ps(LOAD256_##name(row + j + 8), \
+                        _mm256_loadu_ps(v + j + 8), a1); \
+            } \
+            if (j + 8 <= cols) { \
+                a0 = _mm256_fmadd_ps(LOAD256_##name(row + j), \
+                        _mm256_loadu_ps(v + j), a0); \
+                j += 8; \
+            } \
+            s = hsum256(_mm256_add_ps(a0, a1)); \
+            for (; j < cols; j++) { \
+                s += load(row[j]) * v[j]; \
+            } \
+            out[i] = scale != NULL ? s * scale[i] : s; \
+        } \
+    } \
+    TARGET_AVX2 static void expand256_##name(const type *w, \
+            LINALG_SCALAR scale, LINALG_SCALAR *out, size_t n) { \
+        __m256 f = _mm256_set1_ps(scale); \
+        size_t i; \
+        for (i = 0; i + 8 <= n; i += 8) { \
+            _mm256_storeu_ps(out + i, _mm256_mul_ps(LOAD256_##name(w + i), f)); \
+        } \
+        for (; i < n; i++) { \
+            out[i] = load(w[i]) * scale; \
+        } \
+    }
+
+QMAT_X86_KERNELS(bf16, uint16_t, from_bf16)
+QMAT_X86_KERNELS(fp16, half, from_fp16)
+QMAT_X86_KERNELS(int8, int8_t, from_int8)
+
+#undef QMAT_X86_KERNELS
+
+
+/* Rounds n floats to bf16 with AVX512-BF16. Like the hardware
+ * instruction, flushes subnormal inputs and results to zero. */
+__attribute__((target("avx512f,avx512bf16")))
+static void pack_bf16_512(const LINALG_SCALAR *src, uint16_t *dst,
+        size_t n) {
+    __m256bh h;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        h = _mm512_cvtneps_pbh(_mm512_loadu_ps(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), (__m256i)h);
+    }
+    for (; i < n; i++) {
+        dst[i] = to_bf16(src[i]);
+    }
+}
+
+/* Rounds n floats to fp16 with F16C */
+TARGET_AVX2 static void pack_fp16_256(const LINALG_SCALAR *src, half *dst,
+        size_t n) {
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i), _mm256_cvtps_ph(
+                    _mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+    for (; i < n; i++) {
+        dst[i] = to_fp16(src[i]);
+    }
+}
+
+/* Calls the best version of a kernel for this CPU */
+#define DISPATCH(kernel, name, args) \
+    if (isa() >= ISA_AVX512) { \
+        kernel##512_##name args; \
+    } else if (isa() == ISA_AVX2) { \
+        kernel##256_##name args; \
+    } else { \
+        kernel##_##name args; \
+    }
+
+#else
+
+#define DISPATCH(kernel, name, args) kernel##_##name args;
+
+#endif
+
+
+/* Size in bytes of one element of each format */
+static size_t elem_size(int format) {
+    switch (format) {
+        case LAQMAT_BF16:
+            return sizeof(uint16_t);
+        case LAQMAT_FP16:
+            return sizeof(half);
+        case LAQMAT_INT8:
+            return sizeof(int8_t);
+    }
+    return 0;
+}
+
+
+/* Converts the first rows of q starting at row i0 into out */
+static void expand(const qmatrix *q, int i0, int rows, LINALG_SCALAR *out) {
+    size_t off = (size_t)i0 * q->cols;
+    size_t n = (size_t)rows * q->cols;
+    int i;
+
+    switch (q->format) {
+        case LAQMAT_BF16:
+            DISPATCH(expand, bf16,
+                    ((const uint16_t *)q->data + off, 1, out, n))
+            break;
+        case LAQMAT_FP16:
+            DISPATCH(expand, fp16, ((const half *)q->data + off, 1, out, n))
+            break;
+        case LAQMAT_INT8:
+            for (i = 0; i < rows; i++) {
+                DISPATCH(expand, int8, ((const int8_t *)q->data + off
+                        + (size_t)i * q->cols, q->scales[i0 + i],
+                        out + (size_t)i * q->cols, q->cols))
+            }
+            break;
+    }
+}
+
+
+/* Points *m to a row-major copy of itself, kept in *tmp, if it is
+ * tiled. Returns nonzero if the copy cannot be allocated. */
+static int row_major(const matrix **m, matrix **tmp) {
+    *tmp = NULL;
+    if ((*m)->layout == LAMAT_ROW_MAJOR) {
+        return 0;
+    }
+    if (mat_dup(tmp, *m) != 0) {
+        *tmp = NULL;
+        return 1;
+    }
+    if (mat_set_layout(*tmp, LAMAT_ROW_MAJOR) != 0) {
+        mat_del(*tmp);
+        *tmp = NULL;
+        return 1;
+    }
+    *m = *tmp;
+    return 0;
+}
+
+
+int qmat_new(qmatrix **out, const matrix *m, int format) {
+    qmatrix *q;
+    uint16_t *b;
+    half *h;
+    int8_t *c;
+    LINALG_SCALAR max, inv;
+    size_t i, len;
+    int r, j;
+    matrix *tmp;
+
+    if (elem_size(format) == 0) {
+        return LAQMAT_INVALID;
+    }
+    if (row_major(&m, &tmp) != 0) {
+        return LAQMAT_ALLOC;
+    }
+
+    len = (size_t)m->rows * m->cols;
+    q = malloc(sizeof(*q));
+    if (q == NULL) {
+        if (tmp != NULL) {
+            mat_del(tmp);
+        }
+        return LAQMAT_ALLOC;
+    }
+    q->data = malloc(len * elem_size(format));
+    q->scales = format == LAQMAT_INT8
+        ? malloc(m->rows * sizeof(*q->scales)) : NULL;
+    if ((q->data == NULL && len > 0)
+            || (q->scales == NULL && format == LAQMAT_INT8 && m->rows > 0)) {
+        qmat_del(q);
+        if (tmp != NULL) {
+            mat_del(tmp);
+        }
+        return LAQMAT_ALLOC;
+    }
+    q->rows = m->rows;
+    q->cols = m->cols;
+    q->format = format;
+
+    switch (format) {
+        case LAQMAT_BF16:
+            b = q->data;
+#ifdef QMAT_X86
+            if (isa() == ISA_AVX512_BF16) {
+                pack_bf16_512(m->data, b, len);
+                break;
+            }
+#endif
+            for (i = 0; i < len; i++) {
+                b[i] = to_bf16(m->data[i]);
+            }
+            break;
+        case LAQMAT_FP16:
+            h = q->data;
+#ifdef QMAT_X86
+            if (isa() >= ISA_AVX2) {
+                pack_fp16_256(m->data, h, len);
+                break;
+            }
+#endif
+            for (i = 0; i < len; i++) {
+                h[i] = to_fp16(m->data[i]);
+            }
+            break;
+        case LAQMAT_INT8:
+            c = q->data;
+            for (r = 0; r < m->rows; r++) {
+                max = 0;
+                for (j = 0; j < m->cols; j++) {
+                    max = fmaxf(max, fabsf(m->data[(size_t)r * m->cols + j]));
+                }
+                q->scales[r] = max / 127;
+                inv = max > 0 ? 127 / max : 0;
+                for (j = 0; j < m->cols; j++) {
+                    i = (size_t)r * m->cols + j;
+                    c[i] = (int8_t)lrintf(m->data[i] * inv);
+                }
+            }
+            break;
+    }
+
+    if (tmp != NULL) {
+        mat_del(tmp);
+    }
+    *out = q;
+    return 0;
+}
+
+
+int qmat_del(qmatrix *q) {
+    free(q->data);
+    free(q->scales);
+    free(q);
+    return 0;
+}
+
+
+int qmat_dim(const qmatrix *q, int *rows, int *cols, int *format) {
+    if (rows != NULL) {
+        *rows = q->rows;
+    }
+    if (cols != NULL) {
+        *cols = q->cols;
+    }
+    if (format != NULL) {
+        *format = q->format;
+    }
+    return 0;
+}
+
+
+int qmat_to_mat(const qmatrix *q, matrix *out) {
+    LINALG_SCALAR *data;
+
+    data = data_realloc(out->data,
+            (size_t)q->rows * q->cols * sizeof(*out->data));
+    if (data == NULL && q->rows > 0 && q->cols > 0) {
+        return LAQMAT_ALLOC;
+    }
+    out->data = data;
+    out->rows = q->rows;
+    out->cols = q->cols;
+    out->layout = LAMAT_ROW_MAJOR;
+    expand(q, 0, q->rows, out->data);
+    return 0;
+}
+
+
+int qmat_mmul_r(const qmatrix *q, const vector *v, vector *out) {
+    LINALG_SCALAR *data;
+
+    if (v->dim != q->cols) {
+        return LAQMAT_INCOMPATIBLE_DIM;
+    }
+
+    if (out == v) {
+        data = data_alloc(q->rows * sizeof(*data));
+    } else {
+        data = data_realloc(out->data, q->rows * sizeof(*data));
+    }
+    if (data == NULL && q->rows > 0) {
+        return LAQMAT_ALLOC;
+    }
+    if (out != v) {
+        out->data = data;
+    }
+
+    switch (q->format) {
+        case LAQMAT_BF16:
+            DISPATCH(gemv, bf16,
+                    (q->data, NULL, v->data, data, q->rows, q->cols))
+            break;
+        case LAQMAT_FP16:
+            DISPATCH(gemv, fp16,
+                    (q->data, NULL, v->data, data, q->rows, q->cols))
+            break;
+        case LAQMAT_INT8:
+            DISPATCH(gemv, int8,
+                    (q->data, q->scales, v->data, data, q->rows, q->cols))
+            break;
+    }
+
+    if (data != out->data) {
+        data_free(out->data);
+        out->data = data;
+    }
+    out->dim = q->rows;
+    return 0;
+}
+
+
+int qmat_mul(const qmatrix *q, const matrix *b, matrix *out) {
+    const struct linalg_tuning *t = tune_params();
+    LINALG_SCALAR *data, *block;
+    size_t len;
+    int i0, n;
+    matrix *tmp;
+
+    if (q->cols != b->rows) {
+        return LAQMAT_INCOMPATIBLE_DIM;
+    }
+    if (row_major(&b, &tmp) != 0) {
+        return LAQMAT_ALLOC;
+    }
+
+    /* Expands gemm_mc rows of q at a time and multiplies them with the
+     * classical kernel, so the expanded rows stay in cache */
+    block = malloc((size_t)t->gemm_mc * q->cols * sizeof(*block));
+    len = (size_t)q->rows * b->cols * sizeof(*data);
+    if (block == NULL && q->cols > 0) {
+        data = NULL;
+    } else if (out == b) {
+        data = data_alloc(len);
+    } else {
+        data = data_realloc(out->data, len);
+    }
+    if ((block == NULL && q->cols > 0) || (data == NULL && len > 0)) {
+        free(block);
+        if (tmp != NULL) {
+            mat_del(tmp);
+        }
+        return LAQMAT_ALLOC;
+    }
+    if (out != b) {
+        out->data = data;
+    }
+
+    for (i0 = 0; i0 < q->rows; i0 += t->gemm_mc) {
+        n = i0 + t->gemm_mc < q->rows ? t->gemm_mc : q->rows - i0;
+        expand(q, i0, n, block);
+        kern_gemm_ld(block, q->cols, b->data, b->cols,
+                data + (size_t)i0 * b->cols, b->cols,
+                n, q->cols, b->cols, t);
+    }
+    free(block);
+
+    if (data != out->data) {
+        data_free(out->data);
+        out->data = data;
+    }
+    out->rows = q->rows;
+    out->cols = b->cols;
+    out->layout = LAMAT_ROW_MAJOR;
+    if (tmp != NULL) {
+        mat_del(tmp);
+    }
+    return 0;
+}
@@ -0,0 +1,464 @@
+#include "queue.h"
+#include "placement.h"
+#include "internal.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+
+struct linalg_task {
+    int (*run)(struct linalg_task *t);
+    linalg_task_func func;
+    void *ctx;
+    void *arg[3];
+
+    /* Objects read, followed by objects written */
+    const void **objs;
+    int nreads, nobjs;
+
+    /* Unfinished tasks this one waits for, and tasks waiting for it */
+    int ndeps;
+    struct linalg_task **succ;
+    int nsucc, capsucc;
+
+    struct linalg_task *prev, *next;    /* pending list */
+    struct linalg_task *next_ready;
+
+    linalg_task_done cb;
+    void *cb_ctx;
+
+    linalg_queue *q;
+    int result;
+    atomic_int done;
+    /* One for the queue until the task has finished, one for the
+     * caller's handle */
+    atomic_int refs;
+};
+
+struct linalg_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t ready_cond;
+    pthread_cond_t done_cond;
+
+    /* Unfinished tasks, in submission order */
+    struct linalg_task *head, *tail;
+    /* Tasks whose dependencies have all finished */
+    struct linalg_task *ready_head, *ready_tail;
+
+    int stop;
+    pthread_t *threads;
+    int nthreads;
+};
+
+
+/* Releases one reference to t */
+static void task_unref(struct linalg_task *t) {
+    if (atomic_fetch_sub_explicit(&t->refs, 1, memory_order_acq_rel) == 1) {
+        free(t->objs);
+        free(t->succ);
+        free(t);
+    }
+}
+
+
+static void push_ready(linalg_queue *q, struct linalg_task *t) {
+    t->next_ready = NULL;
+    if (q->ready_tail != NULL) {
+        q->ready_tail->next_ready = t;
+    } else {
+        q->ready_head = t;
+    }
+    q->ready_tail = t;
+    pthread_cond_signal(&q->ready_cond);
+}
+
+
+/* Returns 1 if b must wait for a */
+static int conflicts(const struct linalg_task *a,
+        const struct linalg_task *b) {
+    int i, j;
+
+    /* Writes of b against everything in a */
+    for (i = b->nreads; i < b->nobjs; i++) {
+        for (j = 0; j < a->nobjs; j++) {
+            if (b->objs[i] == a->objs[j]) {
+                return 1;
+            }
+        }
+    }
+    /* Reads of b against writes of a */
+    for (i = 0; i < b->nreads; i++) {
+        for (j = a->nreads; j < a->nobjs; j++) {
+            if (b->objs[i] == a->objs[j]) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+/* Records that t waits for p. Called with the queue locked. */
+static int add_dep(struct linalg_task *p, struct linalg_task *t) {
+    struct linalg_task **succ;
+    int cap;
+
+    if (p->nsucc == p->capsucc) {
+        cap = p->capsucc > 0 ? 2 * p->capsucc : 4;
+        succ = realloc(p->succ, cap * sizeof(*succ));
+        if (succ == NULL) {
+            return LAQUEUE_ALLOC;
+        }
+        p->succ = succ;
+        p->capsucc = cap;
+    }
+    p->succ[p->nsucc++] = t;
+    t->ndeps++;
+    return 0;
+}
+
+
+/* Marks t as finished with the given result and releases the tasks
+ * waiting for it. Called with the queue locked; unlocks it while
+ * running the callback and releasing the queue's reference. */
+static void finish(linalg_queue *q, struct linalg_task *t, int result) {
+    linalg_task_done cb;
+    void *cb_ctx;
+    int i;
+
+    if (t->prev != NULL) {
+        t->prev->next = t->next;
+    } else {
+        q->head = t->next;
+    }
+    if (t->next != NULL) {
+        t->next->prev = t->prev;
+    } else {
+        q->tail = t->prev;
+    }
+
+    for (i = 0; i < t->nsucc; i++) {
+        if (--t->succ[i]->ndeps == 0) {
+            push_ready(q, t->succ[i]);
+        }
+    }
+
+    t->result = result;
+    atomic_store_explicit(&t->done, 1, memory_order_release);
+    cb = t->cb;
+    cb_ctx = t->cb_ctx;
+    pthread_cond_broadcast(&q->done_cond);
+
+    pthread_mutex_unlock(&q->lock);
+    if (cb != NULL) {
+        cb(result, cb_ctx);
+    }
+    task_unref(t);
+    pthread_mutex_lock(&q->lock);
+}
+
+
+static void *worker(void *arg) {
+    linalg_queue *q = arg;
+    struct linalg_task *t;
+    int result;
+
+    pthread_mutex_lock(&q->lock);
+    for (;;) {
+        while (q->ready_head == NULL && !q->stop) {
+            pthread_cond_wait(&q->ready_cond, &q->lock);
+        }
+        if (q->ready_head == NULL) {
+            break;
+        }
+
+        t = q->ready_head;
+        q->ready_head = t->next_ready;
+        if (q->ready_head == NULL) {
+            q->ready_tail = NULL;
+        }
+
+        pthread_mutex_unlock(&q->lock);
+        result = t->run(t);
+        pthread_mutex_lock(&q->lock);
+
+        finish(q, t, result);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+
+int linalg_queue_new(linalg_queue **q, int threads) {
+    linalg_queue *r;
+    int i, nodes;
+
+    if (threads <= 0) {
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        threads = threads > 0 ? threads : 1;
+    }
+
+    r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return LAQUEUE_ALLOC;
+    }
+    r->threads = malloc(threads * sizeof(*r->threads));
+    if (r->threads == NULL) {
+        free(r);
+        return LAQUEUE_ALLOC;
+    }
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->ready_cond, NULL);
+    pthread_cond_init(&r->done_cond, NULL);
+
+    nodes = linalg_numa_nodes();
+    for (i = 0; i < threads; i++) {
+        if (pthread_create(&r->threads[i], NULL, worker, r) != 0) {
+            break;
+        }
+        /* Round-robin over the nodes; best effort, a worker that cannot
+         * be pinned still runs */
+        if (nodes > 1) {
+            numa_pin(r->threads[i], i % nodes);
+        }
+    }
+    r->nthreads = i;
+    if (i < threads) {
+        linalg_queue_del(r);
+        return LAQUEUE_ALLOC;
+    }
+
+    *q = r;
+    return 0;
+}
+
+
+int linalg_queue_del(linalg_queue *q) {
+    int i;
+
+    linalg_queue_finish(q);
+
+    pthread_mutex_lock(&q->lock);
+    q->stop = 1;
+    pthread_cond_broadcast(&q->ready_cond);
+    pthread_mutex_unlock(&q->lock);
+
+    for (i = 0; i < q->nthreads; i++) {
+        pthread_join(q->threads[i], NULL);
+    }
+
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->ready_cond);
+    pthread_cond_destroy(&q->done_cond);
+    free(q->threads);
+    free(q);
+    return 0;
+}
+
+
+int linalg_queue_finish(linalg_queue *q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->head != NULL) {
+        pthread_cond_wait(&q->done_cond, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+
+/* Creates a task running run and links it into q */
+static int submit(linalg_queue *q, int (*run)(struct linalg_task *t),
+        linalg_task_func func, void *ctx, void *a0, void *a1, void *a2,
+        const void *const *reads, int nreads,
+        void *const *writes, int nwrites, linalg_task **task) {
+    struct linalg_task *t, *p;
+    int i, err = 0;
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return LAQUEUE_ALLOC;
+    }
+    t->objs = malloc((nreads + nwrites) * sizeof(*t->objs));
+    if (t->objs == NULL && nreads + nwrites > 0) {
+        free(t);
+        return LAQUEUE_ALLOC;
+    }
+    for (i = 0; i < nreads; i++) {
+        t->objs[i] = reads[i];
+    }
+    for (i = 0; i < nwrites; i++) {
+        t->objs[nreads + i] = writes[i];
+    }
+    t->nreads = nreads;
+    t->nobjs = nreads + nwrites;
+    t->run = run;
+    t->func = func;
+    t->ctx = ctx;
+    t->arg[0] = a0;
+    t->arg[1] = a1;
+    t->arg[2] = a2;
+    t->q = q;
+    atomic_init(&t->refs, task != NULL ? 2 : 1);
+
+    pthread_mutex_lock(&q->lock);
+    for (p = q->head; p != NULL && err == 0; p = p->next) {
+        if (conflicts(p, t)) {
+            err = add_dep(p, t);
+        }
+    }
+    if (err != 0) {
+        /* Undo the dependencies recorded so far */
+        for (p = q->head; p != NULL; p = p->next) {
+            if (p->nsucc > 0 && p->succ[p->nsucc - 1] == t) {
+                p->nsucc--;
+            }
+        }
+        pthread_mutex_unlock(&q->lock);
+        free(t->objs);
+        free(t);
+        return err;
+    }
+
+    t->prev = q->tail;
+    if (q->tail != NULL) {
+        q->tail->next = t;
+    } else {
+        q->head = t;
+    }
+    q->tail = t;
+    if (t->ndeps == 0) {
+        push_ready(q, t);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    if (task != NULL) {
+        *task = t;
+    }
+    return 0;
+}
+
+
+static int run_func(struct linalg_task *t) {
+    return t->func(t->ctx);
+}
+
+
+int linalg_submit(linalg_queue *q, linalg_task_func f, void *ctx,
+        const void *const *reads, int nreads,
+        void *const *writes, int nwrites, linalg_task **task) {
+    return submit(q, run_func, f, ctx, NULL, NULL, NULL,
+            reads, nreads, writes, nwrites, task);
+}
+
+
+/* Defines the task body run_NAME and linalg_async_NAME for a function
+ * NAME(in0, in1, out) reading two objects and writing one */
+#define ASYNC_2_1(name, t0, t1, t2) \
+    static int run_##name(struct linalg_task *t) { \
+        return name(t->arg[0], t->arg[1], t->arg[2]); \
+    } \
+    int linalg_async_##name(linalg_queue *q, const t0 *a, const t1 *b, \
+            t2 *out, linalg_task **task) { \
+        const void *reads[2]; \
+        void *writes[1]; \
+        reads[0] = a; \
+        reads[1] = b; \
+        writes[0] = out; \
+        return submit(q, run_##name, NULL, NULL, \
+                (void *)a, (void *)b, out, reads, 2, writes, 1, task); \
+    }
+
+/* Same for a function NAME(inout, in) */
+#define ASYNC_1_1(name, t0, t1) \
+    static int run_##name(struct linalg_task *t) { \
+        return name(t->arg[0], t->arg[1]); \
+    } \
+    int linalg_async_##name(linalg_queue *q, t0 *a, const t1 *b, \
+            linalg_task **task) { \
+        const void *reads[1]; \
+        void *writes[1]; \
+        reads[0] = b; \
+        writes[0] = a; \
+        return submit(q, run_##name, NULL, NULL, \
+                a, (void *)b, NULL, reads, 1, writes, 1, task); \
+    }
+
+ASYNC_2_1(mat_add, matrix, matrix, matrix)
+ASYNC_2_1(mat_sub, matrix, matrix, matrix)
+ASYNC_2_1(mat_mul, matrix, matrix, matrix)
+ASYNC_2_1(vec_mmul_r, matrix, vector, vector)
+ASYNC_1_1(mat_add_, matrix, matrix)
+ASYNC_1_1(mat_sub_, matrix, matrix)
+ASYNC_1_1(mat_mul_, matrix, matrix)
+
+#undef ASYNC_2_1
+#undef ASYNC_1_1
+
+
+/* vec_mmul_r_ takes the object it writes last */
+static int run_vec_mmul_r_(struct linalg_task *t) {
+    return vec_mmul_r_(t->arg[0], t->arg[1]);
+}
+
+int linalg_async_vec_mmul_r_(linalg_queue *q, const matrix *m, vector *v,
+        linalg_task **task) {
+    const void *reads[1];
+    void *writes[1];
+
+    reads[0] = m;
+    writes[0] = v;
+    return submit(q, run_vec_mmul_r_, NULL, NULL,
+            (void *)m, v, NULL, reads, 1, writes, 1, task);
+}
+
+
+int linalg_task_wait(linalg_task *t, int *result) {
+    linalg_queue *q = t->q;
+
+    /* A finished task no longer needs its queue, which may be gone */
+    if (!atomic_load_explicit(&t->done, memory_order_acquire)) {
+        pthread_mutex_lock(&q->lock);
+        while (!atomic_load_explicit(&t->done, memory_order_relaxed)) {
+            pthread_cond_wait(&q->done_cond, &q->lock);
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    if (result != NULL) {
+        *result = t->result;
+    }
+    return 0;
+}
+
+
+int linalg_task_poll(linalg_task *t) {
+    return atomic_load_explicit(&t->done, memory_order_acquire);
+}
+
+
+int linalg_task_then(linalg_task *t, linalg_task_done cb, void *ctx) {
+    linalg_queue *q = t->q;
+    int done;
+
+    done = atomic_load_explicit(&t->done, memory_order_acquire);
+    if (!done) {
+        pthread_mutex_lock(&q->lock);
+        done = atomic_load_explicit(&t->done, memory_order_relaxed);
+        if (!done) {
+            t->cb = cb;
+            t->cb_ctx = ctx;
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+    if (done) {
+        cb(t->result, ctx);
+    }
+    return 0;
+}
+
+
+int linalg_task_del(linalg_task *t) {
+    task_unref(t);
+    return 0;
+}
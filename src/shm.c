@@ -0,0 +1,330 @@
+#include "shm.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* Identifies the objects of this library, "lshm" */
+#define SHM_MAGIC 0x6c73686dU
+
+/* Kinds of objects */
+#define SHM_MATRIX 1
+#define SHM_VECTOR 2
+
+
+/* A shared object holds the data, padded to whole pages, followed by
+ * one page starting with this header. */
+struct shm_ctl {
+    atomic_uint magic;      /* SHM_MAGIC once the rest is filled in */
+    atomic_int refs;        /* references held by every process */
+    atomic_int unlinked;    /* set once the name is removed */
+    int kind;
+    int rows;               /* dimension, for a vector */
+    int cols;
+    int layout;
+    size_t len;             /* bytes of data */
+    char name[NAME_MAX + 2];
+};
+
+/* Every process maps an object right after a private page, which starts
+ * with this and ends with the header of data_wrap. */
+struct shm_local {
+    size_t map;             /* bytes mapped, private page included */
+    struct shm_ctl *ctl;
+};
+
+
+static size_t page_bytes(void) {
+    return sysconf(_SC_PAGESIZE);
+}
+
+
+/* Bytes of an object before its header page, for len bytes of data */
+static size_t data_bytes(size_t len) {
+    size_t page = page_bytes();
+
+    return len > page ? (len + page - 1) / page * page : page;
+}
+
+
+/* Maps the size bytes of the object open as fd after a private page,
+ * its data read-only if readonly is set. Returns the data, or NULL. */
+static void *map_object(int fd, size_t size, int readonly) {
+    size_t page = page_bytes();
+    size_t data = size - page;
+    struct shm_local *l;
+    char *base;
+
+    base = mmap(NULL, page + size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    /* The header page takes references, so it is always writable */
+    if (mmap(base + page, data, readonly ? PROT_READ : PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+            || mmap(base + page + data, page, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_FIXED, fd, data) == MAP_FAILED) {
+        munmap(base, page + size);
+        return NULL;
+    }
+    l = (struct shm_local *)base;
+    l->map = page + size;
+    l->ctl = (struct shm_ctl *)(base + page + data);
+    return base + page;
+}
+
+
+static struct shm_local *local_of(void *p) {
+    return (struct shm_local *)((char *)p - page_bytes());
+}
+
+
+static void unmap(void *p) {
+    struct shm_local *l = local_of(p);
+
+    munmap(l, l->map);
+}
+
+
+/* Drops a reference, for data_free */
+static void release(void *p) {
+    struct shm_ctl *c = local_of(p)->ctl;
+
+    if (atomic_fetch_sub(&c->refs, 1) == 1 && !atomic_load(&c->unlinked)) {
+        shm_unlink(c->name);
+    }
+    unmap(p);
+}
+
+
+/* Creates the object name holding the len bytes at src, and writes into
+ * *out a writable buffer for data_free mapping it */
+static int share(const char *name, const void *src, size_t len, int kind,
+        int rows, int cols, int layout, LINALG_SCALAR **out) {
+    struct shm_ctl *c;
+    size_t size;
+    void *p = NULL;
+    int fd, err;
+
+    if (strlen(name) > NAME_MAX + 1) {
+        errno = ENAMETOOLONG;
+        return LASHM_SYSTEM;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        return errno == EEXIST ? LASHM_EXISTS : LASHM_SYSTEM;
+    }
+    size = data_bytes(len) + page_bytes();
+    if (ftruncate(fd, size) == 0) {
+        p = map_object(fd, size, 0);
+    }
+    err = errno;
+    close(fd);
+    if (p == NULL) {
+        shm_unlink(name);
+        errno = err;
+        return LASHM_SYSTEM;
+    }
+
+    memcpy(p, src, len);
+    c = local_of(p)->ctl;
+    c->kind = kind;
+    c->rows = rows;
+    c->cols = cols;
+    c->layout = layout;
+    c->len = len;
+    strcpy(c->name, name);
+    atomic_store(&c->refs, 1);
+    atomic_store(&c->unlinked, 0);
+    /* Attaching processes read nothing else before this */
+    atomic_store(&c->magic, SHM_MAGIC);
+
+    *out = data_wrap(p, len, 0, release);
+    return 0;
+}
+
+
+/* Maps the object name, of the given kind, read-only and takes
+ * a reference to it */
+static int attach(const char *name, int kind, struct shm_ctl **ctl,
+        LINALG_SCALAR **out) {
+    struct shm_ctl *c;
+    struct stat st;
+    void *p = NULL;
+    int fd, err, refs;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return errno == ENOENT ? LASHM_NOT_FOUND : LASHM_SYSTEM;
+    }
+    if (fstat(fd, &st) != 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return LASHM_SYSTEM;
+    }
+    /* Empty while its creator is still sizing it */
+    if (st.st_size == 0) {
+        close(fd);
+        return LASHM_NOT_FOUND;
+    }
+    if ((size_t)st.st_size < 2 * page_bytes()
+            || st.st_size % page_bytes() != 0) {
+        close(fd);
+        return LASHM_MISMATCH;
+    }
+    p = map_object(fd, st.st_size, 1);
+    err = errno;
+    close(fd);
+    if (p == NULL) {
+        errno = err;
+        return LASHM_SYSTEM;
+    }
+
+    c = local_of(p)->ctl;
+    if (atomic_load(&c->magic) != SHM_MAGIC) {
+        unmap(p);
+        return atomic_load(&c->magic) == 0 ? LASHM_NOT_FOUND : LASHM_MISMATCH;
+    }
+    if (c->kind != kind || data_bytes(c->len) + page_bytes()
+            != (size_t)st.st_size) {
+        unmap(p);
+        return LASHM_MISMATCH;
+    }
+    /* A reference can only be taken while another one is held, or the
+     * object may already be on its way out */
+    refs = atomic_load(&c->refs);
+    do {
+        if (refs <= 0) {
+            unmap(p);
+            return LASHM_NOT_FOUND;
+        }
+    } while (!atomic_compare_exchange_weak(&c->refs, &refs, refs + 1));
+
+    *ctl = c;
+    *out = data_wrap(p, c->len, 1, release);
+    return 0;
+}
+
+
+int mat_share(matrix *m, const char *name) {
+    LINALG_SCALAR *data;
+    int err;
+
+    err = share(name, m->data,
+            mat_len(m->rows, m->cols, m->layout) * sizeof(*m->data),
+            SHM_MATRIX, m->rows, m->cols, m->layout, &data);
+    if (err != 0) {
+        return err;
+    }
+    data_free(m->data);
+    m->data = data;
+    return 0;
+}
+
+
+int mat_attach(matrix **out, const char *name) {
+    struct shm_ctl *c;
+    LINALG_SCALAR *data;
+    matrix *m;
+    int err;
+
+    err = attach(name, SHM_MATRIX, &c, &data);
+    if (err != 0) {
+        return err;
+    }
+    m = malloc(sizeof(*m));
+    m->data = data;
+    m->rows = c->rows;
+    m->cols = c->cols;
+    m->layout = c->layout;
+    *out = m;
+    return 0;
+}
+
+
+int vec_share(vector *v, const char *name) {
+    LINALG_SCALAR *data;
+    int err;
+
+    err = share(name, v->data, (size_t)v->dim * sizeof(*v->data),
+            SHM_VECTOR, v->dim, 1, 0, &data);
+    if (err != 0) {
+        return err;
+    }
+    data_free(v->data);
+    v->data = data;
+    return 0;
+}
+
+
+int vec_attach(vector **out, const char *name) {
+    struct shm_ctl *c;
+    LINALG_SCALAR *data;
+    vector *v;
+    int err;
+
+    err = attach(name, SHM_VECTOR, &c, &data);
+    if (err != 0) {
+        return err;
+    }
+    v = malloc(sizeof(*v));
+    v->data = data;
+    v->dim = c->rows;
+    *out = v;
+    return 0;
+}
+
+
+int linalg_shm_unlink(const char *name) {
+    struct shm_ctl *c;
+    struct stat st;
+    size_t page = page_bytes();
+    int fd, err;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        return errno == ENOENT ? LASHM_NOT_FOUND : LASHM_SYSTEM;
+    }
+    if (fstat(fd, &st) != 0) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return LASHM_SYSTEM;
+    }
+    if ((size_t)st.st_size < 2 * page || st.st_size % page != 0) {
+        close(fd);
+        return LASHM_MISMATCH;
+    }
+    c = mmap(NULL, page, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+            st.st_size - page);
+    err = errno;
+    close(fd);
+    if (c == MAP_FAILED) {
+        errno = err;
+        return LASHM_SYSTEM;
+    }
+
+    err = 0;
+    if (atomic_load(&c->magic) != SHM_MAGIC) {
+        err = LASHM_MISMATCH;
+    } else {
+        /* Set first, so that the last reference does not remove
+         * another object given the name in the meantime */
+        atomic_store(&c->unlinked, 1);
+        if (shm_unlink(name) != 0) {
+            err = errno == ENOENT ? LASHM_NOT_FOUND : LASHM_SYSTEM;
+        }
+    }
+    munmap(c, page);
+    return err;
+}
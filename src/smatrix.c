@@ -0,0 +1,638 @@
+#include "smatrix.h"
+#include "internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+struct smatrix {
+    /* LASMAT_DIAGONAL, LASMAT_BANDED: order rows of lower + upper + 1
+     * elements, row i holding columns i - lower to i + upper, with
+     * zeros outside the matrix.
+     * LASMAT_UPPER, LASMAT_SYMMETRIC: row i of the upper triangle,
+     * columns i to order - 1, for every i in turn.
+     * LASMAT_LOWER: row i of the lower triangle, columns 0 to i,
+     * for every i in turn. */
+    LINALG_SCALAR *data;
+    int order;
+    int kind;
+    int lower;
+    int upper;
+};
+
+
+/* Independent partial sums per dot product, as in kern_gemv */
+#define DOT_LANES 8
+
+
+/* Element (i, j) of the band storage of rows w elements wide,
+ * with lower diagonals below the main one */
+#define BAND(p, w, lower, i, j) ((p)[(size_t)(i) * (w) + (j) - (i) + (lower)])
+
+
+/* y[j] += s * x[j] for every 0 <= j < n */
+static void axpy(LINALG_SCALAR *restrict y, const LINALG_SCALAR *restrict x,
+        LINALG_SCALAR s, int n) {
+    int j;
+    for (j = 0; j < n; j++) {
+        y[j] += s * x[j];
+    }
+}
+
+
+static LINALG_SCALAR dot(const LINALG_SCALAR *x, const LINALG_SCALAR *y,
+        int n) {
+    LINALG_SCALAR acc[DOT_LANES];
+    LINALG_SCALAR r;
+    int j, l;
+
+    for (l = 0; l < DOT_LANES; l++) {
+        acc[l] = 0;
+    }
+    for (j = 0; j + DOT_LANES <= n; j += DOT_LANES) {
+        for (l = 0; l < DOT_LANES; l++) {
+            acc[l] += x[j + l] * y[j + l];
+        }
+    }
+    r = 0;
+    for (l = 0; l < DOT_LANES; l++) {
+        r += acc[l];
+    }
+    for (; j < n; j++) {
+        r += x[j] * y[j];
+    }
+    return r;
+}
+
+
+/* Offset of row i in triangular storage */
+static size_t upper_row(int order, int i) {
+    return (size_t)i * order - (size_t)i * (i - 1) / 2;
+}
+
+static size_t lower_row(int i) {
+    return (size_t)i * (i + 1) / 2;
+}
+
+
+/* Stored part of row i of s: *len elements from column *start. For
+ * LASMAT_SYMMETRIC this is the part in the upper triangle. */
+static const LINALG_SCALAR *srow(const smatrix *s, int i,
+        int *start, int *len) {
+    int lo, hi;
+
+    switch (s->kind) {
+        case LASMAT_UPPER:
+        case LASMAT_SYMMETRIC:
+            *start = i;
+            *len = s->order - i;
+            return s->data + upper_row(s->order, i);
+        case LASMAT_LOWER:
+            *start = 0;
+            *len = i + 1;
+            return s->data + lower_row(i);
+    }
+    lo = i - s->lower > 0 ? i - s->lower : 0;
+    hi = i + s->upper < s->order ? i + s->upper : s->order - 1;
+    *start = lo;
+    *len = hi - lo + 1;
+    return &BAND(s->data, s->lower + s->upper + 1, s->lower, i, lo);
+}
+
+
+/* Number of elements stored for s */
+static size_t slen(const smatrix *s) {
+    if (s->kind == LASMAT_DIAGONAL || s->kind == LASMAT_BANDED) {
+        return (size_t)s->order * (s->lower + s->upper + 1);
+    }
+    return lower_row(s->order);
+}
+
+
+static smatrix *alloc(int order, int kind, int lower, int upper) {
+    smatrix *s;
+
+    s = malloc(sizeof(*s));
+    s->order = order;
+    s->kind = kind;
+    s->lower = lower;
+    s->upper = upper;
+    s->data = calloc(slen(s), sizeof(*s->data));
+    return s;
+}
+
+
+/* Reads the structure of s from the square matrix m */
+static void fill(smatrix *s, const matrix *m) {
+    LINALG_SCALAR *p;
+    int i, j, start, len;
+
+    for (i = 0; i < s->order; i++) {
+        /* Only writes through p, which srow hands out as const */
+        p = (LINALG_SCALAR *)srow(s, i, &start, &len);
+        for (j = 0; j < len; j++) {
+            p[j] = mat_get(m, i, start + j);
+        }
+    }
+}
+
+
+int smat_new(smatrix **out, const matrix *m, int kind) {
+    int order, lower, upper;
+
+    if (kind < LASMAT_DIAGONAL || kind > LASMAT_SYMMETRIC
+            || kind == LASMAT_BANDED) {
+        return LASMAT_INVALID;
+    }
+    if (m->rows != m->cols) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    order = m->rows;
+    lower = kind == LASMAT_DIAGONAL || kind == LASMAT_UPPER ? 0 : order - 1;
+    upper = kind == LASMAT_DIAGONAL || kind == LASMAT_LOWER ? 0 : order - 1;
+    *out = alloc(order, kind, lower > 0 ? lower : 0, upper > 0 ? upper : 0);
+    fill(*out, m);
+    return 0;
+}
+
+
+int smat_band(smatrix **out, const matrix *m, int lower, int upper) {
+    int order;
+
+    if (lower < 0 || upper < 0) {
+        return LASMAT_INVALID;
+    }
+    if (m->rows != m->cols) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    /* Diagonals beyond the corners hold nothing */
+    order = m->rows;
+    lower = lower < order ? lower : (order > 0 ? order - 1 : 0);
+    upper = upper < order ? upper : (order > 0 ? order - 1 : 0);
+    *out = alloc(order, LASMAT_BANDED, lower, upper);
+    fill(*out, m);
+    return 0;
+}
+
+
+int smat_diag(smatrix **out, const vector *d) {
+    smatrix *s;
+
+    s = alloc(d->dim, LASMAT_DIAGONAL, 0, 0);
+    memcpy(s->data, d->data, d->dim * sizeof(*s->data));
+    *out = s;
+    return 0;
+}
+
+
+int smat_identity(smatrix **out, int order) {
+    smatrix *s;
+    int i;
+
+    s = alloc(order, LASMAT_DIAGONAL, 0, 0);
+    for (i = 0; i < order; i++) {
+        s->data[i] = 1;
+    }
+    *out = s;
+    return 0;
+}
+
+
+int smat_del(smatrix *s) {
+    free(s->data);
+    free(s);
+    return 0;
+}
+
+
+int smat_dim(const smatrix *s, int *order, int *kind) {
+    if (order != NULL) {
+        *order = s->order;
+    }
+    if (kind != NULL) {
+        *kind = s->kind;
+    }
+    return 0;
+}
+
+
+int smat_bands(const smatrix *s, int *lower, int *upper) {
+    if (lower != NULL) {
+        *lower = s->lower;
+    }
+    if (upper != NULL) {
+        *upper = s->upper;
+    }
+    return 0;
+}
+
+
+int smat_to_mat(const smatrix *s, matrix *out) {
+    const LINALG_SCALAR *p;
+    size_t bytelen;
+    int i, j, n, start, len;
+
+    n = s->order;
+    bytelen = (size_t)n * n * sizeof(*out->data);
+    out->data = data_realloc(out->data, bytelen);
+    memset(out->data, 0, bytelen);
+    out->rows = n;
+    out->cols = n;
+    out->layout = LAMAT_ROW_MAJOR;
+
+    for (i = 0; i < n; i++) {
+        p = srow(s, i, &start, &len);
+        memcpy(out->data + (size_t)i * n + start, p, len * sizeof(*p));
+        if (s->kind == LASMAT_SYMMETRIC) {
+            for (j = 1; j < len; j++) {
+                out->data[(size_t)(i + j) * n + i] = p[j];
+            }
+        }
+    }
+    return 0;
+}
+
+
+/* out = s * b, with b and out order x k and row-major.
+ * out must not overlap b. */
+static void mul_l(const smatrix *s, const LINALG_SCALAR *b,
+        LINALG_SCALAR *out, int k) {
+    const LINALG_SCALAR *p;
+    LINALG_SCALAR *o;
+    int i, j, start, len;
+    int sym = s->kind == LASMAT_SYMMETRIC;
+
+    memset(out, 0, (size_t)s->order * k * sizeof(*out));
+    for (i = 0; i < s->order; i++) {
+        p = srow(s, i, &start, &len);
+        if (k == 1) {
+            out[i] += dot(p, b + start, len);
+            /* The mirror of row i is column i */
+            if (sym) {
+                axpy(out + i + 1, p + 1, b[i], len - 1);
+            }
+            continue;
+        }
+        o = out + (size_t)i * k;
+        for (j = 0; j < len; j++) {
+            axpy(o, b + (size_t)(start + j) * k, p[j], k);
+        }
+        if (sym) {
+            for (j = 1; j < len; j++) {
+                axpy(out + (size_t)(i + j) * k, b + (size_t)i * k, p[j], k);
+            }
+        }
+    }
+}
+
+
+/* out = a * s, with a and out m x order and row-major.
+ * out must not overlap a. */
+static void mul_r(const LINALG_SCALAR *a, int m, const smatrix *s,
+        LINALG_SCALAR *out) {
+    const LINALG_SCALAR *p, *ar;
+    LINALG_SCALAR *o;
+    int r, j, n, start, len;
+
+    n = s->order;
+    memset(out, 0, (size_t)m * n * sizeof(*out));
+    for (r = 0; r < m; r++) {
+        ar = a + (size_t)r * n;
+        o = out + (size_t)r * n;
+        for (j = 0; j < n; j++) {
+            p = srow(s, j, &start, &len);
+            axpy(o + start, p, ar[j], len);
+            if (s->kind == LASMAT_SYMMETRIC) {
+                o[j] += dot(p + 1, ar + j + 1, len - 1);
+            }
+        }
+    }
+}
+
+
+/* Returns a row-major version of m: m itself or a copy in *tmp,
+ * to be deleted by the caller. */
+static const matrix *row_major(const matrix *m, matrix **tmp) {
+    *tmp = NULL;
+    if (m->layout == LAMAT_ROW_MAJOR) {
+        return m;
+    }
+    mat_dup(tmp, m);
+    mat_set_layout(*tmp, LAMAT_ROW_MAJOR);
+    return *tmp;
+}
+
+
+int smat_mmul_r(const smatrix *s, const vector *v, vector *out) {
+    LINALG_SCALAR *data;
+
+    if (v->dim != s->order) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(s->order * sizeof(*data));
+    mul_l(s, v->data, data, 1);
+    data_free(out->data);
+    out->data = data;
+    out->dim = s->order;
+    return 0;
+}
+
+
+int smat_mmul_l(const vector *v, const smatrix *s, vector *out) {
+    LINALG_SCALAR *data;
+
+    if (v->dim != s->order) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(s->order * sizeof(*data));
+    mul_r(v->data, 1, s, data);
+    data_free(out->data);
+    out->data = data;
+    out->dim = s->order;
+    return 0;
+}
+
+
+int smat_mul_l(const smatrix *s, const matrix *b, matrix *out) {
+    LINALG_SCALAR *data;
+    matrix *tmp;
+
+    if (b->rows != s->order) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    b = row_major(b, &tmp);
+    data = data_alloc((size_t)s->order * b->cols * sizeof(*data));
+    mul_l(s, b->data, data, b->cols);
+    out->cols = b->cols;
+    if (tmp != NULL) {
+        mat_del(tmp);
+    }
+
+    data_free(out->data);
+    out->data = data;
+    out->rows = s->order;
+    out->layout = LAMAT_ROW_MAJOR;
+    return 0;
+}
+
+
+int smat_mul_r(const matrix *a, const smatrix *s, matrix *out) {
+    LINALG_SCALAR *data;
+    matrix *tmp;
+
+    if (a->cols != s->order) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    a = row_major(a, &tmp);
+    data = data_alloc((size_t)a->rows * s->order * sizeof(*data));
+    mul_r(a->data, a->rows, s, data);
+    out->rows = a->rows;
+    if (tmp != NULL) {
+        mat_del(tmp);
+    }
+
+    data_free(out->data);
+    out->data = data;
+    out->cols = s->order;
+    out->layout = LAMAT_ROW_MAJOR;
+    return 0;
+}
+
+
+/* Solves s * x = b for a banded s by Gaussian elimination with partial
+ * pivoting. Row swaps let the upper band grow by s->lower diagonals,
+ * so the factorization works on a copy with room for them. */
+static int solve_band(const smatrix *s, LINALG_SCALAR *x, int k) {
+    LINALG_SCALAR *w, *t, l;
+    int n, kl, ku, wd, c, i, j, p, last, end;
+
+    n = s->order;
+    kl = s->lower;
+    ku = s->upper + kl;
+    wd = kl + ku + 1;
+    w = calloc((size_t)n * wd, sizeof(*w));
+    t = malloc(k * sizeof(*t));
+    for (i = 0; i < n; i++) {
+        memcpy(w + (size_t)i * wd, s->data + (size_t)i * (kl + s->upper + 1),
+                (kl + s->upper + 1) * sizeof(*w));
+    }
+
+    for (c = 0; c < n; c++) {
+        last = c + kl < n ? c + kl : n - 1;
+        end = c + ku < n ? c + ku : n - 1;
+        p = c;
+        for (i = c + 1; i <= last; i++) {
+            if (fabs(BAND(w, wd, kl, i, c)) > fabs(BAND(w, wd, kl, p, c))) {
+                p = i;
+            }
+        }
+        if (BAND(w, wd, kl, p, c) == 0) {
+            free(w);
+            free(t);
+            return LASMAT_SINGULAR;
+        }
+        if (p != c) {
+            for (j = c; j <= end; j++) {
+                l = BAND(w, wd, kl, c, j);
+                BAND(w, wd, kl, c, j) = BAND(w, wd, kl, p, j);
+                BAND(w, wd, kl, p, j) = l;
+            }
+            memcpy(t, x + (size_t)c * k, k * sizeof(*t));
+            memcpy(x + (size_t)c * k, x + (size_t)p * k, k * sizeof(*t));
+            memcpy(x + (size_t)p * k, t, k * sizeof(*t));
+        }
+        for (i = c + 1; i <= last; i++) {
+            l = BAND(w, wd, kl, i, c) / BAND(w, wd, kl, c, c);
+            if (l == 0) {
+                continue;
+            }
+            axpy(&BAND(w, wd, kl, i, c + 1), &BAND(w, wd, kl, c, c + 1),
+                    -l, end - c);
+            axpy(x + (size_t)i * k, x + (size_t)c * k, -l, k);
+        }
+    }
+
+    for (i = n - 1; i >= 0; i--) {
+        end = i + ku < n ? i + ku : n - 1;
+        for (j = i + 1; j <= end; j++) {
+            axpy(x + (size_t)i * k, x + (size_t)j * k,
+                    -BAND(w, wd, kl, i, j), k);
+        }
+        l = 1 / BAND(w, wd, kl, i, i);
+        for (j = 0; j < k; j++) {
+            x[(size_t)i * k + j] *= l;
+        }
+    }
+
+    free(w);
+    free(t);
+    return 0;
+}
+
+
+/* Solves s * x = b for a symmetric positive definite s through its
+ * Cholesky factorization u^T u, computed in the same packed upper
+ * storage, row by row. */
+static int solve_sym(const smatrix *s, LINALG_SCALAR *x, int k) {
+    LINALG_SCALAR *u, *ui, *uj, d;
+    int n, i, j;
+
+    n = s->order;
+    u = malloc(slen(s) * sizeof(*u));
+    memcpy(u, s->data, slen(s) * sizeof(*u));
+
+    for (i = 0; i < n; i++) {
+        ui = u + upper_row(n, i);
+        if (!(ui[0] > 0)) {
+            free(u);
+            return LASMAT_SINGULAR;
+        }
+        ui[0] = sqrt(ui[0]);
+        d = 1 / ui[0];
+        for (j = 1; j < n - i; j++) {
+            ui[j] *= d;
+        }
+        /* Rank one update of the trailing rows */
+        for (j = 1; j < n - i; j++) {
+            uj = u + upper_row(n, i + j);
+            axpy(uj, ui + j, -ui[j], n - i - j);
+        }
+    }
+
+    /* u^T y = b, by columns of u^T, that is rows of u */
+    for (i = 0; i < n; i++) {
+        ui = u + upper_row(n, i);
+        d = 1 / ui[0];
+        for (j = 0; j < k; j++) {
+            x[(size_t)i * k + j] *= d;
+        }
+        for (j = 1; j < n - i; j++) {
+            axpy(x + (size_t)(i + j) * k, x + (size_t)i * k, -ui[j], k);
+        }
+    }
+
+    /* u x = y */
+    for (i = n - 1; i >= 0; i--) {
+        ui = u + upper_row(n, i);
+        for (j = 1; j < n - i; j++) {
+            axpy(x + (size_t)i * k, x + (size_t)(i + j) * k, -ui[j], k);
+        }
+        d = 1 / ui[0];
+        for (j = 0; j < k; j++) {
+            x[(size_t)i * k + j] *= d;
+        }
+    }
+
+    free(u);
+    return 0;
+}
+
+
+/* Replaces x, order x k and row-major, with the solution of s * x = x */
+static int solve(const smatrix *s, LINALG_SCALAR *x, int k) {
+    const LINALG_SCALAR *p;
+    LINALG_SCALAR d;
+    int i, j, n, start, len;
+
+    n = s->order;
+    switch (s->kind) {
+        case LASMAT_BANDED:
+            /* Without lower diagonals no row is ever swapped, and back
+             * substitution is all there is to it */
+            if (s->lower > 0) {
+                return solve_band(s, x, k);
+            }
+            /* fall through */
+        case LASMAT_DIAGONAL:
+        case LASMAT_UPPER:
+            for (i = n - 1; i >= 0; i--) {
+                p = srow(s, i, &start, &len);
+                if (p[0] == 0) {
+                    return LASMAT_SINGULAR;
+                }
+                for (j = 1; j < len; j++) {
+                    axpy(x + (size_t)i * k, x + (size_t)(i + j) * k,
+                            -p[j], k);
+                }
+                d = 1 / p[0];
+                for (j = 0; j < k; j++) {
+                    x[(size_t)i * k + j] *= d;
+                }
+            }
+            return 0;
+        case LASMAT_LOWER:
+            for (i = 0; i < n; i++) {
+                p = srow(s, i, &start, &len);
+                if (p[i] == 0) {
+                    return LASMAT_SINGULAR;
+                }
+                for (j = 0; j < i; j++) {
+                    axpy(x + (size_t)i * k, x + (size_t)j * k, -p[j], k);
+                }
+                d = 1 / p[i];
+                for (j = 0; j < k; j++) {
+                    x[(size_t)i * k + j] *= d;
+                }
+            }
+            return 0;
+        case LASMAT_SYMMETRIC:
+            return solve_sym(s, x, k);
+    }
+    return LASMAT_INVALID;
+}
+
+
+int smat_solve(const smatrix *s, const vector *b, vector *out) {
+    LINALG_SCALAR *data;
+    int err;
+
+    if (b->dim != s->order) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(s->order * sizeof(*data));
+    memcpy(data, b->data, s->order * sizeof(*data));
+    err = solve(s, data, 1);
+    if (err != 0) {
+        data_free(data);
+        return err;
+    }
+
+    data_free(out->data);
+    out->data = data;
+    out->dim = s->order;
+    return 0;
+}
+
+
+int smat_solve_mat(const smatrix *s, const matrix *b, matrix *out) {
+    LINALG_SCALAR *data;
+    int err, cols;
+
+    if (b->rows != s->order) {
+        return LASMAT_INCOMPATIBLE_DIM;
+    }
+
+    cols = b->cols;
+    data = data_alloc((size_t)s->order * cols * sizeof(*data));
+    mat_get_data(b, data);
+    err = solve(s, data, cols);
+    if (err != 0) {
+        data_free(data);
+        return err;
+    }
+
+    data_free(out->data);
+    out->data = data;
+    out->rows = s->order;
+    out->cols = cols;
+    out->layout = LAMAT_ROW_MAJOR;
+    return 0;
+}
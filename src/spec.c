@@ -0,0 +1,5 @@
+#include "internal.h"
+
+/* Kernels for the fixed shapes listed in SPEC_SHAPES, generated
+ * by tools/kgen.c when building. See the Makefile. */
+#include ".gen/spec_kernels.h"
@@ -0,0 +1,280 @@
+#include "stats.h"
+#include "internal.h"
+
+#ifdef LINALG_STATS
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef LINALG_STATS_PERF
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+struct op_counters {
+    unsigned long long calls;
+    unsigned long long ns;
+    unsigned long long self_ns;
+    unsigned long long alloc_bytes;
+    unsigned long long copy_bytes;
+    unsigned long long flops;
+    unsigned long long cycles;
+    unsigned long long instructions;
+};
+
+/* Counters of a single thread.
+ * Blocks are never freed, so the counters of finished
+ * threads are still included in the dump. */
+struct thread_stats {
+    struct op_counters ops[OP_COUNT];
+    struct stats_frame *current;
+    int id;
+    int perf_fd;
+    struct thread_stats *next;
+};
+
+
+static const char *op_names[OP_COUNT] = {
+#define X(name) #name,
+    LINALG_OPS(X)
+#undef X
+};
+
+static _Atomic(struct thread_stats *) all_threads;
+static atomic_int thread_count;
+static _Thread_local struct thread_stats *self;
+
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+#ifdef LINALG_STATS_PERF
+
+/* Opens a group counting user space cycles and instructions of
+ * the calling thread. Returns the group leader, or -1. */
+static int perf_open(void) {
+    struct perf_event_attr attr;
+    int leader, fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = 1;
+    leader = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (leader < 0) {
+        return -1;
+    }
+
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 0;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+    if (fd < 0) {
+        close(leader);
+        return -1;
+    }
+
+    ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return leader;
+}
+
+
+static void perf_read(int fd, long long *out) {
+    unsigned long long buf[3];
+
+    if (fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)) {
+        out[0] = 0;
+        out[1] = 0;
+        return;
+    }
+    out[0] = buf[1];
+    out[1] = buf[2];
+}
+
+#else
+
+static int perf_open(void) {
+    return -1;
+}
+
+
+static void perf_read(int fd, long long *out) {
+    out[0] = 0;
+    out[1] = 0;
+}
+
+#endif
+
+
+static struct thread_stats *thread_stats(void) {
+    struct thread_stats *t;
+
+    if (self != NULL) {
+        return self;
+    }
+
+    t = calloc(1, sizeof(*t));
+    if (t == NULL) {
+        return NULL;
+    }
+    t->id = atomic_fetch_add(&thread_count, 1);
+    t->perf_fd = perf_open();
+
+    t->next = atomic_load(&all_threads);
+    while (!atomic_compare_exchange_weak(&all_threads, &t->next, t)) {
+    }
+
+    self = t;
+    return t;
+}
+
+
+void stats_enter(struct stats_frame *f, enum linalg_op op) {
+    struct thread_stats *t = thread_stats();
+
+    f->owner = t;
+    if (t == NULL) {
+        return;
+    }
+    f->op = op;
+    f->parent = t->current;
+    f->child_ns = 0;
+    t->current = f;
+    perf_read(t->perf_fd, f->start_perf);
+    f->start_ns = now_ns();
+}
+
+
+void stats_leave(struct stats_frame *f) {
+    struct thread_stats *t = f->owner;
+    struct op_counters *c;
+    long long elapsed, perf[2];
+
+    if (t == NULL) {
+        return;
+    }
+    elapsed = now_ns() - f->start_ns;
+    perf_read(t->perf_fd, perf);
+
+    c = &t->ops[f->op];
+    c->calls++;
+    c->ns += elapsed;
+    c->self_ns += elapsed - f->child_ns;
+    c->cycles += perf[0] - f->start_perf[0];
+    c->instructions += perf[1] - f->start_perf[1];
+
+    if (f->parent != NULL) {
+        f->parent->child_ns += elapsed;
+    }
+    t->current = f->parent;
+}
+
+
+void stats_alloc(long long bytes) {
+    if (self != NULL && self->current != NULL) {
+        self->ops[self->current->op].alloc_bytes += bytes;
+    }
+}
+
+
+void stats_copy(long long bytes) {
+    if (self != NULL && self->current != NULL) {
+        self->ops[self->current->op].copy_bytes += bytes;
+    }
+}
+
+
+void stats_flops(long long n) {
+    if (self != NULL && self->current != NULL) {
+        self->ops[self->current->op].flops += n;
+    }
+}
+
+
+static void dump_ops(FILE *out, const struct op_counters *ops) {
+    int i, first = 1;
+
+    fprintf(out, "[");
+    for (i = 0; i < OP_COUNT; i++) {
+        if (ops[i].calls == 0) {
+            continue;
+        }
+        fprintf(out, "%s\n      {\"name\": \"%s\", \"calls\": %llu, "
+                "\"ns\": %llu, \"self_ns\": %llu, \"alloc_bytes\": %llu, "
+                "\"copy_bytes\": %llu, \"flops\": %llu, \"cycles\": %llu, "
+                "\"instructions\": %llu}",
+                first ? "" : ",", op_names[i], ops[i].calls, ops[i].ns,
+                ops[i].self_ns, ops[i].alloc_bytes, ops[i].copy_bytes,
+                ops[i].flops, ops[i].cycles, ops[i].instructions);
+        first = 0;
+    }
+    fprintf(out, "\n    ]");
+}
+
+
+int linalg_stats_dump(FILE *out) {
+    struct op_counters total[OP_COUNT];
+    struct thread_stats *t;
+    int i, first = 1;
+
+    memset(total, 0, sizeof(total));
+
+    fprintf(out, "{\n  \"threads\": [");
+    for (t = atomic_load(&all_threads); t != NULL; t = t->next) {
+        fprintf(out, "%s\n    {\"thread\": %d, \"ops\": ",
+                first ? "" : ",", t->id);
+        dump_ops(out, t->ops);
+        fprintf(out, "}");
+        first = 0;
+
+        for (i = 0; i < OP_COUNT; i++) {
+            total[i].calls += t->ops[i].calls;
+            total[i].ns += t->ops[i].ns;
+            total[i].self_ns += t->ops[i].self_ns;
+            total[i].alloc_bytes += t->ops[i].alloc_bytes;
+            total[i].copy_bytes += t->ops[i].copy_bytes;
+            total[i].flops += t->ops[i].flops;
+            total[i].cycles += t->ops[i].cycles;
+            total[i].instructions += t->ops[i].instructions;
+        }
+    }
+    fprintf(out, "\n  ],\n  \"total\": ");
+    dump_ops(out, total);
+    fprintf(out, "\n}\n");
+    return 0;
+}
+
+
+int linalg_stats_reset(void) {
+    struct thread_stats *t = thread_stats();
+
+    if (t != NULL) {
+        memset(t->ops, 0, sizeof(t->ops));
+    }
+    return 0;
+}
+
+#else
+
+int linalg_stats_dump(FILE *out) {
+    return LASTATS_DISABLED;
+}
+
+
+int linalg_stats_reset(void) {
+    return LASTATS_DISABLED;
+}
+
+#endif
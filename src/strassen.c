@@ -0,0 +1,186 @@
+#include "internal.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Strassen-Winograd multiplication of square matrices: 7 half-size
+ * products and 15 block additions per level instead of 8 products, for
+ * O(n^2.81) operations overall. The schedule is the one of Boyer, Dumas,
+ * Pernet and Zhou, "Memory efficient scheduling of Strassen-Winograd's
+ * matrix multiplication algorithm" (2009), which only needs two
+ * temporaries per level besides the quadrants of c. Every level's
+ * temporaries are carved out of one workspace allocated up front. */
+
+
+/* d = x + y, on h x h blocks */
+static void add(LINALG_SCALAR *d, int ldd, const LINALG_SCALAR *x, int ldx,
+        const LINALG_SCALAR *y, int ldy, int h) {
+    int i, j;
+    for (i = 0; i < h; i++) {
+        for (j = 0; j < h; j++) {
+            d[(size_t)i * ldd + j] = x[(size_t)i * ldx + j]
+                + y[(size_t)i * ldy + j];
+        }
+    }
+}
+
+
+/* d = x - y, on h x h blocks */
+static void sub(LINALG_SCALAR *d, int ldd, const LINALG_SCALAR *x, int ldx,
+        const LINALG_SCALAR *y, int ldy, int h) {
+    int i, j;
+    for (i = 0; i < h; i++) {
+        for (j = 0; j < h; j++) {
+            d[(size_t)i * ldd + j] = x[(size_t)i * ldx + j]
+                - y[(size_t)i * ldy + j];
+        }
+    }
+}
+
+
+/* c = a * b, with n a multiple of 2^levels; ws holds the temporaries
+ * of every level below this one. */
+static void mul(const LINALG_SCALAR *a, int lda, const LINALG_SCALAR *b,
+        int ldb, LINALG_SCALAR *c, int ldc, int n, LINALG_SCALAR *ws,
+        const struct linalg_tuning *t) {
+    const LINALG_SCALAR *a11, *a12, *a21, *a22, *b11, *b12, *b21, *b22;
+    LINALG_SCALAR *c11, *c12, *c21, *c22, *x, *y, *next;
+    int h;
+
+    if (n <= t->strassen_cutoff) {
+        kern_gemm_ld(a, lda, b, ldb, c, ldc, n, n, n, t);
+        return;
+    }
+
+    h = n / 2;
+    a11 = a;
+    a12 = a + h;
+    a21 = a + (size_t)h * lda;
+    a22 = a21 + h;
+    b11 = b;
+    b12 = b + h;
+    b21 = b + (size_t)h * ldb;
+    b22 = b21 + h;
+    c11 = c;
+    c12 = c + h;
+    c21 = c + (size_t)h * ldc;
+    c22 = c21 + h;
+    x = ws;
+    y = ws + (size_t)h * h;
+    next = y + (size_t)h * h;
+
+    sub(x, h, a11, lda, a21, lda, h);           /* S3 */
+    sub(y, h, b22, ldb, b12, ldb, h);           /* T3 */
+    mul(x, h, y, h, c21, ldc, h, next, t);      /* P7 = S3 T3 */
+    add(x, h, a21, lda, a22, lda, h);           /* S1 */
+    sub(y, h, b12, ldb, b11, ldb, h);           /* T1 */
+    mul(x, h, y, h, c22, ldc, h, next, t);      /* P5 = S1 T1 */
+    sub(x, h, x, h, a11, lda, h);               /* S2 = S1 - A11 */
+    sub(y, h, b22, ldb, y, h, h);               /* T2 = B22 - T1 */
+    mul(x, h, y, h, c12, ldc, h, next, t);      /* P6 = S2 T2 */
+    sub(x, h, a12, lda, x, h, h);               /* S4 = A12 - S2 */
+    mul(x, h, b22, ldb, c11, ldc, h, next, t);  /* P3 = S4 B22 */
+    mul(a11, lda, b11, ldb, x, h, h, next, t);  /* P1 = A11 B11 */
+    add(c12, ldc, x, h, c12, ldc, h);           /* U2 = P1 + P6 */
+    add(c21, ldc, c12, ldc, c21, ldc, h);       /* U3 = U2 + P7 */
+    add(c12, ldc, c12, ldc, c22, ldc, h);       /* U4 = U2 + P5 */
+    add(c22, ldc, c21, ldc, c22, ldc, h);       /* C22 = U3 + P5 */
+    add(c12, ldc, c12, ldc, c11, ldc, h);       /* C12 = U4 + P3 */
+    sub(y, h, y, h, b21, ldb, h);               /* T4 = T2 - B21 */
+    mul(a22, lda, y, h, c11, ldc, h, next, t);  /* P4 = A22 T4 */
+    sub(c21, ldc, c21, ldc, c11, ldc, h);       /* C21 = U3 - P4 */
+    mul(a12, lda, b21, ldb, c11, ldc, h, next, t);  /* P2 = A12 B21 */
+    add(c11, ldc, x, h, c11, ldc, h);           /* C11 = P1 + P2 */
+}
+
+
+/* Copies the n x n matrix src into the top left corner of the
+ * N x N matrix dst, zeroing the rest. */
+static void pad(LINALG_SCALAR *dst, int N, const LINALG_SCALAR *src, int n) {
+    int i;
+
+    memset(dst, 0, (size_t)N * N * sizeof(*dst));
+    for (i = 0; i < n; i++) {
+        memcpy(dst + (size_t)i * N, src + (size_t)i * n, n * sizeof(*dst));
+    }
+}
+
+
+/* Halves n until the blocks fit the cutoff, then pads it up to
+ * *leaf * 2^levels so that every level splits evenly. Returns the
+ * padded order, n itself if no recursion is needed. */
+static int padded(int n, const struct linalg_tuning *t, int *leaf) {
+    int levels = 0;
+
+    for (*leaf = n; *leaf > t->strassen_cutoff; *leaf = (*leaf + 1) / 2) {
+        levels++;
+    }
+    return *leaf << levels;
+}
+
+
+size_t kern_strassen_len(int n, const struct linalg_tuning *t) {
+    size_t len, h;
+    int leaf, N;
+
+    N = padded(n, t, &leaf);
+    if (N == leaf) {
+        return 0;
+    }
+    len = 0;
+    for (h = N / 2; h >= (size_t)leaf; h /= 2) {
+        len += 2 * h * h;
+    }
+    if (N != n) {
+        len += 3 * (size_t)N * N;
+    }
+    return len;
+}
+
+
+int kern_strassen(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int n, const struct linalg_tuning *t) {
+    LINALG_SCALAR *ws = NULL;
+    size_t len;
+
+    len = kern_strassen_len(n, t);
+    if (len > 0) {
+        ws = malloc(len * sizeof(*ws));
+        if (ws == NULL) {
+            return 1;
+        }
+    }
+    kern_strassen_ws(a, b, c, n, ws, t);
+    free(ws);
+    return 0;
+}
+
+
+void kern_strassen_ws(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int n, LINALG_SCALAR *ws,
+        const struct linalg_tuning *t) {
+    LINALG_SCALAR *ap, *bp, *cp;
+    size_t len;
+    int leaf, N, i;
+
+    N = padded(n, t, &leaf);
+    if (N == leaf) {
+        kern_gemm(a, b, c, n, n, n, t);
+        return;
+    }
+    len = kern_strassen_len(n, t);
+
+    if (N == n) {
+        mul(a, n, b, n, c, n, n, ws, t);
+    } else {
+        ap = ws + len - 3 * (size_t)N * N;
+        bp = ap + (size_t)N * N;
+        cp = bp + (size_t)N * N;
+        pad(ap, N, a, n);
+        pad(bp, N, b, n);
+        mul(ap, N, bp, N, cp, N, N, ws, t);
+        for (i = 0; i < n; i++) {
+            memcpy(c + (size_t)i * n, cp + (size_t)i * N, n * sizeof(*c));
+        }
+    }
+}
@@ -0,0 +1,297 @@
+#include "summation.h"
+#include "internal.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Mode used by the reductions that are not given one */
+static atomic_int sum_mode = LASUM_NAIVE;
+
+
+/* Independent partial sums per reduction, as in kern_gemv */
+#define SUM_LANES 8
+
+/* Compensated partial sums of LASUM_KAHAN: every one is a chain of
+ * four dependent additions per term, so more of them than SUM_LANES
+ * are needed to keep the adders busy */
+#define KAHAN_LANES 32
+
+/* Terms summed directly by LASUM_PAIRWISE before halves are combined;
+ * a multiple of SUM_LANES. */
+#define SUM_BLOCK 128
+
+/* Terms of the reductions */
+enum term {
+    TERM_DOT,       /* x[i] * y[i] */
+    TERM_SQ,        /* x[i] * x[i] */
+    TERM_DIST       /* (x[i] - y[i])^2 */
+};
+
+
+int linalg_sum_policy(int mode) {
+    if (mode != LASUM_NAIVE && mode != LASUM_PAIRWISE && mode != LASUM_KAHAN) {
+        return LASUM_INVALID;
+    }
+    atomic_store(&sum_mode, mode);
+    return 0;
+}
+
+
+int sum_policy(void) {
+    return atomic_load(&sum_mode);
+}
+
+
+static inline __attribute__((always_inline)) LINALG_SCALAR term(
+        const LINALG_SCALAR *x, const LINALG_SCALAR *y, int i,
+        const enum term op) {
+    LINALG_SCALAR d;
+
+    switch (op) {
+        case TERM_DOT:
+            return x[i] * y[i];
+        case TERM_SQ:
+            return x[i] * x[i];
+        default:
+            d = x[i] - y[i];
+            return d * d;
+    }
+}
+
+
+/* Sum of the n terms, in SUM_LANES partial sums added up as a tree.
+ * Always inlined with a constant op, like gemv_block. */
+static inline __attribute__((always_inline)) LINALG_SCALAR lanes(
+        const LINALG_SCALAR *x, const LINALG_SCALAR *y, int n,
+        const enum term op) {
+    LINALG_SCALAR acc[SUM_LANES];
+    int i, l, w;
+
+    for (l = 0; l < SUM_LANES; l++) {
+        acc[l] = 0;
+    }
+    for (i = 0; i + SUM_LANES <= n; i += SUM_LANES) {
+        for (l = 0; l < SUM_LANES; l++) {
+            acc[l] += term(x, y, i + l, op);
+        }
+    }
+    for (l = 0; l < SUM_LANES && i + l < n; l++) {
+        acc[l] += term(x, y, i + l, op);
+    }
+    for (w = SUM_LANES / 2; w > 0; w /= 2) {
+        for (l = 0; l < w; l++) {
+            acc[l] += acc[l + w];
+        }
+    }
+    return acc[0];
+}
+
+
+static LINALG_SCALAR pairwise(const LINALG_SCALAR *x,
+        const LINALG_SCALAR *y, int n, enum term op) {
+    int h;
+
+    if (n <= SUM_BLOCK) {
+        switch (op) {
+            case TERM_DOT:
+                return lanes(x, y, n, TERM_DOT);
+            case TERM_SQ:
+                return lanes(x, y, n, TERM_SQ);
+            default:
+                return lanes(x, y, n, TERM_DIST);
+        }
+    }
+    /* Split on a block boundary, so that only the last block is short */
+    h = (n / SUM_BLOCK + 1) / 2 * SUM_BLOCK;
+    return pairwise(x, y, h, op)
+        + pairwise(x + h, op == TERM_SQ ? y : y + h, n - h, op);
+}
+
+
+/* Adds t to the compensated sum *s, *c */
+static inline void kahan_add(LINALG_SCALAR *s, LINALG_SCALAR *c,
+        LINALG_SCALAR t) {
+    LINALG_SCALAR u;
+
+    t -= *c;
+    u = *s + t;
+    *c = (u - *s) - t;
+    *s = u;
+}
+
+
+/* Adds t[l] to the compensated sum s[l], c[l] of every lane */
+static inline __attribute__((always_inline)) void kahan_lanes(
+        LINALG_SCALAR *s, LINALG_SCALAR *c, const LINALG_SCALAR *t) {
+    LINALG_SCALAR d, u;
+    int l;
+
+    for (l = 0; l < KAHAN_LANES; l++) {
+        d = t[l] - c[l];
+        u = s[l] + d;
+        c[l] = (u - s[l]) - d;
+        s[l] = u;
+    }
+}
+
+
+/* Sum of the n terms, in KAHAN_LANES compensated partial sums */
+static inline __attribute__((always_inline)) LINALG_SCALAR kahan(
+        const LINALG_SCALAR *x, const LINALG_SCALAR *y, int n,
+        const enum term op) {
+    LINALG_SCALAR s[KAHAN_LANES], c[KAHAN_LANES], t[KAHAN_LANES];
+    int i, l, w;
+
+    for (l = 0; l < KAHAN_LANES; l++) {
+        s[l] = 0;
+        c[l] = 0;
+    }
+    /* The terms first, in a loop of their own: both loops are then
+     * vectorized across the lanes */
+    for (i = 0; i + KAHAN_LANES <= n; i += KAHAN_LANES) {
+        for (l = 0; l < KAHAN_LANES; l++) {
+            t[l] = term(x, y, i + l, op);
+        }
+        kahan_lanes(s, c, t);
+    }
+    /* The last terms, padded with zeros */
+    for (l = 0; l < KAHAN_LANES; l++) {
+        t[l] = i + l < n ? term(x, y, i + l, op) : 0;
+    }
+    kahan_lanes(s, c, t);
+
+    /* Every lane is worth s[l] - c[l]; adding the lanes up as a tree
+     * adds an error that depends on KAHAN_LANES, not on n */
+    for (l = 0; l < KAHAN_LANES; l++) {
+        s[l] -= c[l];
+    }
+    for (w = KAHAN_LANES / 2; w > 0; w /= 2) {
+        for (l = 0; l < w; l++) {
+            s[l] += s[l + w];
+        }
+    }
+    return s[0];
+}
+
+
+LINALG_SCALAR sum_dot(const LINALG_SCALAR *x, const LINALG_SCALAR *y,
+        int n, int mode) {
+    if (mode == LASUM_PAIRWISE) {
+        return pairwise(x, y, n, TERM_DOT);
+    }
+    return kahan(x, y, n, TERM_DOT);
+}
+
+
+LINALG_SCALAR sum_sq(const LINALG_SCALAR *x, int n, int mode) {
+    if (mode == LASUM_PAIRWISE) {
+        return pairwise(x, x, n, TERM_SQ);
+    }
+    return kahan(x, x, n, TERM_SQ);
+}
+
+
+LINALG_SCALAR sum_dist2(const LINALG_SCALAR *x, const LINALG_SCALAR *y,
+        int n, int mode) {
+    if (mode == LASUM_PAIRWISE) {
+        return pairwise(x, y, n, TERM_DIST);
+    }
+    return kahan(x, y, n, TERM_DIST);
+}
+
+
+/* y[j] += s * x[j] for every 0 <= j < n, compensated by c[j] */
+static void kahan_axpy(LINALG_SCALAR *restrict y, LINALG_SCALAR *restrict c,
+        const LINALG_SCALAR *restrict x, LINALG_SCALAR s, int n) {
+    int j;
+
+    for (j = 0; j < n; j++) {
+        kahan_add(&y[j], &c[j], s * x[j]);
+    }
+}
+
+
+/* c = a * b for an m x n block of c, summing the k products of every
+ * element pairwise: blocks of SUM_BLOCK products by kern_gemm_ld, then
+ * halves added recursively. tmp holds m * n elements for every level
+ * of the recursion. */
+static void gemm_pairwise(const LINALG_SCALAR *a, int lda,
+        const LINALG_SCALAR *b, int ldb, LINALG_SCALAR *c, int ldc,
+        int m, int k, int n, LINALG_SCALAR *tmp,
+        const struct linalg_tuning *t) {
+    int i, j, h;
+    LINALG_SCALAR *row;
+
+    if (k <= SUM_BLOCK) {
+        kern_gemm_ld(a, lda, b, ldb, c, ldc, m, k, n, t);
+        return;
+    }
+    h = (k / SUM_BLOCK + 1) / 2 * SUM_BLOCK;
+    gemm_pairwise(a, lda, b, ldb, c, ldc, m, h, n, tmp + (size_t)m * n, t);
+    gemm_pairwise(a + h, lda, b + (size_t)h * ldb, ldb, tmp, n,
+            m, k - h, n, tmp + (size_t)m * n, t);
+    for (i = 0; i < m; i++) {
+        row = c + (size_t)i * ldc;
+        for (j = 0; j < n; j++) {
+            row[j] += tmp[(size_t)i * n + j];
+        }
+    }
+}
+
+
+size_t sum_gemm_len(int k, int mode, const struct linalg_tuning *t) {
+    int levels, p;
+
+    if (mode != LASUM_PAIRWISE) {
+        return t->gemm_nc;
+    }
+    for (levels = 1, p = SUM_BLOCK; p < k; p *= 2) {
+        levels++;
+    }
+    return (size_t)levels * t->gemm_mc * t->gemm_nc;
+}
+
+
+int sum_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n, int mode,
+        const struct linalg_tuning *t) {
+    LINALG_SCALAR *tmp;
+
+    tmp = malloc(sum_gemm_len(k, mode, t) * sizeof(*tmp));
+    if (tmp == NULL) {
+        return 1;
+    }
+    sum_gemm_ws(a, b, c, m, k, n, mode, tmp, t);
+    free(tmp);
+    return 0;
+}
+
+
+void sum_gemm_ws(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, int m, int k, int n, int mode,
+        LINALG_SCALAR *tmp, const struct linalg_tuning *t) {
+    int i0, j0, i, p, h, w;
+
+    /* Blocks of gemm_mc x gemm_nc elements of c, every one of them
+     * summed over all of k before moving on */
+    for (i0 = 0; i0 < m; i0 += t->gemm_mc) {
+        h = i0 + t->gemm_mc < m ? t->gemm_mc : m - i0;
+        for (j0 = 0; j0 < n; j0 += t->gemm_nc) {
+            w = j0 + t->gemm_nc < n ? t->gemm_nc : n - j0;
+            if (mode == LASUM_PAIRWISE) {
+                gemm_pairwise(a + (size_t)i0 * k, k, b + j0, n,
+                        c + (size_t)i0 * n + j0, n, h, k, w, tmp, t);
+                continue;
+            }
+            for (i = i0; i < i0 + h; i++) {
+                memset(c + (size_t)i * n + j0, 0, w * sizeof(*c));
+                memset(tmp, 0, w * sizeof(*tmp));
+                for (p = 0; p < k; p++) {
+                    kahan_axpy(c + (size_t)i * n + j0, tmp,
+                            b + (size_t)p * n + j0, a[(size_t)i * k + p], w);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,415 @@
+#include "tmatrix.h"
+#include "internal.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Real FFT of length n, a power of two, through a complex FFT of length
+ * n / 2 on the even elements as real parts and the odd ones as
+ * imaginary parts. Complex numbers are stored as (re, im) pairs. */
+struct fft_plan {
+    int n;
+    int *rev;               /* bit reversal permutation of n / 2 */
+    LINALG_SCALAR *tw;      /* exp(-pi i j / h) at complex index h + j,
+                             * for the butterflies of half length h */
+    LINALG_SCALAR *rt;      /* exp(-2 pi i k / n), 0 <= k <= n / 4 */
+};
+
+struct tmatrix {
+    LINALG_SCALAR *col;     /* first column, rows elements */
+    LINALG_SCALAR *row;     /* first row, cols elements */
+    int rows;
+    int cols;
+    int kind;
+    /* Transform of the first column of the circulant embedding,
+     * n / 2 + 1 complex elements scaled by 1 / n; NULL for
+     * matrices multiplied directly */
+    LINALG_SCALAR *spec;
+    struct fft_plan plan;
+};
+
+
+/* Matrices of at most as many elements are multiplied directly */
+#define TMAT_DIRECT (64 * 64)
+
+#define TWO_PI 6.28318530717958647692
+
+
+static void plan_init(struct fft_plan *p, int n) {
+    int m, h, i, j, bits;
+    double a;
+
+    m = n / 2;
+    p->n = n;
+    p->rev = malloc(m * sizeof(*p->rev));
+    p->tw = malloc(2 * (size_t)m * sizeof(*p->tw));
+    p->rt = malloc(2 * (size_t)(m / 2 + 1) * sizeof(*p->rt));
+
+    for (bits = 0; (1 << bits) < m; bits++);
+    for (i = 0; i < m; i++) {
+        p->rev[i] = 0;
+        for (j = 0; j < bits; j++) {
+            p->rev[i] |= ((i >> j) & 1) << (bits - 1 - j);
+        }
+    }
+    for (h = 1; h < m; h *= 2) {
+        for (j = 0; j < h; j++) {
+            a = -TWO_PI * j / (2 * h);
+            p->tw[2 * (h + j)] = cos(a);
+            p->tw[2 * (h + j) + 1] = sin(a);
+        }
+    }
+    for (i = 0; i <= m / 2; i++) {
+        a = -TWO_PI * i / n;
+        p->rt[2 * i] = cos(a);
+        p->rt[2 * i + 1] = sin(a);
+    }
+}
+
+
+static void plan_free(struct fft_plan *p) {
+    free(p->rev);
+    free(p->tw);
+    free(p->rt);
+}
+
+
+/* In place complex FFT of the n / 2 elements of z, unscaled. The inverse
+ * transform uses the conjugate twiddles. */
+static void fft_complex(const struct fft_plan *p, LINALG_SCALAR *z,
+        int inverse) {
+    LINALG_SCALAR *a, *b, t, wr, wi, xr, xi, sign;
+    int m, i, j, k, h;
+
+    m = p->n / 2;
+    for (i = 0; i < m; i++) {
+        j = p->rev[i];
+        if (i < j) {
+            t = z[2 * i];
+            z[2 * i] = z[2 * j];
+            z[2 * j] = t;
+            t = z[2 * i + 1];
+            z[2 * i + 1] = z[2 * j + 1];
+            z[2 * j + 1] = t;
+        }
+    }
+
+    sign = inverse ? -1 : 1;
+    for (h = 1; h < m; h *= 2) {
+        for (k = 0; k < m; k += 2 * h) {
+            a = z + 2 * k;
+            b = a + 2 * h;
+            for (j = 0; j < h; j++) {
+                wr = p->tw[2 * (h + j)];
+                wi = sign * p->tw[2 * (h + j) + 1];
+                xr = b[2 * j] * wr - b[2 * j + 1] * wi;
+                xi = b[2 * j] * wi + b[2 * j + 1] * wr;
+                b[2 * j] = a[2 * j] - xr;
+                b[2 * j + 1] = a[2 * j + 1] - xi;
+                a[2 * j] += xr;
+                a[2 * j + 1] += xi;
+            }
+        }
+    }
+}
+
+
+/* Replaces the n reals of x with the n / 2 + 1 first elements of their
+ * transform, the others being their conjugates. x has room for n + 2. */
+static void fft_real(const struct fft_plan *p, LINALG_SCALAR *x) {
+    LINALG_SCALAR ar, ai, br, bi, er, ei, qr, qi, tr, ti, wr, wi;
+    int m, k;
+
+    m = p->n / 2;
+    fft_complex(p, x, 0);
+
+    /* With Z the transform of the even and odd elements as complex
+     * numbers, those of the even ones alone are (Z[k] + Z*[m-k]) / 2
+     * and of the odd ones (Z[k] - Z*[m-k]) / 2i; X[k] is the first plus
+     * exp(-2 pi i k / n) times the second. */
+    ar = x[0];
+    ai = x[1];
+    x[0] = ar + ai;
+    x[1] = 0;
+    x[2 * m] = ar - ai;
+    x[2 * m + 1] = 0;
+    for (k = 1; k <= m / 2; k++) {
+        ar = x[2 * k];
+        ai = x[2 * k + 1];
+        br = x[2 * (m - k)];
+        bi = x[2 * (m - k) + 1];
+        er = (ar + br) / 2;
+        ei = (ai - bi) / 2;
+        qr = (ai + bi) / 2;
+        qi = (br - ar) / 2;
+        wr = p->rt[2 * k];
+        wi = p->rt[2 * k + 1];
+        tr = wr * qr - wi * qi;
+        ti = wr * qi + wi * qr;
+        x[2 * k] = er + tr;
+        x[2 * k + 1] = ei + ti;
+        x[2 * (m - k)] = er - tr;
+        x[2 * (m - k) + 1] = ti - ei;
+    }
+}
+
+
+/* Inverse of fft_real, unscaled: replaces the n / 2 + 1 elements of the
+ * transform in x with n times the n reals they came from. */
+static void fft_real_inv(const struct fft_plan *p, LINALG_SCALAR *x) {
+    LINALG_SCALAR sr, si, dr, di, wr, wi;
+    int m, k;
+
+    m = p->n / 2;
+
+    /* Z[k] = 2 (E[k] + i O[k]), from X[k] = E[k] + W^k O[k] and
+     * X*[m-k] = E[k] - W^k O[k] */
+    sr = x[0];
+    dr = x[2 * m];
+    x[0] = sr + dr;
+    x[1] = sr - dr;
+    for (k = 1; k <= m / 2; k++) {
+        sr = x[2 * k] + x[2 * (m - k)];
+        si = x[2 * k + 1] - x[2 * (m - k) + 1];
+        dr = x[2 * k] - x[2 * (m - k)];
+        di = x[2 * k + 1] + x[2 * (m - k) + 1];
+        wr = p->rt[2 * k];
+        wi = p->rt[2 * k + 1];
+        x[2 * k] = sr + wi * dr - wr * di;
+        x[2 * k + 1] = si + wi * di + wr * dr;
+        x[2 * (m - k)] = sr - wi * dr + wr * di;
+        x[2 * (m - k) + 1] = wi * di + wr * dr - si;
+    }
+
+    fft_complex(p, x, 1);
+}
+
+
+/* y[j] += s * x[j] for every 0 <= j < n */
+static void axpy(LINALG_SCALAR *restrict y, const LINALG_SCALAR *restrict x,
+        LINALG_SCALAR s, int n) {
+    int j;
+    for (j = 0; j < n; j++) {
+        y[j] += s * x[j];
+    }
+}
+
+
+/* Element (i, j) of t */
+static LINALG_SCALAR elem(const tmatrix *t, int i, int j) {
+    return i >= j ? t->col[i - j] : t->row[j - i];
+}
+
+
+/* out = t * x for a column x, or x * t for a row x if left is set.
+ * The part of t * x below the diagonal adds x[j] times col to out from
+ * element j, for every j; the part above it is the dot product of row
+ * with x from element i + 1, for every i. x * t is t^T * x, with the
+ * roles of col and row swapped. */
+static void direct(const tmatrix *t, const LINALG_SCALAR *x, int left,
+        LINALG_SCALAR *out) {
+    const LINALG_SCALAR *c, *r;
+    LINALG_SCALAR s;
+    int i, j, m, n;
+
+    c = left ? t->row : t->col;
+    r = left ? t->col : t->row;
+    m = left ? t->cols : t->rows;
+    n = left ? t->rows : t->cols;
+    for (i = 0; i < m; i++) {
+        s = 0;
+        for (j = 1; j < n - i; j++) {
+            s += r[j] * x[i + j];
+        }
+        out[i] = s;
+    }
+    for (j = 0; j < n && j < m; j++) {
+        axpy(out + j, c, x[j], m - j);
+    }
+}
+
+
+/* Same as direct, through the transform of the embedding. x and out
+ * must not overlap. */
+static void apply(const tmatrix *t, const LINALG_SCALAR *x, int left,
+        LINALG_SCALAR *out) {
+    LINALG_SCALAR *w, *s, r, i;
+    int n, len, k;
+
+    if (t->spec == NULL) {
+        direct(t, x, left, out);
+        return;
+    }
+
+    /* x padded with zeros through the embedding, whose transposed
+     * transform is the conjugate of its transform */
+    n = t->plan.n;
+    len = left ? t->rows : t->cols;
+    w = malloc((n + 2) * sizeof(*w));
+    memcpy(w, x, len * sizeof(*w));
+    memset(w + len, 0, (n - len) * sizeof(*w));
+    fft_real(&t->plan, w);
+    s = t->spec;
+    for (k = 0; k <= n / 2; k++) {
+        i = left ? -s[2 * k + 1] : s[2 * k + 1];
+        r = w[2 * k] * s[2 * k] - w[2 * k + 1] * i;
+        w[2 * k + 1] = w[2 * k] * i + w[2 * k + 1] * s[2 * k];
+        w[2 * k] = r;
+    }
+    fft_real_inv(&t->plan, w);
+    memcpy(out, w, (left ? t->cols : t->rows) * sizeof(*out));
+    free(w);
+}
+
+
+/* Creates a tmatrix, taking col and row, and its transform */
+static tmatrix *create(LINALG_SCALAR *col, int rows, LINALG_SCALAR *row,
+        int cols, int kind) {
+    tmatrix *t;
+    int n, i, pow2;
+    double scale;
+
+    t = malloc(sizeof(*t));
+    t->col = col;
+    t->row = row;
+    t->rows = rows;
+    t->cols = cols;
+    t->kind = kind;
+    t->spec = NULL;
+    if ((size_t)rows * cols <= TMAT_DIRECT) {
+        return t;
+    }
+
+    /* A circulant matrix of a power of two order is its own embedding.
+     * Otherwise the column goes first, the row backwards last, and the
+     * zeros in between keep every product from wrapping around. */
+    pow2 = (rows & (rows - 1)) == 0;
+    for (n = 2; n < rows + cols - 1; n *= 2);
+    if (kind == LATMAT_CIRCULANT && pow2) {
+        n = rows;
+    }
+    plan_init(&t->plan, n);
+    t->spec = malloc((n + 2) * sizeof(*t->spec));
+    memset(t->spec, 0, n * sizeof(*t->spec));
+    memcpy(t->spec, col, rows * sizeof(*col));
+    if (n != rows) {
+        for (i = 1; i < cols; i++) {
+            t->spec[n - i] = row[i];
+        }
+    }
+    fft_real(&t->plan, t->spec);
+    scale = 1.0 / n;
+    for (i = 0; i < n + 2; i++) {
+        t->spec[i] *= scale;
+    }
+    return t;
+}
+
+
+int tmat_circulant(tmatrix **t, const vector *col) {
+    LINALG_SCALAR *c, *r;
+    int n, j;
+
+    n = col->dim;
+    c = malloc(n * sizeof(*c));
+    r = malloc(n * sizeof(*r));
+    memcpy(c, col->data, n * sizeof(*c));
+    for (j = 0; j < n; j++) {
+        r[j] = c[(n - j) % n];
+    }
+    *t = create(c, n, r, n, LATMAT_CIRCULANT);
+    return 0;
+}
+
+
+int tmat_toeplitz(tmatrix **t, const vector *col, const vector *row) {
+    LINALG_SCALAR *c, *r;
+
+    c = malloc(col->dim * sizeof(*c));
+    r = malloc(row->dim * sizeof(*r));
+    memcpy(c, col->data, col->dim * sizeof(*c));
+    memcpy(r, row->data, row->dim * sizeof(*r));
+    r[0] = c[0];
+    *t = create(c, col->dim, r, row->dim, LATMAT_TOEPLITZ);
+    return 0;
+}
+
+
+int tmat_del(tmatrix *t) {
+    if (t->spec != NULL) {
+        plan_free(&t->plan);
+        free(t->spec);
+    }
+    free(t->col);
+    free(t->row);
+    free(t);
+    return 0;
+}
+
+
+int tmat_dim(const tmatrix *t, int *rows, int *cols, int *kind) {
+    if (rows != NULL) {
+        *rows = t->rows;
+    }
+    if (cols != NULL) {
+        *cols = t->cols;
+    }
+    if (kind != NULL) {
+        *kind = t->kind;
+    }
+    return 0;
+}
+
+
+int tmat_to_mat(const tmatrix *t, matrix *out) {
+    LINALG_SCALAR *p;
+    int i, j;
+
+    out->data = data_realloc(out->data,
+            (size_t)t->rows * t->cols * sizeof(*out->data));
+    out->rows = t->rows;
+    out->cols = t->cols;
+    out->layout = LAMAT_ROW_MAJOR;
+
+    for (i = 0; i < t->rows; i++) {
+        p = out->data + (size_t)i * t->cols;
+        for (j = 0; j < t->cols; j++) {
+            p[j] = elem(t, i, j);
+        }
+    }
+    return 0;
+}
+
+
+int tmat_mmul_r(const tmatrix *t, const vector *v, vector *out) {
+    LINALG_SCALAR *data;
+
+    if (v->dim != t->cols) {
+        return LATMAT_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(t->rows * sizeof(*data));
+    apply(t, v->data, 0, data);
+    data_free(out->data);
+    out->data = data;
+    out->dim = t->rows;
+    return 0;
+}
+
+
+int tmat_mmul_l(const vector *v, const tmatrix *t, vector *out) {
+    LINALG_SCALAR *data;
+
+    if (v->dim != t->rows) {
+        return LATMAT_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(t->cols * sizeof(*data));
+    apply(t, v->data, 1, data);
+    data_free(out->data);
+    out->data = data;
+    out->dim = t->cols;
+    return 0;
+}
@@ -0,0 +1,412 @@
+#include "tune.h"
+#include "internal.h"
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Problem sizes the candidates are timed on */
+#define TUNE_GEMM_N 512
+#define TUNE_GEMV_N 1024
+#define TUNE_TRANSPOSE_N 2048
+#define TUNE_STRASSEN_N 1024
+#define TUNE_REPS 3
+
+
+static const struct linalg_tuning defaults = {
+    64,     /* gemm_mc */
+    256,    /* gemm_kc */
+    512,    /* gemm_nc */
+    4,      /* gemv_rows */
+    8,      /* gemv_lanes */
+    32,     /* transpose_block */
+    128     /* strassen_cutoff */
+};
+
+/* Parameters taken into use by linalg_tuning_set, each linked to the
+ * one before. They are never freed, as kernels on other threads may
+ * still be reading one that was replaced: a kernel sees one set of
+ * parameters from start to end. */
+struct snapshot {
+    struct linalg_tuning t;
+    struct snapshot *prev;
+};
+
+/* Parameters in use, NULL until the first call to tune_params or
+ * linalg_tuning_set */
+static _Atomic(const struct linalg_tuning *) params;
+static atomic_flag loading = ATOMIC_FLAG_INIT;
+
+static _Atomic(struct snapshot *) snapshots;
+
+
+static int valid(const struct linalg_tuning *t) {
+    return t->gemm_mc > 0 && t->gemm_kc > 0 && t->gemm_nc > 0
+        && (t->gemv_rows == 1 || t->gemv_rows == 2 || t->gemv_rows == 4)
+        && (t->gemv_lanes == 1 || t->gemv_lanes == 4
+                || t->gemv_lanes == 8 || t->gemv_lanes == 16)
+        && t->transpose_block > 0 && t->strassen_cutoff >= 16;
+}
+
+
+const struct linalg_tuning *tune_params(void) {
+    const struct linalg_tuning *t;
+
+    t = atomic_load_explicit(&params, memory_order_acquire);
+    if (t != NULL) {
+        return t;
+    }
+
+    if (!atomic_flag_test_and_set(&loading)) {
+        if (linalg_tuning_load(NULL) != 0
+                && getenv("LINALG_AUTOTUNE") != NULL
+                && linalg_tune(NULL) == 0) {
+            linalg_tuning_save(NULL);
+        }
+        /* Unless parameters were taken into use meanwhile */
+        t = NULL;
+        atomic_compare_exchange_strong(&params, &t, &defaults);
+    }
+    while ((t = atomic_load_explicit(&params, memory_order_acquire))
+            == NULL) {
+        sched_yield();
+    }
+    return t;
+}
+
+
+int linalg_tuning_get(struct linalg_tuning *out) {
+    *out = *tune_params();
+    return 0;
+}
+
+
+int linalg_tuning_set(const struct linalg_tuning *t) {
+    const struct linalg_tuning *cur;
+    struct snapshot *copy;
+
+    if (!valid(t)) {
+        return LATUNE_INVALID;
+    }
+    cur = atomic_load_explicit(&params, memory_order_acquire);
+    if (cur != NULL && memcmp(cur, t, sizeof(*t)) == 0) {
+        return 0;
+    }
+    copy = malloc(sizeof(*copy));
+    if (copy == NULL) {
+        return LATUNE_ALLOC;
+    }
+    copy->t = *t;
+    copy->prev = atomic_exchange_explicit(&snapshots, copy,
+            memory_order_relaxed);
+    atomic_store_explicit(&params, &copy->t, memory_order_release);
+    return 0;
+}
+
+
+/* Writes the CPU model name into buf, or "unknown". */
+static void cpu_model(char *buf, size_t len) {
+    char line[256];
+    char *p;
+    FILE *f;
+
+    snprintf(buf, len, "unknown");
+    f = fopen("/proc/cpuinfo", "r");
+    if (f == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, "model name", 10) == 0
+                && (p = strchr(line, ':')) != NULL) {
+            p += strspn(p + 1, " \t") + 1;
+            p[strcspn(p, "\n")] = '\0';
+            snprintf(buf, len, "%s", p);
+            break;
+        }
+    }
+    fclose(f);
+}
+
+
+/* Writes the default cache file path into buf.
+ * Returns 0 if there is none. */
+static int default_path(char *buf, size_t len, int make_dir) {
+    const char *env;
+
+    if ((env = getenv("LINALG_TUNE_FILE")) != NULL) {
+        snprintf(buf, len, "%s", env);
+        return 1;
+    }
+    if ((env = getenv("XDG_CACHE_HOME")) != NULL) {
+        snprintf(buf, len, "%s/linalg-tune", env);
+        return 1;
+    }
+    if ((env = getenv("HOME")) != NULL) {
+        snprintf(buf, len, "%s/.cache", env);
+        if (make_dir) {
+            mkdir(buf, 0755);
+        }
+        snprintf(buf + strlen(buf), len - strlen(buf), "/linalg-tune");
+        return 1;
+    }
+    return 0;
+}
+
+
+int linalg_tuning_load(const char *path) {
+    struct linalg_tuning t;
+    char buf[512], line[512], cpu[256], key[64];
+    int value, found = 0;
+    FILE *f;
+
+    if (path == NULL) {
+        if (!default_path(buf, sizeof(buf), 0)) {
+            return LATUNE_IO;
+        }
+        path = buf;
+    }
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return LATUNE_IO;
+    }
+
+    cpu_model(cpu, sizeof(cpu));
+    t = defaults;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "\n")] = '\0';
+        if (strncmp(line, "cpu ", 4) == 0) {
+            found = strcmp(line + 4, cpu) == 0;
+        } else if (sscanf(line, "%63s %d", key, &value) == 2) {
+            if (strcmp(key, "gemm_mc") == 0) {
+                t.gemm_mc = value;
+            } else if (strcmp(key, "gemm_kc") == 0) {
+                t.gemm_kc = value;
+            } else if (strcmp(key, "gemm_nc") == 0) {
+                t.gemm_nc = value;
+            } else if (strcmp(key, "gemv_rows") == 0) {
+                t.gemv_rows = value;
+            } else if (strcmp(key, "gemv_lanes") == 0) {
+                t.gemv_lanes = value;
+            } else if (strcmp(key, "transpose_block") == 0) {
+                t.transpose_block = value;
+            } else if (strcmp(key, "strassen_cutoff") == 0) {
+                t.strassen_cutoff = value;
+            }
+        }
+    }
+    fclose(f);
+
+    if (!found) {
+        return LATUNE_IO;
+    }
+    return linalg_tuning_set(&t);
+}
+
+
+int linalg_tuning_save(const char *path) {
+    const struct linalg_tuning *t = tune_params();
+    char buf[512], cpu[256];
+    FILE *f;
+
+    if (path == NULL) {
+        if (!default_path(buf, sizeof(buf), 1)) {
+            return LATUNE_IO;
+        }
+        path = buf;
+    }
+    f = fopen(path, "w");
+    if (f == NULL) {
+        return LATUNE_IO;
+    }
+
+    cpu_model(cpu, sizeof(cpu));
+    fprintf(f, "# linalg kernel parameters, written by linalg_tuning_save\n");
+    fprintf(f, "cpu %s\n", cpu);
+    fprintf(f, "gemm_mc %d\n", t->gemm_mc);
+    fprintf(f, "gemm_kc %d\n", t->gemm_kc);
+    fprintf(f, "gemm_nc %d\n", t->gemm_nc);
+    fprintf(f, "gemv_rows %d\n", t->gemv_rows);
+    fprintf(f, "gemv_lanes %d\n", t->gemv_lanes);
+    fprintf(f, "transpose_block %d\n", t->transpose_block);
+    fprintf(f, "strassen_cutoff %d\n", t->strassen_cutoff);
+
+    if (fclose(f) != 0) {
+        return LATUNE_IO;
+    }
+    return 0;
+}
+
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+static void fill(LINALG_SCALAR *p, size_t len) {
+    size_t i;
+    for (i = 0; i < len; i++) {
+        p[i] = (LINALG_SCALAR)(i % 17) / 17;
+    }
+}
+
+
+/* Candidate values */
+static const int cand_mc[] = {32, 64, 128};
+static const int cand_kc[] = {64, 128, 256, 512};
+static const int cand_nc[] = {128, 256, 512};
+static const int cand_rows[] = {1, 2, 4};
+static const int cand_lanes[] = {1, 4, 8, 16};
+static const int cand_block[] = {8, 16, 32, 64, 128};
+static const int cand_cutoff[] = {64, 128, 256, 512};
+
+#define COUNT(a) (sizeof(a) / sizeof(*(a)))
+
+
+static double time_gemm(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, const struct linalg_tuning *t) {
+    double t0, best = -1;
+    int r;
+
+    for (r = 0; r < TUNE_REPS; r++) {
+        t0 = now();
+        kern_gemm(a, b, c, TUNE_GEMM_N, TUNE_GEMM_N, TUNE_GEMM_N, t);
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+    }
+    return best;
+}
+
+
+static double time_gemv(const LINALG_SCALAR *m, const LINALG_SCALAR *v,
+        LINALG_SCALAR *out, const struct linalg_tuning *t) {
+    double t0, best = -1;
+    int r;
+
+    for (r = 0; r < TUNE_REPS; r++) {
+        t0 = now();
+        kern_gemv(m, v, out, TUNE_GEMV_N, TUNE_GEMV_N, t);
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+    }
+    return best;
+}
+
+
+static double time_transpose(const LINALG_SCALAR *src, LINALG_SCALAR *dst,
+        const struct linalg_tuning *t) {
+    double t0, best = -1;
+    int r;
+
+    for (r = 0; r < TUNE_REPS; r++) {
+        t0 = now();
+        kern_transpose(src, dst, TUNE_TRANSPOSE_N, TUNE_TRANSPOSE_N, t);
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+    }
+    return best;
+}
+
+
+static double time_strassen(const LINALG_SCALAR *a, const LINALG_SCALAR *b,
+        LINALG_SCALAR *c, const struct linalg_tuning *t) {
+    double t0, best = -1;
+    int r;
+
+    for (r = 0; r < TUNE_REPS; r++) {
+        t0 = now();
+        kern_strassen(a, b, c, TUNE_STRASSEN_N, t);
+        t0 = now() - t0;
+        best = best < 0 || t0 < best ? t0 : best;
+    }
+    return best;
+}
+
+
+int linalg_tune(struct linalg_tuning *out) {
+    struct linalg_tuning t = defaults, best = defaults;
+    LINALG_SCALAR *x, *y, *z;
+    double tm, best_time;
+    size_t len, i, j, k;
+
+    len = (size_t)TUNE_TRANSPOSE_N * TUNE_TRANSPOSE_N;
+    x = malloc(len * sizeof(*x));
+    y = malloc(len * sizeof(*y));
+    z = malloc(len * sizeof(*z));
+    if (x == NULL || y == NULL || z == NULL) {
+        free(x);
+        free(y);
+        free(z);
+        return LATUNE_ALLOC;
+    }
+    fill(x, len);
+    fill(y, len);
+
+    best_time = -1;
+    for (i = 0; i < COUNT(cand_mc); i++) {
+        for (j = 0; j < COUNT(cand_kc); j++) {
+            for (k = 0; k < COUNT(cand_nc); k++) {
+                t.gemm_mc = cand_mc[i];
+                t.gemm_kc = cand_kc[j];
+                t.gemm_nc = cand_nc[k];
+                tm = time_gemm(x, y, z, &t);
+                if (best_time < 0 || tm < best_time) {
+                    best_time = tm;
+                    best.gemm_mc = t.gemm_mc;
+                    best.gemm_kc = t.gemm_kc;
+                    best.gemm_nc = t.gemm_nc;
+                }
+            }
+        }
+    }
+
+    best_time = -1;
+    for (i = 0; i < COUNT(cand_rows); i++) {
+        for (j = 0; j < COUNT(cand_lanes); j++) {
+            t.gemv_rows = cand_rows[i];
+            t.gemv_lanes = cand_lanes[j];
+            tm = time_gemv(x, y, z, &t);
+            if (best_time < 0 || tm < best_time) {
+                best_time = tm;
+                best.gemv_rows = t.gemv_rows;
+                best.gemv_lanes = t.gemv_lanes;
+            }
+        }
+    }
+
+    best_time = -1;
+    for (i = 0; i < COUNT(cand_block); i++) {
+        t.transpose_block = cand_block[i];
+        tm = time_transpose(x, z, &t);
+        if (best_time < 0 || tm < best_time) {
+            best_time = tm;
+            best.transpose_block = t.transpose_block;
+        }
+    }
+
+    /* Uses the best GEMM parameters for the leaves */
+    t = best;
+    best_time = -1;
+    for (i = 0; i < COUNT(cand_cutoff); i++) {
+        t.strassen_cutoff = cand_cutoff[i];
+        tm = time_strassen(x, y, z, &t);
+        if (best_time < 0 || tm < best_time) {
+            best_time = tm;
+            best.strassen_cutoff = t.strassen_cutoff;
+        }
+    }
+
+    free(x);
+    free(y);
+    free(z);
+
+    if (out != NULL) {
+        *out = best;
+    }
+    return linalg_tuning_set(&best);
+}
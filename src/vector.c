@@ -1,21 +1,40 @@
 #include "vector.h"
+#include "internal.h"
 
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
 
 
-struct vector {
+/* Gives v storage of its own, unshared and writable, before a write
+ * in place. If that takes a copy which cannot be allocated, v keeps
+ * its storage and LAVEC_ALLOC is returned. */
+static int own(vector *v) {
     LINALG_SCALAR *data;
-    int dim;
-};
+
+    /* Only empty vectors have no storage */
+    if (v->data == NULL) {
+        return 0;
+    }
+    data = data_own(v->data, 1);
+    if (data == NULL) {
+        return LAVEC_ALLOC;
+    }
+    v->data = data;
+    return 0;
+}
 
 
 int vec_new(vector **out, LINALG_SCALAR *data, int dim) {
-    vector *v = malloc(sizeof(*v));
-    v->data = malloc(dim * sizeof(*v->data));
+    vector *v;
+
+    STATS_OP(vec_new);
+    v = malloc(sizeof(*v));
+    v->data = data_alloc(dim * sizeof(*v->data));
+    STATS_ALLOC(dim * sizeof(*v->data));
     if (data != NULL) {
         memcpy(v->data, data, dim * sizeof(*v->data));
+        STATS_COPY(dim * sizeof(*v->data));
     }
     v->dim = dim;
 
@@ -25,7 +44,10 @@ int vec_new(vector **out, LINALG_SCALAR *data, int dim) {
 
 
 int vec_alloc(vector **out) {
-    vector *v = malloc(sizeof(*v));
+    vector *v;
+
+    STATS_OP(vec_alloc);
+    v = malloc(sizeof(*v));
     v->data = NULL;
     v->dim = 0;
 
@@ -38,6 +60,7 @@ int vec_basis(vector **out, int dim, int pos) {
     int err;
     vector *v;
 
+    STATS_OP(vec_basis);
     err = vec_zero(&v, dim);
     if (err != 0) {
         return err;
@@ -56,8 +79,11 @@ int vec_basis(vector **out, int dim, int pos) {
 int vec_zero(vector **out, int dim) {
     vector *v;
 
+    STATS_OP(vec_zero);
     v = malloc(sizeof(*v));
-    v->data = calloc(dim, sizeof(*v->data));
+    v->data = data_alloc(dim * sizeof(*v->data));
+    memset(v->data, 0, dim * sizeof(*v->data));
+    STATS_ALLOC(dim * sizeof(*v->data));
     v->dim = dim;
 
     *out = v;
@@ -69,8 +95,14 @@ int vec_dup(vector **dst, const vector *src) {
     int err;
     vector *v;
 
-    err = vec_new(&v, src->data, src->dim);
+    STATS_OP(vec_dup);
+    err = vec_alloc(&v);
+    if (err != 0) {
+        return err;
+    }
+    err = vec_cpy(v, src);
     if (err != 0) {
+        vec_del(v);
         return err;
     }
 
@@ -80,22 +112,30 @@ int vec_dup(vector **dst, const vector *src) {
 
 
 int vec_cpy(vector *dst, const vector *src) {
-    dst->data = realloc(dst->data, src->dim * sizeof(*src->data));
+    STATS_OP(vec_cpy);
+    /* Usually shares src's storage, copied on the first write */
+    dst->data = data_copy(dst->data, src->data,
+            src->dim * sizeof(*src->data));
     dst->dim = src->dim;
-    memcpy(dst->data, src->data, src->dim * sizeof(*src->data));
+    if (dst->data != src->data) {
+        STATS_ALLOC(src->dim * sizeof(*src->data));
+        STATS_COPY(src->dim * sizeof(*src->data));
+    }
 
     return 0;
 }
 
 
 int vec_del(vector *v) {
-    free(v->data);
+    STATS_OP(vec_del);
+    data_free(v->data);
     free(v);
     return 0;
 }
 
 
 int vec_dim(const vector *v, int *dim) {
+    STATS_OP(vec_dim);
     *dim = v->dim;
     return 0;
 }
@@ -104,6 +144,8 @@ int vec_dim(const vector *v, int *dim) {
 int vec_norm(const vector *v, LINALG_SCALAR *out) {
     int err;
     LINALG_SCALAR norm;
+
+    STATS_OP(vec_norm);
     err = vec_norm2(v, &norm);
     if (err != 0) {
         return err;
@@ -114,15 +156,31 @@ int vec_norm(const vector *v, LINALG_SCALAR *out) {
 
 
 int vec_norm2(const vector *v, LINALG_SCALAR *out) {
+    STATS_OP(vec_norm2);
+    return vec_norm2_sum(v, sum_policy(), out);
+}
+
+
+int vec_norm2_sum(const vector *v, int mode, LINALG_SCALAR *out) {
     LINALG_SCALAR norm2;
     LINALG_SCALAR x;
     int i;
 
-    norm2 = 0;
-    for (i = 0; i < v->dim; i++) {
-        x = vec_get(v, i);
-        norm2 += x*x;
+    STATS_OP(vec_norm2_sum);
+    if (mode == LASUM_NAIVE) {
+        if (!blas_dot(v->data, v->data, v->dim, &norm2)) {
+            norm2 = 0;
+            for (i = 0; i < v->dim; i++) {
+                x = vec_get(v, i);
+                norm2 += x*x;
+            }
+        }
+    } else if (mode == LASUM_PAIRWISE || mode == LASUM_KAHAN) {
+        norm2 = sum_sq(v->data, v->dim, mode);
+    } else {
+        return LAVEC_INVALID;
     }
+    STATS_FLOPS(2LL * v->dim);
 
     *out = norm2;
     return 0;
@@ -132,6 +190,8 @@ int vec_norm2(const vector *v, LINALG_SCALAR *out) {
 int vec_dist(const vector *a, const vector *b, LINALG_SCALAR *out) {
     int err;
     LINALG_SCALAR dist;
+
+    STATS_OP(vec_dist);
     err = vec_dist2(a, b, &dist);
     if (err != 0) {
         return err;
@@ -142,19 +202,34 @@ int vec_dist(const vector *a, const vector *b, LINALG_SCALAR *out) {
 
 
 int vec_dist2(const vector *a, const vector *b, LINALG_SCALAR *out) {
+    STATS_OP(vec_dist2);
+    return vec_dist2_sum(a, b, sum_policy(), out);
+}
+
+
+int vec_dist2_sum(const vector *a, const vector *b, int mode,
+        LINALG_SCALAR *out) {
     LINALG_SCALAR dist2;
     LINALG_SCALAR x;
     int i;
 
+    STATS_OP(vec_dist2_sum);
     if (a->dim != b->dim) {
         return LAVEC_INCOMPATIBLE_DIM;
     }
 
-    dist2 = 0;
-    for (i = 0; i < a->dim; i++) {
-        x = vec_get(a, i) - vec_get(b, i);
-        dist2 += x*x;
+    if (mode == LASUM_NAIVE) {
+        dist2 = 0;
+        for (i = 0; i < a->dim; i++) {
+            x = vec_get(a, i) - vec_get(b, i);
+            dist2 += x*x;
+        }
+    } else if (mode == LASUM_PAIRWISE || mode == LASUM_KAHAN) {
+        dist2 = sum_dist2(a->data, b->data, a->dim, mode);
+    } else {
+        return LAVEC_INVALID;
     }
+    STATS_FLOPS(3LL * a->dim);
 
     *out = dist2;
     return 0;
@@ -162,18 +237,39 @@ int vec_dist2(const vector *a, const vector *b, LINALG_SCALAR *out) {
 
 
 int vec_get_data(const vector *v, LINALG_SCALAR *data) {
+    STATS_OP(vec_get_data);
     memcpy(data, v->data, v->dim * sizeof(*v->data));
+    STATS_COPY(v->dim * sizeof(*v->data));
     return 0;
 }
 
 
 int vec_set_data(vector *v, const LINALG_SCALAR *data) {
+    STATS_OP(vec_set_data);
+    if (own(v) != 0) {
+        return LAVEC_ALLOC;
+    }
     memcpy(v->data, data, v->dim * sizeof(*v->data));
+    STATS_COPY(v->dim * sizeof(*v->data));
     return 0;
 }
 
 
+LINALG_SCALAR *vec_data_ptr(vector *v) {
+    if (own(v) != 0) {
+        return NULL;
+    }
+    return v->data;
+}
+
+
+const LINALG_SCALAR *vec_data_cptr(const vector *v) {
+    return v->data;
+}
+
+
 int vec_read(const vector *v, int i, LINALG_SCALAR *out) {
+    STATS_OP(vec_read);
     if (i < 0 || i >= v->dim) {
         return LAVEC_OOB;
     }
@@ -188,16 +284,22 @@ LINALG_SCALAR vec_get(const vector *v, int i) {
 
 
 int vec_write(vector *v, int i, LINALG_SCALAR r) {
+    STATS_OP(vec_write);
     if (i < 0 || i >= v->dim) {
         return LAVEC_OOB;
     }
+    if (own(v) != 0) {
+        return LAVEC_ALLOC;
+    }
     vec_set(v, i, r);
     return 0;
 }
 
 
 void vec_set(vector *v, int i, LINALG_SCALAR r) {
-    v->data[i] = r;
+    if (own(v) == 0) {
+        v->data[i] = r;
+    }
 }
 
 
@@ -205,6 +307,7 @@ int vec_add(const vector *a, const vector *b, vector *out) {
     int err;
     vector *tmp;
 
+    STATS_OP(vec_add);
     err = vec_dup(&tmp, a);
     if (err != 0) {
         return err;
@@ -222,14 +325,22 @@ int vec_add(const vector *a, const vector *b, vector *out) {
 
 int vec_add_(vector *a, const vector *b) {
     int i, dim;
+
+    STATS_OP(vec_add_);
     if (a-> dim != b->dim) {
         return LAVEC_INCOMPATIBLE_DIM;
     }
+    if (own(a) != 0) {
+        return LAVEC_ALLOC;
+    }
 
     dim = a->dim;
-    for (i = 0; i < dim; i++) {
-        a->data[i] += b->data[i];
+    if (!blas_axpy(1, b->data, a->data, dim)) {
+        for (i = 0; i < dim; i++) {
+            a->data[i] += b->data[i];
+        }
     }
+    STATS_FLOPS(dim);
     return 0;
 }
 
@@ -238,6 +349,7 @@ int vec_sub(const vector *a, const vector *b, vector *out) {
     int err;
     vector *tmp;
 
+    STATS_OP(vec_sub);
     err = vec_dup(&tmp, a);
     if (err != 0) {
         return err;
@@ -255,31 +367,57 @@ int vec_sub(const vector *a, const vector *b, vector *out) {
 
 int vec_sub_(vector *a, const vector *b) {
     int i, dim;
+
+    STATS_OP(vec_sub_);
     if (a-> dim != b->dim) {
         return LAVEC_INCOMPATIBLE_DIM;
     }
+    if (own(a) != 0) {
+        return LAVEC_ALLOC;
+    }
 
     dim = a->dim;
-    for (i = 0; i < dim; i++) {
-        a->data[i] -= b->data[i];
+    if (!blas_axpy(-1, b->data, a->data, dim)) {
+        for (i = 0; i < dim; i++) {
+            a->data[i] -= b->data[i];
+        }
     }
+    STATS_FLOPS(dim);
     return 0;
 }
 
 
 int vec_dot(const vector *a, const vector *b, LINALG_SCALAR *out) {
+    STATS_OP(vec_dot);
+    return vec_dot_sum(a, b, sum_policy(), out);
+}
+
+
+int vec_dot_sum(const vector *a, const vector *b, int mode,
+        LINALG_SCALAR *out) {
     int i, dim;
     LINALG_SCALAR r;
 
+    STATS_OP(vec_dot_sum);
     if (a->dim != b->dim) {
         return LAVEC_INCOMPATIBLE_DIM;
     }
 
     dim = a->dim;
-    r = 0;
-    for (i = 0; i < dim; i++) {
-        r += vec_get(a, i) * vec_get(b, i);
+    if (mode == LASUM_NAIVE) {
+        if (!blas_dot(a->data, b->data, dim, &r)
+                && !spec_dot(a->data, b->data, dim, &r)) {
+            r = 0;
+            for (i = 0; i < dim; i++) {
+                r += vec_get(a, i) * vec_get(b, i);
+            }
+        }
+    } else if (mode == LASUM_PAIRWISE || mode == LASUM_KAHAN) {
+        r = sum_dot(a->data, b->data, dim, mode);
+    } else {
+        return LAVEC_INVALID;
     }
+    STATS_FLOPS(2LL * dim);
 
     *out = r;
     return 0;
@@ -290,6 +428,7 @@ int vec_smul(const vector *v, LINALG_SCALAR r, vector *out) {
     int err;
     vector *tmp;
 
+    STATS_OP(vec_smul);
     err = vec_dup(&tmp, v);
     if (err != 0) {
         return err;
@@ -307,11 +446,18 @@ int vec_smul(const vector *v, LINALG_SCALAR r, vector *out) {
 
 int vec_smul_(vector *v, LINALG_SCALAR r) {
     int i, dim;
-    
+
+    STATS_OP(vec_smul_);
+    if (own(v) != 0) {
+        return LAVEC_ALLOC;
+    }
     dim = v->dim;
-    for (i = 0; i < dim; i++) {
-        v->data[i] *= r;
+    if (!blas_scal(r, v->data, dim)) {
+        for (i = 0; i < dim; i++) {
+            v->data[i] *= r;
+        }
     }
+    STATS_FLOPS(dim);
     return 0;
 }
 
@@ -320,6 +466,7 @@ int vec_sdiv(const vector *v, LINALG_SCALAR r, vector *out) {
     int err;
     vector *tmp;
 
+    STATS_OP(vec_sdiv);
     err = vec_dup(&tmp, v);
     if (err != 0) {
         return err;
@@ -337,11 +484,72 @@ int vec_sdiv(const vector *v, LINALG_SCALAR r, vector *out) {
 
 int vec_sdiv_(vector *v, LINALG_SCALAR r) {
     int i, dim;
-    
+
+    STATS_OP(vec_sdiv_);
+    if (own(v) != 0) {
+        return LAVEC_ALLOC;
+    }
     dim = v->dim;
     for (i = 0; i < dim; i++) {
         v->data[i] /= r;
     }
+    STATS_FLOPS(dim);
+    return 0;
+}
+
+
+int vec_emul(const vector *a, const vector *b, vector *out) {
+    int i, dim;
+
+    STATS_OP(vec_emul);
+    if (a->dim != b->dim) {
+        return LAVEC_INCOMPATIBLE_DIM;
+    }
+
+    if (out != a && out != b) {
+        out->data = data_realloc(out->data, a->dim * sizeof(*out->data));
+        out->dim = a->dim;
+        STATS_ALLOC(a->dim * sizeof(*out->data));
+    } else if (own(out) != 0) {
+        return LAVEC_ALLOC;
+    }
+    dim = a->dim;
+    for (i = 0; i < dim; i++) {
+        out->data[i] = a->data[i] * b->data[i];
+    }
+    STATS_FLOPS(dim);
+    return 0;
+}
+
+
+int vec_emul_(vector *a, const vector *b) {
+    STATS_OP(vec_emul_);
+    return vec_emul(a, b, a);
+}
+
+
+int vec_map(const vector *v, vm_func f, void *ctx, vector *out) {
+    STATS_OP(vec_map);
+    if (out != v) {
+        out->data = data_realloc(out->data, v->dim * sizeof(*out->data));
+        out->dim = v->dim;
+        STATS_ALLOC(v->dim * sizeof(*out->data));
+    } else if (own(out) != 0) {
+        return LAVEC_ALLOC;
+    }
+    vm_apply(f, ctx, out->data, v->data, v->dim);
+    STATS_FLOPS(v->dim);
+    return 0;
+}
+
+
+int vec_map_(vector *v, vm_func f, void *ctx) {
+    STATS_OP(vec_map_);
+    if (own(v) != 0) {
+        return LAVEC_ALLOC;
+    }
+    vm_apply(f, ctx, v->data, v->data, v->dim);
+    STATS_FLOPS(v->dim);
     return 0;
 }
 
@@ -350,6 +558,7 @@ int vec_mmul_l(const vector *v, const matrix *m, vector *out) {
     int err;
     vector *tmp;
 
+    STATS_OP(vec_mmul_l);
     err = vec_dup(&tmp, v);
     if (err != 0) {
         return err;
@@ -368,81 +577,180 @@ int vec_mmul_l(const vector *v, const matrix *m, vector *out) {
 
 
 int vec_mmul_l_(vector *v, const matrix *m) {
-    int i, j, mrows, mcols;
-    int err;
-    LINALG_SCALAR s;
-    vector *tmp;
+    LINALG_SCALAR *data;
 
-    mat_dim(m, &mrows, &mcols);
-    if (v->dim != mrows) {
+    STATS_OP(vec_mmul_l_);
+    if (v->dim != m->rows) {
         return LAVEC_INCOMPATIBLE_DIM;
     }
-    
-    err = vec_new(&tmp, NULL, mrows);
-    if (err != 0) {
-        return err;
+
+    data = data_alloc(m->cols * sizeof(*data));
+    STATS_ALLOC(m->cols * sizeof(*data));
+    STATS_FLOPS(2LL * m->rows * m->cols);
+
+    mat_gevm(v->data, m, data);
+
+    data_free(v->data);
+    v->data = data;
+    v->dim = m->cols;
+    return 0;
+}
+
+
+int vec_mmul_r(const matrix *m, const vector *v, vector *out) {
+    STATS_OP(vec_mmul_r);
+    if (out == v) {
+        return vec_mmul_r_(m, out);
+    }
+    if (v->dim != m->cols) {
+        return LAVEC_INCOMPATIBLE_DIM;
+    }
+
+    out->data = data_realloc(out->data, m->rows * sizeof(*out->data));
+    out->dim = m->rows;
+    STATS_ALLOC(m->rows * sizeof(*out->data));
+    STATS_FLOPS(2LL * m->rows * m->cols);
+
+    mat_gemv(m, v->data, out->data);
+    return 0;
+}
+
+
+int vec_mmul_r_(const matrix *m, vector *v) {
+    LINALG_SCALAR *data;
+
+    STATS_OP(vec_mmul_r_);
+    if (v->dim != m->cols) {
+        return LAVEC_INCOMPATIBLE_DIM;
+    }
+
+    data = data_alloc(m->rows * sizeof(*data));
+    STATS_ALLOC(m->rows * sizeof(*data));
+    STATS_FLOPS(2LL * m->rows * m->cols);
+
+    mat_gemv(m, v->data, data);
+
+    data_free(v->data);
+    v->data = data;
+    v->dim = m->rows;
+    return 0;
+}
+
+
+/* Elements idx[i] of v, copied into or from elements i of x. As for the
+ * rows of mat_gather_rows, the loads are independent and overlap
+ * without prefetching. */
+struct elem_move {
+    LINALG_SCALAR *v;
+    LINALG_SCALAR *x;
+    const int *idx;
+    int n;              /* indices, for scatter_part */
+};
+
+
+static void gather_part(void *ctx, int index, long lo, long hi) {
+    const struct elem_move *e = ctx;
+    long i;
+
+    (void)index;
+    for (i = lo; i < hi; i++) {
+        e->x[i] = e->v[e->idx[i]];
     }
+}
 
-    for (i = 0; i < mcols; i++) {
-        s = 0;
-        for (j = 0; j < mrows; j++) {
-            s += vec_get(v, j) * mat_get(m, j, i);
+
+/* Parts of a scatter take the elements of v in [lo, hi), each reading
+ * all of idx, so that the last of repeated indices wins */
+static void scatter_part(void *ctx, int index, long lo, long hi) {
+    const struct elem_move *e = ctx;
+    int i;
+
+    (void)index;
+    for (i = 0; i < e->n; i++) {
+        if (e->idx[i] >= lo && e->idx[i] < hi) {
+            e->v[e->idx[i]] = e->x[i];
         }
-        vec_set(tmp, i, s);
     }
+}
 
-    err = vec_cpy(v, tmp);
-    vec_del(tmp);
-    return err;
+
+/* Returns LAVEC_OOB if any of the n indices in idx is outside
+ * [0, dim), else 0. */
+static int check_indices(const int *idx, int n, int dim) {
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (idx[i] < 0 || idx[i] >= dim) {
+            return LAVEC_OOB;
+        }
+    }
+    return 0;
 }
 
 
-int vec_mmul_r(const matrix *m, const vector *v, vector *out) {
+int vec_gather(const vector *v, const int *idx, int n, vector *out) {
+    struct elem_move e;
+    LINALG_SCALAR *data;
     int err;
-    vector *tmp;
 
-    err = vec_dup(&tmp, v);
+    STATS_OP(vec_gather);
+    if (n <= 0) {
+        return LAVEC_INVALID;
+    }
+    err = check_indices(idx, n, v->dim);
     if (err != 0) {
         return err;
     }
 
-    err = vec_mmul_r_(m, tmp);
-    if (err != 0) {
-        vec_del(tmp);
-        return err;
+    if (out == v) {
+        data = data_alloc(n * sizeof(*data));
+    } else {
+        data = data_realloc(out->data, n * sizeof(*data));
+        out->data = data;
     }
+    STATS_ALLOC(n * sizeof(*data));
+    STATS_COPY(n * sizeof(*data));
 
-    err = vec_cpy(out, tmp);
-    vec_del(tmp);
-    return err;
+    e.v = v->data;
+    e.x = data;
+    e.idx = idx;
+    par_for(n, par_parts(n, PAR_GRAIN_BYTES / sizeof(*data)),
+            gather_part, &e);
+
+    if (data != out->data) {
+        data_free(out->data);
+        out->data = data;
+    }
+    out->dim = n;
+    return 0;
 }
 
 
-int vec_mmul_r_(const matrix *m, vector *v) {
-    int i, j, mrows, mcols;
+int vec_scatter(vector *v, const int *idx, int n, const vector *src) {
+    struct elem_move e;
     int err;
-    LINALG_SCALAR s;
-    vector *tmp;
 
-    mat_dim(m, &mrows, &mcols);
-    if (v->dim != mcols) {
+    STATS_OP(vec_scatter);
+    if (src == v) {
+        return LAVEC_INVALID;
+    }
+    if (src->dim != n) {
         return LAVEC_INCOMPATIBLE_DIM;
     }
-    
-    err = vec_new(&tmp, NULL, mrows);
+    err = check_indices(idx, n, v->dim);
     if (err != 0) {
         return err;
     }
 
-    for (i = 0; i < mrows; i++) {
-        s = 0;
-        for (j = 0; j < mcols; j++) {
-            s += vec_get(v, j) * mat_get(m, i, j);
-        }
-        vec_set(tmp, i, s);
+    if (own(v) != 0) {
+        return LAVEC_ALLOC;
     }
-
-    err = vec_cpy(v, tmp);
-    vec_del(tmp);
-    return err;
+    STATS_COPY(n * sizeof(*v->data));
+    e.v = v->data;
+    e.x = src->data;
+    e.idx = idx;
+    e.n = n;
+    par_for(v->dim, par_parts(n, PAR_GRAIN_BYTES / sizeof(*v->data)),
+            scatter_part, &e);
+    return 0;
 }
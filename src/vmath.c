@@ -0,0 +1,257 @@
+#include "vmath.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Number of elements a kernel processes per pass.
+ * Small enough for the chunk to stay in L1 between the load and
+ * the store, large enough to amortize the loop overhead. */
+#define VM_CHUNK 1024
+
+/* Adding this to a float in [-2^22, 2^22] rounds it to an integer,
+ * which is left in the low mantissa bits. */
+#define VM_SHIFTER 12582912.0f
+
+#define VM_LOG2E 1.44269504088896341f
+#define VM_LN2_HI 0.693359375f
+#define VM_LN2_LO -2.12194440e-4f
+
+/* e^x overflows above VM_EXP_HI and is subnormal below VM_EXP_LO */
+#define VM_EXP_HI 88.7228391f
+#define VM_EXP_LO -87.3365447505531f
+
+#define VM_SQRTHF 0.707106781186547524f
+
+#define VM_TANH_SMALL 0.625f
+
+
+static inline uint32_t as_uint(float x) {
+    uint32_t u;
+    memcpy(&u, &x, sizeof(u));
+    return u;
+}
+
+
+static inline float as_float(uint32_t u) {
+    float x;
+    memcpy(&x, &u, sizeof(x));
+    return x;
+}
+
+
+/* Kernels.
+ * These are written without branches or calls so that the loops in
+ * the *_n functions below can be vectorized by the compiler.
+ * See OPT_FLAGS in the Makefile for the flags this depends on. */
+
+static inline float k_exp(float x) {
+    float xc, t, n, r, z, y;
+    uint32_t e, k;
+
+    xc = x > VM_EXP_HI ? VM_EXP_HI : x;
+    xc = xc < VM_EXP_LO ? VM_EXP_LO : xc;
+
+    /* x = n*ln2 + r, |r| <= ln2/2 */
+    t = xc * VM_LOG2E + VM_SHIFTER;
+    n = t - VM_SHIFTER;
+    e = as_uint(t) - as_uint(VM_SHIFTER);
+    r = xc - n * VM_LN2_HI;
+    r = r - n * VM_LN2_LO;
+
+    z = r * r;
+    y = 1.9875691500e-4f;
+    y = y * r + 1.3981999507e-3f;
+    y = y * r + 8.3334519073e-3f;
+    y = y * r + 4.1665795894e-2f;
+    y = y * r + 1.6666665459e-1f;
+    y = y * r + 5.0000001201e-1f;
+    y = y * z + r + 1.0f;
+
+    /* 2^128 is not representable, so for positive n
+     * scale by 2^(n-1) and then by 2. */
+    k = (int32_t)e > 0;
+    y = y * as_float((e + 127 - k) << 23);
+    y = k ? y + y : y;
+
+    y = x > VM_EXP_HI ? INFINITY : y;
+    y = x < VM_EXP_LO ? 0.0f : y;
+    return y;
+}
+
+
+static inline float k_log(float x) {
+    float m, s, e, z, y, r;
+    uint32_t u;
+    int tiny;
+
+    /* Bring subnormals into the normal range */
+    tiny = x < 1.17549435e-38f;
+    s = tiny ? x * 8388608.0f : x;
+    u = as_uint(s);
+
+    /* s = m * 2^e, m in [sqrt(1/2), sqrt(2)) */
+    e = (float)((int32_t)(u >> 23) - 126) - (tiny ? 23.0f : 0.0f);
+    m = as_float((u & 0x007fffff) | 0x3f000000);
+    e = m < VM_SQRTHF ? e - 1.0f : e;
+    m = m < VM_SQRTHF ? m + m - 1.0f : m - 1.0f;
+
+    z = m * m;
+    y = 7.0376836292e-2f;
+    y = y * m - 1.1514610310e-1f;
+    y = y * m + 1.1676998740e-1f;
+    y = y * m - 1.2420140846e-1f;
+    y = y * m + 1.4249322787e-1f;
+    y = y * m - 1.6668057665e-1f;
+    y = y * m + 2.0000714765e-1f;
+    y = y * m - 2.4999993993e-1f;
+    y = y * m + 3.3333331174e-1f;
+    y = y * m * z;
+    y = y + e * VM_LN2_LO;
+    y = y - 0.5f * z;
+    r = m + y;
+    r = r + e * VM_LN2_HI;
+
+    r = x == INFINITY ? INFINITY : r;
+    r = x == 0.0f ? -INFINITY : r;
+    r = x < 0.0f ? NAN : r;
+    r = x != x ? x : r;
+    return r;
+}
+
+
+static inline float k_tanh(float x) {
+    float a, z, p, q;
+
+    /* Small arguments: odd polynomial */
+    z = x * x;
+    p = -5.70498872745e-3f;
+    p = p * z + 2.06390887954e-2f;
+    p = p * z - 5.37397155531e-2f;
+    p = p * z + 1.33314422036e-1f;
+    p = p * z - 3.33332819422e-1f;
+    p = p * z * x + x;
+
+    /* Large arguments: 1 - 2 / (e^2|x| + 1) */
+    a = x < 0.0f ? -x : x;
+    q = 1.0f - 2.0f / (k_exp(a + a) + 1.0f);
+    q = x < 0.0f ? -q : q;
+
+    return a < VM_TANH_SMALL ? p : q;
+}
+
+
+static inline float k_sigmoid(float x) {
+    return 1.0f / (1.0f + k_exp(-x));
+}
+
+
+/* Array kernels */
+
+static void exp_n(LINALG_SCALAR *restrict dst,
+        const LINALG_SCALAR *restrict src, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = k_exp(src[i]);
+    }
+}
+
+
+static void log_n(LINALG_SCALAR *restrict dst,
+        const LINALG_SCALAR *restrict src, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = k_log(src[i]);
+    }
+}
+
+
+static void sqrt_n(LINALG_SCALAR *restrict dst,
+        const LINALG_SCALAR *restrict src, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = sqrtf(src[i]);
+    }
+}
+
+
+static void tanh_n(LINALG_SCALAR *restrict dst,
+        const LINALG_SCALAR *restrict src, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = k_tanh(src[i]);
+    }
+}
+
+
+static void sigmoid_n(LINALG_SCALAR *restrict dst,
+        const LINALG_SCALAR *restrict src, int n) {
+    int i;
+    for (i = 0; i < n; i++) {
+        dst[i] = k_sigmoid(src[i]);
+    }
+}
+
+
+LINALG_SCALAR vm_exp(LINALG_SCALAR x, void *ctx) {
+    return k_exp(x);
+}
+
+
+LINALG_SCALAR vm_log(LINALG_SCALAR x, void *ctx) {
+    return k_log(x);
+}
+
+
+LINALG_SCALAR vm_sqrt(LINALG_SCALAR x, void *ctx) {
+    return sqrtf(x);
+}
+
+
+LINALG_SCALAR vm_tanh(LINALG_SCALAR x, void *ctx) {
+    return k_tanh(x);
+}
+
+
+LINALG_SCALAR vm_sigmoid(LINALG_SCALAR x, void *ctx) {
+    return k_sigmoid(x);
+}
+
+
+void vm_apply(vm_func f, void *ctx,
+        LINALG_SCALAR *dst, const LINALG_SCALAR *src, int n) {
+    void (*kernel)(LINALG_SCALAR *restrict, const LINALG_SCALAR *restrict,
+            int);
+    LINALG_SCALAR buf[VM_CHUNK];
+    int i, len;
+
+    if (f == vm_exp) {
+        kernel = exp_n;
+    } else if (f == vm_log) {
+        kernel = log_n;
+    } else if (f == vm_sqrt) {
+        kernel = sqrt_n;
+    } else if (f == vm_tanh) {
+        kernel = tanh_n;
+    } else if (f == vm_sigmoid) {
+        kernel = sigmoid_n;
+    } else {
+        for (i = 0; i < n; i++) {
+            dst[i] = f(src[i], ctx);
+        }
+        return;
+    }
+
+    if (dst != src) {
+        kernel(dst, src, n);
+        return;
+    }
+
+    /* In place: the kernels take restrict pointers, so stage
+     * each chunk through a buffer that stays in L1. */
+    for (i = 0; i < n; i += VM_CHUNK) {
+        len = n - i < VM_CHUNK ? n - i : VM_CHUNK;
+        memcpy(buf, src + i, len * sizeof(*buf));
+        kernel(dst + i, buf, len);
+    }
+}
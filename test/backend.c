@@ -0,0 +1,436 @@
+/* Routing between the native code and the CBLAS backend: every
+ * operation backend.h lists reaches its BLAS routine from the threshold
+ * on and not below it, nor for the operands and modes it excludes, with
+ * results matching the native ones. The BLAS routines are replaced by
+ * naive ones that count their calls. Built without BLAS, no call may
+ * reach them and LABACK_CBLAS is refused. */
+
+#include "backend.h"
+#include "plan.h"
+#include "summation.h"
+#include "check.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+
+/* Dimensions of the operands, whose work is M * K * N for a product,
+ * M * K for a matrix-vector product and the number of elements
+ * otherwise */
+#define M 19
+#define K 23
+#define N 17
+
+/* Error allowed, times the inner dimension and the largest elements
+ * of the operands */
+#define TOL 1e-6
+
+
+/* The routines counted */
+enum {GEMM, GEMV, DOT, AXPY, SCAL, ROUTINES};
+
+/* Values of the CBLAS enums the backend passes */
+#define ROW_MAJOR 101
+#define NO_TRANS 111
+#define TRANS 112
+
+static atomic_int calls[ROUTINES], bad_args;
+
+
+/* Stand-ins for the routines of the CBLAS library, for the float
+ * LINALG_SCALAR, which count their calls. Linked in its place, they
+ * need no BLAS to build, and support only the row-major operands and
+ * contiguous vectors the backend passes. */
+void cblas_sgemm(int order, int ta, int tb, int m, int n, int k,
+        float alpha, const float *a, int lda, const float *b, int ldb,
+        float beta, float *c, int ldc) {
+    double sum;
+    int i, j, l;
+
+    atomic_fetch_add(&calls[GEMM], 1);
+    if (order != ROW_MAJOR || ta != NO_TRANS || tb != NO_TRANS
+            || lda != k || ldb != n || ldc != n || beta != 0) {
+        atomic_store(&bad_args, 1);
+        return;
+    }
+    for (i = 0; i < m; i++) {
+        for (j = 0; j < n; j++) {
+            sum = 0;
+            for (l = 0; l < k; l++) {
+                sum += (double)a[i * lda + l] * b[l * ldb + j];
+            }
+            c[i * ldc + j] = alpha * sum;
+        }
+    }
+}
+
+
+void cblas_sgemv(int order, int ta, int m, int n, float alpha,
+        const float *a, int lda, const float *x, int incx, float beta,
+        float *y, int incy) {
+    double sum;
+    int i, j;
+
+    atomic_fetch_add(&calls[GEMV], 1);
+    if (order != ROW_MAJOR || (ta != NO_TRANS && ta != TRANS)
+            || lda != n || incx != 1 || incy != 1 || beta != 0) {
+        atomic_store(&bad_args, 1);
+        return;
+    }
+    for (i = 0; i < (ta == TRANS ? n : m); i++) {
+        sum = 0;
+        for (j = 0; j < (ta == TRANS ? m : n); j++) {
+            sum += (double)x[j] * (ta == TRANS ? a[j * lda + i]
+                : a[i * lda + j]);
+        }
+        y[i] = alpha * sum;
+    }
+}
+
+
+float cblas_sdot(int n, const float *x, int incx, const float *y,
+        int incy) {
+    double sum = 0;
+    int i;
+
+    atomic_fetch_add(&calls[DOT], 1);
+    if (incx != 1 || incy != 1) {
+        atomic_store(&bad_args, 1);
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        sum += (double)x[i] * y[i];
+    }
+    return sum;
+}
+
+
+void cblas_saxpy(int n, float alpha, const float *x, int incx, float *y,
+        int incy) {
+    int i;
+
+    atomic_fetch_add(&calls[AXPY], 1);
+    if (incx != 1 || incy != 1) {
+        atomic_store(&bad_args, 1);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+
+void cblas_sscal(int n, float alpha, float *x, int incx) {
+    int i;
+
+    atomic_fetch_add(&calls[SCAL], 1);
+    if (incx != 1) {
+        atomic_store(&bad_args, 1);
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        x[i] *= alpha;
+    }
+}
+
+
+/* Whether the calls since the last check went to routine r alone, or
+ * to none if r is ROUTINES, which then clears the counts */
+static int routed(int r) {
+    int i, ok = 1;
+
+    for (i = 0; i < ROUTINES; i++) {
+        ok &= i == r ? atomic_load(&calls[i]) > 0
+            : atomic_load(&calls[i]) == 0;
+        atomic_store(&calls[i], 0);
+    }
+    return ok;
+}
+
+
+/* Whether a and b hold the same elements */
+static int same(const matrix *a, const matrix *b) {
+    int rows, cols, r, c, i, j;
+
+    mat_dim(a, &rows, &cols);
+    mat_dim(b, &r, &c);
+    if (rows != r || cols != c) {
+        return 0;
+    }
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            if (mat_get(a, i, j) != mat_get(b, i, j)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* Whether out holds v * m (left) or m * v to within TOL */
+static int is_mmul(const matrix *m, const vector *v, const vector *out,
+        int left) {
+    double mmax = 0, vmax = 0, sum;
+    int rows, cols, n, dim, i, j;
+
+    mat_dim(m, &rows, &cols);
+    vec_dim(out, &dim);
+    n = left ? rows : cols;
+    if (dim != (left ? cols : rows)) {
+        return 0;
+    }
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            mmax = fmax(mmax, fabs(mat_get(m, i, j)));
+        }
+    }
+    for (i = 0; i < n; i++) {
+        vmax = fmax(vmax, fabs(vec_get(v, i)));
+    }
+    for (i = 0; i < dim; i++) {
+        sum = 0;
+        for (j = 0; j < n; j++) {
+            sum += (double)vec_get(v, j)
+                * (left ? mat_get(m, j, i) : mat_get(m, i, j));
+        }
+        if (fabs(sum - vec_get(out, i)) > TOL * n * mmax * vmax) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Products of matrices, through mat_mul, mat_mul_ and plans, at the
+ * threshold and one short of it, and those the backend leaves alone */
+static void test_products(void) {
+    long work = (long)M * K * N;
+    matrix *a, *b, *ref, *out;
+    plan *p;
+
+    mat_zero(&a, M, K);
+    mat_zero(&b, K, N);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    mat_zero(&ref, 1, 1);
+    mat_zero(&out, 1, 1);
+    CHECK(linalg_backend(LABACK_NATIVE, 0) == 0);
+    mat_mul(a, b, ref);
+
+    CHECK(linalg_backend(LABACK_CBLAS, work + 1) == 0);
+    CHECK(mat_mul(a, b, out) == 0 && same(out, ref));
+    CHECK(routed(ROUTINES));
+    CHECK(linalg_backend(LABACK_CBLAS, work) == 0);
+    CHECK(mat_mul(a, b, out) == 0 && check_product(a, b, out, TOL));
+    CHECK(routed(GEMM));
+    mat_cpy(out, a);
+    CHECK(mat_mul_(out, b) == 0 && check_product(a, b, out, TOL));
+    CHECK(routed(GEMM));
+    CHECK(mat_mul_plan(&p, M, K, N, 0) == 0);
+    CHECK(plan_execute(p, a, b, out) == 0 && check_product(a, b, out, TOL));
+    CHECK(routed(GEMM));
+    plan_del(p);
+
+    /* Other summation modes, algorithms and layouts stay native */
+    CHECK(linalg_sum_policy(LASUM_KAHAN) == 0);
+    CHECK(mat_mul(a, b, out) == 0 && check_product(a, b, out, TOL));
+    CHECK(routed(ROUTINES));
+    CHECK(linalg_sum_policy(LASUM_NAIVE) == 0);
+    CHECK(mat_mul_policy(LAMAT_MUL_STRASSEN) == 0);
+    CHECK(mat_mul(a, b, out) == 0 && same(out, ref));
+    CHECK(routed(ROUTINES));
+    CHECK(mat_mul_policy(LAMAT_MUL_CLASSIC) == 0);
+    mat_set_layout(a, LAMAT_TILED);
+    CHECK(mat_mul(a, b, out) == 0 && check_product(a, b, out, TOL));
+    CHECK(routed(ROUTINES));
+
+    mat_del(a);
+    mat_del(b);
+    mat_del(ref);
+    mat_del(out);
+}
+
+
+static void test_vectors(void) {
+    matrix *m, *tiled;
+    vector *x, *y, *out, *ref;
+    LINALG_SCALAR r, s;
+    int i;
+
+    mat_zero(&m, M, K);
+    check_fill_matrix(m, -1, 1);
+    mat_dup(&tiled, m);
+    mat_set_layout(tiled, LAMAT_TILED);
+    vec_zero(&x, K);
+    vec_zero(&y, M);
+    check_fill_vector(x, -1, 1);
+    check_fill_vector(y, -1, 1);
+    vec_zero(&out, 1);
+
+    /* Matrix-vector products, of work M * K */
+    CHECK(linalg_backend(LABACK_CBLAS, (long)M * K + 1) == 0);
+    CHECK(vec_mmul_r(m, x, out) == 0 && is_mmul(m, x, out, 0));
+    CHECK(vec_mmul_l(y, m, out) == 0 && is_mmul(m, y, out, 1));
+    CHECK(routed(ROUTINES));
+    CHECK(linalg_backend(LABACK_CBLAS, (long)M * K) == 0);
+    CHECK(vec_mmul_r(m, x, out) == 0 && is_mmul(m, x, out, 0));
+    CHECK(routed(GEMV));
+    CHECK(vec_mmul_l(y, m, out) == 0 && is_mmul(m, y, out, 1));
+    CHECK(routed(GEMV));
+    CHECK(vec_mmul_r(tiled, x, out) == 0 && is_mmul(m, x, out, 0));
+    CHECK(vec_mmul_l(y, tiled, out) == 0 && is_mmul(m, y, out, 1));
+    CHECK(routed(ROUTINES));
+
+    /* Dot products and norms, of work K */
+    CHECK(linalg_backend(LABACK_NATIVE, 0) == 0);
+    vec_dot(x, x, &s);
+    CHECK(linalg_backend(LABACK_CBLAS, K + 1) == 0);
+    CHECK(vec_dot(x, x, &r) == 0 && r == s);
+    CHECK(routed(ROUTINES));
+    CHECK(linalg_backend(LABACK_CBLAS, K) == 0);
+    CHECK(vec_dot(x, x, &r) == 0 && check_close(r, s, TOL * K));
+    CHECK(routed(DOT));
+    CHECK(vec_norm2(x, &r) == 0 && check_close(r, s, TOL * K));
+    CHECK(routed(DOT));
+    CHECK(vec_dot_sum(x, x, LASUM_PAIRWISE, &r) == 0);
+    CHECK(routed(ROUTINES));
+
+    /* Element-wise updates, of work K, exact either way */
+    CHECK(linalg_backend(LABACK_NATIVE, 0) == 0);
+    vec_dup(&ref, x);
+    vec_add_(ref, x);
+    vec_smul_(ref, 3);
+    vec_sub_(ref, x);
+    CHECK(linalg_backend(LABACK_CBLAS, K + 1) == 0);
+    vec_cpy(out, x);
+    CHECK(vec_add_(out, x) == 0 && vec_smul_(out, 3) == 0
+            && vec_sub_(out, x) == 0);
+    CHECK(routed(ROUTINES));
+    CHECK(linalg_backend(LABACK_CBLAS, K) == 0);
+    vec_cpy(out, x);
+    CHECK(vec_add_(out, x) == 0);
+    CHECK(routed(AXPY));
+    CHECK(vec_smul_(out, 3) == 0);
+    CHECK(routed(SCAL));
+    CHECK(vec_sub_(out, x) == 0);
+    CHECK(routed(AXPY));
+    for (i = 0; i < K; i++) {
+        CHECK(vec_get(out, i) == vec_get(ref, i));
+    }
+
+    mat_del(m);
+    mat_del(tiled);
+    vec_del(x);
+    vec_del(y);
+    vec_del(out);
+    vec_del(ref);
+}
+
+
+/* Element-wise updates of matrices, of work M * K, exact either way,
+ * and operands in different layouts, which stay native */
+static void test_matrices(void) {
+    matrix *a, *b, *tiled, *ref, *out;
+
+    mat_zero(&a, M, K);
+    mat_zero(&b, M, K);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    mat_dup(&tiled, b);
+    mat_set_layout(tiled, LAMAT_TILED);
+    CHECK(linalg_backend(LABACK_NATIVE, 0) == 0);
+    mat_dup(&ref, a);
+    mat_add_(ref, b);
+    mat_smul_(ref, 3);
+    mat_sub_(ref, b);
+
+    CHECK(linalg_backend(LABACK_CBLAS, (long)M * K) == 0);
+    mat_dup(&out, a);
+    CHECK(mat_add_(out, b) == 0);
+    CHECK(routed(AXPY));
+    CHECK(mat_smul_(out, 3) == 0);
+    CHECK(routed(SCAL));
+    CHECK(mat_sub_(out, b) == 0 && same(out, ref));
+    CHECK(routed(AXPY));
+    mat_cpy(out, a);
+    CHECK(mat_add_(out, tiled) == 0 && mat_smul_(out, 3) == 0
+            && mat_sub_(out, tiled) == 0);
+    CHECK(same(out, ref) && routed(SCAL));
+
+    CHECK(linalg_backend(LABACK_CBLAS, (long)M * K + 1) == 0);
+    mat_cpy(out, a);
+    CHECK(mat_add_(out, b) == 0 && mat_smul_(out, 3) == 0
+            && mat_sub_(out, b) == 0);
+    CHECK(same(out, ref) && routed(ROUTINES));
+
+    mat_del(a);
+    mat_del(b);
+    mat_del(tiled);
+    mat_del(ref);
+    mat_del(out);
+}
+
+
+/* The native backend, which every build has, takes nothing to the
+ * BLAS however small the threshold */
+static void test_native(void) {
+    matrix *a, *out;
+    vector *v;
+    LINALG_SCALAR r;
+
+    mat_zero(&a, M, M);
+    mat_zero(&out, 1, 1);
+    vec_zero(&v, M);
+    check_fill_matrix(a, -1, 1);
+    check_fill_vector(v, -1, 1);
+    CHECK(linalg_backend(LABACK_NATIVE, 0) == 0);
+    CHECK(mat_mul(a, a, out) == 0 && check_product(a, a, out, TOL));
+    CHECK(mat_add_(out, a) == 0 && mat_smul_(out, 2) == 0);
+    CHECK(vec_mmul_r_(a, v) == 0 && vec_dot(v, v, &r) == 0);
+    CHECK(routed(ROUTINES));
+    mat_del(a);
+    mat_del(out);
+    vec_del(v);
+}
+
+
+static void test_errors(void) {
+    CHECK(linalg_backend(-1, 0) == LABACK_INVALID);
+    CHECK(linalg_backend(LABACK_CBLAS + 1, 0) == LABACK_INVALID);
+    CHECK(linalg_backend(LABACK_NATIVE, -1) == LABACK_INVALID);
+    CHECK(linalg_backend(LABACK_CBLAS, -1) == LABACK_INVALID);
+}
+
+
+int main(void) {
+    matrix *a, *b, *out;
+    int blas;
+
+    srand(1);
+
+    /* The default: a product of work past LABACK_THRESHOLD goes to the
+     * BLAS when there is one */
+    mat_zero(&a, M, K);
+    mat_zero(&b, K, N);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    CHECK((long)M * K * N >= LABACK_THRESHOLD);
+    CHECK(mat_mul(a, b, out) == 0 && check_product(a, b, out, TOL));
+    blas = linalg_backend(LABACK_CBLAS, LABACK_THRESHOLD) == 0;
+    CHECK(blas || linalg_backend(LABACK_CBLAS, 0) == LABACK_UNSUPPORTED);
+    CHECK(routed(blas ? GEMM : ROUTINES));
+    mat_del(a);
+    mat_del(b);
+    mat_del(out);
+
+    test_native();
+    test_errors();
+    if (blas) {
+        test_products();
+        test_vectors();
+        test_matrices();
+    }
+    CHECK(!bad_args);
+    return check_status();
+}
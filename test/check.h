@@ -0,0 +1,102 @@
+#ifndef CHECK_H
+#define CHECK_H 1
+
+/* Minimal checking for the programs of make check: CHECK reports a
+ * condition that does not hold and counts it, and main returns
+ * check_status(), nonzero after any failure. The fill helpers draw
+ * from rand, seeded by each program. */
+
+#include "matrix.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int check_failures;
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", \
+                    __FILE__, __LINE__, #cond); \
+            check_failures++; \
+        } \
+    } while (0)
+
+/* Whether a and b agree to within tol relative to the larger of
+ * their magnitudes and 1 */
+static inline int check_close(double a, double b, double tol) {
+    double scale = fmax(1, fmax(fabs(a), fabs(b)));
+
+    return fabs(a - b) <= tol * scale;
+}
+
+/* A value in [lo, hi), in steps of (hi - lo) / 2048 */
+static inline LINALG_SCALAR check_uniform(double lo, double hi) {
+    return (LINALG_SCALAR)(lo + (hi - lo) * (rand() % 2048) / 2048);
+}
+
+/* Fills m with values in [lo, hi) */
+static inline void check_fill_matrix(matrix *m, double lo, double hi) {
+    int rows, cols, i, j;
+
+    mat_dim(m, &rows, &cols);
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            mat_set(m, i, j, check_uniform(lo, hi));
+        }
+    }
+}
+
+static inline void check_fill_vector(vector *v, double lo, double hi) {
+    int dim, i;
+
+    vec_dim(v, &dim);
+    for (i = 0; i < dim; i++) {
+        vec_set(v, i, check_uniform(lo, hi));
+    }
+}
+
+/* Whether out holds a * b, computed naively in double precision, to
+ * within tol times the inner dimension and the largest elements of
+ * the operands: a bound on the errors of classical and Strassen
+ * products alike */
+static inline int check_product(const matrix *a, const matrix *b,
+        const matrix *out, double tol) {
+    int rows, inner, cols, r, c, i, k;
+    double amax = 0, bmax = 0, sum;
+
+    mat_dim(a, &rows, &inner);
+    mat_dim(b, &i, &cols);
+    mat_dim(out, &r, &c);
+    if (i != inner || r != rows || c != cols) {
+        return 0;
+    }
+    for (r = 0; r < rows; r++) {
+        for (k = 0; k < inner; k++) {
+            amax = fmax(amax, fabs(mat_get(a, r, k)));
+        }
+    }
+    for (k = 0; k < inner; k++) {
+        for (c = 0; c < cols; c++) {
+            bmax = fmax(bmax, fabs(mat_get(b, k, c)));
+        }
+    }
+    for (r = 0; r < rows; r++) {
+        for (c = 0; c < cols; c++) {
+            sum = 0;
+            for (k = 0; k < inner; k++) {
+                sum += (double)mat_get(a, r, k) * mat_get(b, k, c);
+            }
+            if (fabs(sum - mat_get(out, r, c)) > tol * inner * amax * bmax) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static inline int check_status(void) {
+    return check_failures != 0;
+}
+
+#endif
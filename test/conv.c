@@ -0,0 +1,244 @@
+/* Convolutions against naive sums in double precision, for every mode
+ * and kernel sizes around the unrolled 3 x 3 and 5 x 5 ones. */
+
+#include "conv.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+/* Dimensions of the data */
+#define LEN 101
+#define H 37
+#define W 41
+
+/* Channels and filters of conv_multi */
+#define CHANNELS 3
+#define FILTERS 4
+
+#define TOL 1e-4
+
+
+/* Length of the result for data of n and a kernel of k elements, and
+ * the padding before the data */
+static int out_len(int n, int k, int mode) {
+    return mode == LACONV_VALID ? n - k + 1
+        : mode == LACONV_SAME ? n : n + k - 1;
+}
+
+
+static int pad(int k, int mode) {
+    return mode == LACONV_VALID ? 0
+        : mode == LACONV_SAME ? (k - 1) / 2 : k - 1;
+}
+
+
+/* Element (i, j) of the correlation of channel ch of x, h x w by rows
+ * from row ch, with channel ch of kernel row f of k, kh x kw */
+static double correlate(const matrix *x, int ch, int h, int w,
+        const matrix *k, int f, int kh, int kw, int mode, int i, int j) {
+    int a, b, r, c;
+    double sum = 0;
+
+    for (a = 0; a < kh; a++) {
+        for (b = 0; b < kw; b++) {
+            r = i + a - pad(kh, mode);
+            c = j + b - pad(kw, mode);
+            if (r >= 0 && r < h && c >= 0 && c < w) {
+                sum += (double)mat_get(k, f, (ch * kh + a) * kw + b)
+                    * mat_get(x, ch, r * w + c);
+            }
+        }
+    }
+    return sum;
+}
+
+
+static void test_1d(void) {
+    static const int sizes[] = {1, 2, 3, 4, 5, 8, 17};
+    vector *x, *k, *out, *in_place;
+    matrix *xm, *km;
+    size_t s;
+    int mode, n, i, a, ok;
+
+    vec_zero(&x, LEN);
+    vec_zero(&out, 1);
+    mat_zero(&xm, 1, LEN);
+    check_fill_vector(x, -1, 1);
+    for (i = 0; i < LEN; i++) {
+        mat_set(xm, 0, i, vec_get(x, i));
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        vec_zero(&k, sizes[s]);
+        check_fill_vector(k, -1, 1);
+        mat_zero(&km, 1, sizes[s]);
+        for (a = 0; a < sizes[s]; a++) {
+            mat_set(km, 0, a, vec_get(k, a));
+        }
+        for (mode = LACONV_VALID; mode <= LACONV_FULL; mode++) {
+            CHECK(conv_1d(x, k, mode, out) == 0);
+            vec_dim(out, &n);
+            CHECK(n == out_len(LEN, sizes[s], mode));
+            ok = 1;
+            for (i = 0; i < n; i++) {
+                ok &= check_close(correlate(xm, 0, 1, LEN, km, 0, 1,
+                            sizes[s], mode, 0, i), vec_get(out, i), TOL);
+            }
+            CHECK(ok);
+
+            vec_dup(&in_place, x);
+            CHECK(conv_1d_(in_place, k, mode) == 0);
+            vec_dim(in_place, &n);
+            ok = n == out_len(LEN, sizes[s], mode);
+            for (i = 0; ok && i < n; i++) {
+                ok &= vec_get(in_place, i) == vec_get(out, i);
+            }
+            CHECK(ok);
+            vec_del(in_place);
+        }
+        vec_del(k);
+        mat_del(km);
+    }
+
+    vec_zero(&k, LEN + 1);
+    CHECK(conv_1d(x, k, LACONV_VALID, out) == LACONV_INCOMPATIBLE_DIM);
+    CHECK(conv_1d(x, k, LACONV_FULL + 1, out) == LACONV_INVALID);
+    vec_del(k);
+
+    vec_del(x);
+    vec_del(out);
+    mat_del(xm);
+}
+
+
+static void test_2d(void) {
+    static const int sizes[][2] = {{1, 1}, {2, 2}, {3, 3}, {4, 4}, {5, 5},
+        {3, 5}, {7, 2}};
+    matrix *x, *xm, *k, *km, *out, *in_place;
+    size_t s;
+    int mode, layout, rows, cols, i, j, ok;
+
+    mat_zero(&x, H, W);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(x, -1, 1);
+    mat_zero(&xm, 1, H * W);
+    for (i = 0; i < H; i++) {
+        for (j = 0; j < W; j++) {
+            mat_set(xm, 0, i * W + j, mat_get(x, i, j));
+        }
+    }
+
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        mat_zero(&k, sizes[s][0], sizes[s][1]);
+        check_fill_matrix(k, -1, 1);
+        mat_zero(&km, 1, sizes[s][0] * sizes[s][1]);
+        for (i = 0; i < sizes[s][0]; i++) {
+            for (j = 0; j < sizes[s][1]; j++) {
+                mat_set(km, 0, i * sizes[s][1] + j, mat_get(k, i, j));
+            }
+        }
+        for (mode = LACONV_VALID; mode <= LACONV_FULL; mode++) {
+            for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+                mat_set_layout(x, layout);
+                CHECK(conv_2d(x, k, mode, out) == 0);
+                mat_dim(out, &rows, &cols);
+                CHECK(rows == out_len(H, sizes[s][0], mode)
+                        && cols == out_len(W, sizes[s][1], mode));
+                ok = 1;
+                for (i = 0; i < rows; i++) {
+                    for (j = 0; j < cols; j++) {
+                        ok &= check_close(correlate(xm, 0, H, W, km, 0,
+                                    sizes[s][0], sizes[s][1], mode, i, j),
+                                mat_get(out, i, j), TOL);
+                    }
+                }
+                CHECK(ok);
+
+                mat_dup(&in_place, x);
+                CHECK(conv_2d_(in_place, k, mode) == 0);
+                mat_dim(in_place, &rows, &cols);
+                ok = rows == out_len(H, sizes[s][0], mode)
+                    && cols == out_len(W, sizes[s][1], mode);
+                for (i = 0; ok && i < rows; i++) {
+                    for (j = 0; j < cols; j++) {
+                        ok &= mat_get(in_place, i, j) == mat_get(out, i, j);
+                    }
+                }
+                CHECK(ok);
+                mat_del(in_place);
+            }
+        }
+        mat_del(k);
+        mat_del(km);
+    }
+
+    mat_zero(&k, H + 1, 1);
+    CHECK(conv_2d(x, k, LACONV_VALID, out) == LACONV_INCOMPATIBLE_DIM);
+    CHECK(conv_2d(x, k, -1, out) == LACONV_INVALID);
+    mat_del(k);
+
+    mat_del(x);
+    mat_del(xm);
+    mat_del(out);
+}
+
+
+static void test_multi(void) {
+    static const int sizes[][2] = {{3, 3}, {5, 5}, {2, 4}};
+    matrix *x, *filters, *out;
+    size_t s;
+    int mode, rows, cols, oh, ow, f, ch, i, j, ok;
+    double sum;
+
+    mat_zero(&x, CHANNELS, H * W);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(x, -1, 1);
+
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        mat_zero(&filters, FILTERS, CHANNELS * sizes[s][0] * sizes[s][1]);
+        check_fill_matrix(filters, -1, 1);
+        for (mode = LACONV_VALID; mode <= LACONV_FULL; mode++) {
+            CHECK(conv_multi(x, H, W, filters, sizes[s][0], sizes[s][1],
+                        mode, out) == 0);
+            oh = out_len(H, sizes[s][0], mode);
+            ow = out_len(W, sizes[s][1], mode);
+            mat_dim(out, &rows, &cols);
+            CHECK(rows == FILTERS && cols == oh * ow);
+            ok = 1;
+            for (f = 0; f < FILTERS; f++) {
+                for (i = 0; i < oh; i++) {
+                    for (j = 0; j < ow; j++) {
+                        sum = 0;
+                        for (ch = 0; ch < CHANNELS; ch++) {
+                            sum += correlate(x, ch, H, W, filters, f,
+                                    sizes[s][0], sizes[s][1], mode, i, j);
+                        }
+                        ok &= check_close(sum, mat_get(out, f, i * ow + j),
+                                TOL);
+                    }
+                }
+            }
+            CHECK(ok);
+        }
+        mat_del(filters);
+    }
+
+    mat_zero(&filters, FILTERS, CHANNELS * 9 + 1);
+    CHECK(conv_multi(x, H, W, filters, 3, 3, LACONV_SAME, out)
+            == LACONV_INCOMPATIBLE_DIM);
+    CHECK(conv_multi(x, H, W + 1, filters, 3, 3, LACONV_SAME, out)
+            == LACONV_INCOMPATIBLE_DIM);
+    mat_del(filters);
+
+    mat_del(x);
+    mat_del(out);
+}
+
+
+int main(void) {
+    srand(1);
+    test_1d();
+    test_2d();
+    test_multi();
+    return check_status();
+}
@@ -0,0 +1,217 @@
+/* mat_ger, mat_syrk and the covariance accumulator against naive sums
+ * in double precision. */
+
+#include "covar.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+/* Elements of the samples, past a tile of LAMAT_TILED */
+#define DIM 67
+
+/* Samples added, not a multiple of BLOCK */
+#define SAMPLES 150
+#define BLOCK 16
+
+/* Mean of the samples, large next to their spread of about 1 */
+#define OFFSET 1000
+
+#define TOL 1e-4
+
+
+/* Adds alpha * x * y^T to a, then checks it against before plus the
+ * same product, in both layouts */
+static void test_ger(void) {
+    matrix *a, *before;
+    vector *x, *y;
+    int layout, i, j, ok;
+
+    mat_zero(&before, DIM, DIM + 3);
+    vec_zero(&x, DIM);
+    vec_zero(&y, DIM + 3);
+    check_fill_matrix(before, -1, 1);
+    check_fill_vector(x, -1, 1);
+    check_fill_vector(y, -1, 1);
+
+    for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+        mat_dup(&a, before);
+        mat_set_layout(a, layout);
+        CHECK(mat_ger(a, (LINALG_SCALAR)-1.5, x, y) == 0);
+        ok = 1;
+        for (i = 0; i < DIM; i++) {
+            for (j = 0; j < DIM + 3; j++) {
+                ok &= check_close(mat_get(before, i, j)
+                        - 1.5 * vec_get(x, i) * vec_get(y, j),
+                        mat_get(a, i, j), TOL);
+            }
+        }
+        CHECK(ok);
+        CHECK(mat_ger(a, 1, y, x) == LAMAT_INCOMPATIBLE_DIM);
+        mat_del(a);
+    }
+
+    mat_del(before);
+    vec_del(x);
+    vec_del(y);
+}
+
+
+/* Adds alpha * a^T * a to a symmetric c, with either operand tiled */
+static void test_syrk(void) {
+    matrix *a, *c, *before;
+    int layout, i, j, k, ok;
+    double sum;
+
+    mat_zero(&a, SAMPLES, DIM);
+    mat_zero(&before, DIM, DIM);
+    check_fill_matrix(a, -1, 1);
+    for (i = 0; i < DIM; i++) {
+        for (j = i; j < DIM; j++) {
+            sum = check_uniform(-1, 1);
+            mat_set(before, i, j, (LINALG_SCALAR)sum);
+            mat_set(before, j, i, (LINALG_SCALAR)sum);
+        }
+    }
+
+    for (layout = 0; layout < 4; layout++) {
+        mat_dup(&c, before);
+        mat_set_layout(c, layout & 1 ? LAMAT_TILED : LAMAT_ROW_MAJOR);
+        mat_set_layout(a, layout & 2 ? LAMAT_TILED : LAMAT_ROW_MAJOR);
+        CHECK(mat_syrk(c, (LINALG_SCALAR)0.5, a) == 0);
+        ok = 1;
+        for (i = 0; i < DIM; i++) {
+            for (j = 0; j < DIM; j++) {
+                sum = 0;
+                for (k = 0; k < SAMPLES; k++) {
+                    sum += (double)mat_get(a, k, i) * mat_get(a, k, j);
+                }
+                ok &= check_close(mat_get(before, i, j) + 0.5 * sum,
+                        mat_get(c, i, j), TOL);
+            }
+        }
+        CHECK(ok);
+        CHECK(mat_syrk(a, 1, c) == LAMAT_INCOMPATIBLE_DIM);
+        mat_del(c);
+    }
+
+    mat_del(a);
+    mat_del(before);
+}
+
+
+/* Samples added one at a time and by matrices, with the mean, the
+ * covariance computed in two passes and the Gram matrix in double */
+static void test_covar(void) {
+    static double mean[DIM], cov[DIM][DIM], gram[DIM][DIM];
+    matrix *samples, *out;
+    vector *x, *vout;
+    covar *c;
+    long long n;
+    int i, j, k, ok;
+
+    mat_zero(&samples, SAMPLES, DIM);
+    for (i = 0; i < SAMPLES; i++) {
+        for (j = 0; j < DIM; j++) {
+            mat_set(samples, i, j, OFFSET + j + check_uniform(-1, 1));
+        }
+    }
+    for (j = 0; j < DIM; j++) {
+        mean[j] = 0;
+        for (k = 0; k < SAMPLES; k++) {
+            mean[j] += mat_get(samples, k, j);
+        }
+        mean[j] /= SAMPLES;
+    }
+    for (i = 0; i < DIM; i++) {
+        for (j = 0; j < DIM; j++) {
+            cov[i][j] = gram[i][j] = 0;
+            for (k = 0; k < SAMPLES; k++) {
+                cov[i][j] += (mat_get(samples, k, i) - mean[i])
+                    * (mat_get(samples, k, j) - mean[j]);
+                gram[i][j] += (double)mat_get(samples, k, i)
+                    * mat_get(samples, k, j);
+            }
+            cov[i][j] /= SAMPLES - 1;
+        }
+    }
+
+    CHECK(cov_new(&c, DIM, BLOCK) == 0);
+    mat_zero(&out, 1, 1);
+    vec_zero(&x, DIM);
+    vec_zero(&vout, 1);
+
+    CHECK(cov_mean(c, vout) == LACOV_EMPTY);
+    CHECK(cov_covar(c, out) == LACOV_EMPTY);
+
+    /* The first samples one at a time, the rest as a matrix */
+    for (k = 0; k < BLOCK + 3; k++) {
+        for (j = 0; j < DIM; j++) {
+            vec_set(x, j, mat_get(samples, k, j));
+        }
+        CHECK(cov_add(c, x) == 0);
+    }
+    CHECK(cov_covar(c, out) == 0);
+    mat_del(out);
+    mat_zero(&out, SAMPLES - k, DIM);
+    for (i = k; i < SAMPLES; i++) {
+        for (j = 0; j < DIM; j++) {
+            mat_set(out, i - k, j, mat_get(samples, i, j));
+        }
+    }
+    mat_set_layout(out, LAMAT_TILED);
+    CHECK(cov_add_mat(c, out) == 0);
+
+    cov_count(c, &n);
+    CHECK(n == SAMPLES);
+    CHECK(cov_mean(c, vout) == 0);
+    ok = 1;
+    for (j = 0; j < DIM; j++) {
+        ok &= check_close(mean[j], vec_get(vout, j), TOL);
+    }
+    CHECK(ok);
+
+    CHECK(cov_covar(c, out) == 0);
+    ok = 1;
+    for (i = 0; i < DIM; i++) {
+        for (j = 0; j < DIM; j++) {
+            ok &= fabs(cov[i][j] - mat_get(out, i, j)) <= 1e-3;
+        }
+    }
+    CHECK(ok);
+
+    CHECK(cov_gram(c, out) == 0);
+    ok = 1;
+    for (i = 0; i < DIM; i++) {
+        for (j = 0; j < DIM; j++) {
+            ok &= check_close(gram[i][j], mat_get(out, i, j), TOL);
+        }
+    }
+    CHECK(ok);
+
+    CHECK(cov_add_mat(c, samples) == 0);
+    cov_count(c, &n);
+    CHECK(n == 2 * SAMPLES);
+    CHECK(cov_add(c, vout) == 0);
+    vec_del(x);
+    vec_zero(&x, DIM + 1);
+    CHECK(cov_add(c, x) == LACOV_INCOMPATIBLE_DIM);
+    CHECK(cov_reset(c) == 0);
+    cov_count(c, &n);
+    CHECK(n == 0);
+    CHECK(cov_mean(c, vout) == LACOV_EMPTY);
+
+    cov_del(c);
+    mat_del(samples);
+    mat_del(out);
+    vec_del(x);
+    vec_del(vout);
+}
+
+
+int main(void) {
+    srand(1);
+    test_ger();
+    test_syrk();
+    test_covar();
+    return check_status();
+}
@@ -0,0 +1,338 @@
+/* Storage shared between duplicates until the first write
+ * (see mat_dup and vec_dup). */
+
+#include "matrix.h"
+#include "vector.h"
+#include "check.h"
+
+#include <pthread.h>
+#include <string.h>
+
+/* Order of the matrices written below, square so that every in place
+ * operation applies, and with a partial tile */
+#define N 70
+
+#define READERS 4
+#define ROUNDS 2000
+#define WRITERS 2
+
+
+/* Operands of the writes below, read by every thread */
+static matrix *ops_m;       /* N x N */
+static matrix *ops_row;     /* 1 x N */
+static vector *ops_v;       /* N */
+static vector *ops_v4;      /* 4 */
+static const int perm4[4] = {1, 3, 0, 2};
+
+
+/* Every way to write a matrix in place, or as the output of an
+ * operation. Each changes at least one element. */
+static void w_set(matrix *m) { mat_set(m, 1, 2, -7); }
+static void w_write(matrix *m) { mat_write(m, 2, 1, -7); }
+static void w_data_ptr(matrix *m) { mat_data_ptr(m)[0] = -7; }
+
+static void w_row_ptr(matrix *m) {
+    LINALG_SCALAR *row = mat_row_ptr(m, 3);
+
+    if (row != NULL) {
+        row[1] = -7;
+    } else {
+        mat_set(m, 3, 1, -7);
+    }
+}
+
+static void w_set_data(matrix *m) {
+    static const LINALG_SCALAR zeros[N * N];
+    mat_set_data(m, zeros);
+}
+
+static void w_add_(matrix *m) { mat_add_(m, ops_m); }
+static void w_sub_(matrix *m) { mat_sub_(m, ops_m); }
+static void w_mul_(matrix *m) { mat_mul_(m, ops_m); }
+static void w_pow_(matrix *m) { mat_pow_(m, 3); }
+static void w_expm_(matrix *m) { mat_expm_(m); }
+static void w_ger(matrix *m) { mat_ger(m, 1, ops_v, ops_v); }
+static void w_syrk(matrix *m) { mat_syrk(m, 1, ops_m); }
+static void w_radd_(matrix *m) { mat_radd_(m, ops_v); }
+static void w_rsub_(matrix *m) { mat_rsub_(m, ops_v); }
+static void w_rmul_(matrix *m) { mat_rmul_(m, ops_v); }
+static void w_rdiv_(matrix *m) { mat_rdiv_(m, ops_v); }
+static void w_cadd_(matrix *m) { mat_cadd_(m, ops_v); }
+static void w_csub_(matrix *m) { mat_csub_(m, ops_v); }
+static void w_cmul_(matrix *m) { mat_cmul_(m, ops_v); }
+static void w_cdiv_(matrix *m) { mat_cdiv_(m, ops_v); }
+static void w_smul_(matrix *m) { mat_smul_(m, 3); }
+static void w_sdiv_(matrix *m) { mat_sdiv_(m, 3); }
+static void w_map_(matrix *m) { mat_map_(m, vm_exp, NULL); }
+static void w_map(matrix *m) { mat_map(m, vm_sigmoid, NULL, m); }
+static void w_transpose_(matrix *m) { mat_transpose_(m); }
+
+static void w_set_layout(matrix *m) {
+    mat_set_layout(m, mat_get_layout(m) == LAMAT_TILED
+            ? LAMAT_ROW_MAJOR : LAMAT_TILED);
+    mat_set(m, 0, 0, -7);
+}
+
+static void w_scatter_rows(matrix *m) {
+    mat_scatter_rows(m, perm4, 1, ops_row);
+}
+
+static void w_permute_rows(matrix *m) {
+    int p[N], i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = N - 1 - i;
+    }
+    mat_permute_rows(m, p);
+}
+
+static void w_permute_cols(matrix *m) {
+    int p[N], i;
+
+    for (i = 0; i < N; i++) {
+        p[i] = (i + 1) % N;
+    }
+    mat_permute_cols(m, p);
+}
+
+static void w_add_out(matrix *m) { mat_add(ops_m, ops_m, m); }
+
+static void w_cpy_then_set(matrix *m) {
+    mat_cpy(m, ops_m);
+    mat_set(m, 0, 0, -7);
+}
+
+static void (*const mat_writers[])(matrix *) = {
+    w_set, w_write, w_data_ptr, w_row_ptr, w_set_data, w_add_, w_sub_,
+    w_mul_, w_pow_, w_expm_, w_ger, w_syrk, w_radd_, w_rsub_, w_rmul_,
+    w_rdiv_, w_cadd_, w_csub_, w_cmul_, w_cdiv_, w_smul_, w_sdiv_,
+    w_map_, w_map, w_transpose_, w_set_layout, w_scatter_rows,
+    w_permute_rows, w_permute_cols, w_add_out, w_cpy_then_set
+};
+
+#define NMAT_WRITERS (int)(sizeof(mat_writers) / sizeof(*mat_writers))
+
+
+/* The same for vectors */
+static void wv_set(vector *v) { vec_set(v, 1, -7); }
+static void wv_write(vector *v) { vec_write(v, 2, -7); }
+static void wv_data_ptr(vector *v) { vec_data_ptr(v)[0] = -7; }
+
+static void wv_set_data(vector *v) {
+    static const LINALG_SCALAR zeros[N];
+    vec_set_data(v, zeros);
+}
+
+static void wv_add_(vector *v) { vec_add_(v, ops_v); }
+static void wv_sub_(vector *v) { vec_sub_(v, ops_v); }
+static void wv_smul_(vector *v) { vec_smul_(v, 3); }
+static void wv_sdiv_(vector *v) { vec_sdiv_(v, 3); }
+static void wv_emul_(vector *v) { vec_emul_(v, ops_v); }
+static void wv_map_(vector *v) { vec_map_(v, vm_exp, NULL); }
+static void wv_mmul_l_(vector *v) { vec_mmul_l_(v, ops_m); }
+static void wv_mmul_r_(vector *v) { vec_mmul_r_(ops_m, v); }
+static void wv_scatter(vector *v) { vec_scatter(v, perm4, 4, ops_v4); }
+static void wv_add_out(vector *v) { vec_add(ops_v, ops_v, v); }
+
+static void (*const vec_writers[])(vector *) = {
+    wv_set, wv_write, wv_data_ptr, wv_set_data, wv_add_, wv_sub_,
+    wv_smul_, wv_sdiv_, wv_emul_, wv_map_, wv_mmul_l_, wv_mmul_r_,
+    wv_scatter, wv_add_out
+};
+
+#define NVEC_WRITERS (int)(sizeof(vec_writers) / sizeof(*vec_writers))
+
+
+/* Whether m holds the values of data, ordered by rows */
+static int matrix_is(const matrix *m, const LINALG_SCALAR *data) {
+    LINALG_SCALAR got[N * N];
+    int rows, cols;
+
+    mat_dim(m, &rows, &cols);
+    if (rows != N || cols != N) {
+        return 0;
+    }
+    mat_get_data(m, got);
+    return memcmp(got, data, sizeof(got)) == 0;
+}
+
+
+static int vector_is(const vector *v, const LINALG_SCALAR *data) {
+    LINALG_SCALAR got[N];
+    int dim;
+
+    vec_dim(v, &dim);
+    if (dim != N) {
+        return 0;
+    }
+    vec_get_data(v, got);
+    return memcmp(got, data, sizeof(got)) == 0;
+}
+
+
+/* Applies every writer to a duplicate of orig, which must be left as
+ * it was, while the duplicate must change. With swap, the writer is
+ * applied to orig instead and the duplicate must be left as it was.
+ * Several threads run this on the same orig at once. */
+struct writer_args {
+    matrix *m;
+    vector *v;
+    int swap;
+};
+
+static void *writer(void *arg) {
+    const struct writer_args *a = arg;
+    LINALG_SCALAR before[N * N], vbefore[N];
+    matrix *dup, *target, *other;
+    vector *vdup, *vtarget, *vother;
+    int i;
+
+    mat_get_data(a->m, before);
+    for (i = 0; i < NMAT_WRITERS; i++) {
+        mat_dup(&dup, a->m);
+        target = a->swap ? a->m : dup;
+        other = a->swap ? dup : a->m;
+        mat_writers[i](target);
+        CHECK(matrix_is(other, before));
+        CHECK(!matrix_is(target, before));
+        if (a->swap) {
+            mat_set_data(a->m, before);
+            mat_set_layout(a->m, mat_get_layout(dup));
+        }
+        mat_del(dup);
+    }
+
+    vec_get_data(a->v, vbefore);
+    for (i = 0; i < NVEC_WRITERS; i++) {
+        vec_dup(&vdup, a->v);
+        vtarget = a->swap ? a->v : vdup;
+        vother = a->swap ? vdup : a->v;
+        vec_writers[i](vtarget);
+        CHECK(vector_is(vother, vbefore));
+        CHECK(!vector_is(vtarget, vbefore));
+        if (a->swap) {
+            vec_set_data(a->v, vbefore);
+        }
+        vec_del(vdup);
+    }
+    return NULL;
+}
+
+
+/* Writes through duplicates leave the original untouched, in either
+ * layout, with WRITERS threads duplicating the same original at once;
+ * writes to an original leave its duplicates untouched. */
+static void test_writes(void) {
+    pthread_t threads[WRITERS];
+    struct writer_args args;
+    LINALG_SCALAR before[N * N], vbefore[N];
+    matrix *m;
+    vector *v;
+    int layout, i;
+
+    for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+        mat_zero(&m, N, N);
+        check_fill_matrix(m, 0, 0.25);
+        mat_set_layout(m, layout);
+        vec_zero(&v, N);
+        check_fill_vector(v, 1, 1.5);
+        mat_get_data(m, before);
+        vec_get_data(v, vbefore);
+
+        args.m = m;
+        args.v = v;
+        args.swap = 0;
+        for (i = 0; i < WRITERS; i++) {
+            CHECK(pthread_create(&threads[i], NULL, writer, &args) == 0);
+        }
+        for (i = 0; i < WRITERS; i++) {
+            pthread_join(threads[i], NULL);
+        }
+        CHECK(matrix_is(m, before));
+        CHECK(mat_get_layout(m) == layout);
+        CHECK(vector_is(v, vbefore));
+
+        args.swap = 1;
+        writer(&args);
+
+        mat_del(m);
+        vec_del(v);
+    }
+}
+
+
+static matrix *shared_m;
+static vector *shared_v;
+
+
+/* Reads shared_m and shared_v through the const accessors, as many
+ * threads at once, and writes the sum of what it read into *arg */
+static void *reader(void *arg) {
+    const LINALG_SCALAR *p;
+    LINALG_SCALAR sum = 0;
+    int i;
+
+    for (i = 0; i < ROUNDS; i++) {
+        p = mat_row_cptr(shared_m, i % N);
+        sum += p[0];
+        p = mat_data_cptr(shared_m);
+        sum += p[i % (N * N)];
+        sum += mat_get(shared_m, i % N, i % N);
+        p = vec_data_cptr(shared_v);
+        sum += p[i % N];
+    }
+    *(LINALG_SCALAR *)arg = sum;
+    return NULL;
+}
+
+
+/* Concurrent readers of a duplicated matrix and vector must neither
+ * copy nor free the shared storage. */
+static void test_concurrent_reads(void) {
+    pthread_t threads[READERS];
+    LINALG_SCALAR sums[READERS];
+    matrix *dup_m;
+    vector *dup_v;
+    int i;
+
+    mat_zero(&shared_m, N, N);
+    vec_zero(&shared_v, N);
+    mat_dup(&dup_m, shared_m);
+    vec_dup(&dup_v, shared_v);
+
+    for (i = 0; i < READERS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, reader, &sums[i]) == 0);
+    }
+    for (i = 0; i < READERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(sums[i] == 0);
+    }
+
+    CHECK(mat_data_cptr(shared_m) == mat_data_cptr(dup_m));
+    CHECK(vec_data_cptr(shared_v) == vec_data_cptr(dup_v));
+
+    mat_del(dup_m);
+    vec_del(dup_v);
+    mat_del(shared_m);
+    vec_del(shared_v);
+}
+
+
+int main(void) {
+    srand(1);
+    mat_zero(&ops_m, N, N);
+    check_fill_matrix(ops_m, 0, 0.25);
+    mat_zero(&ops_row, 1, N);
+    vec_zero(&ops_v, N);
+    check_fill_vector(ops_v, 1, 1.5);
+    vec_zero(&ops_v4, 4);
+
+    test_writes();
+    test_concurrent_reads();
+
+    mat_del(ops_m);
+    mat_del(ops_row);
+    vec_del(ops_v);
+    vec_del(ops_v4);
+    return check_status();
+}
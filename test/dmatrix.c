@@ -0,0 +1,241 @@
+/* dmatrices over 1, 3, 4, 6 and 8 forked processes connected by Unix
+ * domain sockets: local parts holding the global elements their blocks
+ * map to, scatter and gather giving back every element, and SUMMA
+ * products against naive ones in double precision, with dimensions
+ * that end in partial blocks and grids with processes owning none. */
+
+#include "dmatrix.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Dimensions of the operands, none a multiple of the blocks, and
+ * those of a product too small for every process to own a block */
+#define M 70
+#define K 53
+#define N 41
+#define NB 8
+#define SMALL_M 5
+#define SMALL_K 3
+#define SMALL_N 9
+#define SMALL_NB 4
+
+/* Error allowed in products, times the inner dimension and the largest
+ * elements of the operands */
+#define TOL 1e-6
+
+/* Seconds a process may take before it is presumed stuck waiting for
+ * one that failed */
+#define TIMEOUT 60
+
+
+static const int sizes[] = {1, 3, 4, 6, 8};
+
+
+/* Whether the local part of d, over c, holds the elements of m its
+ * blocks map to, the grid being found as the header describes it */
+static int local_matches(const linalg_comm *c, const dmatrix *d,
+        const matrix *m) {
+    const matrix *l = dmat_local(d);
+    int rank, size, p, q, nb, rows, cols, i, j, ig, jg;
+
+    linalg_comm_rank(c, &rank, &size);
+    for (p = 1; (p + 1) * (p + 1) <= size; p++);
+    while (size % p != 0) {
+        p--;
+    }
+    q = size / p;
+    dmat_dim(d, NULL, NULL, &nb);
+    mat_dim(l, &rows, &cols);
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            ig = (i / nb * p + rank / q) * nb + i % nb;
+            jg = (j / nb * q + rank % q) * nb + j % nb;
+            if (mat_get(l, i, j) != mat_get(m, ig, jg)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* Whether a and b hold the same elements */
+static int same(const matrix *a, const matrix *b) {
+    int rows, cols, r, co, i, j;
+
+    mat_dim(a, &rows, &cols);
+    mat_dim(b, &r, &co);
+    if (rows != r || cols != co) {
+        return 0;
+    }
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            if (mat_get(a, i, j) != mat_get(b, i, j)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* a * b over c in blocks of nb, scattered from the first process and
+ * gathered on the last, which checks the result */
+static void product(linalg_comm *c, const matrix *a, const matrix *b,
+        int nb) {
+    dmatrix *da, *db, *dout;
+    matrix *out;
+    int rank, size, rows, cols, inner, r, co;
+
+    linalg_comm_rank(c, &rank, &size);
+    mat_dim(a, &rows, &inner);
+    mat_dim(b, NULL, &cols);
+    CHECK(dmat_new(&da, c, rows, inner, nb) == 0);
+    CHECK(dmat_new(&db, c, inner, cols, nb) == 0);
+    CHECK(dmat_new(&dout, c, 1, 1, nb) == 0);
+    CHECK(dmat_scatter(da, rank == 0 ? a : NULL, 0) == 0);
+    CHECK(dmat_scatter(db, rank == 0 ? b : NULL, 0) == 0);
+    CHECK(local_matches(c, da, a) && local_matches(c, db, b));
+
+    CHECK(dmat_mul(da, db, dout) == 0);
+    dmat_dim(dout, &r, &co, NULL);
+    CHECK(r == rows && co == cols);
+    mat_zero(&out, 1, 1);
+    CHECK(dmat_gather(dout, rank == size - 1 ? out : NULL, size - 1) == 0);
+    if (rank == size - 1) {
+        CHECK(check_product(a, b, out, TOL));
+    }
+
+    /* Again into the same out, which now has the right dimensions */
+    CHECK(dmat_mul(da, db, dout) == 0);
+    CHECK(dmat_gather(dout, rank == 0 ? out : NULL, 0) == 0);
+    if (rank == 0) {
+        CHECK(check_product(a, b, out, TOL));
+    }
+
+    mat_del(out);
+    dmat_del(da);
+    dmat_del(db);
+    dmat_del(dout);
+}
+
+
+static void test_round_trip(linalg_comm *c, const matrix *a) {
+    dmatrix *d;
+    matrix *m;
+    int rank, size;
+
+    linalg_comm_rank(c, &rank, &size);
+    CHECK(dmat_new(&d, c, M, K, NB) == 0);
+    CHECK(dmat_scatter(d, rank == size - 1 ? a : NULL, size - 1) == 0);
+    CHECK(local_matches(c, d, a));
+    mat_zero(&m, 1, 1);
+    CHECK(dmat_gather(d, rank == 0 ? m : NULL, 0) == 0);
+    if (rank == 0) {
+        CHECK(same(m, a));
+    }
+    mat_del(m);
+    dmat_del(d);
+}
+
+
+/* Errors found from the arguments alone, which every process reports
+ * without sending anything */
+static void test_errors(linalg_comm *c) {
+    dmatrix *a, *b, *other;
+    matrix *m;
+    int size;
+
+    linalg_comm_rank(c, NULL, &size);
+    CHECK(dmat_new(&a, c, -1, K, NB) == LADMAT_INVALID);
+    CHECK(dmat_new(&a, c, M, K, 0) == LADMAT_INVALID);
+    CHECK(dmat_new(&a, c, M, K, NB) == 0);
+    CHECK(dmat_new(&b, c, M, N, NB) == 0);
+    CHECK(dmat_new(&other, c, K, N, SMALL_NB) == 0);
+    CHECK(dmat_mul(a, b, other) == LADMAT_INVALID);
+    CHECK(dmat_mul(a, other, b) == LADMAT_INVALID);
+    CHECK(dmat_mul(a, b, a) == LADMAT_INVALID);
+    dmat_del(other);
+    CHECK(dmat_new(&other, c, 1, 1, NB) == 0);
+    CHECK(dmat_mul(a, b, other) == LADMAT_INCOMPATIBLE_DIM);
+    mat_zero(&m, M + 1, K);
+    CHECK(dmat_scatter(a, m, -1) == LADMAT_INVALID);
+    CHECK(dmat_scatter(a, m, size) == LADMAT_INVALID);
+    /* Only the root sees m, the others waiting for their parts */
+    if (size == 1) {
+        CHECK(dmat_scatter(a, m, 0) == LADMAT_INCOMPATIBLE_DIM);
+    }
+    mat_del(m);
+    dmat_del(a);
+    dmat_del(b);
+    dmat_del(other);
+}
+
+
+/* The part of the process of the given rank out of size */
+static int run(const char *path, int rank, int size, const matrix *a,
+        const matrix *b, const matrix *sa, const matrix *sb) {
+    linalg_comm *c;
+
+    alarm(TIMEOUT);
+    CHECK(linalg_comm_connect(&c, path, rank, size) == 0);
+    if (check_status() != 0) {
+        return check_status();
+    }
+    test_round_trip(c, a);
+    product(c, a, b, NB);
+    product(c, sa, sb, SMALL_NB);
+    test_errors(c);
+    linalg_comm_del(c);
+    if (check_status() != 0) {
+        fprintf(stderr, "in process %d of %d\n", rank, size);
+    }
+    return check_status();
+}
+
+
+int main(void) {
+    matrix *a, *b, *sa, *sb;
+    char path[64];
+    pid_t pids[8];
+    size_t s;
+    int status, r, failed = 0;
+
+    srand(1);
+    mat_zero(&a, M, K);
+    mat_zero(&b, K, N);
+    mat_zero(&sa, SMALL_M, SMALL_K);
+    mat_zero(&sb, SMALL_K, SMALL_N);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    check_fill_matrix(sa, -1, 1);
+    check_fill_matrix(sb, -1, 1);
+
+    /* Every process forked before any thread is started, which it
+     * would lack, and given the operands before the first scatter so
+     * that it can check its own part. Failures are counted apart until
+     * the last process is forked, which would count them again. */
+    for (s = 0; s < sizeof(sizes) / sizeof(*sizes); s++) {
+        sprintf(path, "/tmp/linalg-test-%d-%d", (int)getpid(), sizes[s]);
+        for (r = 0; r < sizes[s]; r++) {
+            pids[r] = fork();
+            if (pids[r] == 0) {
+                _exit(run(path, r, sizes[s], a, b, sa, sb));
+            }
+        }
+        for (r = 0; r < sizes[s]; r++) {
+            failed += pids[r] < 0 || waitpid(pids[r], &status, 0) != pids[r]
+                || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+    }
+    CHECK(failed == 0);
+
+    mat_del(a);
+    mat_del(b);
+    mat_del(sa);
+    mat_del(sb);
+    return check_status();
+}
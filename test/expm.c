@@ -0,0 +1,297 @@
+/* mat_pow and mat_expm against repeated naive products and a Taylor
+ * series, in double precision. */
+
+#include "matrix.h"
+#include "summation.h"
+#include "tune.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Largest order tested, past a tile of LAMAT_TILED */
+#define MAX_N 67
+
+/* Terms of the Taylor series, for a matrix scaled to a 1-norm below 1/2 */
+#define TERMS 30
+
+
+static double ref[MAX_N][MAX_N], tmp[MAX_N][MAX_N], term[MAX_N][MAX_N];
+
+
+/* c = a * b, all n x n */
+static void naive_mul(double c[MAX_N][MAX_N], double a[MAX_N][MAX_N],
+        double b[MAX_N][MAX_N], int n) {
+    double r[MAX_N][MAX_N];
+    int i, j, k;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            r[i][j] = 0;
+            for (k = 0; k < n; k++) {
+                r[i][j] += a[i][k] * b[k][j];
+            }
+        }
+    }
+    memcpy(c, r, sizeof(r));
+}
+
+
+static void to_array(const matrix *m, double a[MAX_N][MAX_N], int n) {
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            a[i][j] = mat_get(m, i, j);
+        }
+    }
+}
+
+
+/* Whether m, n x n, holds ref to within tol relative to the largest
+ * element of ref */
+static int matches_ref(const matrix *m, int n, double tol) {
+    double max = 0;
+    int rows, cols, i, j;
+
+    mat_dim(m, &rows, &cols);
+    if (rows != n || cols != n) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            max = fmax(max, fabs(ref[i][j]));
+        }
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            if (fabs(mat_get(m, i, j) - ref[i][j]) > tol * fmax(max, 1)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* ref = exp(a), by the Taylor series of a / 2^s squared s times */
+static void naive_expm(const matrix *m, int n) {
+    double norm = 0, col, scale;
+    int s, i, j, k;
+
+    to_array(m, tmp, n);
+    for (j = 0; j < n; j++) {
+        col = 0;
+        for (i = 0; i < n; i++) {
+            col += fabs(tmp[i][j]);
+        }
+        norm = fmax(norm, col);
+    }
+    s = norm > 0.5 ? (int)ceil(log2(norm / 0.5)) : 0;
+    scale = ldexp(1, -s);
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            tmp[i][j] *= scale;
+            ref[i][j] = term[i][j] = i == j;
+        }
+    }
+    for (k = 1; k < TERMS; k++) {
+        naive_mul(term, term, tmp, n);
+        for (i = 0; i < n; i++) {
+            for (j = 0; j < n; j++) {
+                term[i][j] /= k;
+                ref[i][j] += term[i][j];
+            }
+        }
+    }
+    for (k = 0; k < s; k++) {
+        naive_mul(ref, ref, ref, n);
+    }
+}
+
+
+static void test_pow(void) {
+    static const int orders[] = {1, 2, 5, 17, MAX_N};
+    static const int powers[] = {0, 1, 2, 3, 7, 16, 21};
+    matrix *a, *out;
+    size_t o, p;
+    int n, layout, k, i, j;
+
+    mat_zero(&out, 1, 1);
+    for (o = 0; o < sizeof(orders) / sizeof(*orders); o++) {
+        n = orders[o];
+        mat_zero(&a, n, n);
+        /* Scaled so that powers neither blow up nor vanish */
+        check_fill_matrix(a, -1.5 / sqrt(n), 1.5 / sqrt(n));
+        for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+            mat_set_layout(a, layout);
+            for (p = 0; p < sizeof(powers) / sizeof(*powers); p++) {
+                to_array(a, tmp, n);
+                for (i = 0; i < n; i++) {
+                    for (j = 0; j < n; j++) {
+                        ref[i][j] = i == j;
+                    }
+                }
+                for (k = 0; k < powers[p]; k++) {
+                    naive_mul(ref, ref, tmp, n);
+                }
+                CHECK(mat_pow(a, powers[p], out) == 0);
+                CHECK(matches_ref(out, n, 1e-4));
+                CHECK(mat_get_layout(out) == layout);
+            }
+            mat_cpy(out, a);
+            CHECK(mat_pow_(out, 3) == 0);
+            naive_mul(ref, tmp, tmp, n);
+            naive_mul(ref, ref, tmp, n);
+            CHECK(matches_ref(out, n, 1e-4));
+        }
+        mat_del(a);
+    }
+    mat_del(out);
+}
+
+
+static void test_expm(void) {
+    static const double scales[] = {0.001, 0.1, 1, 8};
+    matrix *a, *out;
+    size_t s;
+    int n, layout, i;
+
+    mat_zero(&out, 1, 1);
+    for (n = 1; n <= MAX_N; n += 33) {
+        mat_zero(&a, n, n);
+        for (s = 0; s < sizeof(scales) / sizeof(*scales); s++) {
+            check_fill_matrix(a, -scales[s] / sqrt(n),
+                    scales[s] / sqrt(n));
+            naive_expm(a, n);
+            for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+                mat_set_layout(a, layout);
+                CHECK(mat_expm(a, out) == 0);
+                CHECK(matches_ref(out, n, 1e-4));
+                CHECK(mat_get_layout(out) == layout);
+            }
+            mat_cpy(out, a);
+            CHECK(mat_expm_(out) == 0);
+            CHECK(matches_ref(out, n, 1e-4));
+        }
+        mat_del(a);
+    }
+
+    /* A diagonal matrix, whose exponential is known exactly */
+    mat_zero(&a, 10, 10);
+    for (i = 0; i < 10; i++) {
+        mat_set(a, i, i, (LINALG_SCALAR)(i - 5));
+    }
+    CHECK(mat_expm(a, out) == 0);
+    for (i = 0; i < 10; i++) {
+        CHECK(check_close(exp(i - 5), mat_get(out, i, i), 1e-5));
+    }
+    mat_del(a);
+    mat_del(out);
+}
+
+
+static void test_errors(void) {
+    matrix *a, *out;
+
+    mat_zero(&a, 3, 4);
+    mat_zero(&out, 1, 1);
+    CHECK(mat_pow(a, 2, out) == LAMAT_INCOMPATIBLE_DIM);
+    CHECK(mat_expm(a, out) == LAMAT_INCOMPATIBLE_DIM);
+    mat_del(a);
+
+    mat_zero(&a, 3, 3);
+    CHECK(mat_pow(a, -1, out) == LAMAT_INVALID);
+    mat_set(a, 1, 2, (LINALG_SCALAR)NAN);
+    CHECK(mat_expm(a, out) == LAMAT_INVALID);
+    mat_set(a, 1, 2, (LINALG_SCALAR)INFINITY);
+    CHECK(mat_expm_(a) == LAMAT_INVALID);
+    mat_del(a);
+    mat_del(out);
+}
+
+
+/* Products by Strassen's algorithm, recursing down to the smallest
+ * cutoff, and with every summation mode, which take their scratch out
+ * of the same workspace */
+static void test_policies(void) {
+    static const int modes[] = {LASUM_PAIRWISE, LASUM_KAHAN};
+    struct linalg_tuning saved, t;
+    matrix *a, *out;
+    size_t i;
+    int k;
+
+    mat_zero(&a, MAX_N, MAX_N);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(a, -0.3, 0.3);
+    naive_expm(a, MAX_N);
+
+    linalg_tuning_get(&saved);
+    t = saved;
+    t.strassen_cutoff = 16;
+    CHECK(linalg_tuning_set(&t) == 0);
+    CHECK(mat_mul_policy(LAMAT_MUL_STRASSEN) == 0);
+    CHECK(mat_expm(a, out) == 0);
+    CHECK(matches_ref(out, MAX_N, 1e-4));
+    CHECK(mat_mul_policy(LAMAT_MUL_CLASSIC) == 0);
+    CHECK(linalg_tuning_set(&saved) == 0);
+
+    for (i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        CHECK(linalg_sum_policy(modes[i]) == 0);
+        CHECK(mat_expm(a, out) == 0);
+        CHECK(matches_ref(out, MAX_N, 1e-4));
+    }
+    CHECK(linalg_sum_policy(LASUM_NAIVE) == 0);
+
+    /* a^5, by the same naive products as test_pow */
+    to_array(a, tmp, MAX_N);
+    naive_mul(ref, tmp, tmp, MAX_N);
+    for (k = 2; k < 5; k++) {
+        naive_mul(ref, ref, tmp, MAX_N);
+    }
+    CHECK(linalg_tuning_set(&t) == 0);
+    CHECK(mat_mul_policy(LAMAT_MUL_STRASSEN) == 0);
+    CHECK(mat_pow(a, 5, out) == 0);
+    CHECK(matches_ref(out, MAX_N, 1e-4));
+    CHECK(mat_mul_policy(LAMAT_MUL_CLASSIC) == 0);
+    CHECK(linalg_tuning_set(&saved) == 0);
+    CHECK(linalg_sum_policy(LASUM_PAIRWISE) == 0);
+    CHECK(mat_pow(a, 5, out) == 0);
+    CHECK(matches_ref(out, MAX_N, 1e-4));
+    CHECK(linalg_sum_policy(LASUM_NAIVE) == 0);
+
+    mat_del(a);
+    mat_del(out);
+}
+
+
+/* The workspace can be released before it exists, and is
+ * grown again afterwards */
+static void test_release(void) {
+    matrix *a, *out;
+
+    CHECK(linalg_workspace_release() == 0);
+    mat_zero(&a, 40, 40);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(a, -0.1, 0.1);
+    naive_expm(a, 40);
+    CHECK(mat_expm(a, out) == 0);
+    CHECK(linalg_workspace_release() == 0);
+    CHECK(linalg_workspace_release() == 0);
+    CHECK(mat_expm(a, out) == 0);
+    CHECK(matches_ref(out, 40, 1e-4));
+    mat_del(a);
+    mat_del(out);
+}
+
+
+int main(void) {
+    srand(1);
+    test_release();
+    test_pow();
+    test_expm();
+    test_policies();
+    test_errors();
+    return check_status();
+}
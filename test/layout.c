@@ -0,0 +1,282 @@
+/* Operations on LAMAT_TILED matrices against the same operations on
+ * row-major ones: element-wise results equal, products by vectors and
+ * matrices within their rounding, results in the layout of the first
+ * operand, and conversions that give back every element. */
+
+#include "matrix.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+/* Dimensions with partial tiles at the edges, and one past a single
+ * full tile */
+#define ROWS 150
+#define COLS 91
+#define SMALL (LAMAT_TILE + 1)
+
+/* Error allowed in products, times the inner dimension and the largest
+ * elements of the operands */
+#define TOL 1e-6
+
+
+typedef int (*mat_vec_op)(const matrix *m, const vector *v, matrix *out);
+typedef int (*mat_vec_op_)(matrix *m, const vector *v);
+
+static const mat_vec_op row_ops[] = {mat_radd, mat_rsub, mat_rmul, mat_rdiv};
+static const mat_vec_op_ row_ops_[] = {
+    mat_radd_, mat_rsub_, mat_rmul_, mat_rdiv_
+};
+static const mat_vec_op col_ops[] = {mat_cadd, mat_csub, mat_cmul, mat_cdiv};
+static const mat_vec_op_ col_ops_[] = {
+    mat_cadd_, mat_csub_, mat_cmul_, mat_cdiv_
+};
+
+
+/* Whether a and b hold the same elements, and a is in the given
+ * layout */
+static int same(const matrix *a, const matrix *b, int layout) {
+    int rows, cols, r, c, i, j;
+
+    mat_dim(a, &rows, &cols);
+    mat_dim(b, &r, &c);
+    if (rows != r || cols != c || mat_get_layout(a) != layout) {
+        return 0;
+    }
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            if (mat_get(a, i, j) != mat_get(b, i, j)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* A tiled duplicate of m */
+static matrix *tiled(const matrix *m) {
+    matrix *t;
+
+    mat_dup(&t, m);
+    CHECK(mat_set_layout(t, LAMAT_TILED) == 0);
+    return t;
+}
+
+
+static void test_convert(void) {
+    static const int dims[][2] = {
+        {1, 1}, {LAMAT_TILE, LAMAT_TILE}, {SMALL, 3}, {ROWS, COLS}, {0, 7}
+    };
+    static LINALG_SCALAR data[ROWS * COLS], back[ROWS * COLS];
+    matrix *m, *t;
+    size_t d;
+    int rows, cols, i, ok;
+
+    for (d = 0; d < sizeof(dims) / sizeof(*dims); d++) {
+        rows = dims[d][0];
+        cols = dims[d][1];
+        mat_zero(&m, rows, cols);
+        check_fill_matrix(m, -1, 1);
+        t = tiled(m);
+        CHECK(same(t, m, LAMAT_TILED));
+        CHECK(mat_row_ptr(t, 0) == NULL);
+
+        mat_get_data(m, data);
+        mat_get_data(t, back);
+        ok = 1;
+        for (i = 0; i < rows * cols; i++) {
+            ok &= back[i] == data[i];
+            data[i] = -data[i];
+        }
+        CHECK(ok);
+        CHECK(mat_set_data(t, data) == 0);
+        mat_set_data(m, data);
+        CHECK(same(t, m, LAMAT_TILED));
+
+        if (rows > 0) {
+            mat_set(t, rows - 1, cols - 1, 5);
+            mat_set(m, rows - 1, cols - 1, 5);
+        }
+        CHECK(mat_set_layout(t, LAMAT_ROW_MAJOR) == 0);
+        CHECK(same(t, m, LAMAT_ROW_MAJOR));
+        CHECK(mat_set_layout(t, LAMAT_TILED + 1) == LAMAT_INVALID);
+        CHECK(mat_get_layout(t) == LAMAT_ROW_MAJOR);
+        mat_del(t);
+        mat_del(m);
+    }
+}
+
+
+/* Every element-wise operation, with each operand in either layout */
+static void test_elementwise(void) {
+    matrix *a, *b, *ta, *tb, *ref, *out;
+    vector *rv, *cv;
+    size_t k;
+
+    mat_zero(&a, ROWS, COLS);
+    mat_zero(&b, ROWS, COLS);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, 1, 2);
+    ta = tiled(a);
+    tb = tiled(b);
+    vec_zero(&rv, COLS);
+    vec_zero(&cv, ROWS);
+    check_fill_vector(rv, 1, 2);
+    check_fill_vector(cv, 1, 2);
+    mat_zero(&ref, 1, 1);
+    mat_zero(&out, 1, 1);
+
+    mat_add(a, b, ref);
+    CHECK(mat_add(ta, b, out) == 0 && same(out, ref, LAMAT_TILED));
+    CHECK(mat_add(a, tb, out) == 0 && same(out, ref, LAMAT_ROW_MAJOR));
+    mat_sub(a, b, ref);
+    CHECK(mat_sub(ta, tb, out) == 0 && same(out, ref, LAMAT_TILED));
+    mat_cpy(out, ta);
+    CHECK(mat_sub_(out, b) == 0 && same(out, ref, LAMAT_TILED));
+
+    mat_smul(a, 3, ref);
+    CHECK(mat_smul(ta, 3, out) == 0 && same(out, ref, LAMAT_TILED));
+    mat_sdiv(a, 3, ref);
+    mat_cpy(out, ta);
+    CHECK(mat_sdiv_(out, 3) == 0 && same(out, ref, LAMAT_TILED));
+    mat_map(a, vm_exp, NULL, ref);
+    CHECK(mat_map(ta, vm_exp, NULL, out) == 0 && same(out, ref, LAMAT_TILED));
+
+    for (k = 0; k < sizeof(row_ops) / sizeof(*row_ops); k++) {
+        row_ops[k](a, rv, ref);
+        CHECK(row_ops[k](ta, rv, out) == 0 && same(out, ref, LAMAT_TILED));
+        mat_cpy(out, ta);
+        CHECK(row_ops_[k](out, rv) == 0 && same(out, ref, LAMAT_TILED));
+        col_ops[k](a, cv, ref);
+        CHECK(col_ops[k](ta, cv, out) == 0 && same(out, ref, LAMAT_TILED));
+        mat_cpy(out, ta);
+        CHECK(col_ops_[k](out, cv) == 0 && same(out, ref, LAMAT_TILED));
+    }
+
+    mat_transpose(a, ref);
+    CHECK(mat_transpose(ta, out) == 0 && same(out, ref, LAMAT_TILED));
+    mat_cpy(out, ta);
+    CHECK(mat_transpose_(out) == 0 && same(out, ref, LAMAT_TILED));
+
+    mat_del(a);
+    mat_del(b);
+    mat_del(ta);
+    mat_del(tb);
+    mat_del(ref);
+    mat_del(out);
+    vec_del(rv);
+    vec_del(cv);
+}
+
+
+/* Whether out holds v * m (left) or m * v against a naive sum in
+ * double precision */
+static int is_mmul(const matrix *m, const vector *v, const vector *out,
+        int left) {
+    double mmax = 0, vmax = 0, sum;
+    int rows, cols, n, dim, i, j;
+
+    mat_dim(m, &rows, &cols);
+    vec_dim(out, &dim);
+    n = left ? rows : cols;
+    if (dim != (left ? cols : rows)) {
+        return 0;
+    }
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            mmax = fmax(mmax, fabs(mat_get(m, i, j)));
+        }
+    }
+    for (i = 0; i < n; i++) {
+        vmax = fmax(vmax, fabs(vec_get(v, i)));
+    }
+    for (i = 0; i < dim; i++) {
+        sum = 0;
+        for (j = 0; j < n; j++) {
+            sum += (double)vec_get(v, j)
+                * (left ? mat_get(m, j, i) : mat_get(m, i, j));
+        }
+        if (fabs(sum - vec_get(out, i)) > TOL * n * mmax * vmax) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+static void test_products(void) {
+    matrix *a, *b, *ops[2][2], *out, *ref, *c, *tc;
+    vector *x, *y, *w;
+    int i, j;
+
+    mat_zero(&a, ROWS, COLS);
+    mat_zero(&b, COLS, SMALL);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    ops[0][0] = a;
+    ops[0][1] = tiled(a);
+    ops[1][0] = b;
+    ops[1][1] = tiled(b);
+    mat_zero(&out, 1, 1);
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            CHECK(mat_mul(ops[0][i], ops[1][j], out) == 0);
+            CHECK(check_product(a, b, out, TOL));
+            CHECK(mat_get_layout(out) == i);
+        }
+    }
+    mat_cpy(out, ops[0][1]);
+    CHECK(mat_mul_(out, b) == 0 && check_product(a, b, out, TOL));
+
+    vec_zero(&x, ROWS);
+    vec_zero(&y, COLS);
+    vec_zero(&w, 1);
+    check_fill_vector(x, -1, 1);
+    check_fill_vector(y, -1, 1);
+    CHECK(vec_mmul_l(x, ops[0][1], w) == 0 && is_mmul(a, x, w, 1));
+    CHECK(vec_mmul_r(ops[0][1], y, w) == 0 && is_mmul(a, y, w, 0));
+    vec_cpy(w, x);
+    CHECK(vec_mmul_l_(w, ops[0][1]) == 0 && is_mmul(a, x, w, 1));
+    vec_cpy(w, y);
+    CHECK(vec_mmul_r_(ops[0][1], w) == 0 && is_mmul(a, y, w, 0));
+
+    /* Rank updates, which write a tiled matrix in place */
+    mat_zero(&ref, ROWS, COLS);
+    tc = tiled(ref);
+    mat_ger(ref, 2, x, y);
+    CHECK(mat_ger(tc, 2, x, y) == 0 && same(tc, ref, LAMAT_TILED));
+    mat_del(tc);
+    mat_zero(&c, COLS, COLS);
+    tc = tiled(c);
+    mat_syrk(c, 0.5, a);
+    CHECK(mat_syrk(tc, 0.5, ops[0][1]) == 0);
+    CHECK(mat_get_layout(tc) == LAMAT_TILED);
+    mat_sub_(c, tc);
+    for (i = 0; i < COLS; i++) {
+        for (j = 0; j < COLS; j++) {
+            CHECK(fabs(mat_get(c, i, j)) <= TOL * ROWS);
+        }
+    }
+
+    for (i = 0; i < 2; i++) {
+        for (j = 0; j < 2; j++) {
+            mat_del(ops[i][j]);
+        }
+    }
+    mat_del(out);
+    mat_del(ref);
+    mat_del(c);
+    mat_del(tc);
+    vec_del(x);
+    vec_del(y);
+    vec_del(w);
+}
+
+
+int main(void) {
+    srand(1);
+    test_convert();
+    test_elementwise();
+    test_products();
+    return check_status();
+}
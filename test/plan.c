@@ -0,0 +1,107 @@
+/* Execution plans against a naive product in double precision, split
+ * into bands and from several threads at once, which then share the
+ * pool of par_for. */
+
+#include "plan.h"
+#include "summation.h"
+#include "check.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+/* Dimensions of the products, large enough for several bands */
+#define ROWS 301
+#define INNER 257
+#define COLS 263
+
+/* Error allowed, times the inner dimension and the largest elements
+ * of the operands */
+#define TOL 1e-6
+
+#define EXECUTORS 3
+#define ROUNDS 4
+
+
+static matrix *a, *b;
+
+
+/* Executes a plan of its own ROUNDS times, writing into *arg
+ * whether every result matched */
+static void *executor(void *arg) {
+    matrix *out;
+    plan *p;
+    int i, ok = 1;
+
+    mat_zero(&out, 1, 1);
+    if (mat_mul_plan(&p, ROWS, INNER, COLS, LAPLAN_THREADS) != 0) {
+        ok = 0;
+    } else {
+        for (i = 0; i < ROUNDS; i++) {
+            ok &= plan_execute(p, a, b, out) == 0
+                && check_product(a, b, out, TOL);
+        }
+        plan_del(p);
+    }
+    mat_del(out);
+    *(int *)arg = ok;
+    return NULL;
+}
+
+
+/* Plans of every summation mode with and without bands */
+static void test_modes(void) {
+    static const int modes[] = {LASUM_NAIVE, LASUM_PAIRWISE, LASUM_KAHAN};
+    matrix *out;
+    plan *p;
+    size_t i;
+    int flags;
+
+    mat_zero(&out, 1, 1);
+    for (i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        CHECK(linalg_sum_policy(modes[i]) == 0);
+        for (flags = 0; flags <= LAPLAN_THREADS; flags += LAPLAN_THREADS) {
+            CHECK(mat_mul_plan(&p, ROWS, INNER, COLS, flags) == 0);
+            CHECK(plan_execute(p, a, b, out) == 0);
+            CHECK(check_product(a, b, out, TOL));
+            CHECK(plan_execute(p, b, a, out) == LAPLAN_INCOMPATIBLE_DIM);
+            CHECK(plan_execute(p, a, b, a) == LAPLAN_INVALID);
+            plan_del(p);
+        }
+    }
+    CHECK(linalg_sum_policy(LASUM_NAIVE) == 0);
+    mat_del(out);
+}
+
+
+static void test_concurrent(void) {
+    pthread_t threads[EXECUTORS];
+    int ok[EXECUTORS], i;
+
+    for (i = 0; i < EXECUTORS; i++) {
+        CHECK(pthread_create(&threads[i], NULL, executor, &ok[i]) == 0);
+    }
+    for (i = 0; i < EXECUTORS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(ok[i]);
+    }
+}
+
+
+int main(void) {
+    plan *p;
+
+    srand(1);
+    mat_zero(&a, ROWS, INNER);
+    mat_zero(&b, INNER, COLS);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+
+    CHECK(mat_mul_plan(&p, 0, INNER, COLS, 0) == LAPLAN_INVALID);
+    CHECK(mat_mul_plan(&p, ROWS, INNER, COLS, 4) == LAPLAN_INVALID);
+    test_modes();
+    test_concurrent();
+
+    mat_del(a);
+    mat_del(b);
+    return check_status();
+}
@@ -0,0 +1,277 @@
+/* qmatrices in every storage format: elements within half a step of
+ * their format from the originals, int8 rows scaled independently, and
+ * products against naive ones in double precision over the converted
+ * elements. Every version of the kernels the CPU supports is checked,
+ * each in a child process whose $LINALG_QMAT_ISA caps it. */
+
+#include "qmatrix.h"
+#include "check.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Dimensions, neither a multiple of the lanes of any kernel, and rows
+ * over more than one block of qmat_mul */
+#define ROWS 147
+#define COLS 203
+#define BCOLS 45
+
+/* Error allowed in products, times the inner dimension and the largest
+ * elements of the operands */
+#define TOL 1e-6
+
+
+static const int formats[] = {LAQMAT_BF16, LAQMAT_FP16, LAQMAT_INT8};
+
+
+/* Whether d, converted back from a qmatrix of m, holds the elements of
+ * m to within half a step of the format, plus the rounding of the int8
+ * products by their scales */
+static int rounded(const matrix *m, const matrix *d, int format) {
+    double x, max, err;
+    int i, j;
+
+    for (i = 0; i < ROWS; i++) {
+        max = 0;
+        for (j = 0; j < COLS; j++) {
+            max = fmax(max, fabs(mat_get(m, i, j)));
+        }
+        for (j = 0; j < COLS; j++) {
+            x = mat_get(m, i, j);
+            err = fabs(mat_get(d, i, j) - x);
+            if ((format == LAQMAT_BF16 && err > fabs(x) / 256)
+                    || (format == LAQMAT_FP16
+                        && err > fmax(fabs(x) / 2048, 0x1p-25))
+                    || (format == LAQMAT_INT8
+                        && err > max / 254 + max * 1e-6)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* Whether out holds d * v to within TOL */
+static int is_mmul_r(const matrix *d, const vector *v, const vector *out) {
+    double dmax = 0, vmax = 0, sum;
+    int dim, i, j;
+
+    vec_dim(out, &dim);
+    if (dim != ROWS) {
+        return 0;
+    }
+    for (j = 0; j < COLS; j++) {
+        vmax = fmax(vmax, fabs(vec_get(v, j)));
+        for (i = 0; i < ROWS; i++) {
+            dmax = fmax(dmax, fabs(mat_get(d, i, j)));
+        }
+    }
+    for (i = 0; i < ROWS; i++) {
+        sum = 0;
+        for (j = 0; j < COLS; j++) {
+            sum += (double)mat_get(d, i, j) * vec_get(v, j);
+        }
+        if (fabs(sum - vec_get(out, i)) > TOL * COLS * dmax * vmax) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Rows of magnitudes from 1e-3 to 10, so that a scale shared
+ * between them would flush the smaller ones, and a row of zeros */
+static void test_formats(void) {
+    matrix *m, *tiled, *d, *d2, *b, *out;
+    vector *v, *w;
+    qmatrix *q;
+    double scale;
+    size_t f;
+    int rows, cols, format, i, j;
+
+    mat_zero(&m, ROWS, COLS);
+    for (i = 0; i < ROWS - 1; i++) {
+        scale = pow(10, i % 5 - 3);
+        for (j = 0; j < COLS; j++) {
+            mat_set(m, i, j, check_uniform(-scale, scale));
+        }
+    }
+    mat_dup(&tiled, m);
+    mat_set_layout(tiled, LAMAT_TILED);
+    mat_zero(&b, COLS, BCOLS);
+    check_fill_matrix(b, -1, 1);
+    vec_zero(&v, COLS);
+    check_fill_vector(v, -1, 1);
+    mat_zero(&d, 1, 1);
+    mat_zero(&d2, 1, 1);
+    mat_zero(&out, 1, 1);
+    vec_zero(&w, 1);
+
+    for (f = 0; f < sizeof(formats) / sizeof(*formats); f++) {
+        CHECK(qmat_new(&q, m, formats[f]) == 0);
+        qmat_dim(q, &rows, &cols, &format);
+        CHECK(rows == ROWS && cols == COLS && format == formats[f]);
+        CHECK(qmat_to_mat(q, d) == 0);
+        CHECK(rounded(m, d, formats[f]));
+        for (j = 0; j < COLS; j++) {
+            CHECK(mat_get(d, ROWS - 1, j) == 0);
+        }
+
+        CHECK(qmat_mmul_r(q, v, w) == 0);
+        CHECK(is_mmul_r(d, v, w));
+        CHECK(qmat_mul(q, b, out) == 0);
+        CHECK(check_product(d, b, out, TOL));
+        CHECK(mat_get_layout(out) == LAMAT_ROW_MAJOR);
+        qmat_del(q);
+
+        /* Tiled operands are read through row-major copies */
+        CHECK(qmat_new(&q, tiled, formats[f]) == 0);
+        CHECK(qmat_to_mat(q, d2) == 0);
+        CHECK(mat_get_layout(d2) == LAMAT_ROW_MAJOR);
+        for (i = 0; i < ROWS; i++) {
+            for (j = 0; j < COLS; j++) {
+                CHECK(mat_get(d2, i, j) == mat_get(d, i, j));
+            }
+        }
+        mat_set_layout(b, LAMAT_TILED);
+        CHECK(qmat_mul(q, b, out) == 0);
+        CHECK(check_product(d, b, out, TOL));
+        CHECK(mat_get_layout(out) == LAMAT_ROW_MAJOR);
+        mat_set_layout(b, LAMAT_ROW_MAJOR);
+        qmat_del(q);
+    }
+
+    mat_del(m);
+    mat_del(tiled);
+    mat_del(d);
+    mat_del(d2);
+    mat_del(b);
+    mat_del(out);
+    vec_del(v);
+    vec_del(w);
+}
+
+
+/* Products written over their right operand, by a square qmatrix,
+ * match those written elsewhere */
+static void test_in_place(void) {
+    matrix *m, *b, *ref;
+    vector *v, *ref_v;
+    qmatrix *q;
+    size_t f;
+    int i, j, ok;
+
+    mat_zero(&m, COLS, COLS);
+    check_fill_matrix(m, -1, 1);
+    mat_zero(&b, COLS, BCOLS);
+    vec_zero(&v, COLS);
+    mat_zero(&ref, 1, 1);
+    vec_zero(&ref_v, 1);
+    for (f = 0; f < sizeof(formats) / sizeof(*formats); f++) {
+        check_fill_matrix(b, -1, 1);
+        check_fill_vector(v, -1, 1);
+        CHECK(qmat_new(&q, m, formats[f]) == 0);
+        CHECK(qmat_mul(q, b, ref) == 0);
+        CHECK(qmat_mul(q, b, b) == 0);
+        CHECK(qmat_mmul_r(q, v, ref_v) == 0);
+        CHECK(qmat_mmul_r(q, v, v) == 0);
+        ok = 1;
+        for (i = 0; i < COLS; i++) {
+            for (j = 0; j < BCOLS; j++) {
+                ok &= mat_get(b, i, j) == mat_get(ref, i, j);
+            }
+            ok &= vec_get(v, i) == vec_get(ref_v, i);
+        }
+        CHECK(ok);
+        qmat_del(q);
+    }
+    mat_del(m);
+    mat_del(b);
+    mat_del(ref);
+    vec_del(v);
+    vec_del(ref_v);
+}
+
+
+static void test_special(void) {
+    static const LINALG_SCALAR data[] = {70000, -1e30f, 65504, 1e-9f};
+    matrix *m, *d;
+    qmatrix *q;
+
+    mat_new(&m, data, 1, 4);
+    mat_zero(&d, 1, 1);
+    CHECK(qmat_new(&q, m, LAQMAT_FP16) == 0);
+    qmat_to_mat(q, d);
+    CHECK(mat_get(d, 0, 0) == INFINITY && mat_get(d, 0, 1) == -INFINITY);
+    CHECK(mat_get(d, 0, 2) == 65504 && mat_get(d, 0, 3) == 0);
+    qmat_del(q);
+    CHECK(qmat_new(&q, m, LAQMAT_BF16) == 0);
+    qmat_to_mat(q, d);
+    CHECK(check_close(mat_get(d, 0, 1), -1e30, 1.0 / 256));
+    qmat_del(q);
+    CHECK(qmat_new(&q, m, LAQMAT_INT8) == 0);
+    qmat_to_mat(q, d);
+    CHECK(check_close(mat_get(d, 0, 1), -1e30, 1e-6)
+            && mat_get(d, 0, 0) == 0);
+    qmat_del(q);
+    mat_del(m);
+    mat_del(d);
+}
+
+
+static void test_errors(void) {
+    matrix *m, *out;
+    vector *v;
+    qmatrix *q;
+
+    mat_zero(&m, 3, 4);
+    mat_zero(&out, 1, 1);
+    vec_zero(&v, 3);
+    CHECK(qmat_new(&q, m, 0) == LAQMAT_INVALID);
+    CHECK(qmat_new(&q, m, LAQMAT_INT8 + 1) == LAQMAT_INVALID);
+    CHECK(qmat_new(&q, m, LAQMAT_FP16) == 0);
+    CHECK(qmat_mmul_r(q, v, v) == LAQMAT_INCOMPATIBLE_DIM);
+    CHECK(qmat_mul(q, m, out) == LAQMAT_INCOMPATIBLE_DIM);
+    qmat_del(q);
+    mat_del(m);
+    mat_del(out);
+    vec_del(v);
+}
+
+
+static void run(void) {
+    test_formats();
+    test_in_place();
+    test_special();
+    test_errors();
+}
+
+
+int main(void) {
+    static const char *const caps[] = {"generic", "avx2", "avx512"};
+    size_t i;
+    pid_t pid;
+    int status;
+
+    srand(1);
+    /* Before any thread is started, which a child would lack */
+    for (i = 0; getenv("LINALG_QMAT_ISA") == NULL
+            && i < sizeof(caps) / sizeof(*caps); i++) {
+        pid = fork();
+        if (pid == 0) {
+            setenv("LINALG_QMAT_ISA", caps[i], 1);
+            run();
+            if (check_status() != 0) {
+                fprintf(stderr, "with LINALG_QMAT_ISA=%s\n", caps[i]);
+            }
+            exit(check_status());
+        }
+        CHECK(pid > 0 && waitpid(pid, &status, 0) == pid
+                && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    run();
+    return check_status();
+}
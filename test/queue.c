@@ -0,0 +1,297 @@
+/* Tasks of a linalg_queue: random tasks over a few objects that check,
+ * while running, that the tasks they conflict with ran in submission
+ * order and not alongside them; chains of asynchronous operations
+ * against their results; results of failed operations; and a
+ * submission whose dependencies cannot all be recorded, which must
+ * leave the queue as it was. */
+
+#define _GNU_SOURCE
+
+#include "queue.h"
+#include "check.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* Objects the random tasks read and write, and tasks submitted */
+#define NOBJ 4
+#define NTASKS 400
+
+#define THREADS 4
+
+/* Order of the matrices of the asynchronous operations */
+#define N 96
+
+/* Error allowed, times the inner dimension and the largest elements
+ * of the operands */
+#define TOL 1e-6
+
+
+struct op {
+    int id;
+    int reads, writes;          /* masks of objects */
+    int expect[NOBJ];           /* writes of each submitted before */
+};
+
+static int objs[NOBJ];
+static atomic_int version[NOBJ], readers[NOBJ], writers[NOBJ];
+static atomic_int ran, done_calls, bad;
+
+/* Calls to realloc of this thread left before it fails, or -1 to never
+ * fail; other threads are left alone */
+static _Thread_local int realloc_budget = -1;
+
+static void *(*next_realloc)(void *, size_t);
+
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gate_cond = PTHREAD_COND_INITIALIZER;
+static int gate_open;
+
+
+/* The queue's only call to realloc records a dependency, which this
+ * makes fail on demand. ThreadSanitizer calls it before it can run
+ * instrumented code. */
+__attribute__((no_sanitize_thread))
+void *realloc(void *p, size_t n) {
+    if (realloc_budget == 0) {
+        return NULL;
+    }
+    if (realloc_budget > 0) {
+        realloc_budget--;
+    }
+    if (next_realloc == NULL) {
+        next_realloc = (void *(*)(void *, size_t))dlsym(RTLD_NEXT, "realloc");
+    }
+    return next_realloc(p, n);
+}
+
+
+static int run_op(void *ctx) {
+    struct op *o = ctx;
+    int i;
+
+    for (i = 0; i < NOBJ; i++) {
+        if (o->reads & 1 << i) {
+            atomic_fetch_add(&readers[i], 1);
+            bad |= atomic_load(&version[i]) != o->expect[i]
+                || atomic_load(&writers[i]) != 0;
+        }
+        if (o->writes & 1 << i) {
+            bad |= atomic_fetch_add(&writers[i], 1) != 0
+                || atomic_load(&version[i]) != o->expect[i]
+                || atomic_load(&readers[i]) != 0;
+        }
+    }
+    /* Long enough for tasks that must not overlap to do so */
+    usleep(o->id % 4 * 50);
+    for (i = 0; i < NOBJ; i++) {
+        if (o->reads & 1 << i) {
+            atomic_fetch_sub(&readers[i], 1);
+        }
+        if (o->writes & 1 << i) {
+            atomic_fetch_add(&version[i], 1);
+            atomic_fetch_sub(&writers[i], 1);
+        }
+    }
+    atomic_fetch_add(&ran, 1);
+    return o->id;
+}
+
+
+static void count_done(int result, void *ctx) {
+    atomic_fetch_add(&done_calls, result == *(int *)ctx);
+}
+
+
+static void test_order(void) {
+    static struct op ops[NTASKS];
+    const void *reads[NOBJ];
+    void *writes[NOBJ];
+    int submitted[NOBJ] = {0};
+    linalg_queue *q;
+    linalg_task *t;
+    int i, k, nr, nw, result, ok = 1;
+
+    CHECK(linalg_queue_new(&q, THREADS) == 0);
+    for (i = 0; i < NTASKS; i++) {
+        ops[i].id = i;
+        ops[i].reads = rand() % (1 << NOBJ);
+        ops[i].writes = rand() % (1 << NOBJ) & ~ops[i].reads;
+        /* Mostly readers, so that some run side by side */
+        ops[i].writes &= rand() % 2 ? 0 : ~0;
+        nr = nw = 0;
+        for (k = 0; k < NOBJ; k++) {
+            ops[i].expect[k] = submitted[k];
+            if (ops[i].reads & 1 << k) {
+                reads[nr++] = &objs[k];
+            }
+            if (ops[i].writes & 1 << k) {
+                writes[nw++] = &objs[k];
+                submitted[k]++;
+            }
+        }
+        if (i % 5 == 0) {
+            ok &= linalg_submit(q, run_op, &ops[i],
+                    reads, nr, writes, nw, &t) == 0;
+            linalg_task_then(t, count_done, &ops[i].id);
+            if (i % 25 == 0) {
+                ok &= linalg_task_wait(t, &result) == 0 && result == i
+                    && linalg_task_poll(t);
+            }
+            linalg_task_del(t);
+        } else {
+            ok &= linalg_submit(q, run_op, &ops[i],
+                    reads, nr, writes, nw, NULL) == 0;
+        }
+    }
+    CHECK(ok);
+    CHECK(linalg_queue_finish(q) == 0);
+    CHECK(ran == NTASKS && done_calls == NTASKS / 5 && !bad);
+    for (k = 0; k < NOBJ; k++) {
+        CHECK(version[k] == submitted[k]);
+    }
+    CHECK(linalg_queue_del(q) == 0);
+}
+
+
+/* c = a * b, d = c * b, then c += a, which must wait for d to have
+ * read c; likewise w = a * v before v = a * v */
+static void test_async(void) {
+    matrix *a, *b, *c, *d, *ref;
+    vector *v, *w, *v0;
+    linalg_queue *q;
+    linalg_task *t;
+    int i, j, result, ok;
+
+    mat_zero(&a, N, N);
+    mat_zero(&b, N, N);
+    mat_zero(&c, 1, 1);
+    mat_zero(&d, 1, 1);
+    mat_zero(&ref, 1, 1);
+    vec_zero(&v, N);
+    vec_zero(&w, 1);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    check_fill_vector(v, -1, 1);
+    vec_dup(&v0, v);
+    mat_mul(a, b, ref);
+
+    CHECK(linalg_queue_new(&q, THREADS) == 0);
+    CHECK(linalg_async_mat_mul(q, a, b, c, NULL) == 0);
+    CHECK(linalg_async_mat_mul(q, c, b, d, NULL) == 0);
+    CHECK(linalg_async_mat_add_(q, c, a, &t) == 0);
+    CHECK(linalg_async_vec_mmul_r(q, a, v, w, NULL) == 0);
+    CHECK(linalg_async_vec_mmul_r_(q, a, v, NULL) == 0);
+    CHECK(linalg_task_wait(t, &result) == 0 && result == 0);
+    linalg_task_del(t);
+    CHECK(linalg_queue_finish(q) == 0);
+
+    CHECK(check_product(ref, b, d, TOL));
+    ok = 1;
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            ok &= check_close(mat_get(ref, i, j) + mat_get(a, i, j),
+                    mat_get(c, i, j), 1e-6);
+        }
+        ok &= vec_get(v, i) == vec_get(w, i);
+    }
+    CHECK(ok);
+    vec_mmul_r_(a, v0);
+    for (i = 0; i < N; i++) {
+        ok &= vec_get(v0, i) == vec_get(w, i);
+    }
+    CHECK(ok);
+
+    /* A failed operation reports its error, and the tasks waiting for
+     * it still run */
+    mat_del(c);
+    mat_zero(&c, N + 1, N);
+    CHECK(linalg_async_mat_mul(q, a, c, d, &t) == 0);
+    CHECK(linalg_async_mat_sub(q, d, d, c, NULL) == 0);
+    CHECK(linalg_task_wait(t, &result) == 0
+            && result == LAMAT_INCOMPATIBLE_DIM);
+    linalg_task_del(t);
+    CHECK(linalg_queue_del(q) == 0);
+    mat_dim(c, &i, &j);
+    CHECK(i == N && j == N && mat_get(c, N - 1, N - 1) == 0);
+
+    mat_del(a);
+    mat_del(b);
+    mat_del(c);
+    mat_del(d);
+    mat_del(ref);
+    vec_del(v);
+    vec_del(w);
+    vec_del(v0);
+}
+
+
+/* Holds the queue's only worker until test_rollback is done
+ * submitting */
+static int gate(void *ctx) {
+    (void)ctx;
+    pthread_mutex_lock(&gate_lock);
+    while (!gate_open) {
+        pthread_cond_wait(&gate_cond, &gate_lock);
+    }
+    pthread_mutex_unlock(&gate_lock);
+    atomic_fetch_add(&ran, 1);
+    return 0;
+}
+
+
+static int count(void *ctx) {
+    (void)ctx;
+    atomic_fetch_add(&ran, 1);
+    return 0;
+}
+
+
+/* A task waiting for two others, where only the first dependency can
+ * be recorded, is not submitted, and the first forgets it */
+static void test_rollback(void) {
+    const void *reads[2];
+    void *writes[1];
+    linalg_queue *q;
+    int i;
+
+    ran = 0;
+    CHECK(linalg_queue_new(&q, 1) == 0);
+    writes[0] = &objs[1];
+    CHECK(linalg_submit(q, gate, NULL, NULL, 0, writes, 1, NULL) == 0);
+    writes[0] = &objs[0];
+    CHECK(linalg_submit(q, count, NULL, NULL, 0, writes, 1, NULL) == 0);
+    /* Four readers fill the room for the second task's dependents */
+    reads[0] = &objs[0];
+    for (i = 0; i < 4; i++) {
+        CHECK(linalg_submit(q, count, NULL, reads, 1, NULL, 0, NULL) == 0);
+    }
+
+    reads[1] = &objs[1];
+    realloc_budget = 1;
+    CHECK(linalg_submit(q, count, NULL, reads, 2, NULL, 0, NULL)
+            == LAQUEUE_ALLOC);
+    CHECK(realloc_budget == 0);
+    realloc_budget = -1;
+    /* Likely to get the memory of the task that was not submitted */
+    CHECK(linalg_submit(q, count, NULL, reads + 1, 1, NULL, 0, NULL) == 0);
+
+    pthread_mutex_lock(&gate_lock);
+    gate_open = 1;
+    pthread_cond_signal(&gate_cond);
+    pthread_mutex_unlock(&gate_lock);
+    CHECK(linalg_queue_del(q) == 0);
+    CHECK(ran == 7);
+}
+
+
+int main(void) {
+    srand(1);
+    test_order();
+    test_async();
+    test_rollback();
+    return check_status();
+}
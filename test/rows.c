@@ -0,0 +1,258 @@
+/* Row gather/scatter, permutations and index selection against naive
+ * copies, in both layouts, with matrices large enough to be split
+ * between threads. */
+
+#include "matrix.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+/* Dimensions of the matrices, past a tile of LAMAT_TILED, and rows
+ * selected, several times the rows of a thread's grain */
+#define ROWS 4099
+#define COLS 1031
+#define N 3001
+
+/* Dimension of the vectors and elements selected, likewise */
+#define VDIM (1 << 20)
+#define VN (1 << 21)
+
+
+/* Fills perm with a random permutation of n */
+static void shuffle(int *perm, int n) {
+    int i, j, t;
+
+    for (i = 0; i < n; i++) {
+        perm[i] = i;
+    }
+    for (i = n - 1; i > 0; i--) {
+        j = rand() % (i + 1);
+        t = perm[i];
+        perm[i] = perm[j];
+        perm[j] = t;
+    }
+}
+
+
+static void test_gather_scatter(void) {
+    static int idx[N], perm[ROWS];
+    matrix *m, *orig, *out, *src;
+    int layout, rows, cols, i, j, ok;
+
+    for (i = 0; i < N; i++) {
+        idx[i] = rand() % ROWS;
+    }
+    mat_zero(&out, 1, 1);
+    for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+        mat_zero(&m, ROWS, COLS);
+        check_fill_matrix(m, -1, 1);
+        mat_dup(&orig, m);
+        mat_set_layout(m, layout);
+
+        CHECK(mat_gather_rows(m, idx, N, out) == 0);
+        mat_dim(out, &rows, &cols);
+        CHECK(rows == N && cols == COLS && mat_get_layout(out) == layout);
+        ok = 1;
+        for (i = 0; i < N; i++) {
+            for (j = 0; j < COLS; j++) {
+                ok &= mat_get(out, i, j) == mat_get(orig, idx[i], j);
+            }
+        }
+        CHECK(ok);
+
+        /* Scattering the rows of a permutation back undoes it */
+        shuffle(perm, ROWS);
+        CHECK(mat_gather_rows(m, perm, ROWS, out) == 0);
+        mat_zero(&src, 1, 1);
+        mat_cpy(src, out);
+        mat_del(m);
+        mat_zero(&m, ROWS, COLS);
+        mat_set_layout(m, layout);
+        CHECK(mat_scatter_rows(m, perm, ROWS, src) == 0);
+        ok = 1;
+        for (i = 0; i < ROWS; i++) {
+            for (j = 0; j < COLS; j++) {
+                ok &= mat_get(m, i, j) == mat_get(orig, i, j);
+            }
+        }
+        CHECK(ok);
+
+        CHECK(mat_gather_rows(m, idx, 0, out) == LAMAT_INVALID);
+        idx[N / 2] = ROWS;
+        CHECK(mat_gather_rows(m, idx, N, out) == LAMAT_OOB);
+        CHECK(mat_scatter_rows(m, idx, N, src) == LAMAT_INCOMPATIBLE_DIM);
+        CHECK(mat_scatter_rows(m, perm, ROWS, m) == LAMAT_INVALID);
+        idx[N / 2] = 0;
+
+        mat_del(src);
+        mat_del(orig);
+        mat_del(m);
+    }
+    mat_del(out);
+}
+
+
+static void test_permute(void) {
+    static int rperm[ROWS], cperm[COLS];
+    matrix *m, *orig, *before;
+    int layout, i, j, ok;
+
+    for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+        mat_zero(&m, ROWS, COLS);
+        check_fill_matrix(m, -1, 1);
+        mat_dup(&orig, m);
+        mat_set_layout(m, layout);
+
+        shuffle(rperm, ROWS);
+        CHECK(mat_permute_rows(m, rperm) == 0);
+        shuffle(cperm, COLS);
+        CHECK(mat_permute_cols(m, cperm) == 0);
+        ok = 1;
+        for (i = 0; i < ROWS; i++) {
+            for (j = 0; j < COLS; j++) {
+                ok &= mat_get(m, i, j) == mat_get(orig, rperm[i], cperm[j]);
+            }
+        }
+        CHECK(ok);
+
+        /* Repeated entries, and entries out of range, are rejected
+         * before anything moves */
+        mat_dup(&before, m);
+        cperm[1] = cperm[0];
+        CHECK(mat_permute_cols(m, cperm) == LAMAT_INVALID);
+        rperm[3] = -1;
+        CHECK(mat_permute_rows(m, rperm) == LAMAT_OOB);
+        rperm[3] = ROWS;
+        CHECK(mat_permute_rows(m, rperm) == LAMAT_OOB);
+        ok = 1;
+        for (i = 0; i < ROWS; i++) {
+            for (j = 0; j < COLS; j++) {
+                ok &= mat_get(m, i, j) == mat_get(before, i, j);
+            }
+        }
+        CHECK(ok);
+        mat_del(before);
+
+        mat_del(orig);
+        mat_del(m);
+    }
+}
+
+
+/* Repeated indices get the last of their rows, however the work
+ * is split */
+static void test_duplicates(void) {
+    static int idx[N], last[ROWS];
+    matrix *m, *src;
+    int layout, i, j, ok;
+
+    for (i = 0; i < ROWS; i++) {
+        last[i] = -1;
+    }
+    for (i = 0; i < N; i++) {
+        idx[i] = rand() % 64 * (ROWS / 64);
+        last[idx[i]] = i;
+    }
+
+    mat_zero(&src, N, COLS);
+    check_fill_matrix(src, -1, 1);
+    for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+        mat_zero(&m, ROWS, COLS);
+        mat_set_layout(m, layout);
+        CHECK(mat_scatter_rows(m, idx, N, src) == 0);
+        ok = 1;
+        for (i = 0; i < ROWS; i++) {
+            for (j = 0; j < COLS; j++) {
+                ok &= mat_get(m, i, j)
+                    == (last[i] < 0 ? 0 : mat_get(src, last[i], j));
+            }
+        }
+        CHECK(ok);
+        mat_del(m);
+    }
+    mat_del(src);
+}
+
+
+/* vec_gather and vec_scatter, with about two indices per element */
+static void test_vectors(void) {
+    static int idx[VN], last[VDIM];
+    vector *v, *src, *out;
+    int i, ok;
+
+    for (i = 0; i < VDIM; i++) {
+        last[i] = -1;
+    }
+    for (i = 0; i < VN; i++) {
+        idx[i] = rand() % VDIM;
+        last[idx[i]] = i;
+    }
+    vec_zero(&v, VDIM);
+    vec_zero(&src, VN);
+    vec_zero(&out, 1);
+    for (i = 0; i < VN; i++) {
+        vec_set(src, i, (LINALG_SCALAR)(i + 1));
+    }
+
+    CHECK(vec_scatter(v, idx, VN, src) == 0);
+    ok = 1;
+    for (i = 0; i < VDIM; i++) {
+        ok &= vec_get(v, i) == (LINALG_SCALAR)(last[i] + 1);
+    }
+    CHECK(ok);
+
+    CHECK(vec_gather(v, idx, VN, out) == 0);
+    ok = 1;
+    for (i = 0; i < VN; i++) {
+        ok &= vec_get(out, i) == (LINALG_SCALAR)(last[idx[i]] + 1);
+    }
+    CHECK(ok);
+
+    CHECK(vec_gather(v, idx, 0, out) == LAVEC_INVALID);
+    CHECK(vec_scatter(v, idx, VN - 1, src) == LAVEC_INCOMPATIBLE_DIM);
+    CHECK(vec_scatter(src, idx, VN, src) == LAVEC_INVALID);
+    idx[VN / 2] = VDIM;
+    CHECK(vec_scatter(v, idx, VN, src) == LAVEC_OOB);
+    CHECK(vec_gather(v, idx, VN, out) == LAVEC_OOB);
+
+    vec_del(v);
+    vec_del(src);
+    vec_del(out);
+}
+
+
+/* Matrices without columns have nothing to move, but their
+ * indices are still checked */
+static void test_empty_rows(void) {
+    static const int idx[] = {2, 0, 2};
+    static const int perm[] = {2, 0, 1};
+    matrix *m, *out, *src;
+    int rows, cols;
+
+    mat_zero(&m, 3, 0);
+    mat_zero(&out, 1, 1);
+    mat_zero(&src, 3, 0);
+
+    CHECK(mat_gather_rows(m, idx, 3, out) == 0);
+    mat_dim(out, &rows, &cols);
+    CHECK(rows == 3 && cols == 0);
+    CHECK(mat_scatter_rows(m, idx, 3, src) == 0);
+    CHECK(mat_permute_rows(m, perm) == 0);
+    CHECK(mat_permute_cols(m, perm) == 0);
+    CHECK(mat_permute_rows(m, idx) == LAMAT_INVALID);
+
+    mat_del(m);
+    mat_del(out);
+    mat_del(src);
+}
+
+
+int main(void) {
+    srand(1);
+    test_gather_scatter();
+    test_permute();
+    test_duplicates();
+    test_vectors();
+    test_empty_rows();
+    return check_status();
+}
@@ -0,0 +1,286 @@
+/* Shared matrices and vectors across forked processes: references held
+ * by every process, attached storage that cannot be written, writes of
+ * the sharing process seen by the others, and names unlinked and given
+ * to new objects while other processes attach and drop the old ones. */
+
+#include "shm.h"
+#include "check.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Dimensions, small enough for no operation to start threads, which
+ * the children would lack */
+#define ROWS 50
+#define COLS 41
+
+#define CHILDREN 4
+
+/* Objects given the same name in turn, and attachments per child
+ * meanwhile */
+#define GENERATIONS 20
+#define ATTACHES 2000
+
+
+/* Writes into name a name unique to this process and tag */
+static void make_name(char *name, const char *tag) {
+    sprintf(name, "/linalg-test-%d-%s", (int)getpid(), tag);
+}
+
+
+/* Waits for pid and returns its exit status, or -1 if it did not
+ * exit normally */
+static int wait_child(pid_t pid) {
+    int status;
+
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)) {
+        return -1;
+    }
+    return WEXITSTATUS(status);
+}
+
+
+/* Whether every element of m is x */
+static int filled(const matrix *m, LINALG_SCALAR x) {
+    int rows, cols, i, j;
+
+    mat_dim(m, &rows, &cols);
+    for (i = 0; i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            if (mat_get(m, i, j) != x) {
+                return 0;
+            }
+        }
+    }
+    return rows == ROWS && cols == COLS;
+}
+
+
+/* A ROWS x COLS matrix of x */
+static matrix *generation(LINALG_SCALAR x) {
+    static LINALG_SCALAR data[ROWS * COLS];
+    matrix *m;
+    int i;
+
+    for (i = 0; i < ROWS * COLS; i++) {
+        data[i] = x;
+    }
+    mat_new(&m, data, ROWS, COLS);
+    return m;
+}
+
+
+static void segv(int sig) {
+    (void)sig;
+    _exit(3);
+}
+
+
+/* Attaches name, then reports on ready and waits on go before checking
+ * that the sharing process's write is seen, and that a write of its own
+ * stays private */
+static int attacher(const char *name, int ready, int go) {
+    matrix *m;
+    char c = 0;
+    int ok;
+
+    if (mat_attach(&m, name) != 0) {
+        return 1;
+    }
+    ok = mat_get(m, 1, 2) == 1;
+    ok &= write(ready, &c, 1) == 1 && read(go, &c, 1) == 1;
+    ok &= mat_get(m, 1, 2) == 7;
+    mat_set(m, 3, 4, 9);
+    ok &= mat_get(m, 3, 4) == 9 && mat_get(m, 1, 2) == 7;
+    mat_del(m);
+    return !ok;
+}
+
+
+static void test_references(void) {
+    int ready[2], go[2], i;
+    pid_t pids[CHILDREN];
+    char name[64], c;
+    matrix *m, *a;
+
+    make_name(name, "refs");
+    mat_zero(&m, ROWS, COLS);
+    mat_set(m, 1, 2, 1);
+    CHECK(mat_share(m, name) == 0);
+
+    CHECK(pipe(ready) == 0 && pipe(go) == 0);
+    for (i = 0; i < CHILDREN; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            _exit(attacher(name, ready[1], go[0]));
+        }
+    }
+    for (i = 0; i < CHILDREN; i++) {
+        CHECK(read(ready[0], &c, 1) == 1);
+    }
+    mat_set(m, 1, 2, 7);
+    for (i = 0; i < CHILDREN; i++) {
+        CHECK(write(go[1], &c, 1) == 1);
+    }
+    for (i = 0; i < CHILDREN; i++) {
+        CHECK(wait_child(pids[i]) == 0);
+    }
+    CHECK(mat_get(m, 3, 4) == 0);
+
+    /* The name outlives the sharing process's reference while
+     * another is held, and goes with the last one */
+    CHECK(mat_attach(&a, name) == 0);
+    mat_del(m);
+    CHECK(mat_attach(&m, name) == 0);
+    mat_del(m);
+    mat_del(a);
+    CHECK(mat_attach(&a, name) == LASHM_NOT_FOUND);
+
+    close(ready[0]);
+    close(ready[1]);
+    close(go[0]);
+    close(go[1]);
+}
+
+
+/* Writes through the storage of an attached matrix fault */
+static void test_read_only(void) {
+    struct sigaction sa;
+    char name[64];
+    matrix *m, *a;
+    pid_t pid;
+
+    make_name(name, "ro");
+    mat_zero(&m, ROWS, COLS);
+    CHECK(mat_share(m, name) == 0);
+    CHECK(mat_attach(&a, name) == 0);
+    pid = fork();
+    if (pid == 0) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = segv;
+        sigaction(SIGSEGV, &sa, NULL);
+        sigaction(SIGBUS, &sa, NULL);
+        *(volatile LINALG_SCALAR *)mat_data_cptr(a) = 1;
+        _exit(0);
+    }
+    CHECK(wait_child(pid) == 3);
+
+    /* Taken into private storage by a write */
+    CHECK(mat_data_ptr(a) != NULL);
+    mat_set(a, 0, 0, 5);
+    CHECK(mat_get(m, 0, 0) == 0 && mat_get(a, 0, 0) == 5);
+    mat_del(a);
+    mat_del(m);
+}
+
+
+/* Attaches name over and over; every matrix found must hold a single
+ * generation of the values */
+static int racer(const char *name) {
+    LINALG_SCALAR x;
+    matrix *m;
+    int i, err;
+
+    for (i = 0; i < ATTACHES; i++) {
+        err = mat_attach(&m, name);
+        if (err == LASHM_NOT_FOUND) {
+            continue;
+        }
+        if (err != 0) {
+            return 1;
+        }
+        x = mat_get(m, 0, 0);
+        if (x < 1 || x > GENERATIONS || !filled(m, x)) {
+            return 1;
+        }
+        mat_del(m);
+    }
+    return 0;
+}
+
+
+/* Generations of objects under one name, each unlinked while the
+ * children attach it, and the name given to the next */
+static void test_unlink(void) {
+    pid_t pids[CHILDREN];
+    char name[64];
+    matrix *m, *old;
+    int g, i;
+
+    make_name(name, "race");
+    m = generation(1);
+    CHECK(mat_share(m, name) == 0);
+    for (i = 0; i < CHILDREN; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            _exit(racer(name));
+        }
+    }
+    for (g = 2; g <= GENERATIONS; g++) {
+        usleep(1000);
+        CHECK(linalg_shm_unlink(name) == 0);
+        old = m;
+        m = generation((LINALG_SCALAR)g);
+        CHECK(mat_share(m, name) == 0);
+        /* Dropping the last reference to the old object leaves
+         * the new one */
+        mat_del(old);
+    }
+    for (i = 0; i < CHILDREN; i++) {
+        CHECK(wait_child(pids[i]) == 0);
+    }
+
+    CHECK(mat_attach(&old, name) == 0);
+    CHECK(filled(old, GENERATIONS));
+    mat_del(old);
+    mat_del(m);
+    CHECK(mat_attach(&old, name) == LASHM_NOT_FOUND);
+    CHECK(linalg_shm_unlink(name) == LASHM_NOT_FOUND);
+}
+
+
+static void test_errors(void) {
+    char name[64], other[64];
+    matrix *m, *a;
+    vector *v, *w;
+    int fd;
+
+    make_name(name, "vec");
+    vec_zero(&v, COLS);
+    vec_set(v, COLS - 1, 3);
+    CHECK(vec_share(v, name) == 0);
+    CHECK(vec_attach(&w, name) == 0);
+    CHECK(vec_get(w, COLS - 1) == 3);
+    vec_del(w);
+    CHECK(mat_attach(&a, name) == LASHM_MISMATCH);
+    mat_zero(&m, 2, 2);
+    CHECK(mat_share(m, name) == LASHM_EXISTS);
+    CHECK(mat_share(m, "/linalg/test") == LASHM_SYSTEM);
+    mat_del(m);
+    vec_del(v);
+    CHECK(vec_attach(&w, name) == LASHM_NOT_FOUND);
+
+    /* Objects of other programs */
+    make_name(other, "foreign");
+    fd = shm_open(other, O_RDWR | O_CREAT | O_EXCL, 0600);
+    CHECK(fd >= 0 && ftruncate(fd, 100) == 0);
+    close(fd);
+    CHECK(mat_attach(&a, other) == LASHM_MISMATCH);
+    CHECK(linalg_shm_unlink(other) == LASHM_MISMATCH);
+    shm_unlink(other);
+}
+
+
+int main(void) {
+    srand(1);
+    test_references();
+    test_read_only();
+    test_unlink();
+    test_errors();
+    return check_status();
+}
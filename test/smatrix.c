@@ -0,0 +1,282 @@
+/* Structured matrices against the dense matrices they stand for, with
+ * products and solves computed naively in double precision. */
+
+#include "smatrix.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+/* Order of the matrices, past a tile of LAMAT_TILED */
+#define N 67
+
+/* Columns of the dense operands */
+#define K 5
+
+#define TOL 1e-4
+
+/* Error allowed in products with the dense form, times the order and
+ * the largest elements of the operands */
+#define PRODUCT_TOL 1e-6
+
+/* Diagonals of the banded matrices */
+#define LOWER 2
+#define UPPER 1
+
+
+/* Whether element (i, j) is part of the structure of kind, LASMAT_BANDED
+ * having LOWER and UPPER diagonals */
+static int in_structure(int kind, int i, int j) {
+    switch (kind) {
+    case LASMAT_DIAGONAL:
+        return i == j;
+    case LASMAT_BANDED:
+        return i - j <= LOWER && j - i <= UPPER;
+    case LASMAT_UPPER:
+        return j >= i;
+    case LASMAT_LOWER:
+        return j <= i;
+    default:
+        return 1;
+    }
+}
+
+
+/* Fills m, N x N, with values in [-1, 1) off the diagonal and above
+ * N on it, so that every structure of it is nonsingular and its
+ * symmetric one positive definite */
+static void fill_square(matrix *m) {
+    int i, j;
+
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            mat_set(m, i, j, i == j ? N + 1 + (LINALG_SCALAR)(i % 3)
+                    : check_uniform(-1, 1));
+        }
+    }
+}
+
+
+/* Writes into d the dense matrix an smatrix of kind made from m
+ * stands for */
+static void structure_of(const matrix *m, int kind, double d[N][N]) {
+    int i, j;
+
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            if (kind == LASMAT_SYMMETRIC) {
+                d[i][j] = i <= j ? mat_get(m, i, j) : mat_get(m, j, i);
+            } else {
+                d[i][j] = in_structure(kind, i, j) ? mat_get(m, i, j) : 0;
+            }
+        }
+    }
+}
+
+
+static int matrix_is(const matrix *m, double d[N][N]) {
+    int rows, cols, i, j;
+
+    mat_dim(m, &rows, &cols);
+    if (rows != N || cols != N) {
+        return 0;
+    }
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            if (mat_get(m, i, j) != d[i][j]) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+
+/* Whether out holds d * v, or v * d with left */
+static int is_vec_product(double d[N][N], const vector *v, int left,
+        const vector *out) {
+    int dim, i, k;
+    double sum;
+
+    vec_dim(out, &dim);
+    if (dim != N) {
+        return 0;
+    }
+    for (i = 0; i < N; i++) {
+        sum = 0;
+        for (k = 0; k < N; k++) {
+            sum += (left ? d[k][i] : d[i][k]) * vec_get(v, k);
+        }
+        if (!check_close(sum, vec_get(out, i), TOL)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Whether d * x = b */
+static int solves(double d[N][N], const vector *x, const vector *b) {
+    int i, k;
+    double sum;
+
+    for (i = 0; i < N; i++) {
+        sum = 0;
+        for (k = 0; k < N; k++) {
+            sum += d[i][k] * vec_get(x, k);
+        }
+        if (!check_close(sum, vec_get(b, i), TOL)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+/* Every operation of every kind, with dense operands in both layouts */
+static void test_kinds(void) {
+    static const int kinds[] = {LASMAT_DIAGONAL, LASMAT_BANDED,
+        LASMAT_UPPER, LASMAT_LOWER, LASMAT_SYMMETRIC};
+    static double d[N][N];
+    matrix *m, *a, *b, *dense, *out;
+    vector *v, *vout;
+    smatrix *s;
+    int order, kind, lower, upper, layout;
+    size_t i;
+
+    mat_zero(&m, N, N);
+    mat_zero(&a, K, N);
+    mat_zero(&b, N, K);
+    mat_zero(&dense, 1, 1);
+    mat_zero(&out, 1, 1);
+    vec_zero(&v, N);
+    vec_zero(&vout, 1);
+    fill_square(m);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    check_fill_vector(v, -1, 1);
+
+    for (i = 0; i < sizeof(kinds) / sizeof(*kinds); i++) {
+        if (kinds[i] == LASMAT_BANDED) {
+            CHECK(smat_band(&s, m, LOWER, UPPER) == 0);
+        } else {
+            CHECK(smat_new(&s, m, kinds[i]) == 0);
+        }
+        structure_of(m, kinds[i], d);
+
+        smat_dim(s, &order, &kind);
+        CHECK(order == N && kind == kinds[i]);
+        if (kinds[i] == LASMAT_BANDED) {
+            smat_bands(s, &lower, &upper);
+            CHECK(lower == LOWER && upper == UPPER);
+        }
+        CHECK(smat_to_mat(s, dense) == 0);
+        CHECK(matrix_is(dense, d));
+
+        CHECK(smat_mmul_r(s, v, vout) == 0);
+        CHECK(is_vec_product(d, v, 0, vout));
+        CHECK(smat_mmul_l(v, s, vout) == 0);
+        CHECK(is_vec_product(d, v, 1, vout));
+        CHECK(smat_solve(s, v, vout) == 0);
+        CHECK(solves(d, vout, v));
+
+        for (layout = LAMAT_ROW_MAJOR; layout <= LAMAT_TILED; layout++) {
+            mat_set_layout(a, layout);
+            mat_set_layout(b, layout);
+            CHECK(smat_mul_l(s, b, out) == 0);
+            CHECK(check_product(dense, b, out, PRODUCT_TOL));
+            CHECK(smat_mul_r(a, s, out) == 0);
+            CHECK(check_product(a, dense, out, PRODUCT_TOL));
+            CHECK(smat_solve_mat(s, b, out) == 0);
+            CHECK(check_product(dense, out, b, PRODUCT_TOL));
+        }
+        smat_del(s);
+    }
+
+    mat_del(m);
+    mat_del(a);
+    mat_del(b);
+    mat_del(dense);
+    mat_del(out);
+    vec_del(v);
+    vec_del(vout);
+}
+
+
+/* Diagonal smatrices made from vectors and identities */
+static void test_diag(void) {
+    static double d[N][N];
+    matrix *out;
+    vector *v, *vout;
+    smatrix *s;
+    int i, j;
+
+    mat_zero(&out, 1, 1);
+    vec_zero(&v, N);
+    vec_zero(&vout, 1);
+    check_fill_vector(v, -1, 1);
+
+    CHECK(smat_diag(&s, v) == 0);
+    for (i = 0; i < N; i++) {
+        for (j = 0; j < N; j++) {
+            d[i][j] = i == j ? vec_get(v, i) : 0;
+        }
+    }
+    CHECK(smat_to_mat(s, out) == 0);
+    CHECK(matrix_is(out, d));
+    smat_del(s);
+
+    CHECK(smat_identity(&s, N) == 0);
+    CHECK(smat_mmul_r(s, v, vout) == 0);
+    for (i = 0; i < N; i++) {
+        CHECK(vec_get(vout, i) == vec_get(v, i));
+    }
+    smat_del(s);
+
+    mat_del(out);
+    vec_del(v);
+    vec_del(vout);
+}
+
+
+static void test_errors(void) {
+    matrix *m, *rect;
+    vector *v, *vout;
+    smatrix *s;
+
+    mat_zero(&m, N, N);
+    mat_zero(&rect, N, N + 1);
+    vec_zero(&v, N + 1);
+    vec_zero(&vout, 1);
+
+    CHECK(smat_new(&s, rect, LASMAT_UPPER) == LASMAT_INCOMPATIBLE_DIM);
+    CHECK(smat_new(&s, m, 0) == LASMAT_INVALID);
+    CHECK(smat_new(&s, m, LASMAT_BANDED) == LASMAT_INVALID);
+    CHECK(smat_band(&s, m, -1, 0) == LASMAT_INVALID);
+
+    /* m is zero: singular, and not positive definite */
+    CHECK(smat_new(&s, m, LASMAT_UPPER) == 0);
+    CHECK(smat_mmul_r(s, v, vout) == LASMAT_INCOMPATIBLE_DIM);
+    CHECK(smat_mul_r(rect, s, m) == LASMAT_INCOMPATIBLE_DIM);
+    vec_del(v);
+    vec_zero(&v, N);
+    vec_set(v, 0, 1);
+    CHECK(smat_solve(s, v, vout) == LASMAT_SINGULAR);
+    smat_del(s);
+    CHECK(smat_new(&s, m, LASMAT_SYMMETRIC) == 0);
+    CHECK(smat_solve(s, v, vout) == LASMAT_SINGULAR);
+    smat_del(s);
+
+    mat_del(m);
+    mat_del(rect);
+    vec_del(v);
+    vec_del(vout);
+}
+
+
+int main(void) {
+    srand(1);
+    test_kinds();
+    test_diag();
+    test_errors();
+    return check_status();
+}
@@ -0,0 +1,97 @@
+/* LAMAT_MUL_STRASSEN against a naive product in double precision. */
+
+#include "matrix.h"
+#include "tune.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+/* Largest order tested */
+#define MAX_N 150
+
+/* Error allowed, times the inner dimension and the largest elements
+ * of the operands */
+#define TOL 1e-5
+
+
+/* Orders around the cutoff and its multiples, with and without the
+ * padding of odd orders */
+static void test_orders(void) {
+    static const int orders[] = {1, 2, 15, 16, 17, 31, 32, 33, 64, 65, 100,
+        MAX_N};
+    matrix *a, *b, *out;
+    size_t i;
+
+    mat_zero(&out, 1, 1);
+    for (i = 0; i < sizeof(orders) / sizeof(*orders); i++) {
+        mat_zero(&a, orders[i], orders[i]);
+        mat_zero(&b, orders[i], orders[i]);
+        check_fill_matrix(a, -1, 1);
+        check_fill_matrix(b, -1, 1);
+
+        CHECK(mat_mul_algo(a, b, out, LAMAT_MUL_STRASSEN) == 0);
+        CHECK(check_product(a, b, out, TOL));
+        CHECK(mat_mul_algo(a, b, out, LAMAT_MUL_CLASSIC) == 0);
+        CHECK(check_product(a, b, out, TOL));
+
+        mat_del(a);
+        mat_del(b);
+    }
+    mat_del(out);
+}
+
+
+/* Products Strassen does not apply to are classical: rectangular and
+ * tiled operands, and the policy of mat_mul and mat_mul_ */
+static void test_fallbacks(void) {
+    matrix *a, *b, *out;
+
+    mat_zero(&a, 40, 70);
+    mat_zero(&b, 70, 50);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    CHECK(mat_mul_algo(a, b, out, LAMAT_MUL_STRASSEN) == 0);
+    CHECK(check_product(a, b, out, TOL));
+    mat_del(a);
+    mat_del(b);
+
+    mat_zero(&a, 70, 70);
+    mat_zero(&b, 70, 70);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+    mat_set_layout(b, LAMAT_TILED);
+    CHECK(mat_mul_algo(a, b, out, LAMAT_MUL_STRASSEN) == 0);
+    CHECK(check_product(a, b, out, TOL));
+    mat_set_layout(b, LAMAT_ROW_MAJOR);
+
+    CHECK(mat_mul_policy(LAMAT_MUL_STRASSEN) == 0);
+    CHECK(mat_mul(a, b, out) == 0);
+    CHECK(check_product(a, b, out, TOL));
+    mat_cpy(out, a);
+    CHECK(mat_mul_(out, b) == 0);
+    CHECK(check_product(a, b, out, TOL));
+    CHECK(mat_mul_policy(LAMAT_MUL_CLASSIC) == 0);
+
+    CHECK(mat_mul_algo(a, b, out, -1) == LAMAT_INVALID);
+
+    mat_del(a);
+    mat_del(b);
+    mat_del(out);
+}
+
+
+int main(void) {
+    struct linalg_tuning t;
+
+    srand(1);
+    /* Recurse down to the smallest cutoff, so that small orders
+     * take several levels */
+    linalg_tuning_get(&t);
+    t.strassen_cutoff = 16;
+    CHECK(linalg_tuning_set(&t) == 0);
+
+    test_orders();
+    test_fallbacks();
+    return check_status();
+}
@@ -0,0 +1,155 @@
+/* Reductions in every summation mode against sums in double precision:
+ * errors within the bounds of each mode relative to the sum of the
+ * magnitudes of the terms, through the _sum variants, the global policy
+ * and mat_mul, on lengths that end in partial blocks. */
+
+#include "summation.h"
+#include "check.h"
+
+#include <float.h>
+#include <stdlib.h>
+
+/* Lengths of the vectors, the last long enough for naive sums to drift */
+#define NDIMS 4
+#define LONG ((1 << 20) + 13)
+
+/* Inner dimension of the products, likewise */
+#define INNER (1 << 16)
+
+/* Errors allowed, in units of FLT_EPSILON / 2 times the sum of the
+ * magnitudes of the terms: the rounding of the products and of a few
+ * lane merges for LASUM_KAHAN, and of the naive runs within a block
+ * and the log n levels above them for LASUM_PAIRWISE */
+#define KAHAN_ERR 8
+#define PAIRWISE_ERR 64
+
+
+static const int dims[NDIMS] = {1, 31, 1000, LONG};
+static const int modes[] = {LASUM_NAIVE, LASUM_PAIRWISE, LASUM_KAHAN};
+
+
+/* Whether got is within the bound of mode of ref, the exact sum
+ * of terms whose magnitudes sum to abs */
+static int within(int mode, double got, double ref, double abs) {
+    double err = fabs(got - ref) / (abs * (FLT_EPSILON / 2));
+
+    switch (mode) {
+        case LASUM_KAHAN:
+            return err <= KAHAN_ERR;
+        case LASUM_PAIRWISE:
+            return err <= PAIRWISE_ERR;
+    }
+    return 1;
+}
+
+
+static void test_vectors(void) {
+    vector *a, *b;
+    LINALG_SCALAR r, p;
+    double dot, norm2, dist2, diff, err[3];
+    size_t m;
+    int d, i, ok;
+
+    for (d = 0; d < NDIMS; d++) {
+        vec_zero(&a, dims[d]);
+        vec_zero(&b, dims[d]);
+        check_fill_vector(a, 1, 2);
+        check_fill_vector(b, 0.5, 1);
+        dot = norm2 = dist2 = 0;
+        for (i = 0; i < dims[d]; i++) {
+            dot += (double)vec_get(a, i) * vec_get(b, i);
+            norm2 += (double)vec_get(a, i) * vec_get(a, i);
+            diff = (double)vec_get(a, i) - vec_get(b, i);
+            dist2 += diff * diff;
+        }
+
+        ok = 1;
+        for (m = 0; m < sizeof(modes) / sizeof(*modes); m++) {
+            ok &= vec_dot_sum(a, b, modes[m], &r) == 0
+                && within(modes[m], r, dot, dot);
+            err[m] = fabs(r - dot);
+            ok &= vec_norm2_sum(a, modes[m], &r) == 0
+                && within(modes[m], r, norm2, norm2);
+            ok &= vec_dist2_sum(a, b, modes[m], &r) == 0
+                && within(modes[m], r, dist2, dist2);
+
+            /* The policy selects the same sums */
+            ok &= linalg_sum_policy(modes[m]) == 0;
+            vec_dot(a, b, &p);
+            vec_dot_sum(a, b, modes[m], &r);
+            ok &= p == r;
+        }
+        CHECK(ok);
+        /* Long enough for the modes to matter */
+        if (dims[d] == LONG) {
+            CHECK(err[0] > err[1] && err[0] > err[2]);
+        }
+        CHECK(linalg_sum_policy(LASUM_NAIVE) == 0);
+        vec_del(a);
+        vec_del(b);
+    }
+}
+
+
+/* Products whose inner dimension is long, elements of the result
+ * against each mode's bound */
+static void test_products(void) {
+    matrix *a, *b, *out;
+    double ref, abs;
+    size_t m;
+    int i, j, k, ok;
+
+    mat_zero(&a, 2, INNER);
+    mat_zero(&b, INNER, 3);
+    mat_zero(&out, 1, 1);
+    check_fill_matrix(a, -1, 2);
+    check_fill_matrix(b, 0.5, 1);
+    for (m = 0; m < sizeof(modes) / sizeof(*modes); m++) {
+        CHECK(linalg_sum_policy(modes[m]) == 0);
+        CHECK(mat_mul(a, b, out) == 0);
+        ok = 1;
+        for (i = 0; i < 2; i++) {
+            for (j = 0; j < 3; j++) {
+                ref = abs = 0;
+                for (k = 0; k < INNER; k++) {
+                    ref += (double)mat_get(a, i, k) * mat_get(b, k, j);
+                    abs += fabs((double)mat_get(a, i, k) * mat_get(b, k, j));
+                }
+                ok &= within(modes[m], mat_get(out, i, j), ref, abs);
+            }
+        }
+        CHECK(ok);
+    }
+    CHECK(linalg_sum_policy(LASUM_NAIVE) == 0);
+    mat_del(a);
+    mat_del(b);
+    mat_del(out);
+}
+
+
+static void test_errors(void) {
+    vector *a, *b;
+    LINALG_SCALAR r;
+
+    vec_zero(&a, 4);
+    vec_zero(&b, 5);
+    CHECK(linalg_sum_policy(LASUM_KAHAN + 1) == LASUM_INVALID);
+    CHECK(linalg_sum_policy(-1) == LASUM_INVALID);
+    CHECK(vec_dot_sum(a, a, LASUM_KAHAN + 1, &r) == LAVEC_INVALID);
+    CHECK(vec_norm2_sum(a, -1, &r) == LAVEC_INVALID);
+    CHECK(vec_dist2_sum(a, a, 7, &r) == LAVEC_INVALID);
+    CHECK(vec_dot_sum(a, b, LASUM_KAHAN, &r) == LAVEC_INCOMPATIBLE_DIM);
+    CHECK(vec_dist2_sum(a, b, LASUM_PAIRWISE, &r)
+            == LAVEC_INCOMPATIBLE_DIM);
+    vec_del(a);
+    vec_del(b);
+}
+
+
+int main(void) {
+    srand(1);
+    test_vectors();
+    test_products();
+    test_errors();
+    return check_status();
+}
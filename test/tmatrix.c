@@ -0,0 +1,140 @@
+/* Toeplitz and circulant matrices against their dense equivalents, with
+ * products computed naively in double precision, on both sides of the
+ * direct and FFT paths. */
+
+#include "tmatrix.h"
+#include "check.h"
+
+#include <stdlib.h>
+
+
+/* Element (i, j) of the matrix with the first column col and first row
+ * row, circulant if row is NULL */
+static LINALG_SCALAR element(const vector *col, const vector *row,
+        int i, int j) {
+    int n;
+
+    if (row == NULL) {
+        vec_dim(col, &n);
+        return vec_get(col, ((i - j) % n + n) % n);
+    }
+    return i >= j ? vec_get(col, i - j) : vec_get(row, j - i);
+}
+
+
+/* Checks t, rows x cols, against the matrix of col and row: its dense
+ * form exactly, its products with vectors on either side to within
+ * the bound on the errors of the FFT, relative to the largest elements
+ * of the operands, here at most 1 */
+static void check_tmatrix(const tmatrix *t, const vector *col,
+        const vector *row, int rows, int cols) {
+    matrix *dense;
+    vector *x, *y, *out;
+    int r, c, kind, dim, i, j, ok;
+    double sum;
+
+    tmat_dim(t, &r, &c, &kind);
+    CHECK(r == rows && c == cols);
+    CHECK(kind == (row == NULL ? LATMAT_CIRCULANT : LATMAT_TOEPLITZ));
+
+    mat_zero(&dense, 1, 1);
+    CHECK(tmat_to_mat(t, dense) == 0);
+    mat_dim(dense, &r, &c);
+    ok = r == rows && c == cols;
+    for (i = 0; ok && i < rows; i++) {
+        for (j = 0; j < cols; j++) {
+            ok &= mat_get(dense, i, j) == element(col, row, i, j);
+        }
+    }
+    CHECK(ok);
+    mat_del(dense);
+
+    vec_zero(&x, cols);
+    vec_zero(&y, rows);
+    vec_zero(&out, 1);
+    check_fill_vector(x, -1, 1);
+    check_fill_vector(y, -1, 1);
+
+    CHECK(tmat_mmul_r(t, x, out) == 0);
+    vec_dim(out, &dim);
+    ok = dim == rows;
+    for (i = 0; ok && i < rows; i++) {
+        sum = 0;
+        for (j = 0; j < cols; j++) {
+            sum += (double)element(col, row, i, j) * vec_get(x, j);
+        }
+        ok &= fabs(sum - vec_get(out, i)) <= 1e-5 * cols;
+    }
+    CHECK(ok);
+
+    CHECK(tmat_mmul_l(y, t, out) == 0);
+    vec_dim(out, &dim);
+    ok = dim == cols;
+    for (j = 0; ok && j < cols; j++) {
+        sum = 0;
+        for (i = 0; i < rows; i++) {
+            sum += (double)vec_get(y, i) * element(col, row, i, j);
+        }
+        ok &= fabs(sum - vec_get(out, j)) <= 1e-5 * rows;
+    }
+    CHECK(ok);
+
+    CHECK(tmat_mmul_r(t, y, out) == (rows == cols ? 0
+                : LATMAT_INCOMPATIBLE_DIM));
+    CHECK(tmat_mmul_l(x, t, out) == (rows == cols ? 0
+                : LATMAT_INCOMPATIBLE_DIM));
+
+    vec_del(x);
+    vec_del(y);
+    vec_del(out);
+}
+
+
+/* Orders multiplied directly, of a power of two applied as they are,
+ * and others embedded */
+static void test_circulant(void) {
+    static const int orders[] = {1, 2, 5, 64, 100, 128, 300, 1024};
+    vector *col;
+    tmatrix *t;
+    size_t i;
+
+    for (i = 0; i < sizeof(orders) / sizeof(*orders); i++) {
+        vec_zero(&col, orders[i]);
+        check_fill_vector(col, -1, 1);
+        CHECK(tmat_circulant(&t, col) == 0);
+        check_tmatrix(t, col, NULL, orders[i], orders[i]);
+        tmat_del(t);
+        vec_del(col);
+    }
+}
+
+
+static void test_toeplitz(void) {
+    static const int shapes[][2] = {{1, 1}, {3, 7}, {64, 64}, {50, 90},
+        {200, 130}, {1, 500}, {500, 1}, {256, 256}};
+    vector *col, *row;
+    tmatrix *t;
+    size_t i;
+
+    for (i = 0; i < sizeof(shapes) / sizeof(*shapes); i++) {
+        vec_zero(&col, shapes[i][0]);
+        vec_zero(&row, shapes[i][1]);
+        check_fill_vector(col, -1, 1);
+        check_fill_vector(row, -1, 1);
+        CHECK(tmat_toeplitz(&t, col, row) == 0);
+        /* row[0] is ignored */
+        vec_set(row, 0, vec_get(col, 0));
+        check_tmatrix(t, col, row, shapes[i][0], shapes[i][1]);
+        tmat_del(t);
+        vec_del(col);
+        vec_del(row);
+    }
+}
+
+
+int main(void) {
+    srand(1);
+    test_circulant();
+    test_toeplitz();
+    return check_status();
+}
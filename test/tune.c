@@ -0,0 +1,183 @@
+/* The tuning cache file written by linalg_tuning_save and read back by
+ * linalg_tuning_load, files it must reject, and products that stay
+ * right while other threads replace the parameters. */
+
+#include "tune.h"
+#include "check.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Dimensions of the products, past every block size tried */
+#define ROWS 150
+#define INNER 170
+#define COLS 130
+
+/* Error allowed, times the inner dimension and the largest elements
+ * of the operands */
+#define TOL 1e-6
+
+#define ROUNDS 20
+
+/* Most parameter sets taken into use meanwhile, each of which stays
+ * allocated */
+#define SWITCHES 100000
+
+
+static char path[] = "/tmp/linalg-tune-XXXXXX";
+
+static const struct linalg_tuning small = {
+    16, 32, 48, 2, 4, 8, 16
+};
+
+static matrix *a, *b;
+static atomic_int done;
+
+
+static int same(const struct linalg_tuning *x,
+        const struct linalg_tuning *y) {
+    return memcmp(x, y, sizeof(*x)) == 0;
+}
+
+
+/* Rewrites the cache file with the line of key, if any, replaced by
+ * key and value */
+static void rewrite(const char *key, const char *value) {
+    char lines[16][512];
+    FILE *f;
+    int i, n = 0;
+
+    f = fopen(path, "r");
+    while (n < 16 && fgets(lines[n], sizeof(lines[n]), f) != NULL) {
+        n++;
+    }
+    fclose(f);
+    f = fopen(path, "w");
+    for (i = 0; i < n; i++) {
+        if (strncmp(lines[i], key, strlen(key)) == 0
+                && lines[i][strlen(key)] == ' ') {
+            fprintf(f, "%s %s\n", key, value);
+        } else {
+            fputs(lines[i], f);
+        }
+    }
+    fclose(f);
+}
+
+
+static void test_round_trip(void) {
+    struct linalg_tuning saved, t;
+
+    linalg_tuning_get(&saved);
+    CHECK(linalg_tuning_set(&small) == 0);
+    CHECK(linalg_tuning_save(path) == 0);
+    CHECK(linalg_tuning_set(&saved) == 0);
+    CHECK(linalg_tuning_load(path) == 0);
+    linalg_tuning_get(&t);
+    CHECK(same(&t, &small));
+
+    /* The default cache file is $LINALG_TUNE_FILE, set by main */
+    CHECK(linalg_tuning_set(&saved) == 0);
+    CHECK(linalg_tuning_load(NULL) == 0);
+    linalg_tuning_get(&t);
+    CHECK(same(&t, &small));
+    CHECK(linalg_tuning_set(&saved) == 0);
+    CHECK(linalg_tuning_save(NULL) == 0);
+    CHECK(linalg_tuning_set(&small) == 0);
+    CHECK(linalg_tuning_load(path) == 0);
+    linalg_tuning_get(&t);
+    CHECK(same(&t, &saved));
+}
+
+
+/* Files that are rejected leave the parameters as they were */
+static void test_rejected(void) {
+    struct linalg_tuning saved, t;
+
+    CHECK(linalg_tuning_set(&small) == 0);
+    CHECK(linalg_tuning_save(path) == 0);
+    linalg_tuning_get(&saved);
+
+    rewrite("gemv_lanes", "3");
+    CHECK(linalg_tuning_load(path) == LATUNE_INVALID);
+    rewrite("gemv_lanes", "4");
+    rewrite("strassen_cutoff", "8");
+    CHECK(linalg_tuning_load(path) == LATUNE_INVALID);
+    rewrite("strassen_cutoff", "16");
+    rewrite("cpu", "another model");
+    CHECK(linalg_tuning_load(path) == LATUNE_IO);
+    linalg_tuning_get(&t);
+    CHECK(same(&t, &saved));
+
+    CHECK(unlink(path) == 0);
+    CHECK(linalg_tuning_load(path) == LATUNE_IO);
+    CHECK(linalg_tuning_save("/nonexistent/linalg-tune") == LATUNE_IO);
+
+    t = small;
+    t.gemm_kc = 0;
+    CHECK(linalg_tuning_set(&t) == LATUNE_INVALID);
+    t = small;
+    t.gemv_rows = 3;
+    CHECK(linalg_tuning_set(&t) == LATUNE_INVALID);
+    linalg_tuning_get(&t);
+    CHECK(same(&t, &saved));
+}
+
+
+/* Switches between two sets of parameters until the products are done */
+static void *switcher(void *arg) {
+    const struct linalg_tuning *sets = arg;
+    int i;
+
+    for (i = 0; i < SWITCHES && !done; i++) {
+        linalg_tuning_set(&sets[i % 2]);
+    }
+    return NULL;
+}
+
+
+static void test_concurrent(void) {
+    struct linalg_tuning sets[2];
+    pthread_t thread;
+    matrix *out;
+    int i, ok = 1;
+
+    linalg_tuning_get(&sets[0]);
+    sets[1] = small;
+    mat_zero(&out, 1, 1);
+    CHECK(pthread_create(&thread, NULL, switcher, sets) == 0);
+    for (i = 0; i < ROUNDS; i++) {
+        ok &= mat_mul(a, b, out) == 0 && check_product(a, b, out, TOL);
+    }
+    done = 1;
+    pthread_join(thread, NULL);
+    CHECK(ok);
+    mat_del(out);
+}
+
+
+int main(void) {
+    int fd;
+
+    srand(1);
+    fd = mkstemp(path);
+    CHECK(fd >= 0);
+    close(fd);
+    setenv("LINALG_TUNE_FILE", path, 1);
+
+    mat_zero(&a, ROWS, INNER);
+    mat_zero(&b, INNER, COLS);
+    check_fill_matrix(a, -1, 1);
+    check_fill_matrix(b, -1, 1);
+
+    test_round_trip();
+    test_concurrent();
+    test_rejected();
+
+    mat_del(a);
+    mat_del(b);
+    return check_status();
+}
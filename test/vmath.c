@@ -0,0 +1,166 @@
+/* The built-in functions of vmath.h against libm in double precision,
+ * rounded to float, over a sweep of every range of floats: errors within
+ * the documented bounds, and the same values from vm_apply as from
+ * single calls. */
+
+#include "vector.h"
+#include "check.h"
+
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Bit patterns skipped between samples, odd so that every bit of the
+ * significand varies */
+#define STRIDE 997
+
+/* Samples handed to vm_apply at a time, not a multiple of its lanes */
+#define CHUNK 1001
+
+
+struct func {
+    const char *name;
+    vm_func f;
+    double (*ref)(double);
+    int ulps;               /* largest error allowed */
+    double lo;              /* smallest input of the domain */
+};
+
+
+static double sigmoid(double x) {
+    return 1 / (1 + exp(-x));
+}
+
+
+static const struct func funcs[] = {
+    {"vm_exp", vm_exp, exp, 1, -INFINITY},
+    {"vm_log", vm_log, log, 1, 0},
+    {"vm_sqrt", vm_sqrt, sqrt, 0, 0},
+    {"vm_tanh", vm_tanh, tanh, 2, -INFINITY},
+    {"vm_sigmoid", vm_sigmoid, sigmoid, 2, -INFINITY}
+};
+
+
+/* Floats in order of their bit patterns, from -FLT_MAX to FLT_MAX */
+static int32_t ordered(float x) {
+    int32_t i;
+
+    memcpy(&i, &x, sizeof(i));
+    return i < 0 ? INT32_MIN - i : i;
+}
+
+
+/* Whether got is within ulps of ref, rounded to float, after its
+ * flushes: results below FLT_MIN may be zero */
+static int within(float got, double ref, int ulps) {
+    float r = (float)ref;
+    int64_t d;
+
+    if (isnan(r) || isinf(r)) {
+        return memcmp(&got, &r, sizeof(r)) == 0 || (isnan(r) && isnan(got));
+    }
+    if (got == 0 && fabs(ref) < FLT_MIN) {
+        return 1;
+    }
+    d = (int64_t)ordered(got) - ordered(r);
+    return !isnan(got) && d >= -ulps && d <= ulps;
+}
+
+
+/* Checks f on the samples in x, n of them, through both paths */
+static int check_samples(const struct func *fn, const float *x, int n) {
+    float y[CHUNK], one;
+    int i, ok = 1;
+
+    vm_apply(fn->f, NULL, y, x, n);
+    for (i = 0; i < n; i++) {
+        one = fn->f(x[i], NULL);
+        if (memcmp(&one, &y[i], sizeof(one)) != 0
+                || !within(y[i], fn->ref(x[i]), fn->ulps)) {
+            fprintf(stderr, "%s(%a) = %a, expected %a\n",
+                    fn->name, x[i], y[i], (float)fn->ref(x[i]));
+            ok = 0;
+        }
+    }
+    return ok;
+}
+
+
+/* Every STRIDE-th float of either sign in the domain of each function */
+static void test_sweep(void) {
+    float x[CHUNK];
+    uint32_t bits, sign;
+    size_t f;
+    int n, ok;
+
+    for (f = 0; f < sizeof(funcs) / sizeof(*funcs); f++) {
+        ok = 1;
+        n = 0;
+        for (sign = 0; sign <= 1; sign++) {
+            for (bits = 0; bits < 0x7f800000u; bits += STRIDE) {
+                bits |= sign << 31;
+                memcpy(&x[n], &bits, sizeof(bits));
+                bits &= 0x7fffffffu;
+                if (x[n] < funcs[f].lo) {
+                    continue;
+                }
+                if (++n == CHUNK) {
+                    ok &= check_samples(&funcs[f], x, n);
+                    n = 0;
+                }
+            }
+        }
+        ok &= check_samples(&funcs[f], x, n);
+        CHECK(ok);
+    }
+}
+
+
+static void test_special(void) {
+    CHECK(vm_exp(100, NULL) == INFINITY);
+    CHECK(vm_exp(-100, NULL) == 0);
+    CHECK(vm_exp(0, NULL) == 1);
+    CHECK(vm_log(0, NULL) == -INFINITY);
+    CHECK(isnan(vm_log(-1, NULL)));
+    CHECK(vm_log(1, NULL) == 0);
+    CHECK(isnan(vm_sqrt(-1, NULL)));
+    CHECK(vm_sqrt(4, NULL) == 2);
+    CHECK(vm_tanh(30, NULL) == 1 && vm_tanh(-30, NULL) == -1);
+    CHECK(vm_sigmoid(0, NULL) == 0.5f);
+    CHECK(vm_sigmoid(-200, NULL) == 0 && vm_sigmoid(200, NULL) == 1);
+}
+
+
+static LINALG_SCALAR affine(LINALG_SCALAR x, void *ctx) {
+    return x * *(LINALG_SCALAR *)ctx + 1;
+}
+
+
+/* A function of the caller's, with its context, through vec_map */
+static void test_callback(void) {
+    LINALG_SCALAR scale = 3;
+    vector *v, *out;
+    int i, dim, ok;
+
+    vec_zero(&v, CHUNK);
+    vec_zero(&out, 1);
+    check_fill_vector(v, -1, 1);
+    CHECK(vec_map(v, affine, &scale, out) == 0);
+    vec_dim(out, &dim);
+    ok = dim == CHUNK;
+    for (i = 0; ok && i < CHUNK; i++) {
+        ok &= vec_get(out, i) == vec_get(v, i) * 3 + 1;
+    }
+    CHECK(ok);
+    vec_del(v);
+    vec_del(out);
+}
+
+
+int main(void) {
+    srand(1);
+    test_sweep();
+    test_special();
+    test_callback();
+    return check_status();
+}
@@ -0,0 +1,235 @@
+/* Emits kernels specialized for a fixed list of shapes, so that the
+ * compiler sees constant loop bounds and can unroll and vectorize them
+ * completely. Called from the Makefile with SPEC_SHAPES.
+ *
+ * Usage: kgen SHAPE...
+ *   Each SHAPE is MxK or MxKxN, MxK being short for MxKxK. It produces
+ *     - a GEMM for an M x K matrix times a K x N matrix,
+ *     - a GEMV for an M x K matrix times a vector of length K,
+ *     - a dot product of two vectors of length K.
+ *   Duplicates are emitted only once.
+ *
+ * The generated code is written to stdout and expects LINALG_SCALAR
+ * to be defined when included.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* Accumulators used by the GEMV and dot kernels */
+#define LANES 8
+
+#define MAX_SHAPES 256
+
+struct shape {
+    int m, k, n;
+};
+
+static struct shape gemm[MAX_SHAPES], gemv[MAX_SHAPES];
+static int dot[MAX_SHAPES];
+static int ngemm, ngemv, ndot;
+
+
+static int parse(const char *s, struct shape *out) {
+    char tail;
+    int n;
+
+    n = sscanf(s, "%dx%dx%d%c", &out->m, &out->k, &out->n, &tail);
+    if (n == 2) {
+        out->n = out->k;
+    } else if (n != 3) {
+        return 0;
+    }
+    return out->m > 0 && out->k > 0 && out->n > 0;
+}
+
+
+static void emit_gemm(struct shape s) {
+    printf("static void gemm_%dx%dx%d(const LINALG_SCALAR *restrict a,\n"
+           "        const LINALG_SCALAR *restrict b,"
+           " LINALG_SCALAR *restrict c) {\n", s.m, s.k, s.n);
+    printf("    LINALG_SCALAR x;\n"
+           "    int i, p, j;\n\n");
+    printf("    for (i = 0; i < %d; i++) {\n", s.m);
+    printf("        for (j = 0; j < %d; j++) {\n", s.n);
+    printf("            c[i * %d + j] = 0;\n", s.n);
+    printf("        }\n");
+    printf("        for (p = 0; p < %d; p++) {\n", s.k);
+    printf("            x = a[i * %d + p];\n", s.k);
+    printf("            for (j = 0; j < %d; j++) {\n", s.n);
+    printf("                c[i * %d + j] += x * b[p * %d + j];\n", s.n, s.n);
+    printf("            }\n");
+    printf("        }\n");
+    printf("    }\n");
+    printf("}\n\n\n");
+}
+
+
+/* Prints the statements summing row[0..len) * v[0..len) into s,
+ * with the given indentation. */
+static void emit_sum(int len, const char *row, const char *ind) {
+    int body = len / LANES * LANES;
+
+    if (body > 0) {
+        printf("%sfor (l = 0; l < %d; l++) {\n", ind, LANES);
+        printf("%s    acc[l] = 0;\n", ind);
+        printf("%s}\n", ind);
+        printf("%sfor (j = 0; j < %d; j += %d) {\n", ind, body, LANES);
+        printf("%s    for (l = 0; l < %d; l++) {\n", ind, LANES);
+        printf("%s        acc[l] += %s[j + l] * v[j + l];\n", ind, row);
+        printf("%s    }\n", ind);
+        printf("%s}\n", ind);
+    }
+    printf("%ss = 0;\n", ind);
+    if (body > 0) {
+        printf("%sfor (l = 0; l < %d; l++) {\n", ind, LANES);
+        printf("%s    s += acc[l];\n", ind);
+        printf("%s}\n", ind);
+    }
+    if (body < len) {
+        printf("%sfor (j = %d; j < %d; j++) {\n", ind, body, len);
+        printf("%s    s += %s[j] * v[j];\n", ind, row);
+        printf("%s}\n", ind);
+    }
+}
+
+
+static void emit_decls(int len) {
+    if (len >= LANES) {
+        printf("    LINALG_SCALAR acc[%d], s;\n"
+               "    int j, l;\n", LANES);
+    } else {
+        printf("    LINALG_SCALAR s;\n"
+               "    int j;\n");
+    }
+}
+
+
+static void emit_gemv(struct shape s) {
+    printf("static void gemv_%dx%d(const LINALG_SCALAR *restrict m,\n"
+           "        const LINALG_SCALAR *restrict v,"
+           " LINALG_SCALAR *restrict out) {\n", s.m, s.k);
+    emit_decls(s.k);
+    printf("    int i;\n\n");
+    printf("    for (i = 0; i < %d; i++) {\n", s.m);
+    printf("        const LINALG_SCALAR *row = m + i * %d;\n", s.k);
+    emit_sum(s.k, "row", "        ");
+    printf("        out[i] = s;\n");
+    printf("    }\n");
+    printf("}\n\n\n");
+}
+
+
+static void emit_dot(int len) {
+    printf("static LINALG_SCALAR dot_%d(const LINALG_SCALAR *restrict a,\n"
+           "        const LINALG_SCALAR *restrict v) {\n", len);
+    emit_decls(len);
+    printf("\n");
+    emit_sum(len, "a", "    ");
+    printf("    return s;\n");
+    printf("}\n\n\n");
+}
+
+
+static void emit_dispatch(void) {
+    int i;
+
+    printf("int spec_gemm(const LINALG_SCALAR *a,"
+           " const LINALG_SCALAR *b,\n"
+           "        LINALG_SCALAR *c, int m, int k, int n) {\n");
+    for (i = 0; i < ngemm; i++) {
+        printf("    if (m == %d && k == %d && n == %d) {\n"
+               "        gemm_%dx%dx%d(a, b, c);\n"
+               "        return 1;\n"
+               "    }\n",
+               gemm[i].m, gemm[i].k, gemm[i].n,
+               gemm[i].m, gemm[i].k, gemm[i].n);
+    }
+    printf("    (void)a, (void)b, (void)c, (void)m, (void)k, (void)n;\n");
+    printf("    return 0;\n}\n\n\n");
+
+    printf("spec_gemm_fn spec_gemm_find(int m, int k, int n) {\n");
+    for (i = 0; i < ngemm; i++) {
+        printf("    if (m == %d && k == %d && n == %d) {\n"
+               "        return gemm_%dx%dx%d;\n"
+               "    }\n",
+               gemm[i].m, gemm[i].k, gemm[i].n,
+               gemm[i].m, gemm[i].k, gemm[i].n);
+    }
+    printf("    (void)m, (void)k, (void)n;\n");
+    printf("    return NULL;\n}\n\n\n");
+
+    printf("int spec_gemv(const LINALG_SCALAR *m,"
+           " const LINALG_SCALAR *v,\n"
+           "        LINALG_SCALAR *out, int rows, int cols) {\n");
+    for (i = 0; i < ngemv; i++) {
+        printf("    if (rows == %d && cols == %d) {\n"
+               "        gemv_%dx%d(m, v, out);\n"
+               "        return 1;\n"
+               "    }\n",
+               gemv[i].m, gemv[i].k, gemv[i].m, gemv[i].k);
+    }
+    printf("    (void)m, (void)v, (void)out, (void)rows, (void)cols;\n");
+    printf("    return 0;\n}\n\n\n");
+
+    printf("int spec_dot(const LINALG_SCALAR *a,"
+           " const LINALG_SCALAR *b,\n"
+           "        int dim, LINALG_SCALAR *out) {\n");
+    for (i = 0; i < ndot; i++) {
+        printf("    if (dim == %d) {\n"
+               "        *out = dot_%d(a, b);\n"
+               "        return 1;\n"
+               "    }\n", dot[i], dot[i]);
+    }
+    printf("    (void)a, (void)b, (void)dim, (void)out;\n");
+    printf("    return 0;\n}\n");
+}
+
+
+int main(int argc, char **argv) {
+    struct shape s;
+    int i, j;
+
+    for (i = 1; i < argc; i++) {
+        if (!parse(argv[i], &s)) {
+            fprintf(stderr, "%s: invalid shape '%s'\n", argv[0], argv[i]);
+            return 1;
+        }
+
+        for (j = 0; j < ngemm && memcmp(&gemm[j], &s, sizeof(s)) != 0; j++)
+            ;
+        if (j == ngemm && ngemm < MAX_SHAPES) {
+            gemm[ngemm++] = s;
+        }
+        for (j = 0; j < ngemv && (gemv[j].m != s.m || gemv[j].k != s.k); j++)
+            ;
+        if (j == ngemv && ngemv < MAX_SHAPES) {
+            gemv[ngemv++] = s;
+        }
+        for (j = 0; j < ndot && dot[j] != s.k; j++)
+            ;
+        if (j == ndot && ndot < MAX_SHAPES) {
+            dot[ndot++] = s.k;
+        }
+    }
+
+    printf("/* Generated by kgen from the shapes:");
+    for (i = 1; i < argc; i++) {
+        printf(" %s", argv[i]);
+    }
+    printf("\n * Do not edit, change SPEC_SHAPES in the Makefile instead. */\n\n\n");
+
+    for (i = 0; i < ngemm; i++) {
+        emit_gemm(gemm[i]);
+    }
+    for (i = 0; i < ngemv; i++) {
+        emit_gemv(gemv[i]);
+    }
+    for (i = 0; i < ndot; i++) {
+        emit_dot(dot[i]);
+    }
+    emit_dispatch();
+    return 0;
+}
@@ -0,0 +1,55 @@
+/* Measures the best kernel parameters for this machine and saves them
+ * where the library looks for them at startup.
+ *
+ * Usage: linalg-tune [-o FILE] [-n]
+ *   -o FILE   save to FILE instead of the default cache file
+ *   -n        only print the parameters, do not save them
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tune.h"
+
+
+int main(int argc, char **argv) {
+    struct linalg_tuning t;
+    const char *path = NULL;
+    int save = 1;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0) {
+            save = 0;
+        } else {
+            fprintf(stderr, "usage: %s [-o FILE] [-n]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("Tuning kernels... ");
+    fflush(stdout);
+    if (linalg_tune(&t) != 0) {
+        printf("Failed.\n");
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    printf("Done.\n");
+
+    printf("gemm_mc          %d\n", t.gemm_mc);
+    printf("gemm_kc          %d\n", t.gemm_kc);
+    printf("gemm_nc          %d\n", t.gemm_nc);
+    printf("gemv_rows        %d\n", t.gemv_rows);
+    printf("gemv_lanes       %d\n", t.gemv_lanes);
+    printf("transpose_block  %d\n", t.transpose_block);
+    printf("strassen_cutoff  %d\n", t.strassen_cutoff);
+
+    if (save && linalg_tuning_save(path) != 0) {
+        fprintf(stderr, "could not write %s\n",
+                path != NULL ? path : "the default cache file");
+        return 1;
+    }
+    return 0;
+}